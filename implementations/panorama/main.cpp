@@ -4,6 +4,8 @@
 #include <string>
 #include <map>
 
+#include "../../sfm/Geometry.hpp"
+
 using namespace cv;
 using namespace std;
 
@@ -318,29 +320,18 @@ Mat mergeImages(
                                          0, 1, -minY,
                                          0, 0,     1);
 
-    Mat inv_homography = (translation * homography).inv();
+    // Pixel coordinates of a few thousand are well within float precision
+    Matx33f inv_homography = Matx33d(Mat((translation * homography).inv()));
 
     Mat merged = Mat::zeros(rows, cols, im1.type());
     im2.copyTo(merged(Rect(-minX, -minY, im2.cols, im2.rows)));
 
     // update to range of im2
-    for (int i = start_row; i < start_row + warped_rows; ++i)
-    {
-        for (int j = start_col; j < start_col + warped_cols; ++j)
-        {
-            Mat pt = (Mat_<double>(3, 1) << j, i, 1);
-            Mat_<double> inv_pt = inv_homography * pt;
-
-            assert(inv_pt(2) != 0.0);
-            double x = (inv_pt(0) / inv_pt(2));
-            double y = (inv_pt(1) / inv_pt(2));
-
-            if (x >= 0 && y >= 0 && x < im1.cols && y < im1.rows)
-            {
-                merged.at<Vec3b>(i, j) = im1.at<Vec3b>(y, x);
-            }
-        }
-    }
+    Geometry::warp_homography(
+        im1,
+        inv_homography,
+        Rect(start_col, start_row, warped_cols, warped_rows),
+        merged);
 
     return merged;
 }
@@ -8,6 +8,11 @@
 #include <calib3d/calib3d.hpp>
 #include <highgui/highgui.hpp>
 
+#include <cfloat>
+
+#include "../sfm/Pipeline.hpp"
+#include "../sfm/Reprojection.hpp"
+
 #ifndef _CRT_SECURE_NO_WARNINGS
 # define _CRT_SECURE_NO_WARNINGS
 #endif
@@ -227,47 +232,73 @@ enum { DETECTION = 0, CAPTURING = 1, CALIBRATED = 2 };
 bool runCalibrationAndSave(Settings& s, Size imageSize, Mat&  cameraMatrix, Mat& distCoeffs,
                            vector<vector<Point2f> > imagePoints );
 
-int main(int argc, char* argv[])
+// Hands out the images of the settings' input, camera or list, until it
+// runs dry
+class SettingsCapture : public Pipeline::Stage
 {
-    help();
+public:
+    SettingsCapture(Settings& s, Pipeline::Ring<Pipeline::Frame>& output)
+    : s(s), output(output), index(0)
+    {
+        attach(output);
+    }
 
-    //! [file_read]
-    Settings s;
-    const string inputSettingsFile = argc > 1 ? argv[1] : "default.xml";
-    FileStorage fs(inputSettingsFile, FileStorage::READ); // Read the settings
-    if (!fs.isOpened())
+    bool step()
     {
-        cout << "Could not open the configuration file: \"" << inputSettingsFile << "\"" << endl;
-        return -1;
+        frame.image = s.nextImage();
+        if( frame.image.empty() )
+            return false;
+
+        frame.index = ++index;
+        frame.captured = frame.started = frame.processed = getTickCount();
+        return output.push(frame);
     }
-    fs["Settings"] >> s;
-    fs.release();                                         // close Settings file
-    //! [file_read]
 
-    //FileStorage fout("settings.yml", FileStorage::WRITE); // write config as YAML
-    //fout << "Settings" << s;
+private:
+    Settings& s;
+    Pipeline::Ring<Pipeline::Frame>& output;
+    Pipeline::Frame frame;
+    int index;
+};
 
-    if (!s.goodInput)
+// Finds the pattern on every image, collects views and calibrates once
+// there are enough, then passes the image on with the pattern drawn. Keys
+// from the display: 'g' starts collecting, 'u' toggles undistortion.
+class Calibration : public Pipeline::Stage
+{
+public:
+    Calibration(Settings& s, bool live,
+                Pipeline::Ring<Pipeline::Frame>& input,
+                Pipeline::Ring<int>& keys,
+                Pipeline::Ring<Pipeline::Frame>& output)
+    : s(s), live(live), input(input), keys(keys), output(output),
+      mode(s.inputType == Settings::IMAGE_LIST ? CAPTURING : DETECTION), prevTimestamp(0)
     {
-        cout << "Invalid input detected. Application stopping. " << endl;
-        return -1;
+        attach(input);
+        attach(keys);
+        attach(output);
     }
 
-    vector<vector<Point2f> > imagePoints;
-    Mat cameraMatrix, distCoeffs;
-    Size imageSize;
-    int mode = s.inputType == Settings::IMAGE_LIST ? CAPTURING : DETECTION;
-    clock_t prevTimestamp = 0;
-    const Scalar RED(0,0,255), GREEN(0,255,0);
-    const char ESC_KEY = 27;
-
-    //! [get_input]
-    for(;;)
+    bool step()
     {
-        Mat view;
+        const Scalar RED(0,0,255), GREEN(0,255,0);
+
+        int key;
+        while( keys.try_pop(key) )
+        {
+            if( key == 'u' && mode == CALIBRATED )
+               s.showUndistorsed = !s.showUndistorsed;
+
+            if( live && key == 'g' )
+            {
+                mode = CAPTURING;
+                imagePoints.clear();
+            }
+        }
+
         bool blinkOutput = false;
 
-        view = s.nextImage();
+        const bool got = input.pop(frame);
 
         //-----  If no more image, or got enough, then stop calibration and show result -------------
         if( mode == CAPTURING && imagePoints.size() >= (size_t)s.nrFrames )
@@ -277,15 +308,16 @@ int main(int argc, char* argv[])
           else
               mode = DETECTION;
         }
-        if(view.empty())          // If there are no more images stop the loop
+        if(!got)                  // If there are no more images stop the loop
         {
             // if calibration threshold was not reached yet, calibrate now
             if( mode != CALIBRATED && !imagePoints.empty() )
                 runCalibrationAndSave(s, imageSize,  cameraMatrix, distCoeffs, imagePoints);
-            break;
+            return false;
         }
-        //! [get_input]
 
+        frame.started = getTickCount();
+        Mat& view = frame.image;
         imageSize = view.size();  // Format input image.
         if( s.flipVertical )    flip( view, view, 0 );
 
@@ -323,18 +355,17 @@ int main(int argc, char* argv[])
               // improve the found corners' coordinate accuracy for chessboard
                 if( s.calibrationPattern == Settings::CHESSBOARD)
                 {
-                    Mat viewGray;
                     cvtColor(view, viewGray, COLOR_BGR2GRAY);
                     cornerSubPix( viewGray, pointBuf, Size(11,11),
                         Size(-1,-1), TermCriteria( TermCriteria::EPS+TermCriteria::COUNT, 30, 0.1 ));
                 }
 
                 if( mode == CAPTURING &&  // For camera only take new samples after delay time
-                    (!s.inputCapture.isOpened() || clock() - prevTimestamp > s.delay*1e-3*CLOCKS_PER_SEC) )
+                    (!live || clock() - prevTimestamp > s.delay*1e-3*CLOCKS_PER_SEC) )
                 {
                     imagePoints.push_back(pointBuf);
                     prevTimestamp = clock();
-                    blinkOutput = s.inputCapture.isOpened();
+                    blinkOutput = live;
                 }
 
                 // Draw the corners.
@@ -366,28 +397,82 @@ int main(int argc, char* argv[])
         //! [output_undistorted]
         if( mode == CALIBRATED && s.showUndistorsed )
         {
-            Mat temp = view.clone();
+            view.copyTo(temp);
             undistort(temp, view, cameraMatrix, distCoeffs);
         }
         //! [output_undistorted]
-        //------------------------------ Show image and check for input commands -------------------
-        //! [await_input]
-        imshow("Image View", view);
-        char key = (char)waitKey(s.inputCapture.isOpened() ? 50 : s.delay);
 
-        if( key  == ESC_KEY )
-            break;
+        frame.processed = getTickCount();
+        return output.push(frame);
+    }
 
-        if( key == 'u' && mode == CALIBRATED )
-           s.showUndistorsed = !s.showUndistorsed;
+    Mat cameraMatrix, distCoeffs;
+    Size imageSize;
 
-        if( s.inputCapture.isOpened() && key == 'g' )
-        {
-            mode = CAPTURING;
-            imagePoints.clear();
-        }
-        //! [await_input]
+private:
+    Settings& s;
+    const bool live;
+    Pipeline::Ring<Pipeline::Frame>& input;
+    Pipeline::Ring<int>& keys;
+    Pipeline::Ring<Pipeline::Frame>& output;
+    Pipeline::Frame frame;
+    Mat viewGray, temp;
+
+    vector<vector<Point2f> > imagePoints;
+    int mode;
+    clock_t prevTimestamp;
+};
+
+int main(int argc, char* argv[])
+{
+    help();
+
+    //! [file_read]
+    Settings s;
+    const string inputSettingsFile = argc > 1 ? argv[1] : "default.xml";
+    FileStorage fs(inputSettingsFile, FileStorage::READ); // Read the settings
+    if (!fs.isOpened())
+    {
+        cout << "Could not open the configuration file: \"" << inputSettingsFile << "\"" << endl;
+        return -1;
     }
+    fs["Settings"] >> s;
+    fs.release();                                         // close Settings file
+    //! [file_read]
+
+    //FileStorage fout("settings.yml", FileStorage::WRITE); // write config as YAML
+    //fout << "Settings" << s;
+
+    if (!s.goodInput)
+    {
+        cout << "Invalid input detected. Application stopping. " << endl;
+        return -1;
+    }
+
+    const char ESC_KEY = 27;
+
+    //! [get_input]
+    // Reading, detection and display each run on a thread. A camera keeps
+    // only its newest frames; an image list is shown image by image.
+    const bool live = s.inputCapture.isOpened();
+    const Pipeline::Policy policy = live ? Pipeline::DROP_OLDEST : Pipeline::BLOCK;
+    Pipeline::Ring<Pipeline::Frame> captured(2, policy);
+    Pipeline::Ring<Pipeline::Frame> detected(2, policy);
+    Pipeline::Ring<int> keys(16, Pipeline::DROP_OLDEST);
+
+    SettingsCapture capture(s, captured);
+    Calibration calibration(s, live, captured, keys, detected);
+    Pipeline::Display display("Image View", detected, &keys, ESC_KEY, live ? 50 : s.delay);
+
+    Pipeline::Runner runner;
+    runner.start(capture);
+    runner.start(calibration);
+    runner.run(display);
+    //! [get_input]
+
+    const Mat& cameraMatrix = calibration.cameraMatrix;
+    const Mat& distCoeffs = calibration.distCoeffs;
+    const Size imageSize = calibration.imageSize;
 
     // -----------------------Show the undistorted image for the image list ------------------------
     //! [show_results]
@@ -436,8 +521,9 @@ static double computeReprojectionErrors( const vector<vector<Point3f> >& objectP
                                          vector<float>& perViewErrors, bool fisheye)
 {
     vector<Point2f> imagePoints2;
+    Reprojection::Points2 projected, observed;
     size_t totalPoints = 0;
-    double totalErr = 0, err;
+    double totalErr = 0;
     perViewErrors.resize(objectPoints.size());
 
     for(size_t i = 0; i < objectPoints.size(); ++i )
@@ -451,11 +537,14 @@ static double computeReprojectionErrors( const vector<vector<Point3f> >& objectP
         {
             projectPoints(objectPoints[i], rvecs[i], tvecs[i], cameraMatrix, distCoeffs, imagePoints2);
         }
-        err = norm(imagePoints[i], imagePoints2, NORM_L2);
+
+        projected.assign(imagePoints2);
+        observed.assign(imagePoints[i]);
+        Reprojection::Errors errors = Reprojection::errors(projected, observed, DBL_MAX);
 
         size_t n = objectPoints[i].size();
-        perViewErrors[i] = (float) std::sqrt(err*err/n);
-        totalErr        += err*err;
+        perViewErrors[i] = (float) errors.rms;
+        totalErr        += errors.rms * errors.rms * n;
         totalPoints     += n;
     }
 
@@ -4,7 +4,10 @@
 #include <cstdio>
 #include <iostream>
 
-#include "../Camera.hpp"
+#include "../sfm/Camera.hpp"
+#include "../sfm/Pipeline.hpp"
+#include "../sfm/Pyramid.hpp"
+#include "../sfm/Tracker.hpp"
 
 using namespace std;
 using namespace cv;
@@ -105,7 +108,7 @@ bool find_correspondences(const Mat& im1, const Mat& im2,
 
     double t = getTickCount();
     // Change distance based on descriptor
-    BFMatcher matcher = BFMatcher::BFMatcher(NORM_L2, true);
+    BFMatcher matcher(NORM_L2, true);
     matcher.match(descriptor1, descriptor2, matches);
 
     // for (int i = 0; i < cross_checked_matches.size(); ++i)
@@ -146,66 +149,97 @@ bool find_correspondences(const Mat& im1, const Mat& im2,
 //     imshow(mp->window_name, drawing);
 // }
 
-int main(int argc, char** argv)
+// Matches every frame it is handed against the query image, or follows the
+// matches of an earlier frame with the tracker, and passes the frame on
+// with the matches drawn. Space on the display takes the next frame as the
+// query, r drops it. A query taken from the camera keeps hold of the
+// frame's pool buffer rather than copying it.
+class Correspondences : public Pipeline::Stage
 {
-    int expected_argument_count = 3;
-    if (argc - 1 < expected_argument_count)
+public:
+    Correspondences(Pipeline::Ring<Pipeline::Frame>& input,
+                    Pipeline::Ring<int>& keys,
+                    Pipeline::Ring<Pipeline::Frame>& output)
+    : _input(input)
+    , _keys(keys)
+    , _output(output)
+    , _query(imread("images/Lenna.png"))
+    , _tracker(500, 0)
+    , _first_id(0)
+    , _take_query(false)
     {
-        print_usage_format();
-        return -1;
+        attach(input);
+        attach(keys);
+        attach(output);
     }
 
-    string calibration_filepath = argv[1];
-    int video_width             = atoi(argv[2]);
-    int video_height            = atoi(argv[3]);
-
-
-    Camera cam(calibration_filepath);
-    cam.resize(Size(video_width, video_height));
-
-    VideoCapture vc(0);
-    vc.set(CV_CAP_PROP_FRAME_WIDTH, video_width);
-    vc.set(CV_CAP_PROP_FRAME_HEIGHT, video_height);
-
-    if (!vc.isOpened()) return 0;
+    bool step()
+    {
+        if (!_input.pop(_item))
+            return false;
+        _item.started = getTickCount();
 
-    string window_name = "source";
-    namedWindow(window_name);
+        int key;
+        while (_keys.try_pop(key))
+        {
+            if (key == ' ') _take_query = true;
+            else if (key == 'r') { _query = Mat(); _query_buffer.release(); }
+        }
 
-    Mat query = imread("images/Lenna.png");//Mat();
-    Mat image = Mat();
-    vector<KeyPoint> query_feat, im_feat;
-    Mat              query_desc, im_desc;
+        Mat& image = _item.image;
 
-    while (vc.isOpened())
-    {
-        vc >> image;
+        // Held, the buffer stays out of the pool and nothing is drawn on
+        // it, as this frame goes on to the display bare
+        if (_take_query)
+        {
+            _query = image;
+            _query_buffer = _item.buffer;
+            _query_feat.clear();
+            _query_desc = Mat();
+            _tracker.reset(Pyramid(_query));
+            _take_query = false;
+            _item.processed = getTickCount();
+            return Pipeline::pass(_output, _item);
+        }
 
-        bool success = false;
-        if (!query.empty())
+        if (!_query.empty())
         {
-            im_feat.clear();
-            im_desc = Mat();
-
-            double time_spent = getTickCount();
-            // Find 2D correspondences
-            std::vector<DMatch> matches;
-            success = find_correspondences(query, image,
-                                           query_feat, im_feat,
-                                           query_desc, im_desc,
-                                           matches);
-
-            time_spent = (getTickCount() - time_spent) / getTickFrequency();
-            printf("%0.4f\n", time_spent);
-            if (success)
+            Pyramid pyramid(image);
+            if (_tracker.update(pyramid) < min_tracked)
             {
-                vector<Point2d> query_pts, im_pts;
-                for (int i = 0; i < matches.size(); ++i)
+                _im_feat.clear();
+                _im_desc = Mat();
+
+                // Find 2D correspondences
+                std::vector<DMatch> matches;
+                if (find_correspondences(_query, image,
+                                         _query_feat, _im_feat,
+                                         _query_desc, _im_desc,
+                                         matches))
                 {
-                    query_pts.push_back(Point2d(query_feat[matches[i].queryIdx].pt));
-                    im_pts.push_back(Point2d(im_feat[matches[i].trainIdx].pt));
+                    vector<Point2f> seeds;
+                    _tracked_query.clear();
+                    for (int i = 0; i < matches.size(); ++i)
+                    {
+                        _tracked_query.push_back(_query_feat[matches[i].queryIdx].pt);
+                        seeds.push_back(_im_feat[matches[i].trainIdx].pt);
+                    }
+
+                    _first_id = _tracker.created();
+                    _tracker.reset(pyramid, seeds);
                 }
+            }
 
+            vector<Point2d> query_pts, im_pts;
+            const vector<Tracker::Track>& tracks = _tracker.tracks();
+            for (int i = 0; i < tracks.size(); ++i)
+            {
+                query_pts.push_back(Point2d(_tracked_query[tracks[i].id - _first_id]));
+                im_pts.push_back(Point2d(tracks[i].point));
+            }
+
+            if (query_pts.size() >= 8)
+            {
                 // Find homography between correspondences
                 vector<char> mask;
                 Mat homography = findHomography(query_pts, im_pts, CV_RANSAC, 2, mask);
@@ -213,14 +247,12 @@ int main(int argc, char** argv)
                 int count = 0;
                 for (int i = 0; i < mask.size(); ++i) count += (mask[i] != 0);
 
-                success = count >= 8;
-
-                if (success)
+                if (count >= 8)
                 {
-                    Mat points = (Mat_<double>(4, 3) <<          0,          0, 1,
-                                                        query.cols,          0, 1,
-                                                        query.cols, query.rows, 1,
-                                                                 0, query.rows, 1);
+                    Mat points = (Mat_<double>(4, 3) <<           0,           0, 1,
+                                                        _query.cols,           0, 1,
+                                                        _query.cols, _query.rows, 1,
+                                                                  0, _query.rows, 1);
 
                     // H * dest = src, rows are points
                     Mat warped = (homography * points.t()).t();
@@ -247,31 +279,106 @@ int main(int argc, char** argv)
                         line(image, quad[i], quad[j], Scalar(0, 255, 0), 3);
                     }
 
+                    vector<KeyPoint> query_kp, im_kp;
+                    vector<DMatch> matches;
+                    for (int i = 0; i < query_pts.size(); ++i)
+                    {
+                        query_kp.push_back(KeyPoint(Point2f(query_pts[i]), 7.0f));
+                        im_kp.push_back(KeyPoint(Point2f(im_pts[i]), 7.0f));
+                        matches.push_back(DMatch(i, i, 0.0f));
+                    }
+
                     Mat drawing;
-                    drawMatches(query, query_feat, image, im_feat, matches, drawing,
+                    drawMatches(_query, query_kp, image, im_kp, matches, drawing,
                                 Scalar::all(-1), Scalar::all(-1),
                                 mask, DrawMatchesFlags::DEFAULT);
 
-                    imshow(window_name, drawing);
+                    std::swap(image, drawing);
+                    _item.buffer.release();
                 }
             }
         }
 
-        if (!success)
-        {
-            imshow(window_name, image);
-        }
+        _item.processed = getTickCount();
+        return Pipeline::pass(_output, _item);
+    }
 
-        char key = waitKey(20);
-        if (key == ' ')
-        {
-            vc >> query;
-            query_feat.clear();
-            query_desc = Mat();
-        }
-        else if (key == 'r') query = Mat();
-        else if (key == 'q') break;
+private:
+    // The frame is matched against the query once, and the matched points
+    // are then tracked until fewer than min_tracked survive. The tracker
+    // never detects on its own; _tracked_query holds the query point of
+    // each track, by id from _first_id.
+    static const int min_tracked = 20;
+
+    Pipeline::Ring<Pipeline::Frame>& _input;
+    Pipeline::Ring<int>& _keys;
+    Pipeline::Ring<Pipeline::Frame>& _output;
+    Pipeline::Frame _item;
+
+    Mat _query;
+    FramePool::Handle _query_buffer;
+    vector<KeyPoint> _query_feat, _im_feat;
+    Mat              _query_desc, _im_desc;
+
+    Tracker _tracker;
+    vector<Point2f> _tracked_query;
+    int _first_id;
+
+    bool _take_query;
+};
+
+int main(int argc, char** argv)
+{
+    int expected_argument_count = 3;
+    if (argc - 1 < expected_argument_count)
+    {
+        print_usage_format();
+        return -1;
     }
 
+    string calibration_filepath = argv[1];
+    int video_width             = atoi(argv[2]);
+    int video_height            = atoi(argv[3]);
+
+
+    Camera calibration(calibration_filepath);
+    const Camera& cam = calibration.at_resolution(Size(video_width, video_height));
+
+    VideoCapture vc(0);
+    vc.set(CV_CAP_PROP_FRAME_WIDTH, video_width);
+    vc.set(CV_CAP_PROP_FRAME_HEIGHT, video_height);
+
+    if (!vc.isOpened()) return 0;
+
+    string window_name = "source";
+    namedWindow(window_name);
+
+    // Only the newest frame waits on each edge, so matches are drawn on the
+    // latest frame there is
+    Pipeline::Ring<Pipeline::Frame> captured(1, Pipeline::DROP_OLDEST);
+    Pipeline::Ring<Pipeline::Frame> matched(1, Pipeline::DROP_OLDEST);
+
+    // Keys go back from the display to the matcher, which takes them up
+    // on its next frame; far fewer than 16 get typed in between
+    Pipeline::Ring<int> keys(16, Pipeline::DROP_OLDEST);
+
+    // One frame in each stage and in each of the rings' two slots, the
+    // query, and one spare
+    FramePool pool(9, Size(vc.get(CV_CAP_PROP_FRAME_WIDTH), vc.get(CV_CAP_PROP_FRAME_HEIGHT)), CV_8UC3);
+
+    Pipeline::Capture capture(vc, pool, captured);
+    Correspondences correspondences(captured, keys, matched);
+    Pipeline::Display display(window_name, matched, &keys, 'q');
+    display.report_latency(true);
+
+    Pipeline::Runner runner;
+    runner.start(capture);
+    runner.start(correspondences);
+    runner.run(display);
+
+    Pipeline::report("capture -> match", captured);
+    Pipeline::report("match -> display", matched);
+    display.summary();
+
     return 0;
 }
@@ -4,6 +4,9 @@
 #include <cstdio>
 #include <string>
 
+#include "../sfm/Pyramid.hpp"
+#include "../sfm/Tracker.hpp"
+
 #define DEBUG false
 
 using namespace std;
@@ -427,25 +430,53 @@ int main(int argc, char** argv)
 
     Mat im1, im2;
     im1 = imread("images/Lenna.png");
+
+    // Matches against im1 are tracked from frame to frame and only found
+    // again once fewer than min_tracked survive. tracked1 holds the im1
+    // point of each track, by id from first_id.
+    const int min_tracked = 20;
+    Tracker tracker(500, 0);
+    vector<Point2f> tracked1;
+    int first_id = 0;
+
     while (vc.isOpened())
     {
         vc >> im2;
         vector<Point2d> pts1, pts2;
-        std::vector<KeyPoint> feat1, feat2;
-        std::vector<DMatch> matches;
         double t = getTickCount();
-        bool found = find_correspondences(im1, im2, feat1, feat2, matches);
-        printf("[find_correspondences]: %0.4f seconds\n", (getTickCount() - t) / getTickFrequency());
+        Pyramid pyramid(im2);
+        if (tracker.update(pyramid) < min_tracked)
+        {
+            std::vector<KeyPoint> feat1, feat2;
+            std::vector<DMatch> matches;
+            if (find_correspondences(im1, im2, feat1, feat2, matches))
+            {
+                vector<Point2f> seeds;
+                tracked1.clear();
+                for (int i = 0; i < matches.size(); ++i)
+                {
+                    tracked1.push_back(feat1[matches[i].queryIdx].pt);
+                    seeds.push_back(feat2[matches[i].trainIdx].pt);
+                }
 
-        // cout << matches.size() << " " << feat1.size() << " " << feat2.size() << endl;
-        for (int i = 0; i < matches.size(); ++i)
+                first_id = tracker.created();
+                tracker.reset(pyramid, seeds);
+            }
+            printf("[find_correspondences]: %0.4f seconds\n", (getTickCount() - t) / getTickFrequency());
+        }
+        else
         {
-            // cout << i << endl;
-            // cout << matches[i].queryIdx << " " << matches[i].trainIdx << endl;
-            pts1.push_back(Point2d(feat1[matches[i].queryIdx].pt));
-            pts2.push_back(Point2d(feat2[matches[i].trainIdx].pt));
+            printf("[track]: %0.4f seconds\n", (getTickCount() - t) / getTickFrequency());
         }
 
+        const vector<Tracker::Track>& tracks = tracker.tracks();
+        for (int i = 0; i < tracks.size(); ++i)
+        {
+            pts1.push_back(Point2d(tracked1[tracks[i].id - first_id]));
+            pts2.push_back(Point2d(tracks[i].point));
+        }
+        bool found = !pts1.empty();
+
         assert(pts1.size() == pts2.size());
         
         Mat rotation, translation;
@@ -559,7 +590,11 @@ int main(int argc, char** argv)
         // else
         imshow("im2", im2);
 
-        if (waitKey(20) == 'r') vc >> im1;
+        if (waitKey(20) == 'r')
+        {
+            vc >> im1;
+            tracker.reset(Pyramid(im1));
+        }
         if (waitKey(20) == 27) break;
     }
 }
@@ -9,6 +9,11 @@
 #include <assert.h>
 #include <cstdio>
 
+#include "../sfm/Camera.hpp"
+#include "../sfm/FrameContext.hpp"
+#include "../sfm/Pipeline.hpp"
+#include "../sfm/Pose.hpp"
+
 using namespace cv;
 using namespace std;
 
@@ -42,23 +47,10 @@ void draw_poly(const Mat& im, const vector<Point>& poly, Scalar color)
     }
 }
 
-bool find_black_quad(Mat& image, vector<Point>& quad)
+bool find_black_quad(FrameContext& frame, vector<Point>& quad)
 {
-    Mat gray;
-    cvtColor(image, gray, CV_BGR2GRAY);
-
-    Mat adapt;
-    adaptiveThreshold(
-        gray,
-        adapt,
-        255,
-        ADAPTIVE_THRESH_GAUSSIAN_C,
-        THRESH_BINARY,
-        7,
-        10
-    );
-
-    // imshow("adapt", adapt);
+    const Mat& adapt_source = frame.adaptive_thresholded(7, 10);
+    // imshow("adapt", adapt_source);
 
     int erosion_size = 3;
     int square_size  = erosion_size * 2 + 1;
@@ -68,21 +60,15 @@ bool find_black_quad(Mat& image, vector<Point>& quad)
         Point(erosion_size, erosion_size)
     );
 
-    erode(adapt, adapt, element);
+    // Eroded into a copy, the thresholded frame is shared
+    Mat adapt;
+    erode(adapt_source, adapt, element);
     // imshow("eroded", adapt);
 
     Mat labels;
     connectedComponents(adapt, labels, 4);
 
-    Mat thresh;
-    threshold(
-        gray,
-        thresh,
-        100,
-        255,
-        THRESH_BINARY
-    );
-
+    const Mat& thresh = frame.thresholded(100);
     // imshow("thresh", thresh);
 
     double maxLabel;
@@ -210,24 +196,14 @@ bool find_black_quad(Mat& image, vector<Point>& quad)
     return true;
 }
 
-void sort_quad_corners(Mat& image,
+void sort_quad_corners(FrameContext& frame,
                        const vector<Point>& quad,
                        vector<Point>& sorted_quad)
 {
     assert(quad.size() == 4);
     assert(&quad != &sorted_quad);
 
-    Mat gray;
-    cvtColor(image, gray, CV_BGR2GRAY);
-
-    Mat thresh;
-    threshold(
-        gray,
-        thresh,
-        155,
-        255,
-        THRESH_BINARY
-    );
+    const Mat& thresh = frame.thresholded(155);
 
     Rect r = boundingRect(quad);
     Point2f white_centroid = Point(0, 0);
@@ -321,7 +297,11 @@ void draw_sorted_corners(Mat& image,
     }
 }
 
-Mat draw_image_in_quad(Mat& image, vector<Point>& quad, const Mat& imposed, Mat homography = Mat())
+// Pixels of imposed inside saved_rect are read from saved instead, for when
+// imposed is image itself: saved then holds them as they were before this
+// call wrote over them
+Mat draw_image_in_quad(Mat& image, vector<Point>& quad, const Mat& imposed, Mat homography = Mat(),
+                       const Mat& saved = Mat(), Rect saved_rect = Rect())
 {
     vector<Point> src_points;
     src_points.push_back(Point(0, 0));
@@ -369,7 +349,8 @@ Mat draw_image_in_quad(Mat& image, vector<Point>& quad, const Mat& imposed, Mat
                 if (qx >= 0 && qy >= 0 && qx < imposed.cols && qy < imposed.rows)
                 {
                     // printf("(%d, %d) -> (%d, %d)\n", y, x, qy, qx);
-                    image.at<Vec3b>(y, x) = imposed.at<Vec3b>(qy, qx);
+                    const Mat& source = saved_rect.contains(Point(qx, qy)) ? saved : imposed;
+                    image.at<Vec3b>(y, x) = source.at<Vec3b>(qy, qx);
                 }
                 else
                 {
@@ -383,15 +364,22 @@ Mat draw_image_in_quad(Mat& image, vector<Point>& quad, const Mat& imposed, Mat
 }
 
 // Kind of slow way to do it. Should update quad to represent new region
-void draw_image_in_quad_rec(Mat& image, vector<Point> quad, int its=3)
+//
+// Each pass reads the image it writes, so only the part it is about to
+// write is saved first, into saved: a buffer the size of the image that
+// the caller keeps from frame to frame
+void draw_image_in_quad_rec(Mat& image, vector<Point> quad, Mat& saved, int its=3)
 {
     assert(quad.size() == 4);
 
+    saved.create(image.size(), image.type());
+
     Mat homography = Mat();
     for (int i = 1; i < its; ++i)
     {
-        Mat image_clone = image.clone();
-        homography = draw_image_in_quad(image, quad, image_clone, homography);
+        Rect written = boundingRect(quad) & Rect(0, 0, image.cols, image.rows);
+        image(written).copyTo(saved(written));
+        homography = draw_image_in_quad(image, quad, image, homography, saved, written);
 
         for (int j = 0; j < quad.size(); ++j)
         {
@@ -412,31 +400,71 @@ void draw_image_in_quad_rec(Mat& image, vector<Point> quad, int its=3)
     }
 }
 
-void get_square_pose(const vector<Point>& quad, 
+// Both poses of the planar ambiguity for the marker, best first. tracked
+// is cleared by the caller whenever the marker is lost.
+struct SquarePose
+{
+    bool    tracked;
+    Matx33d rotations[2];
+    Vec3d   translations[2];
+    double  errors[2];
+};
+
+void get_square_pose(const vector<Point>& quad,
                      const Mat& camera_matrix,
                      const Mat& distortion_coeff,
-                     Mat& rot, Mat& trans)
+                     SquarePose& pose)
 {
     assert(quad.size() == 4);
 
-    float object_points[4][3] =
+    const Point2d object[4] =
     {
-        {-1.0f,  1.0f,  0.0f},
-        { 1.0f,  1.0f,  0.0f},
-        { 1.0f, -1.0f,  0.0f},
-        {-1.0f, -1.0f,  0.0f},
+        Point2d(-1.0,  1.0),
+        Point2d( 1.0,  1.0),
+        Point2d( 1.0, -1.0),
+        Point2d(-1.0, -1.0),
     };
 
-    Mat object_mat = Mat(quad.size(), 3, CV_32F, object_points);
-    Mat quad_mat = Mat(quad.size(), 2, CV_32F);
+    Point2d corners[4], normalized[4];
+    for (int i = 0; i < 4; ++i)
+        corners[i] = Point2d(quad[i].x, quad[i].y);
+
+    Mat corners_mat(4, 1, CV_64FC2, corners);
+    Mat normalized_mat(4, 1, CV_64FC2, normalized);
+    undistortPoints(corners_mat, normalized_mat, camera_matrix, distortion_coeff);
 
-    for (int i = 0; i < quad.size(); ++i)
+    // Warm start: the marker barely moves between frames, so a couple of
+    // Gauss-Newton steps from last frame's poses usually suffice.
+    const double max_error = 2.0 / camera_matrix.at<double>(0, 0);
+    if (pose.tracked)
     {
-        quad_mat.at<float>(i, 0) = quad[i].x;
-        quad_mat.at<float>(i, 1) = quad[i].y;
+        const Point3d points[4] =
+        {
+            Point3d(object[0].x, object[0].y, 0.0),
+            Point3d(object[1].x, object[1].y, 0.0),
+            Point3d(object[2].x, object[2].y, 0.0),
+            Point3d(object[3].x, object[3].y, 0.0),
+        };
+
+        for (int s = 0; s < 2; ++s)
+        {
+            pose.errors[s] = Pose::refine(
+                points, normalized, 4, pose.rotations[s], pose.translations[s], 2);
+        }
+
+        if (pose.errors[1] < pose.errors[0])
+        {
+            std::swap(pose.rotations[0], pose.rotations[1]);
+            std::swap(pose.translations[0], pose.translations[1]);
+            std::swap(pose.errors[0], pose.errors[1]);
+        }
+
+        if (pose.errors[0] < max_error)
+            return;
     }
 
-    solvePnP(object_mat, quad_mat, camera_matrix, distortion_coeff, rot, trans);
+    pose.tracked = Pose::planar(
+        object, normalized, 4, pose.rotations, pose.translations, pose.errors) == 2;
 }
 
 void draw_cube_with_pose(Mat& image,
@@ -488,20 +516,89 @@ void draw_cube_with_pose(Mat& image,
     }
 }
 
-// assumes no skew
-void update_camera_matrix_resize(Mat& camera_matrix, Size old_size, Size new_size)
+// Finds the black square on every frame it is handed and draws the
+// overlays on the frame before passing it on
+class SquareDetect : public Pipeline::Stage
 {
-    assert(old_size.width * new_size.height == old_size.height * new_size.width);
-    assert(old_size.width != 0 && old_size.height != 0);
+public:
+    SquareDetect(const Camera& camera,
+                 Pipeline::Ring<Pipeline::Frame>& input,
+                 Pipeline::Ring<Pipeline::Frame>& output)
+    : _camera_matrix(camera.matrix())
+    , _distortion_coeff(camera.distortion())
+    , _input(input)
+    , _output(output)
+    {
+        _pose.tracked = false;
+        attach(input);
+        attach(output);
+    }
 
-    double width_ratio = ((double) new_size.width) / old_size.width;
-    double height_ratio = ((double) new_size.height) / old_size.height;
+    bool step()
+    {
+        if (!_input.pop(_item))
+            return false;
+        _item.started = getTickCount();
 
-    camera_matrix.at<double>(0, 0) *= width_ratio;
-    camera_matrix.at<double>(1, 1) *= height_ratio;
-    camera_matrix.at<double>(0, 2) = new_size.width * 0.5;
-    camera_matrix.at<double>(1, 2) = new_size.height * 0.5;
-}
+        // The frame moves into the context without a copy, and the
+        // context's previous buffer goes back round in its place
+        _frame.swap(_item.image);
+
+        // Overlays go on the frame only after the analysis is done with it
+        Mat& image = _frame.frame();
+        bool found = find_black_quad(_frame, _quad);
+
+        if (_quad.size() == 4)
+        {
+            if (found)
+            {
+                vector<Point> sorted_quad;
+                sort_quad_corners(_frame, _quad, sorted_quad);
+                _quad = sorted_quad;
+
+                // draw_sorted_corners(image, _quad);
+                // draw_image_in_quad(image, _quad, image.clone());
+                draw_image_in_quad_rec(image, _quad, _saved, 3);
+
+                get_square_pose(_quad, _camera_matrix, _distortion_coeff, _pose);
+                if (_pose.tracked)
+                {
+                    Mat rot, trans = Mat(_pose.translations[0]);
+                    Rodrigues(Mat(_pose.rotations[0]), rot);
+                    // cout << "Rotation\n" << rot << endl;
+                    // cout << "Translation\n" << trans << endl << endl;
+
+                    draw_cube_with_pose(image, rot, trans, _camera_matrix, _distortion_coeff);
+                }
+            }
+            else
+            {
+                _pose.tracked = false;
+            }
+        }
+        else
+        {
+            _pose.tracked = false;
+        }
+
+        std::swap(_item.image, image);
+        _item.processed = getTickCount();
+        return Pipeline::pass(_output, _item);
+    }
+
+private:
+    Mat _camera_matrix;
+    Mat _distortion_coeff;
+
+    Pipeline::Ring<Pipeline::Frame>& _input;
+    Pipeline::Ring<Pipeline::Frame>& _output;
+    Pipeline::Frame _item;
+
+    FrameContext _frame;
+    vector<Point> _quad;
+    SquarePose _pose;
+    Mat _saved;
+};
 
 int main(int argc, char** argv)
 {
@@ -509,27 +606,18 @@ int main(int argc, char** argv)
     if (argc > 1)
         index = atoi(argv[1]);
 
+    // Either the calibration XML or its binary conversion
     string camera_calib_filename = "../calibration_data/out_camera_data.xml";
-    FileStorage fs(camera_calib_filename, FileStorage::READ);
-
-    Mat camera_matrix, distortion_coeff;
-    int camera_width, camera_height;
-    fs["camera_matrix"] >> camera_matrix;
-    fs["distortion_coefficients"] >> distortion_coeff;
-    fs["image_width"] >> camera_width;
-    fs["image_height"] >> camera_height;
+    if (argc > 2)
+        camera_calib_filename = argv[2];
 
-    std::cout << camera_height << " " << camera_width << std::endl;
+    Camera calibration(camera_calib_filename);
+    std::cout << calibration.resolution().height << " " << calibration.resolution().width << std::endl;
 
     int width = 1280;
     int height = 720;
 
-    update_camera_matrix_resize(
-        camera_matrix,
-        Size(camera_width, camera_height),
-        Size(width, height));
-
-    fs.release();
+    const Camera& camera = calibration.at_resolution(Size(width, height));
 
     VideoCapture vc(index);
     vc.set(CV_CAP_PROP_FRAME_WIDTH, width);
@@ -539,42 +627,29 @@ int main(int argc, char** argv)
 
     if (!vc.isOpened()) return 0;
 
-    Mat image;
-    vc >> image;
-
     namedWindow("outlined_source", CV_WINDOW_NORMAL);
-    vector<Point> quad;
-    while (vc.isOpened())
-    {
-        vc >> image;
-        bool found = find_black_quad(image, quad);
-
-        if (quad.size() == 4)
-        {
-            if (found)
-            {
-                vector<Point> sorted_quad;
-                sort_quad_corners(image, quad, sorted_quad);
-                quad = sorted_quad;
-
-                // draw_sorted_corners(image, quad);
-                // draw_image_in_quad(image, quad, image.clone());
-                draw_image_in_quad_rec(image, quad, 3);
-
-                Mat rot, trans;
-                // get_square_pose(quad, camera_matrix, distortion_coeff, rot, trans);
-                // cout << "Rotation\n" << rot << endl;
-                // cout << "Translation\n" << trans << endl << endl;
-
-                // draw_cube_with_pose(image, rot, trans, camera_matrix, distortion_coeff);
-            }
-        }
 
-        // Mat resized_image;
-        // resize(image, resized_image, Size(width, height));
-        imshow("outlined_source", image);
-
-        if (waitKey(20) == 27)
-            break;
-    }
+    // Capture, detection and display each on a thread. Each edge holds only
+    // the newest frame, so the overlay is drawn on the latest frame there
+    // is rather than on one that waited behind others.
+    Pipeline::Ring<Pipeline::Frame> captured(1, Pipeline::DROP_OLDEST);
+    Pipeline::Ring<Pipeline::Frame> detected(1, Pipeline::DROP_OLDEST);
+
+    // One frame in each stage and in each of the rings' two slots, with
+    // one spare
+    FramePool pool(8, Size(vc.get(CV_CAP_PROP_FRAME_WIDTH), vc.get(CV_CAP_PROP_FRAME_HEIGHT)), CV_8UC3);
+
+    Pipeline::Capture capture(vc, pool, captured);
+    SquareDetect detect(camera, captured, detected);
+    Pipeline::Display display("outlined_source", detected, NULL);
+    display.report_latency(true);
+
+    Pipeline::Runner runner;
+    runner.start(capture);
+    runner.start(detect);
+    runner.run(display);
+
+    Pipeline::report("capture -> detect", captured);
+    Pipeline::report("detect -> display", detected);
+    display.summary();
 }
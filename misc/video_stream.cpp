@@ -2,9 +2,50 @@
 #include <string>
 #include <iostream>
 
+#include "../sfm/Pipeline.hpp"
+
 using namespace cv;
 using namespace std;
 
+// Edges of every frame it is handed
+class Edges : public Pipeline::Stage
+{
+public:
+    Edges(Pipeline::Ring<Pipeline::Frame>& input, Pipeline::Ring<Pipeline::Frame>& output)
+    : _input(input)
+    , _output(output)
+    {
+        attach(input);
+        attach(output);
+    }
+
+    bool step()
+    {
+        if (!_input.pop(_item))
+            return false;
+        _item.started = getTickCount();
+
+        // Gray edge images go round the output ring and color frames back
+        // to the pool, so neither side reallocates
+        cvtColor(_item.image, _gray, CV_BGR2GRAY);
+        Canny(_gray, _edges.image, 100, 50, 3);
+        _edges.index = _item.index;
+        _edges.captured = _item.captured;
+        _edges.started = _item.started;
+        _edges.processed = getTickCount();
+
+        // Nothing holds the color frame's buffer past here
+        Pipeline::release(_item);
+        return _output.push(_edges);
+    }
+
+private:
+    Pipeline::Ring<Pipeline::Frame>& _input;
+    Pipeline::Ring<Pipeline::Frame>& _output;
+    Pipeline::Frame _item, _edges;
+    Mat _gray;
+};
+
 int main(int argc, char** argv)
 {
     int index = 0;
@@ -16,20 +57,29 @@ int main(int argc, char** argv)
     VideoCapture vc(index);
 
     if (!vc.isOpened()) return 0;
-    
+
     vc.set(CV_CAP_PROP_FRAME_WIDTH, width);
     vc.set(CV_CAP_PROP_FRAME_HEIGHT, height);
 
-    Mat image;
-    vc >> image;
-
     namedWindow("test");
-    while (vc.isOpened())
-    {
-        vc >> image;
-        cvtColor(image, image, CV_BGR2GRAY);
-        Canny(image, image, 100, 50, 3);
-        imshow("test", image);
-        if (waitKey(30) == 27) break;
-    }
+
+    Pipeline::Ring<Pipeline::Frame> captured(2, Pipeline::DROP_OLDEST);
+    Pipeline::Ring<Pipeline::Frame> edges(2, Pipeline::DROP_OLDEST);
+
+    // One frame in capture and edge detection and in each of the captured
+    // ring's three slots, with one spare
+    FramePool pool(6, Size(vc.get(CV_CAP_PROP_FRAME_WIDTH), vc.get(CV_CAP_PROP_FRAME_HEIGHT)), CV_8UC3);
+
+    Pipeline::Capture capture(vc, pool, captured);
+    Edges edge_detect(captured, edges);
+    Pipeline::Display display("test", edges, NULL);
+
+    Pipeline::Runner runner;
+    runner.start(capture);
+    runner.start(edge_detect);
+    runner.run(display);
+
+    Pipeline::report("capture -> edges", captured);
+    Pipeline::report("edges -> display", edges);
+    display.summary();
 }
@@ -0,0 +1,432 @@
+#include "BundleAdjust.hpp"
+
+#include <calib3d.hpp>
+#include <cmath>
+
+namespace
+{
+    // Residuals above this many pixels are down-weighted (Huber)
+    const double huber_delta = 2.0;
+
+    double huber_weight(double r)
+    {
+        return r <= huber_delta ? 1.0 : huber_delta / r;
+    }
+
+    double huber_cost(double r)
+    {
+        return r <= huber_delta ? 0.5 * r * r
+                                : huber_delta * (r - 0.5 * huber_delta);
+    }
+
+    double pose_cost(
+        const std::vector<cv::Point3d>& points,
+        const std::vector<cv::Point2d>& pixels,
+        const cv::Matx33d& K,
+        const cv::Matx33d& R,
+        const cv::Vec3d& t,
+        double& mean_error)
+    {
+        double cost = 0.0;
+        mean_error = 0.0;
+        int count = 0;
+
+        for (int i = 0; i < points.size(); ++i)
+        {
+            const cv::Point3d& p = points[i];
+            cv::Vec3d Xc = R * cv::Vec3d(p.x, p.y, p.z) + t;
+            if (Xc(2) <= 0.0)
+            {
+                // Charged, or a step that puts points behind the camera
+                // would look like one that fits them
+                cost += huber_cost(1e6);
+                continue;
+            }
+
+            double u = K(0, 0) * Xc(0) / Xc(2) + K(0, 2);
+            double v = K(1, 1) * Xc(1) / Xc(2) + K(1, 2);
+            double r = std::sqrt((u - pixels[i].x) * (u - pixels[i].x) +
+                                 (v - pixels[i].y) * (v - pixels[i].y));
+
+            cost += huber_cost(r);
+            mean_error += r;
+            ++count;
+        }
+
+        mean_error /= std::max(count, 1);
+        return cost;
+    }
+
+    double point_cost(
+        const cv::Matx34d* const* projections,
+        const cv::Point2d* const* pixels,
+        int n,
+        const cv::Vec4d& X,
+        double& mean_error)
+    {
+        double cost = 0.0;
+        mean_error = 0.0;
+
+        for (int i = 0; i < n; ++i)
+        {
+            const cv::Matx34d& P = *projections[i];
+            double w = P(2, 0) * X(0) + P(2, 1) * X(1) + P(2, 2) * X(2) + P(2, 3);
+            if (w <= 0.0)
+            {
+                cost += huber_cost(1e6);
+                continue;
+            }
+
+            double u = (P(0, 0) * X(0) + P(0, 1) * X(1) + P(0, 2) * X(2) + P(0, 3)) / w;
+            double v = (P(1, 0) * X(0) + P(1, 1) * X(1) + P(1, 2) * X(2) + P(1, 3)) / w;
+            double r = std::sqrt((u - pixels[i]->x) * (u - pixels[i]->x) +
+                                 (v - pixels[i]->y) * (v - pixels[i]->y));
+
+            cost += huber_cost(r);
+            mean_error += r;
+        }
+
+        mean_error /= std::max(n, 1);
+        return cost;
+    }
+
+    double refine_point(
+        const cv::Matx34d* const* projections,
+        const cv::Point2d* const* pixels,
+        int n,
+        cv::Point3d& point,
+        int iterations)
+    {
+        cv::Vec4d X(point.x, point.y, point.z, 1.0);
+        double mean_error;
+        double cost = point_cost(projections, pixels, n, X, mean_error);
+        double lambda = 1e-3;
+
+        for (int it = 0; it < iterations; ++it)
+        {
+            cv::Matx33d H;
+            cv::Vec3d g;
+
+            for (int i = 0; i < n; ++i)
+            {
+                const cv::Matx34d& P = *projections[i];
+                double wx = P(0, 0) * X(0) + P(0, 1) * X(1) + P(0, 2) * X(2) + P(0, 3);
+                double wy = P(1, 0) * X(0) + P(1, 1) * X(1) + P(1, 2) * X(2) + P(1, 3);
+                double w  = P(2, 0) * X(0) + P(2, 1) * X(1) + P(2, 2) * X(2) + P(2, 3);
+                if (w <= 0.0)
+                    continue;
+
+                double u = wx / w;
+                double v = wy / w;
+                cv::Vec2d e(u - pixels[i]->x, v - pixels[i]->y);
+                double weight = huber_weight(std::sqrt(e.dot(e)));
+
+                cv::Matx23d J;
+                for (int k = 0; k < 3; ++k)
+                {
+                    J(0, k) = (P(0, k) - u * P(2, k)) / w;
+                    J(1, k) = (P(1, k) - v * P(2, k)) / w;
+                }
+
+                H += weight * (J.t() * J);
+                g += weight * (J.t() * e);
+            }
+
+            for (int k = 0; k < 3; ++k)
+                H(k, k) *= 1.0 + lambda;
+
+            cv::Vec3d dx = H.solve(-g, cv::DECOMP_CHOLESKY);
+            cv::Vec4d candidate(X(0) + dx(0), X(1) + dx(1), X(2) + dx(2), 1.0);
+
+            double candidate_error;
+            double candidate_cost = point_cost(projections, pixels, n, candidate, candidate_error);
+            if (candidate_cost < cost)
+            {
+                X = candidate;
+                cost = candidate_cost;
+                mean_error = candidate_error;
+                lambda *= 0.1;
+
+                if (dx.dot(dx) < 1e-18)
+                    break;
+            }
+            else
+            {
+                lambda *= 10.0;
+            }
+        }
+
+        point = cv::Point3d(X(0), X(1), X(2));
+        return mean_error;
+    }
+
+    class PoseStep : public cv::ParallelLoopBody
+    {
+    private:
+        const std::vector<BundleAdjust::Observation>& _observations;
+        const std::vector<std::vector<int> >& _view_observations;
+        const std::vector<cv::Point3d>& _points;
+        const std::vector<unsigned char>& _fixed_views;
+        const cv::Matx33d& _K;
+        std::vector<cv::Matx33d>& _rotations;
+        std::vector<cv::Vec3d>& _translations;
+
+    public:
+        PoseStep(
+            const std::vector<BundleAdjust::Observation>& observations,
+            const std::vector<std::vector<int> >& view_observations,
+            const std::vector<cv::Point3d>& points,
+            const std::vector<unsigned char>& fixed_views,
+            const cv::Matx33d& K,
+            std::vector<cv::Matx33d>& rotations,
+            std::vector<cv::Vec3d>& translations)
+        : _observations(observations)
+        , _view_observations(view_observations)
+        , _points(points)
+        , _fixed_views(fixed_views)
+        , _K(K)
+        , _rotations(rotations)
+        , _translations(translations)
+        {}
+
+        virtual void operator()(const cv::Range& range) const
+        {
+            std::vector<cv::Point3d> points;
+            std::vector<cv::Point2d> pixels;
+
+            for (int v = range.start; v < range.end; ++v)
+            {
+                const std::vector<int>& indices = _view_observations[v];
+                if (_fixed_views[v] || indices.size() < 6)
+                    continue;
+
+                points.clear();
+                pixels.clear();
+                for (int i = 0; i < indices.size(); ++i)
+                {
+                    const BundleAdjust::Observation& o = _observations[indices[i]];
+                    points.push_back(_points[o.point]);
+                    pixels.push_back(o.pixel);
+                }
+
+                BundleAdjust::refine_pose(points, pixels, _K, _rotations[v], _translations[v], 3);
+            }
+        }
+    };
+
+    class PointStep : public cv::ParallelLoopBody
+    {
+    private:
+        const std::vector<BundleAdjust::Observation>& _observations;
+        const std::vector<std::vector<int> >& _point_observations;
+        const std::vector<cv::Matx34d>& _projections;
+        std::vector<cv::Point3d>& _points;
+        std::vector<double>& _errors;
+
+    public:
+        PointStep(
+            const std::vector<BundleAdjust::Observation>& observations,
+            const std::vector<std::vector<int> >& point_observations,
+            const std::vector<cv::Matx34d>& projections,
+            std::vector<cv::Point3d>& points,
+            std::vector<double>& errors)
+        : _observations(observations)
+        , _point_observations(point_observations)
+        , _projections(projections)
+        , _points(points)
+        , _errors(errors)
+        {}
+
+        virtual void operator()(const cv::Range& range) const
+        {
+            std::vector<const cv::Matx34d*> projections;
+            std::vector<const cv::Point2d*> pixels;
+
+            for (int p = range.start; p < range.end; ++p)
+            {
+                const std::vector<int>& indices = _point_observations[p];
+                if (indices.size() < 2)
+                    continue;
+
+                projections.clear();
+                pixels.clear();
+                for (int i = 0; i < indices.size(); ++i)
+                {
+                    const BundleAdjust::Observation& o = _observations[indices[i]];
+                    projections.push_back(&_projections[o.view]);
+                    pixels.push_back(&o.pixel);
+                }
+
+                _errors[p] = refine_point(&projections[0], &pixels[0], indices.size(), _points[p], 3);
+            }
+        }
+    };
+}
+
+namespace BundleAdjust
+{
+    double refine_pose(
+        const std::vector<cv::Point3d>& points,
+        const std::vector<cv::Point2d>& pixels,
+        const cv::Matx33d& K,
+        cv::Matx33d& rotation,
+        cv::Vec3d& translation,
+        int iterations)
+    {
+        assert(points.size() == pixels.size());
+
+        const double fx = K(0, 0);
+        const double fy = K(1, 1);
+
+        double mean_error;
+        double cost = pose_cost(points, pixels, K, rotation, translation, mean_error);
+        double lambda = 1e-3;
+
+        for (int it = 0; it < iterations; ++it)
+        {
+            cv::Matx66d H;
+            cv::Matx61d g;
+
+            for (int i = 0; i < points.size(); ++i)
+            {
+                const cv::Point3d& p = points[i];
+                cv::Vec3d RX = rotation * cv::Vec3d(p.x, p.y, p.z);
+                cv::Vec3d Xc = RX + translation;
+                if (Xc(2) <= 0.0)
+                    continue;
+
+                double iz = 1.0 / Xc(2);
+                double u = fx * Xc(0) * iz + K(0, 2);
+                double v = fy * Xc(1) * iz + K(1, 2);
+                cv::Vec2d e(u - pixels[i].x, v - pixels[i].y);
+                double weight = huber_weight(std::sqrt(e.dot(e)));
+
+                // d(u, v) / d(Xc)
+                cv::Matx23d Ju(fx * iz,     0.0, -fx * Xc(0) * iz * iz,
+                                   0.0, fy * iz, -fy * Xc(1) * iz * iz);
+
+                // d(Xc) / d(omega, t) for R <- exp(omega) * R, t <- t + dt
+                const double jx[] = {    0.0,  RX(2), -RX(1), 1.0, 0.0, 0.0,
+                                     -RX(2),    0.0,  RX(0), 0.0, 1.0, 0.0,
+                                      RX(1), -RX(0),    0.0, 0.0, 0.0, 1.0 };
+                cv::Matx36d Jx(jx);
+
+                cv::Matx26d J = Ju * Jx;
+                H += weight * (J.t() * J);
+                g += weight * (J.t() * cv::Matx21d(e(0), e(1)));
+            }
+
+            for (int k = 0; k < 6; ++k)
+                H(k, k) *= 1.0 + lambda;
+
+            cv::Matx61d dx = H.solve(-g, cv::DECOMP_CHOLESKY);
+
+            cv::Matx33d dR;
+            cv::Rodrigues(cv::Vec3d(dx(0), dx(1), dx(2)), dR);
+            cv::Matx33d candidate_rotation = dR * rotation;
+            cv::Vec3d candidate_translation = translation + cv::Vec3d(dx(3), dx(4), dx(5));
+
+            double candidate_error;
+            double candidate_cost = pose_cost(points, pixels, K,
+                                              candidate_rotation,
+                                              candidate_translation,
+                                              candidate_error);
+            if (candidate_cost < cost)
+            {
+                rotation = candidate_rotation;
+                translation = candidate_translation;
+                cost = candidate_cost;
+                mean_error = candidate_error;
+                lambda *= 0.1;
+
+                if (dx.dot(dx) < 1e-18)
+                    break;
+            }
+            else
+            {
+                lambda *= 10.0;
+            }
+        }
+
+        return mean_error;
+    }
+
+    double refine_point(
+        const std::vector<cv::Matx34d>& projections,
+        const std::vector<cv::Point2d>& pixels,
+        cv::Point3d& point,
+        int iterations)
+    {
+        assert(projections.size() == pixels.size());
+
+        int n = projections.size();
+        std::vector<const cv::Matx34d*> P(n);
+        std::vector<const cv::Point2d*> x(n);
+        for (int i = 0; i < n; ++i)
+        {
+            P[i] = &projections[i];
+            x[i] = &pixels[i];
+        }
+
+        if (n == 0)
+            return 0.0;
+
+        return ::refine_point(&P[0], &x[0], n, point, iterations);
+    }
+
+    double adjust(
+        const std::vector<Observation>& observations,
+        const cv::Matx33d& K,
+        std::vector<cv::Matx33d>& rotations,
+        std::vector<cv::Vec3d>& translations,
+        std::vector<cv::Point3d>& points,
+        const std::vector<unsigned char>& fixed_views,
+        int iterations)
+    {
+        assert(rotations.size() == translations.size());
+        assert(rotations.size() == fixed_views.size());
+
+        const int n_views = rotations.size();
+        const int n_points = points.size();
+
+        std::vector<std::vector<int> > view_observations(n_views);
+        std::vector<std::vector<int> > point_observations(n_points);
+        for (int i = 0; i < observations.size(); ++i)
+        {
+            view_observations[observations[i].view].push_back(i);
+            point_observations[observations[i].point].push_back(i);
+        }
+
+        std::vector<cv::Matx34d> projections(n_views);
+        std::vector<double> errors(n_points, 0.0);
+
+        for (int it = 0; it < iterations; ++it)
+        {
+            cv::parallel_for_(cv::Range(0, n_views),
+                PoseStep(observations, view_observations, points, fixed_views,
+                         K, rotations, translations));
+
+            for (int v = 0; v < n_views; ++v)
+            {
+                const cv::Matx33d& R = rotations[v];
+                const cv::Vec3d& t = translations[v];
+                projections[v] = K * cv::Matx34d(R(0, 0), R(0, 1), R(0, 2), t(0),
+                                                 R(1, 0), R(1, 1), R(1, 2), t(1),
+                                                 R(2, 0), R(2, 1), R(2, 2), t(2));
+            }
+
+            cv::parallel_for_(cv::Range(0, n_points),
+                PointStep(observations, point_observations, projections, points, errors));
+        }
+
+        double mean_error = 0.0;
+        int count = 0;
+        for (int p = 0; p < n_points; ++p)
+        {
+            mean_error += errors[p] * point_observations[p].size();
+            count += point_observations[p].size();
+        }
+
+        return mean_error / std::max(count, 1);
+    }
+}
@@ -0,0 +1,50 @@
+#ifndef __BUNDLE_ADJUST_HPP__
+#define __BUNDLE_ADJUST_HPP__
+
+#include <vector>
+#include <core.hpp>
+
+// Poses follow the MultiView convention: x_camera = R * x_world + t.
+namespace BundleAdjust
+{
+    struct Observation
+    {
+        int view;
+        int point;
+        cv::Point2d pixel;
+    };
+
+    // Levenberg-Marquardt refinement of a single camera pose while the
+    // points are held fixed. Returns the mean reprojection error (pixels).
+    double refine_pose(
+        const std::vector<cv::Point3d>& points,
+        const std::vector<cv::Point2d>& pixels,
+        const cv::Matx33d& K,
+        cv::Matx33d& rotation,
+        cv::Vec3d& translation,
+        int iterations = 10);
+
+    // Gauss-Newton refinement of a single point seen by the given
+    // pixel projection matrices (K * [R | t]).
+    double refine_point(
+        const std::vector<cv::Matx34d>& projections,
+        const std::vector<cv::Point2d>& pixels,
+        cv::Point3d& point,
+        int iterations = 5);
+
+    // Alternates between refining every pose with the points fixed and
+    // every point with the poses fixed. Each half is embarrassingly
+    // parallel, which lets a single pass run over the whole scene.
+    // Views flagged in fixed_views keep their pose (at least one must be
+    // fixed to hold the gauge). Returns the final mean reprojection error.
+    double adjust(
+        const std::vector<Observation>& observations,
+        const cv::Matx33d& K,
+        std::vector<cv::Matx33d>& rotations,
+        std::vector<cv::Vec3d>& translations,
+        std::vector<cv::Point3d>& points,
+        const std::vector<unsigned char>& fixed_views,
+        int iterations = 5);
+}
+
+#endif
\ No newline at end of file
@@ -1,45 +1,248 @@
 #include "Camera.hpp"
 
+#include <calib3d.hpp>
+#include <imgproc.hpp>
 #include <string>
+#include <cstdio>
+#include <cstring>
 #include <assert.h>
 
+namespace
+{
+    const int grid_cells = 32;
+    const int grid_steps = 2;
+
+    // Binary calibration layout, all fields in host byte order:
+    //   char[4] magic, int32 version, int32 width, int32 height, int32 model,
+    //   double[9] camera matrix, int32 n, double[n] distortion,
+    //   int32 has_maps, then if set the CV_16SC2 and CV_16UC1 maps for
+    //   width x height, row by row.
+    const char binary_magic[4] = { 'C', 'A', 'L', 'B' };
+    const int  binary_version  = 1;
+
+    bool read_ints(FILE* file, int* values, int n)
+    {
+        return fread(values, sizeof(int), n, file) == n;
+    }
+
+    bool read_mat(FILE* file, cv::Mat& mat, int rows, int cols, int type)
+    {
+        mat.create(rows, cols, type);
+        const size_t row_size = cols * mat.elemSize();
+        for (int i = 0; i < rows; ++i)
+        {
+            if (fread(mat.ptr(i), 1, row_size, file) != row_size)
+                return false;
+        }
+        return true;
+    }
+
+    bool write_mat(FILE* file, const cv::Mat& mat)
+    {
+        const size_t row_size = mat.cols * mat.elemSize();
+        for (int i = 0; i < mat.rows; ++i)
+        {
+            if (fwrite(mat.ptr(i), 1, row_size, file) != row_size)
+                return false;
+        }
+        return true;
+    }
+}
+
 Camera::Camera(const std::string& calibration_data_path)
 {
-    cv::FileStorage fs(calibration_data_path, cv::FileStorage::READ);
+    if (!load_binary(calibration_data_path))
+        load_xml(calibration_data_path);
+}
 
-    int camera_width, camera_height;
+void Camera::load_xml(const std::string& path)
+{
+    cv::FileStorage fs(path, cv::FileStorage::READ);
+
+    int camera_width = 0, camera_height = 0, fisheye = 0;
     fs["image_width"]             >> camera_width;
     fs["image_height"]            >> camera_height;
     fs["camera_matrix"]           >> this->_matrix;
     fs["distortion_coefficients"] >> this->_distortion;
+    fs["fisheye_model"]           >> fisheye;
 
-    _inverse = _matrix.inv();
-    
     fs.release();
 
     assert(camera_width != 0 && camera_height != 0);
 
     this->_resolution = cv::Size(camera_width, camera_height);
+    this->_model = fisheye ? FISHEYE : RADIAL_TANGENTIAL;
+
+    update();
+}
+
+bool Camera::load_binary(const std::string& path)
+{
+    FILE* file = fopen(path.c_str(), "rb");
+    if (!file)
+        return false;
+
+    char magic[4];
+    if (fread(magic, 1, 4, file) != 4 || memcmp(magic, binary_magic, 4) != 0)
+    {
+        fclose(file);
+        return false;
+    }
+
+    // From here on it is a blob, so a short read or a field out of range
+    // is corrupt data
+    int header[4], count, has_maps;
+    bool ok = read_ints(file, header, 4) && header[0] == binary_version
+           && header[1] > 0 && header[2] > 0
+           && header[3] >= PINHOLE && header[3] <= FISHEYE;
+
+    _matrix.create(3, 3, CV_64F);
+    ok = ok && fread(_matrix.ptr<double>(), sizeof(double), 9, file) == 9;
+    ok = ok && read_ints(file, &count, 1) && count >= 0 && count <= 14;
+    if (ok)
+    {
+        _distortion.create(count, 1, CV_64F);
+        ok = count == 0 || fread(_distortion.ptr<double>(), sizeof(double), count, file) == count;
+    }
+    ok = ok && read_ints(file, &has_maps, 1);
+
+    cv::Mat map1, map2;
+    if (ok && has_maps)
+    {
+        ok = read_mat(file, map1, header[2], header[1], CV_16SC2)
+          && read_mat(file, map2, header[2], header[1], CV_16UC1);
+    }
+    fclose(file);
+
+    // Not to be handed on to the XML reader, which would choke on it
+    if (!ok)
+        CV_Error(cv::Error::StsParseError, "Corrupt calibration file " + path);
+
+    _resolution = cv::Size(header[1], header[2]);
+    _model = (Model) header[3];
+    update();
+
+    _map1 = map1;
+    _map2 = map2;
+
+    return true;
+}
+
+bool Camera::save(const std::string& path, bool with_maps) const
+{
+    FILE* file = fopen(path.c_str(), "wb");
+    if (!file)
+    {
+        printf("Could not open %s for writing\n", path.c_str());
+        return false;
+    }
+
+    cv::Mat matrix, distortion;
+    _matrix.convertTo(matrix, CV_64F);
+    _distortion.reshape(1, _distortion.total()).convertTo(distortion, CV_64F);
+
+    const int header[4] = { binary_version, _resolution.width, _resolution.height, (int) _model };
+    const int count = distortion.total();
+    const int has_maps = with_maps && _model != PINHOLE;
+
+    bool ok = fwrite(binary_magic, 1, 4, file) == 4
+           && fwrite(header, sizeof(int), 4, file) == 4
+           && fwrite(matrix.ptr<double>(), sizeof(double), 9, file) == 9
+           && fwrite(&count, sizeof(int), 1, file) == 1
+           && (count == 0 || fwrite(distortion.ptr<double>(), sizeof(double), count, file) == count)
+           && fwrite(&has_maps, sizeof(int), 1, file) == 1;
+
+    if (ok && has_maps)
+    {
+        cv::Mat map1, map2;
+        undistort_maps(_resolution, map1, map2);
+        ok = write_mat(file, map1) && write_mat(file, map2);
+    }
+
+    fclose(file);
+    return ok;
+}
+
+Camera::Camera(cv::Mat camera_matrix, cv::Mat distortion, const cv::Size& resolution, Model model)
+: _matrix(camera_matrix.clone())
+, _distortion(distortion.clone())
+, _resolution(resolution)
+, _model(model)
+{
+    assert(resolution.width != 0 && resolution.height != 0);
+    update();
+}
+
+Camera::Camera(const Camera& calibrated, const cv::Size& resolution)
+: _matrix(calibrated._matrix.clone())
+, _distortion(calibrated._distortion)
+, _resolution(resolution)
+, _model(calibrated._model)
+{
+    assert(resolution.width != 0 && resolution.height != 0);
+
+    double width_ratio = ((double) resolution.width) / calibrated._resolution.width;
+    double height_ratio = ((double) resolution.height) / calibrated._resolution.height;
+
+    _matrix.at<double>(0, 0) *= width_ratio;
+    _matrix.at<double>(1, 1) *= height_ratio;
+    _matrix.at<double>(0, 2)  = resolution.width * 0.5;
+    _matrix.at<double>(1, 2)  = resolution.height * 0.5;
+
+    update();
 }
 
-Camera::Camera(cv::Mat camera_matrix, cv::Mat distortion)
-: _matrix(camera_matrix)
-, _distortion(distortion)
-{}
+// Derives everything else from the matrix and distortion, once per
+// construction
+void Camera::update()
+{
+    _inverse = _matrix.inv();
+
+    _intrinsics.fx = _matrix.at<double>(0, 0);
+    _intrinsics.fy = _matrix.at<double>(1, 1);
+    _intrinsics.cx = _matrix.at<double>(0, 2);
+    _intrinsics.cy = _matrix.at<double>(1, 2);
+
+    // OpenCV's rational, thin prism and tilted models go up to 14
+    // coefficients; the ones past what the model uses have to be zero
+    const int used = _model == FISHEYE ? 4 : 5;
+    bool distorted = false;
+    for (int i = 0; i < _distortion.total(); ++i)
+    {
+        const double k = _distortion.at<double>(i);
+        if (i >= used && k != 0.0)
+            CV_Error(cv::Error::StsBadArg, "Distortion coefficients the camera model can't use");
+        distorted = distorted || k != 0.0;
+    }
+
+    for (int i = 0; i < 5; ++i)
+    {
+        _intrinsics.k[i] = i < used && i < _distortion.total() ? _distortion.at<double>(i) : 0.0;
+    }
+
+    // Nothing to undo, skip the Newton steps
+    if (!distorted)
+        _model = PINHOLE;
+
+    if (_model == FISHEYE)
+        CameraModel::Camera<CameraModel::Fisheye>(_intrinsics).build(_resolution, grid_cells, _grid);
+    else if (_model == RADIAL_TANGENTIAL)
+        CameraModel::Camera<CameraModel::RadialTangential>(_intrinsics).build(_resolution, grid_cells, _grid);
+}
 
 cv::Mat Camera::matrix() const
 {
-    return _matrix;
+    return _matrix.clone();
 }
 
 cv::Mat Camera::inverse() const
 {
-    return _inverse;
+    return _inverse.clone();
 }
 
 cv::Mat Camera::distortion() const
 {
-    return _distortion;
+    return _distortion.clone();
 }
 
 cv::Size Camera::resolution() const
@@ -47,34 +250,164 @@ cv::Size Camera::resolution() const
     return _resolution;
 }
 
-void Camera::resize(const cv::Size& new_res)
+Camera::Model Camera::model() const
 {
-    assert(new_res.width != 0 && new_res.height != 0);
+    return _model;
+}
 
-    double width_ratio = ((double) new_res.width) / _resolution.width;
-    double height_ratio = ((double) new_res.height) / _resolution.height;
+const CameraModel::Intrinsics& Camera::intrinsics() const
+{
+    return _intrinsics;
+}
 
-    _matrix.at<double>(0, 0) *= width_ratio;
-    _matrix.at<double>(1, 1) *= height_ratio;
-    _matrix.at<double>(0, 2)  = new_res.width * 0.5;
-    _matrix.at<double>(1, 2)  = new_res.height * 0.5;
+const Camera& Camera::at_resolution(const cv::Size& resolution) const
+{
+    if (resolution == _resolution)
+        return *this;
 
-    _resolution = new_res;
-    _inverse = _matrix.inv();
+    cv::AutoLock lock(_mutex);
+
+    for (int i = 0; i < _instances.size(); ++i)
+    {
+        if (_instances[i]->_resolution == resolution)
+            return *_instances[i];
+    }
+
+    _instances.push_back(cv::Ptr<Camera>(new Camera(*this, resolution)));
+    return *_instances.back();
+}
+
+cv::Point2d Camera::project(const cv::Point3d& p) const
+{
+    switch (_model)
+    {
+    case FISHEYE:
+        return CameraModel::Camera<CameraModel::Fisheye>(_intrinsics).project(p);
+    case RADIAL_TANGENTIAL:
+        return CameraModel::Camera<CameraModel::RadialTangential>(_intrinsics).project(p);
+    default:
+        return CameraModel::Camera<CameraModel::Pinhole>(_intrinsics).project(p);
+    }
+}
+
+cv::Point3d Camera::normalize(const cv::Point2d& p) const
+{
+    cv::Point2d x;
+    switch (_model)
+    {
+    case FISHEYE:
+        x = CameraModel::Camera<CameraModel::Fisheye>(_intrinsics).unproject(p);
+        break;
+    case RADIAL_TANGENTIAL:
+        x = CameraModel::Camera<CameraModel::RadialTangential>(_intrinsics).unproject(p);
+        break;
+    default:
+        x = CameraModel::Camera<CameraModel::Pinhole>(_intrinsics).unproject(p);
+        break;
+    }
+
+    return cv::Point3d(x.x, x.y, 1.0);
 }
 
-// Assume projection is identity
-cv::Point3d Camera::project(const cv::Point3d p) const
+void Camera::project(const std::vector<cv::Point3d>& points, std::vector<cv::Point2d>& pixels) const
 {
-    cv::Mat_<double> projection = _matrix * (cv::Mat_<double>(3, 1) << p.x, p.y, p.z);
+    pixels.resize(points.size());
+    if (points.empty())
+        return;
 
-    return cv::Point3d(projection(0), projection(1), projection(2));
+    switch (_model)
+    {
+    case FISHEYE:
+        CameraModel::Camera<CameraModel::Fisheye>(_intrinsics).project(&points[0], points.size(), &pixels[0]);
+        break;
+    case RADIAL_TANGENTIAL:
+        CameraModel::Camera<CameraModel::RadialTangential>(_intrinsics).project(&points[0], points.size(), &pixels[0]);
+        break;
+    default:
+        CameraModel::Camera<CameraModel::Pinhole>(_intrinsics).project(&points[0], points.size(), &pixels[0]);
+        break;
+    }
 }
 
-cv::Point3d Camera::normalize(const cv::Point2d p) const
+template<typename T>
+void Camera::normalize_points(const std::vector<cv::Point_<T> >& pixels, std::vector<cv::Point2d>& normalized) const
 {
-    cv::Mat_<double> normalization = _inverse * (cv::Mat_<double>(3, 1) << p.x, p.y, 1.0);
+    normalized.resize(pixels.size());
+    if (pixels.empty())
+        return;
 
-    return cv::Point3d(normalization(0), normalization(1), normalization(2));
+    switch (_model)
+    {
+    case FISHEYE:
+        CameraModel::Camera<CameraModel::Fisheye>(_intrinsics).unproject(
+            &pixels[0], pixels.size(), _grid, &normalized[0], grid_steps);
+        break;
+    case RADIAL_TANGENTIAL:
+        CameraModel::Camera<CameraModel::RadialTangential>(_intrinsics).unproject(
+            &pixels[0], pixels.size(), _grid, &normalized[0], grid_steps);
+        break;
+    default:
+        for (int i = 0; i < pixels.size(); ++i)
+        {
+            normalized[i] = cv::Point2d(
+                (pixels[i].x - _intrinsics.cx) / _intrinsics.fx,
+                (pixels[i].y - _intrinsics.cy) / _intrinsics.fy);
+        }
+        break;
+    }
+}
+
+void Camera::normalize(const std::vector<cv::Point2d>& pixels, std::vector<cv::Point2d>& normalized) const
+{
+    normalize_points(pixels, normalized);
 }
 
+void Camera::normalize(const std::vector<cv::Point2f>& pixels, std::vector<cv::Point2d>& normalized) const
+{
+    normalize_points(pixels, normalized);
+}
+
+void Camera::undistort(const std::vector<cv::Point2d>& pixels, std::vector<cv::Point2d>& undistorted) const
+{
+    normalize_points(pixels, undistorted);
+    for (int i = 0; i < undistorted.size(); ++i)
+    {
+        undistorted[i].x = _intrinsics.fx * undistorted[i].x + _intrinsics.cx;
+        undistorted[i].y = _intrinsics.fy * undistorted[i].y + _intrinsics.cy;
+    }
+}
+
+void Camera::undistort_maps(const cv::Size& size, cv::Mat& map1, cv::Mat& map2) const
+{
+    if (size != _resolution)
+    {
+        at_resolution(size).undistort_maps(size, map1, map2);
+        return;
+    }
+
+    cv::AutoLock lock(_mutex);
+
+    if (_map1.empty())
+    {
+        if (_model == FISHEYE)
+            cv::fisheye::initUndistortRectifyMap(_matrix, _distortion, cv::Matx33d::eye(), _matrix, size, CV_16SC2, _map1, _map2);
+        else
+            cv::initUndistortRectifyMap(_matrix, _distortion, cv::Mat(), _matrix, size, CV_16SC2, _map1, _map2);
+    }
+
+    map1 = _map1;
+    map2 = _map2;
+}
+
+void Camera::undistort(const cv::Mat& image, cv::Mat& undistorted) const
+{
+    if (_model == PINHOLE)
+    {
+        image.copyTo(undistorted);
+        return;
+    }
+
+    cv::Mat map1, map2;
+    undistort_maps(image.size(), map1, map2);
+    cv::remap(image, undistorted, map1, map2, cv::INTER_LINEAR, cv::BORDER_CONSTANT);
+}
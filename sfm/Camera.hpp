@@ -1,30 +1,116 @@
-
 #ifndef __CAMERA_HPP__
 #define __CAMERA_HPP__
 
+#include <vector>
 #include <core.hpp>
 
+#include "CameraModel.hpp"
+
+// Calibrated camera whose lens model is picked at run time from the
+// calibration data. project and normalize dispatch once per call (or once
+// per batch) to the matching CameraModel::Camera<Model>.
+//
+// A Camera never changes after construction. Other image sizes get their
+// own instances from at_resolution, which can be shared between threads.
 class Camera
 {
+public:
+    enum Model
+    {
+        PINHOLE,
+        RADIAL_TANGENTIAL,
+        FISHEYE
+    };
+
 private:
     cv::Mat  _matrix;
     cv::Mat  _inverse;
     cv::Mat  _distortion;
     cv::Size _resolution;
+    Model    _model;
+
+    CameraModel::Intrinsics _intrinsics;
+
+    // Starting guesses for sparse undistortion, over the full resolution
+    CameraModel::InverseGrid _grid;
+
+    // Fixed-point remap tables (CV_16SC2 source coordinates and CV_16UC1
+    // interpolation indices), built on first use
+    mutable cv::Mat _map1, _map2;
+
+    // Instances handed out by at_resolution
+    mutable std::vector<cv::Ptr<Camera> > _instances;
+    mutable cv::Mutex _mutex;
+
+    // Scaled copy of calibrated for another image size
+    Camera(const Camera& calibrated, const cv::Size& resolution);
+
+    void update();
+
+    // False if the file isn't a binary calibration blob; throws if it is
+    // one but corrupt
+    bool load_binary(const std::string& path);
+    void load_xml(const std::string& path);
+
+    template<typename T>
+    void normalize_points(const std::vector<cv::Point_<T> >& pixels, std::vector<cv::Point2d>& normalized) const;
 
 public:
+    // Reads either the calibration tool's XML output or a binary blob
+    // written by save, whichever the file holds. A corrupt blob throws
+    // cv::Exception.
     Camera(const std::string& calibration_data_path);
-    Camera(cv::Mat camera_matrix, cv::Mat distortion);
 
+    // resolution is the size of the images camera_matrix was calibrated
+    // for. Throws cv::Exception if distortion has nonzero coefficients
+    // past the ones model uses (5 for RADIAL_TANGENTIAL, 4 for FISHEYE).
+    Camera(cv::Mat camera_matrix, cv::Mat distortion, const cv::Size& resolution, Model model = RADIAL_TANGENTIAL);
+
+    // Writes the calibration as a compact binary blob: resolution, model,
+    // camera matrix and distortion, plus the undistortion maps for the
+    // calibrated resolution if with_maps is set. Returns false on failure.
+    bool save(const std::string& path, bool with_maps = false) const;
+
+    // Copies, so the camera stays immutable
     cv::Mat      matrix() const;
     cv::Mat     inverse() const;
     cv::Mat  distortion() const;
     cv::Size resolution() const;
+    Model         model() const;
+
+    const CameraModel::Intrinsics& intrinsics() const;
+
+    // The same camera for images of another size: focal lengths scaled,
+    // principal point at the center. Built once per size and kept for the
+    // lifetime of this camera, so the reference can be shared freely.
+    const Camera& at_resolution(const cv::Size& resolution) const;
+
+    // Camera frame point to (distorted) pixel
+    cv::Point2d project(const cv::Point3d& p) const;
+
+    // Pixel to undistorted normalized coordinates, with z = 1
+    cv::Point3d normalize(const cv::Point2d& p) const;
+
+    void project(const std::vector<cv::Point3d>& points, std::vector<cv::Point2d>& pixels) const;
+
+    // Sparse undistortion of keypoints: a bilinear lookup in a coarse
+    // inverse distortion grid followed by two Newton steps. The output is
+    // normalized coordinates, as Pose and MultiView's triangulation take.
+    void normalize(const std::vector<cv::Point2d>& pixels, std::vector<cv::Point2d>& normalized) const;
+    void normalize(const std::vector<cv::Point2f>& pixels, std::vector<cv::Point2d>& normalized) const;
+
+    // Same, mapped back through the camera matrix: the pixels an ideal
+    // pinhole camera would have seen, for the pixel-based MultiView calls.
+    void undistort(const std::vector<cv::Point2d>& pixels, std::vector<cv::Point2d>& undistorted) const;
 
-    void resize(const cv::Size& new_res);
+    // Undistortion tables for images of the given size (those of
+    // at_resolution(size)), built once and shared afterwards. The
+    // undistorted image keeps the same camera matrix.
+    void undistort_maps(const cv::Size& size, cv::Mat& map1, cv::Mat& map2) const;
 
-    cv::Point3d project(const cv::Point3d p) const;
-    cv::Point3d normalize(const cv::Point2d p) const;
+    // One bilinear remap pass through the cached tables. cv::remap splits
+    // the rows over threads and has SIMD paths for the fixed-point maps.
+    void undistort(const cv::Mat& image, cv::Mat& undistorted) const;
 };
 
 #endif
@@ -0,0 +1,272 @@
+#ifndef __CAMERA_MODEL_HPP__
+#define __CAMERA_MODEL_HPP__
+
+#include <cmath>
+#include <vector>
+#include <algorithm>
+#include <core.hpp>
+
+// Compile-time camera models. Each model maps normalized coordinates
+// (x/z, y/z) to distorted normalized coordinates and back, inline and
+// without data-dependent branches, so the batch loops vectorize. Inverse
+// distortion runs a fixed number of Newton steps from the distorted point.
+//
+// Coefficients follow OpenCV's order: k1 k2 p1 p2 k3 for the
+// radial-tangential model, k1 k2 k3 k4 for the fisheye model.
+namespace CameraModel
+{
+    struct Intrinsics
+    {
+        double fx, fy, cx, cy; // skew is assumed to be zero
+        double k[5];
+    };
+
+    struct Pinhole
+    {
+        static cv::Point2d distort(const cv::Point2d& x, const double*)
+        {
+            return x;
+        }
+
+        static cv::Point2d step(const cv::Point2d&, const cv::Point2d& xd, const double*)
+        {
+            return xd;
+        }
+
+        static cv::Point2d undistort(const cv::Point2d& x, const double*)
+        {
+            return x;
+        }
+    };
+
+    // Brown-Conrady radial (k1 k2 k3) and tangential (p1 p2) distortion
+    struct RadialTangential
+    {
+        enum { iterations = 5 };
+
+        static cv::Point2d distort(const cv::Point2d& x, const double* k)
+        {
+            const double xy = x.x * x.y;
+            const double r2 = x.x * x.x + x.y * x.y;
+            const double radial = 1.0 + r2 * (k[0] + r2 * (k[1] + r2 * k[4]));
+
+            return cv::Point2d(
+                x.x * radial + 2.0 * k[2] * xy + k[3] * (r2 + 2.0 * x.x * x.x),
+                x.y * radial + k[2] * (r2 + 2.0 * x.y * x.y) + 2.0 * k[3] * xy);
+        }
+
+        // One Newton step on distort(x) = xd
+        static cv::Point2d step(const cv::Point2d& x, const cv::Point2d& xd, const double* k)
+        {
+            const double r2 = x.x * x.x + x.y * x.y;
+            const double radial = 1.0 + r2 * (k[0] + r2 * (k[1] + r2 * k[4]));
+            const double dradial = k[0] + r2 * (2.0 * k[1] + 3.0 * r2 * k[4]);
+
+            const cv::Point2d e = distort(x, k) - xd;
+
+            // Jacobian of distort at x
+            const double a = radial + 2.0 * x.x * x.x * dradial + 2.0 * k[2] * x.y + 6.0 * k[3] * x.x;
+            const double b = 2.0 * x.x * x.y * dradial + 2.0 * k[2] * x.x + 2.0 * k[3] * x.y;
+            const double d = radial + 2.0 * x.y * x.y * dradial + 6.0 * k[2] * x.y + 2.0 * k[3] * x.x;
+
+            const double inv_det = 1.0 / (a * d - b * b);
+            return cv::Point2d(
+                x.x - (d * e.x - b * e.y) * inv_det,
+                x.y - (a * e.y - b * e.x) * inv_det);
+        }
+
+        static cv::Point2d undistort(const cv::Point2d& xd, const double* k)
+        {
+            cv::Point2d x = xd;
+            for (int it = 0; it < iterations; ++it)
+            {
+                x = step(x, xd, k);
+            }
+            return x;
+        }
+    };
+
+    // Equidistant fisheye: theta_d = theta (1 + k1 theta^2 + ... + k4 theta^8)
+    struct Fisheye
+    {
+        enum { iterations = 5 };
+
+        static cv::Point2d distort(const cv::Point2d& x, const double* k)
+        {
+            // atan(r) / r tends to 1, so a tiny r gives the right limit
+            const double r = std::max(std::sqrt(x.x * x.x + x.y * x.y), 1e-12);
+            const double theta = std::atan(r);
+            const double t2 = theta * theta;
+            const double theta_d = theta * (1.0 + t2 * (k[0] + t2 * (k[1] + t2 * (k[2] + t2 * k[3]))));
+
+            const double scale = theta_d / r;
+            return cv::Point2d(x.x * scale, x.y * scale);
+        }
+
+        // One Newton step on theta_d(theta) for the radius of xd, from the
+        // angle of x
+        static cv::Point2d step(const cv::Point2d& x, const cv::Point2d& xd, const double* k)
+        {
+            const double theta_d = std::max(std::sqrt(xd.x * xd.x + xd.y * xd.y), 1e-12);
+            const double theta = newton(std::atan(std::sqrt(x.x * x.x + x.y * x.y)), theta_d, k);
+
+            const double scale = std::tan(theta) / theta_d;
+            return cv::Point2d(xd.x * scale, xd.y * scale);
+        }
+
+        static cv::Point2d undistort(const cv::Point2d& xd, const double* k)
+        {
+            const double theta_d = std::max(std::sqrt(xd.x * xd.x + xd.y * xd.y), 1e-12);
+
+            double theta = theta_d;
+            for (int it = 0; it < iterations; ++it)
+            {
+                theta = newton(theta, theta_d, k);
+            }
+
+            const double scale = std::tan(theta) / theta_d;
+            return cv::Point2d(xd.x * scale, xd.y * scale);
+        }
+
+    private:
+        static double newton(double theta, double theta_d, const double* k)
+        {
+            const double t2 = theta * theta;
+            const double f = theta * (1.0 + t2 * (k[0] + t2 * (k[1] + t2 * (k[2] + t2 * k[3])))) - theta_d;
+            const double df = 1.0 + t2 * (3.0 * k[0] + t2 * (5.0 * k[1] + t2 * (7.0 * k[2] + t2 * 9.0 * k[3])));
+            return theta - f / df;
+        }
+    };
+
+    // Undistorted normalized coordinates sampled on a regular grid over
+    // distorted normalized coordinates. A bilinear lookup lands close
+    // enough for one or two Newton steps to converge.
+    struct InverseGrid
+    {
+        double x0, y0;                 // distorted coordinates of node (0, 0)
+        double inv_step_x, inv_step_y;
+        int cols, rows;                // nodes
+        std::vector<cv::Point2d> nodes;
+
+        // Points outside the grid are clamped onto its border
+        cv::Point2d lookup(const cv::Point2d& xd) const
+        {
+            const double gx = std::min(std::max((xd.x - x0) * inv_step_x, 0.0), cols - 1.001);
+            const double gy = std::min(std::max((xd.y - y0) * inv_step_y, 0.0), rows - 1.001);
+            const int ix = (int) gx, iy = (int) gy;
+            const double fx = gx - ix, fy = gy - iy;
+
+            const cv::Point2d* n = &nodes[iy * cols + ix];
+            return (n[0] * (1.0 - fx) + n[1] * fx) * (1.0 - fy)
+                 + (n[cols] * (1.0 - fx) + n[cols + 1] * fx) * fy;
+        }
+    };
+
+    template<typename Model>
+    class Camera
+    {
+    private:
+        Intrinsics _intrinsics;
+
+    public:
+        explicit Camera(const Intrinsics& intrinsics)
+        : _intrinsics(intrinsics)
+        {}
+
+        const Intrinsics& intrinsics() const
+        {
+            return _intrinsics;
+        }
+
+        // Camera frame point to pixel
+        cv::Point2d project(const cv::Point3d& p) const
+        {
+            const Intrinsics& c = _intrinsics;
+            const double iz = 1.0 / p.z;
+            const cv::Point2d x = Model::distort(cv::Point2d(p.x * iz, p.y * iz), c.k);
+
+            return cv::Point2d(c.fx * x.x + c.cx, c.fy * x.y + c.cy);
+        }
+
+        // Pixel to undistorted normalized coordinates (on the z = 1 plane)
+        cv::Point2d unproject(const cv::Point2d& pixel) const
+        {
+            const Intrinsics& c = _intrinsics;
+            const cv::Point2d x((pixel.x - c.cx) / c.fx, (pixel.y - c.cy) / c.fy);
+
+            return Model::undistort(x, c.k);
+        }
+
+        // Same, starting from the grid and taking steps Newton steps
+        cv::Point2d unproject(const cv::Point2d& pixel, const InverseGrid& grid, int steps) const
+        {
+            const Intrinsics& c = _intrinsics;
+            const cv::Point2d xd((pixel.x - c.cx) / c.fx, (pixel.y - c.cy) / c.fy);
+
+            cv::Point2d x = grid.lookup(xd);
+            for (int it = 0; it < steps; ++it)
+            {
+                x = Model::step(x, xd, c.k);
+            }
+            return x;
+        }
+
+        // Samples the inverse distortion over an image of the given size
+        // (plus a cell of margin) with cells x cells cells.
+        void build(const cv::Size& size, int cells, InverseGrid& grid) const
+        {
+            const Intrinsics& c = _intrinsics;
+            const double step_x = size.width / (c.fx * cells);
+            const double step_y = size.height / (c.fy * cells);
+
+            grid.cols = cells + 3;
+            grid.rows = cells + 3;
+            grid.x0 = -c.cx / c.fx - step_x;
+            grid.y0 = -c.cy / c.fy - step_y;
+            grid.inv_step_x = 1.0 / step_x;
+            grid.inv_step_y = 1.0 / step_y;
+
+            grid.nodes.resize(grid.cols * grid.rows);
+            for (int i = 0; i < grid.rows; ++i)
+            {
+                for (int j = 0; j < grid.cols; ++j)
+                {
+                    const cv::Point2d xd(grid.x0 + j * step_x, grid.y0 + i * step_y);
+                    grid.nodes[i * grid.cols + j] = Model::undistort(xd, c.k);
+                }
+            }
+        }
+
+        void project(const cv::Point3d* points, int n, cv::Point2d* pixels) const
+        {
+            for (int i = 0; i < n; ++i)
+            {
+                pixels[i] = project(points[i]);
+            }
+        }
+
+        void unproject(const cv::Point2d* pixels, int n, cv::Point2d* normalized) const
+        {
+            for (int i = 0; i < n; ++i)
+            {
+                normalized[i] = unproject(pixels[i]);
+            }
+        }
+
+        template<typename T>
+        void unproject(
+            const cv::Point_<T>* pixels,
+            int n,
+            const InverseGrid& grid,
+            cv::Point2d* normalized,
+            int steps = 2) const
+        {
+            for (int i = 0; i < n; ++i)
+            {
+                normalized[i] = unproject(cv::Point2d(pixels[i].x, pixels[i].y), grid, steps);
+            }
+        }
+    };
+}
+
+#endif
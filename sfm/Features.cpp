@@ -1,22 +1,160 @@
 #include "Features.hpp"
+#include "Pyramid.hpp"
 
 #include <core.hpp>
+#include <video.hpp>
 #include <xfeatures2d.hpp>
 
+#include <cassert>
+#include <cmath>
+
+namespace
+{
+    // Flow tiles and the context solved around each, so flow near a tile
+    // edge sees the same neighbourhood it would over the whole image
+    const int tile_size   = 256;
+    const int tile_margin = 32;
+
+    // Grid spacing of the sampled correspondences and the largest round
+    // trip error (pixels) they may have
+    const int   grid_step      = 8;
+    const float max_round_trip = 1.0f;
+
+    // Farneback settings
+    const double pyramid_scale = 0.5;
+    const int    levels        = 3;
+    const int    window_size   = 15;
+    const int    iterations    = 3;
+    const int    poly_n        = 5;
+    const double poly_sigma    = 1.1;
+
+    // Place recognition features
+    const int orb_fast_threshold = 20;
+    const int orb_patch_size     = 31;
+
+    struct FlowSample
+    {
+        cv::Point2f from, to;
+        float error;
+    };
+
+    class FlowBody : public cv::ParallelLoopBody
+    {
+    private:
+        const cv::Mat& _gray1;
+        const cv::Mat& _gray2;
+        const std::vector<cv::Rect>& _tiles;
+        std::vector<std::vector<FlowSample> >& _samples;
+
+    public:
+        FlowBody(
+            const cv::Mat& gray1,
+            const cv::Mat& gray2,
+            const std::vector<cv::Rect>& tiles,
+            std::vector<std::vector<FlowSample> >& samples)
+        : _gray1(gray1)
+        , _gray2(gray2)
+        , _tiles(tiles)
+        , _samples(samples)
+        {}
+
+        virtual void operator()(const cv::Range& range) const
+        {
+            const cv::Rect image(0, 0, _gray1.cols, _gray1.rows);
+
+            for (int t = range.start; t < range.end; ++t)
+            {
+                const cv::Rect& tile = _tiles[t];
+                const cv::Rect window = image & cv::Rect(
+                    tile.x - tile_margin,
+                    tile.y - tile_margin,
+                    tile.width + 2 * tile_margin,
+                    tile.height + 2 * tile_margin);
+
+                cv::Mat forward, backward;
+                cv::calcOpticalFlowFarneback(_gray1(window), _gray2(window), forward,
+                    pyramid_scale, levels, window_size, iterations, poly_n, poly_sigma, 0);
+                cv::calcOpticalFlowFarneback(_gray2(window), _gray1(window), backward,
+                    pyramid_scale, levels, window_size, iterations, poly_n, poly_sigma, 0);
+
+                std::vector<FlowSample>& samples = _samples[t];
+                samples.clear();
+
+                // Grid points at the centers of grid_step cells
+                for (int y = tile.y + grid_step / 2; y < tile.y + tile.height; y += grid_step)
+                {
+                    const cv::Point2f* row = forward.ptr<cv::Point2f>(y - window.y);
+                    for (int x = tile.x + grid_step / 2; x < tile.x + tile.width; x += grid_step)
+                    {
+                        const cv::Point2f f = row[x - window.x];
+                        const cv::Point2f to(x + f.x, y + f.y);
+
+                        const int u = cvRound(to.x) - window.x;
+                        const int v = cvRound(to.y) - window.y;
+                        if (u < 0 || v < 0 || u >= window.width || v >= window.height)
+                            continue;
+
+                        const cv::Point2f b = backward.ptr<cv::Point2f>(v)[u];
+                        const float error = std::sqrt((f.x + b.x) * (f.x + b.x) + (f.y + b.y) * (f.y + b.y));
+                        if (error <= max_round_trip)
+                        {
+                            FlowSample sample = { cv::Point2f(x, y), to, error };
+                            samples.push_back(sample);
+                        }
+                    }
+                }
+            }
+        }
+    };
+}
+
 namespace Features
 {
-    void findMatches(
-        const cv::Mat& im1,
-        const cv::Mat& im2,
-        std::vector<cv::KeyPoint>& kp1,
-        std::vector<cv::KeyPoint>& kp2,
-        cv::Mat& desc1,
-        cv::Mat& desc2,
-        std::vector<cv::DMatch>& matches)
-    {        
+    void detect(
+        const cv::Mat& im,
+        std::vector<cv::KeyPoint>& kp,
+        cv::Mat& desc)
+    {
         cv::Ptr<cv::AKAZE> akaze = cv::AKAZE::create();
-        akaze->detectAndCompute(im1, cv::noArray(), kp1, desc1);
-        akaze->detectAndCompute(im2, cv::noArray(), kp2, desc2);
+        akaze->detectAndCompute(im, cv::noArray(), kp, desc);
+    }
+
+    void orbFeatures(
+        const cv::Mat& gray,
+        int max_features,
+        std::vector<cv::KeyPoint>& kp,
+        cv::Mat& desc)
+    {
+        kp.clear();
+        cv::FAST(gray, kp, orb_fast_threshold, true);
+        cv::KeyPointsFilter::retainBest(kp, max_features);
+        orbDescriptors(gray, kp, desc);
+    }
+
+    void orbDescriptors(
+        const cv::Mat& gray,
+        std::vector<cv::KeyPoint>& kp,
+        cv::Mat& desc)
+    {
+        for (int i = 0; i < kp.size(); ++i)
+        {
+            kp[i].size   = orb_patch_size;
+            kp[i].angle  = 0.0f;
+            kp[i].octave = 0;
+        }
+
+        // One pyramid level; the feature count only matters to detection
+        cv::Ptr<cv::ORB> orb = cv::ORB::create(500, 1.2f, 1, orb_patch_size, 0, 2, cv::ORB::FAST_SCORE, orb_patch_size);
+        orb->compute(gray, kp, desc);
+    }
+
+    void match(
+        const cv::Mat& desc1,
+        const cv::Mat& desc2,
+        std::vector<cv::DMatch>& matches)
+    {
+        if (desc1.empty() || desc2.empty())
+            return;
 
         cv::BFMatcher matcher(cv::NORM_HAMMING);
         std::vector<std::vector<cv::DMatch> > nn_matches;
@@ -25,7 +163,8 @@ namespace Features
         const double ratio_test_thresh = 0.8f;
         for (int i = 0; i < nn_matches.size(); ++i)
         {
-            assert(nn_matches[i].size() == 2);
+            if (nn_matches[i].size() < 2)
+                continue;
 
             const cv::DMatch& first = nn_matches[i][0];
             float dist1 = nn_matches[i][0].distance;
@@ -37,4 +176,61 @@ namespace Features
             }
         }
     }
-}
+
+    void findMatches(
+        const cv::Mat& im1,
+        const cv::Mat& im2,
+        std::vector<cv::KeyPoint>& kp1,
+        std::vector<cv::KeyPoint>& kp2,
+        cv::Mat& desc1,
+        cv::Mat& desc2,
+        std::vector<cv::DMatch>& matches)
+    {        
+        detect(im1, kp1, desc1);
+        detect(im2, kp2, desc2);
+        match(desc1, desc2, matches);
+    }
+
+    void flowMatches(
+        const Pyramid& frame1,
+        const Pyramid& frame2,
+        std::vector<cv::KeyPoint>& kp1,
+        std::vector<cv::KeyPoint>& kp2,
+        std::vector<cv::DMatch>& matches)
+    {
+        const cv::Mat& gray1 = frame1.gray();
+        const cv::Mat& gray2 = frame2.gray();
+        assert(gray1.size() == gray2.size());
+
+        std::vector<cv::Rect> tiles;
+        for (int y = 0; y < gray1.rows; y += tile_size)
+        {
+            for (int x = 0; x < gray1.cols; x += tile_size)
+            {
+                tiles.push_back(cv::Rect(x, y,
+                    std::min(tile_size, gray1.cols - x),
+                    std::min(tile_size, gray1.rows - y)));
+            }
+        }
+
+        std::vector<std::vector<FlowSample> > samples(tiles.size());
+        cv::parallel_for_(cv::Range(0, tiles.size()), FlowBody(gray1, gray2, tiles, samples));
+
+        // Gathered in tile order, so the output doesn't depend on scheduling
+        kp1.clear();
+        kp2.clear();
+        matches.clear();
+        for (int t = 0; t < samples.size(); ++t)
+        {
+            for (int i = 0; i < samples[t].size(); ++i)
+            {
+                const FlowSample& sample = samples[t][i];
+                const int index = kp1.size();
+
+                kp1.push_back(cv::KeyPoint(sample.from, grid_step));
+                kp2.push_back(cv::KeyPoint(sample.to, grid_step));
+                matches.push_back(cv::DMatch(index, index, sample.error));
+            }
+        }
+    }
+}
\ No newline at end of file
@@ -11,8 +11,40 @@ namespace cv
     struct DMatch;
 }
 
+class Pyramid;
+
 namespace Features
 {
+    void detect(
+        const cv::Mat& im,
+        std::vector<cv::KeyPoint>& kp,
+        cv::Mat& desc);
+
+    // The strongest max_features FAST corners of a gray image with upright
+    // ORB descriptors at full resolution. Upright and single scale is what
+    // place recognition on a handheld camera needs, and it is what
+    // orbDescriptors computes for points found some other way, so the two
+    // match each other.
+    void orbFeatures(
+        const cv::Mat& gray,
+        int max_features,
+        std::vector<cv::KeyPoint>& kp,
+        cv::Mat& desc);
+
+    // Upright ORB descriptors at the given keypoints. Keypoints too close
+    // to the border are dropped; class_id is kept, so callers can tag
+    // keypoints with their own indices.
+    void orbDescriptors(
+        const cv::Mat& gray,
+        std::vector<cv::KeyPoint>& kp,
+        cv::Mat& desc);
+
+    // Ratio-tested nearest neighbour matches from desc1 into desc2
+    void match(
+        const cv::Mat& desc1,
+        const cv::Mat& desc2,
+        std::vector<cv::DMatch>& matches);
+
     void findMatches(
         const cv::Mat& im1,
         const cv::Mat& im2,
@@ -21,6 +53,20 @@ namespace Features
         cv::Mat& desc1,
         cv::Mat& desc2,
         std::vector<cv::DMatch>& matches);
+
+    // Dense correspondences for consecutive video frames, without
+    // descriptors. Coarse-to-fine (Farneback) flow is solved per image tile
+    // in parallel, both ways, and sampled on a regular grid; samples whose
+    // backward flow doesn't lead back to the start are dropped. matches[i]
+    // pairs kp1[i] with kp2[i], with the round trip error as distance.
+    // Only the gray levels of the pyramids are used, since Farneback
+    // smooths its own levels.
+    void flowMatches(
+        const Pyramid& frame1,
+        const Pyramid& frame2,
+        std::vector<cv::KeyPoint>& kp1,
+        std::vector<cv::KeyPoint>& kp2,
+        std::vector<cv::DMatch>& matches);
 }
 
 #endif
\ No newline at end of file
@@ -0,0 +1,136 @@
+#include "FrameContext.hpp"
+
+#include <imgproc.hpp>
+#include <videoio.hpp>
+
+#include <cassert>
+#include <algorithm>
+
+FrameContext::FrameContext()
+: _index(0)
+, _gray_index(0)
+, _pyramid_index(0)
+{}
+
+bool FrameContext::read(cv::VideoCapture& capture)
+{
+    // Decoded straight into the frame buffer, which the device reuses when
+    // the size doesn't change
+    if (!capture.read(_frame) || _frame.empty())
+        return false;
+
+    ++_index;
+    return true;
+}
+
+void FrameContext::set(const cv::Mat& image)
+{
+    image.copyTo(_frame);
+    ++_index;
+}
+
+void FrameContext::swap(cv::Mat& image)
+{
+    std::swap(_frame, image);
+    ++_index;
+}
+
+int FrameContext::index() const
+{
+    return _index;
+}
+
+cv::Mat& FrameContext::frame()
+{
+    return _frame;
+}
+
+const cv::Mat& FrameContext::gray()
+{
+    assert(_index > 0);
+    if (_gray_index != _index)
+    {
+        if (_frame.channels() == 1)
+            _frame.copyTo(_gray);
+        else
+            cv::cvtColor(_frame, _gray, CV_BGR2GRAY);
+        _gray_index = _index;
+    }
+
+    return _gray;
+}
+
+const cv::Mat& FrameContext::blurred(int size)
+{
+    bool stale;
+    cv::Mat& image = derived(BLURRED, size, 0.0, stale);
+    if (stale)
+        cv::GaussianBlur(gray(), image, cv::Size(size, size), 0.0);
+
+    return image;
+}
+
+const cv::Mat& FrameContext::thresholded(double value)
+{
+    bool stale;
+    cv::Mat& image = derived(THRESHOLDED, value, 0.0, stale);
+    if (stale)
+        cv::threshold(gray(), image, value, 255, cv::THRESH_BINARY);
+
+    return image;
+}
+
+const cv::Mat& FrameContext::adaptive_thresholded(int block_size, double offset)
+{
+    bool stale;
+    cv::Mat& image = derived(ADAPTIVE, block_size, offset, stale);
+    if (stale)
+    {
+        cv::adaptiveThreshold(gray(), image, 255,
+                              cv::ADAPTIVE_THRESH_GAUSSIAN_C, cv::THRESH_BINARY,
+                              block_size, offset);
+    }
+
+    return image;
+}
+
+const Pyramid& FrameContext::pyramid(int depth)
+{
+    assert(_index > 0);
+    if (_pyramid_index != _index || _pyramid.depth() != depth)
+    {
+        if (_pyramid_index != _index)
+            std::swap(_pyramid, _spare);
+
+        _pyramid.build(gray(), depth);
+        _pyramid_index = _index;
+    }
+
+    return _pyramid;
+}
+
+cv::Mat& FrameContext::derived(Kind kind, double a, double b, bool& stale)
+{
+    assert(_index > 0);
+
+    int i = 0;
+    while (i < _derived.size()
+           && !(_derived[i].kind == kind && _derived[i].a == a && _derived[i].b == b))
+    {
+        ++i;
+    }
+
+    if (i == _derived.size())
+    {
+        Derived entry;
+        entry.kind  = kind;
+        entry.a     = a;
+        entry.b     = b;
+        entry.index = 0;
+        _derived.push_back(entry);
+    }
+
+    stale = _derived[i].index != _index;
+    _derived[i].index = _index;
+    return _derived[i].image;
+}
@@ -0,0 +1,90 @@
+#ifndef __FRAME_CONTEXT_HPP__
+#define __FRAME_CONTEXT_HPP__
+
+#include <deque>
+#include <core.hpp>
+
+#include "Pyramid.hpp"
+
+namespace cv
+{
+    class VideoCapture;
+}
+
+// One captured frame and the images derived from it. A derived image is
+// computed the first time it is asked for and then served from memory for
+// the rest of the frame, so stages that all start from the gray frame or the
+// same threshold share one conversion. Every buffer, the frame's included,
+// is kept from one frame to the next and written in place, so a stream of
+// same-sized frames allocates nothing after the first.
+//
+// Derived images reflect the frame as it was when first asked for: draw
+// overlays on frame() only after the analysis is done.
+class FrameContext
+{
+public:
+    FrameContext();
+
+    // Starts the next frame by reading it from the capture device. Returns
+    // false (and keeps nothing) when the device has no frame.
+    bool read(cv::VideoCapture& capture);
+
+    // Starts the next frame by copying image in
+    void set(const cv::Mat& image);
+
+    // Starts the next frame on image's buffer, handing back the previous
+    // frame's in image, which spares set's copy when image is about to be
+    // rewritten anyway
+    void swap(cv::Mat& image);
+
+    // Frames started so far
+    int index() const;
+
+    cv::Mat& frame();
+
+    const cv::Mat& gray();
+
+    // Gaussian blur of the gray frame with a size x size kernel
+    const cv::Mat& blurred(int size = 5);
+
+    // 255 where the gray frame is above value, 0 elsewhere
+    const cv::Mat& thresholded(double value);
+
+    // 255 where the gray frame is above its Gaussian weighted block_size
+    // neighbourhood mean minus offset, 0 elsewhere
+    const cv::Mat& adaptive_thresholded(int block_size, double offset);
+
+    const Pyramid& pyramid(int depth = 3);
+
+private:
+    enum Kind { BLURRED, THRESHOLDED, ADAPTIVE };
+
+    struct Derived
+    {
+        Kind kind;
+        double a, b;   // the parameters it was made with
+        int index;     // frame it was made for
+        cv::Mat image;
+    };
+
+    int _index;
+    cv::Mat _frame;
+
+    cv::Mat _gray;
+    int _gray_index;
+
+    // Kept across frames for their buffers, one per distinct parameter set.
+    // A deque, so adding one doesn't move the images already handed out.
+    std::deque<Derived> _derived;
+
+    // The previous frame's pyramid is usually still held by a tracker, so
+    // the current one is built into the buffers of the one before
+    Pyramid _pyramid, _spare;
+    int _pyramid_index;
+
+    // The entry for these parameters, and whether it still has to be
+    // computed for this frame
+    cv::Mat& derived(Kind kind, double a, double b, bool& stale);
+};
+
+#endif
@@ -0,0 +1,177 @@
+#include "FramePool.hpp"
+
+#include <cassert>
+
+namespace
+{
+    const int max_buffers = 64;
+    const int row_alignment = 64;
+
+    int popcount(unsigned long long bits)
+    {
+        int n = 0;
+        for (; bits; bits &= bits - 1)
+        {
+            ++n;
+        }
+        return n;
+    }
+}
+
+FramePool::Handle::Handle()
+: _pool(NULL)
+, _buffer(-1)
+{}
+
+FramePool::Handle::Handle(FramePool* pool, int buffer)
+: _pool(pool)
+, _buffer(buffer)
+{}
+
+FramePool::Handle::Handle(const Handle& other)
+: _pool(other._pool)
+, _buffer(other._buffer)
+{
+    if (_pool)
+        _pool->retain(_buffer);
+}
+
+FramePool::Handle& FramePool::Handle::operator=(const Handle& other)
+{
+    // Retained first, in case other is this
+    if (other._pool)
+        other._pool->retain(other._buffer);
+    release();
+
+    _pool = other._pool;
+    _buffer = other._buffer;
+    return *this;
+}
+
+FramePool::Handle::Handle(Handle&& other)
+: _pool(other._pool)
+, _buffer(other._buffer)
+{
+    other._pool = NULL;
+    other._buffer = -1;
+}
+
+FramePool::Handle& FramePool::Handle::operator=(Handle&& other)
+{
+    if (this != &other)
+    {
+        release();
+        _pool = other._pool;
+        _buffer = other._buffer;
+        other._pool = NULL;
+        other._buffer = -1;
+    }
+    return *this;
+}
+
+FramePool::Handle::~Handle()
+{
+    release();
+}
+
+bool FramePool::Handle::empty() const
+{
+    return _pool == NULL;
+}
+
+void FramePool::Handle::release()
+{
+    if (_pool)
+        _pool->release(_buffer);
+
+    _pool = NULL;
+    _buffer = -1;
+}
+
+cv::Mat FramePool::Handle::image() const
+{
+    assert(_pool);
+    return _pool->_images[_buffer];
+}
+
+bool FramePool::Handle::holds(const cv::Mat& image) const
+{
+    return _pool && image.data == _pool->_images[_buffer].data;
+}
+
+int FramePool::Handle::holders() const
+{
+    return _pool ? _pool->_holders[_buffer].load(std::memory_order_acquire) : 0;
+}
+
+FramePool::FramePool(int count, const cv::Size& size, int type)
+: _size(size)
+, _type(type)
+, _count(count)
+, _images(count)
+, _holders(count)
+{
+    assert(count > 0 && count <= max_buffers);
+
+    const size_t row = cv::alignSize(size.width * CV_ELEM_SIZE(type), row_alignment);
+    const size_t bytes = row * size.height;
+
+    _memory.resize(count * bytes + row_alignment);
+    uchar* base = cv::alignPtr(&_memory[0], row_alignment);
+    for (int i = 0; i < count; ++i)
+    {
+        _images[i] = cv::Mat(size, type, base + i * bytes, row);
+        _holders[i].store(0, std::memory_order_relaxed);
+    }
+
+    _free.store(count == max_buffers ? ~0ull : (1ull << count) - 1, std::memory_order_release);
+}
+
+FramePool::Handle FramePool::acquire()
+{
+    unsigned long long free = _free.load(std::memory_order_acquire);
+    while (free)
+    {
+        const unsigned long long lowest = free & (~free + 1);
+        if (_free.compare_exchange_weak(free, free & ~lowest, std::memory_order_acq_rel))
+        {
+            const int buffer = popcount(lowest - 1);
+            _holders[buffer].store(1, std::memory_order_relaxed);
+            return Handle(this, buffer);
+        }
+    }
+
+    return Handle();
+}
+
+int FramePool::count() const
+{
+    return _count;
+}
+
+int FramePool::available() const
+{
+    return popcount(_free.load(std::memory_order_acquire));
+}
+
+cv::Size FramePool::size() const
+{
+    return _size;
+}
+
+int FramePool::type() const
+{
+    return _type;
+}
+
+void FramePool::retain(int buffer)
+{
+    _holders[buffer].fetch_add(1, std::memory_order_relaxed);
+}
+
+void FramePool::release(int buffer)
+{
+    // Whatever the last holder wrote is done before the buffer is free
+    if (_holders[buffer].fetch_sub(1, std::memory_order_acq_rel) == 1)
+        _free.fetch_or(1ull << buffer, std::memory_order_release);
+}
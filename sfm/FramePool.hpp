@@ -0,0 +1,83 @@
+#ifndef __FRAME_POOL_HPP__
+#define __FRAME_POOL_HPP__
+
+#include <atomic>
+#include <vector>
+#include <core.hpp>
+
+// A fixed set of same-sized image buffers, allocated together once, that
+// frames are captured into and then handed from stage to stage by
+// reference count instead of being copied. A buffer goes back to the pool
+// when its last handle is gone, so a capture loop whose frames are let go
+// in time allocates nothing after the pool itself. Rows start on 64 byte
+// boundaries.
+//
+// Handles can be copied and released from any thread: the free buffers are
+// a bit mask and the holder counts are atomic. The pool has to outlive its
+// handles.
+class FramePool
+{
+public:
+    class Handle
+    {
+    public:
+        Handle();
+        Handle(const Handle& other);
+        Handle& operator=(const Handle& other);
+
+        // Moves, so swapping frames that carry handles doesn't touch the
+        // holder counts
+        Handle(Handle&& other);
+        Handle& operator=(Handle&& other);
+        ~Handle();
+
+        bool empty() const;
+
+        // Lets go of the buffer, which goes back to the pool with the last
+        // holder
+        void release();
+
+        // Header on the buffer's pixels. Every holder sees what is written
+        // there, so only a sole holder (holders() == 1) should write.
+        cv::Mat image() const;
+
+        // Whether image shares this buffer's pixels
+        bool holds(const cv::Mat& image) const;
+
+        int holders() const;
+
+    private:
+        friend class FramePool;
+        Handle(FramePool* pool, int buffer);
+
+        FramePool* _pool;
+        int _buffer;
+    };
+
+    // At most 64 buffers
+    FramePool(int count, const cv::Size& size, int type);
+
+    // A buffer nobody holds, or an empty handle when every one is held
+    Handle acquire();
+
+    int count() const;
+    int available() const;
+    cv::Size size() const;
+    int type() const;
+
+private:
+    cv::Size _size;
+    int _type;
+    int _count;
+
+    std::vector<uchar> _memory;
+    std::vector<cv::Mat> _images;   // one header per buffer
+
+    std::atomic<unsigned long long> _free;   // a bit per free buffer
+    std::vector<std::atomic<int> > _holders;
+
+    void retain(int buffer);
+    void release(int buffer);
+};
+
+#endif
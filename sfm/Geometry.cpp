@@ -0,0 +1,221 @@
+#include "Geometry.hpp"
+
+#include <cassert>
+
+namespace
+{
+    template<typename T>
+    class TriangulateBody : public cv::ParallelLoopBody
+    {
+    private:
+        const std::vector<cv::Point_<T> >& _x1;
+        const cv::Matx<T, 3, 4>& _P1;
+        const std::vector<cv::Point_<T> >& _x2;
+        const cv::Matx<T, 3, 4>& _P2;
+        std::vector<cv::Point3_<T> >& _points;
+        std::vector<unsigned char>& _valid;
+
+    public:
+        TriangulateBody(
+            const std::vector<cv::Point_<T> >& x1,
+            const cv::Matx<T, 3, 4>& P1,
+            const std::vector<cv::Point_<T> >& x2,
+            const cv::Matx<T, 3, 4>& P2,
+            std::vector<cv::Point3_<T> >& points,
+            std::vector<unsigned char>& valid)
+        : _x1(x1)
+        , _P1(P1)
+        , _x2(x2)
+        , _P2(P2)
+        , _points(points)
+        , _valid(valid)
+        {}
+
+        virtual void operator()(const cv::Range& range) const
+        {
+            for (int i = range.start; i < range.end; ++i)
+            {
+                Geometry::NormalEquations<T> equations;
+                equations.add(_x1[i], _P1);
+                equations.add(_x2[i], _P2);
+                _valid[i] = equations.solve(_points[i]);
+            }
+        }
+    };
+
+    template<typename T>
+    class WarpBody : public cv::ParallelLoopBody
+    {
+    private:
+        const cv::Mat& _src;
+        const cv::Matx<T, 3, 3>& _H;
+        const cv::Rect& _region;
+        cv::Mat& _dst;
+
+    public:
+        WarpBody(
+            const cv::Mat& src,
+            const cv::Matx<T, 3, 3>& H,
+            const cv::Rect& region,
+            cv::Mat& dst)
+        : _src(src)
+        , _H(H)
+        , _region(region)
+        , _dst(dst)
+        {}
+
+        virtual void operator()(const cv::Range& range) const
+        {
+            const cv::Matx<T, 3, 3>& H = _H;
+            const T cols = _src.cols, rows = _src.rows;
+
+            for (int i = range.start; i < range.end; ++i)
+            {
+                // Homogeneous source coordinates at the start of the row;
+                // along the row only the first column of H is added.
+                const T x0 = _region.x, y0 = i;
+                const T u0 = H(0, 0) * x0 + H(0, 1) * y0 + H(0, 2);
+                const T v0 = H(1, 0) * x0 + H(1, 1) * y0 + H(1, 2);
+                const T w0 = H(2, 0) * x0 + H(2, 1) * y0 + H(2, 2);
+
+                cv::Vec3b* out = _dst.ptr<cv::Vec3b>(i) + _region.x;
+                for (int j = 0; j < _region.width; ++j)
+                {
+                    // Computed from the row start rather than accumulated,
+                    // which would drift in float over a long row
+                    const T w = w0 + H(2, 0) * j;
+                    if (w == 0)
+                        continue;
+
+                    const T x = (u0 + H(0, 0) * j) / w;
+                    const T y = (v0 + H(1, 0) * j) / w;
+
+                    // Coarse test first, so only small values get rounded
+                    if (x > -1 && y > -1 && x < cols && y < rows)
+                    {
+                        const int px = cvRound(x), py = cvRound(y);
+                        if (px >= 0 && py >= 0 && px < _src.cols && py < _src.rows)
+                            out[j] = _src.ptr<cv::Vec3b>(py)[px];
+                    }
+                }
+            }
+        }
+    };
+}
+
+namespace Geometry
+{
+    template<typename T>
+    NormalEquations<T>::NormalEquations()
+    : AtA(cv::Matx<T, 3, 3>::zeros())
+    , Atb(0, 0, 0)
+    {}
+
+    template<typename T>
+    void NormalEquations<T>::add(const cv::Point_<T>& x, const cv::Matx<T, 3, 4>& P, T sign)
+    {
+        for (int r = 0; r < 2; ++r)
+        {
+            const T c = r == 0 ? x.x : x.y;
+            const T a0 = c * P(2, 0) - P(r, 0);
+            const T a1 = c * P(2, 1) - P(r, 1);
+            const T a2 = c * P(2, 2) - P(r, 2);
+            const T b  = P(r, 3) - c * P(2, 3);
+
+            AtA(0, 0) += sign * a0 * a0;
+            AtA(0, 1) += sign * a0 * a1;
+            AtA(0, 2) += sign * a0 * a2;
+            AtA(1, 1) += sign * a1 * a1;
+            AtA(1, 2) += sign * a1 * a2;
+            AtA(2, 2) += sign * a2 * a2;
+
+            Atb(0) += sign * a0 * b;
+            Atb(1) += sign * a1 * b;
+            Atb(2) += sign * a2 * b;
+        }
+    }
+
+    template<typename T>
+    bool NormalEquations<T>::solve(cv::Point3_<T>& point) const
+    {
+        cv::Matx<T, 3, 3> A = AtA;
+        A(1, 0) = A(0, 1);
+        A(2, 0) = A(0, 2);
+        A(2, 1) = A(1, 2);
+
+        cv::Vec<T, 3> X;
+        if (!cv::solve(A, Atb, X, cv::DECOMP_CHOLESKY))
+            return false;
+
+        point = cv::Point3_<T>(X(0), X(1), X(2));
+        return true;
+    }
+
+    template<typename T>
+    bool triangulate(
+        const cv::Point_<T>* observations,
+        const cv::Matx<T, 3, 4>* projections,
+        int n,
+        cv::Point3_<T>& point)
+    {
+        NormalEquations<T> equations;
+        for (int k = 0; k < n; ++k)
+        {
+            equations.add(observations[k], projections[k]);
+        }
+
+        return n >= 2 && equations.solve(point);
+    }
+
+    template<typename T>
+    void triangulate(
+        const std::vector<cv::Point_<T> >& x1,
+        const cv::Matx<T, 3, 4>& P1,
+        const std::vector<cv::Point_<T> >& x2,
+        const cv::Matx<T, 3, 4>& P2,
+        std::vector<cv::Point3_<T> >& points,
+        std::vector<unsigned char>& valid)
+    {
+        assert(x1.size() == x2.size());
+
+        points.resize(x1.size());
+        valid.resize(x1.size());
+        cv::parallel_for_(cv::Range(0, x1.size()),
+            TriangulateBody<T>(x1, P1, x2, P2, points, valid));
+    }
+
+    template<typename T>
+    void warp_homography(
+        const cv::Mat& src,
+        const cv::Matx<T, 3, 3>& inverse_homography,
+        const cv::Rect& region,
+        cv::Mat& dst)
+    {
+        assert(src.type() == CV_8UC3 && dst.type() == CV_8UC3);
+
+        const cv::Rect clipped = region & cv::Rect(0, 0, dst.cols, dst.rows);
+        if (clipped.area() == 0)
+            return;
+
+        cv::parallel_for_(cv::Range(clipped.y, clipped.y + clipped.height),
+            WarpBody<T>(src, inverse_homography, clipped, dst));
+    }
+
+    template struct NormalEquations<float>;
+    template struct NormalEquations<double>;
+
+    template bool triangulate(const cv::Point2f*, const cv::Matx<float, 3, 4>*, int, cv::Point3f&);
+    template bool triangulate(const cv::Point2d*, const cv::Matx<double, 3, 4>*, int, cv::Point3d&);
+
+    template void triangulate(
+        const std::vector<cv::Point2f>&, const cv::Matx<float, 3, 4>&,
+        const std::vector<cv::Point2f>&, const cv::Matx<float, 3, 4>&,
+        std::vector<cv::Point3f>&, std::vector<unsigned char>&);
+    template void triangulate(
+        const std::vector<cv::Point2d>&, const cv::Matx<double, 3, 4>&,
+        const std::vector<cv::Point2d>&, const cv::Matx<double, 3, 4>&,
+        std::vector<cv::Point3d>&, std::vector<unsigned char>&);
+
+    template void warp_homography(const cv::Mat&, const cv::Matx<float, 3, 3>&, const cv::Rect&, cv::Mat&);
+    template void warp_homography(const cv::Mat&, const cv::Matx<double, 3, 3>&, const cv::Rect&, cv::Mat&);
+}
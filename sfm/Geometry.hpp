@@ -0,0 +1,63 @@
+#ifndef __GEOMETRY_HPP__
+#define __GEOMETRY_HPP__
+
+#include <vector>
+#include <core.hpp>
+
+// Scalar geometry kernels templated on the floating point type and
+// instantiated for float and double. The offline pipeline keeps double;
+// real-time paths can drop to float where the accuracy allows it (see
+// precision_benchmark).
+namespace Geometry
+{
+    // Normal equations of the inhomogeneous DLT system A * [X Y Z]^T = b,
+    // built one observation (normalized coordinates) at a time. Only the
+    // upper triangle of AtA is kept up to date.
+    template<typename T>
+    struct NormalEquations
+    {
+        cv::Matx<T, 3, 3> AtA;
+        cv::Vec<T, 3>     Atb;
+
+        NormalEquations();
+
+        // Adds the two rows of one observation, or removes them again
+        // with sign = -1.
+        void add(const cv::Point_<T>& x, const cv::Matx<T, 3, 4>& P, T sign = 1);
+
+        // Cholesky solve; false if the system is singular
+        bool solve(cv::Point3_<T>& point) const;
+    };
+
+    // Linear triangulation from n >= 2 views
+    template<typename T>
+    bool triangulate(
+        const cv::Point_<T>* observations,
+        const cv::Matx<T, 3, 4>* projections,
+        int n,
+        cv::Point3_<T>& point);
+
+    // Two-view linear triangulation of every correspondence, in parallel.
+    // valid is cleared where the system is singular.
+    template<typename T>
+    void triangulate(
+        const std::vector<cv::Point_<T> >& x1,
+        const cv::Matx<T, 3, 4>& P1,
+        const std::vector<cv::Point_<T> >& x2,
+        const cv::Matx<T, 3, 4>& P2,
+        std::vector<cv::Point3_<T> >& points,
+        std::vector<unsigned char>& valid);
+
+    // Inverse warp of a CV_8UC3 image: every pixel p of region in dst takes
+    // the nearest src pixel at inverse_homography * p, if there is one.
+    // Rows run in parallel and each row costs one multiply-add per
+    // coordinate and pixel.
+    template<typename T>
+    void warp_homography(
+        const cv::Mat& src,
+        const cv::Matx<T, 3, 3>& inverse_homography,
+        const cv::Rect& region,
+        cv::Mat& dst);
+}
+
+#endif
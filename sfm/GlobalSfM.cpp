@@ -0,0 +1,907 @@
+#include "GlobalSfM.hpp"
+
+#include <calib3d.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <map>
+#include <queue>
+#include <set>
+
+#include "BundleAdjust.hpp"
+#include "Features.hpp"
+#include "InvertedIndex.hpp"
+#include "MultiView.hpp"
+#include "Util.hpp"
+#include "Vocabulary.hpp"
+
+namespace
+{
+    const int    retrieval_neighbours   = 20;
+    const int    vocabulary_samples     = 200;
+    const int    vocabulary_branching   = 10;
+    const int    vocabulary_depth       = 3;
+    const int    min_matches            = 30;
+    const int    min_pair_inliers       = 30;
+    const int    rotation_iterations    = 20;
+    const double rotation_sigma         = 5.0 * CV_PI / 180.0;
+    const double max_rotation_error     = 5.0 * CV_PI / 180.0;
+    const int    translation_iterations = 5;
+    const int    min_translation_edges  = 2;
+    const double translation_sigma      = 0.1;
+    const double min_track_angle        = 1.0 * CV_PI / 180.0;
+    const double max_track_error        = 4.0;
+
+    double rotation_angle(const cv::Matx33d& R)
+    {
+        double c = (cv::trace(R) - 1.0) * 0.5;
+        return std::acos(std::max(-1.0, std::min(1.0, c)));
+    }
+
+    // Closest rotation in the Frobenius sense
+    cv::Matx33d project_to_rotation(const cv::Matx33d& M)
+    {
+        cv::Matx31d w;
+        cv::Matx33d u, vt;
+        cv::SVD::compute(M, w, u, vt);
+
+        cv::Matx33d R = u * vt;
+        if (cv::determinant(R) < 0.0)
+        {
+            for (int k = 0; k < 3; ++k)
+                u(k, 2) = -u(k, 2);
+            R = u * vt;
+        }
+
+        return R;
+    }
+
+    // Unit direction from the center of view j to the center of view i,
+    // expressed in world coordinates.
+    cv::Vec3d pair_direction(const GlobalSfM::ViewPair& pair,
+                             const std::vector<cv::Matx33d>& rotations)
+    {
+        cv::Vec3d d = rotations[pair.j].t() * pair.translation;
+        double n = std::sqrt(d.dot(d));
+        return n > 0.0 ? d / n : d;
+    }
+
+    int find_root(std::vector<int>& parent, int a)
+    {
+        while (parent[a] != a)
+        {
+            parent[a] = parent[parent[a]];
+            a = parent[a];
+        }
+        return a;
+    }
+
+    // Marks the views reachable from root through pairs
+    void connected_to(int root, int n_views,
+                      const std::vector<GlobalSfM::ViewPair>& pairs,
+                      std::vector<unsigned char>& reached)
+    {
+        std::vector<std::vector<int> > adjacency(n_views);
+        for (int e = 0; e < pairs.size(); ++e)
+        {
+            adjacency[pairs[e].i].push_back(pairs[e].j);
+            adjacency[pairs[e].j].push_back(pairs[e].i);
+        }
+
+        reached.assign(n_views, 0);
+        std::queue<int> frontier;
+        frontier.push(root);
+        reached[root] = 1;
+
+        while (!frontier.empty())
+        {
+            int v = frontier.front();
+            frontier.pop();
+
+            for (int k = 0; k < adjacency[v].size(); ++k)
+            {
+                int u = adjacency[v][k];
+                if (!reached[u])
+                {
+                    reached[u] = 1;
+                    frontier.push(u);
+                }
+            }
+        }
+    }
+
+    // Every pair when there are few views, otherwise each view with the
+    // retrieval_neighbours views scoring best against it on a bag of
+    // words trained over the views themselves
+    void candidate_pairs(
+        const std::vector<GlobalSfM::View>& views,
+        std::vector<std::pair<int, int> >& candidates)
+    {
+        const int n = views.size();
+        candidates.clear();
+        if (n <= retrieval_neighbours + 1)
+        {
+            for (int i = 0; i < n; ++i)
+            {
+                for (int j = i + 1; j < n; ++j)
+                {
+                    candidates.push_back(std::make_pair(i, j));
+                }
+            }
+            return;
+        }
+
+        // Trained on an even subsample of each view's descriptors
+        std::vector<cv::Mat> samples(n);
+        for (int v = 0; v < n; ++v)
+        {
+            const cv::Mat& d = views[v].descriptors;
+            const int step = std::max(1, d.rows / vocabulary_samples);
+            for (int r = 0; r < d.rows; r += step)
+            {
+                samples[v].push_back(d.row(r));
+            }
+        }
+
+        Vocabulary vocabulary;
+        vocabulary.train(samples, vocabulary_branching, vocabulary_depth);
+
+        std::vector<Vocabulary::BowVector> bows(n);
+        InvertedIndex index(vocabulary.words());
+        for (int v = 0; v < n; ++v)
+        {
+            vocabulary.transform(views[v].descriptors, bows[v]);
+            index.add(v, bows[v]);
+        }
+
+        // A pair retrieved from both sides is verified once
+        std::set<std::pair<int, int> > unique;
+        std::vector<InvertedIndex::Candidate> neighbours;
+        for (int i = 0; i < n; ++i)
+        {
+            index.query(bows[i], retrieval_neighbours + 1, 0.0, neighbours);
+            for (int k = 0; k < neighbours.size(); ++k)
+            {
+                const int j = neighbours[k].keyframe;
+                if (j != i)
+                    unique.insert(std::make_pair(std::min(i, j), std::max(i, j)));
+            }
+        }
+
+        candidates.assign(unique.begin(), unique.end());
+    }
+
+    // Unregisters the views that are not fixed and are held by fewer than
+    // min_translation_edges edges of nonzero weight to other registered
+    // views. A single direction leaves a view free to slide along it, so
+    // the solve would put it anywhere on the line, down to on top of its
+    // neighbour. Each view dropped can leave a neighbour short in turn.
+    int drop_unconstrained(
+        const std::vector<GlobalSfM::ViewPair>& pairs,
+        const std::vector<int>& edges,
+        const std::vector<double>& weights,
+        const std::vector<unsigned char>& fixed,
+        std::vector<unsigned char>& registered)
+    {
+        std::vector<int> constraints(registered.size());
+        int dropped = 0;
+        bool changed = true;
+        while (changed)
+        {
+            std::fill(constraints.begin(), constraints.end(), 0);
+            for (int k = 0; k < edges.size(); ++k)
+            {
+                const GlobalSfM::ViewPair& pair = pairs[edges[k]];
+                if (weights[k] > 0.0 && registered[pair.i] && registered[pair.j])
+                {
+                    ++constraints[pair.i];
+                    ++constraints[pair.j];
+                }
+            }
+
+            changed = false;
+            for (int v = 0; v < registered.size(); ++v)
+            {
+                if (registered[v] && !fixed[v] && constraints[v] < min_translation_edges)
+                {
+                    registered[v] = 0;
+                    ++dropped;
+                    changed = true;
+                }
+            }
+        }
+
+        return dropped;
+    }
+
+    // Applies the weighted Laplacian of the translation constraints to c
+    void apply_laplacian(
+        const std::vector<GlobalSfM::ViewPair>& pairs,
+        const std::vector<int>& edges,
+        const std::vector<cv::Vec3d>& directions,
+        const std::vector<double>& weights,
+        const std::vector<cv::Vec3d>& c,
+        std::vector<cv::Vec3d>& out)
+    {
+        std::fill(out.begin(), out.end(), cv::Vec3d(0, 0, 0));
+        for (int k = 0; k < edges.size(); ++k)
+        {
+            const GlobalSfM::ViewPair& pair = pairs[edges[k]];
+            const cv::Vec3d& d = directions[k];
+            cv::Vec3d delta = c[pair.i] - c[pair.j];
+            cv::Vec3d perp = (delta - d * d.dot(delta)) * weights[k];
+            out[pair.i] += perp;
+            out[pair.j] -= perp;
+        }
+    }
+
+    class RelativePoseBody : public cv::ParallelLoopBody
+    {
+    private:
+        const std::vector<GlobalSfM::View>& _views;
+        const std::vector<std::pair<int, int> >& _candidates;
+        const cv::Mat& _K;
+        std::vector<GlobalSfM::ViewPair>& _pairs;
+        std::vector<unsigned char>& _valid;
+
+    public:
+        RelativePoseBody(
+            const std::vector<GlobalSfM::View>& views,
+            const std::vector<std::pair<int, int> >& candidates,
+            const cv::Mat& K,
+            std::vector<GlobalSfM::ViewPair>& pairs,
+            std::vector<unsigned char>& valid)
+        : _views(views)
+        , _candidates(candidates)
+        , _K(K)
+        , _pairs(pairs)
+        , _valid(valid)
+        {}
+
+        virtual void operator()(const cv::Range& range) const
+        {
+            // Shared by every pair of this stripe
+            const cv::Matx33d K(_K);
+            MultiView::TwoViewWorkspace workspace;
+            MultiView::TwoViewResult result;
+            std::vector<cv::DMatch> matches;
+            std::vector<cv::Point2d> pts1, pts2;
+
+            for (int c = range.start; c < range.end; ++c)
+            {
+                int i = _candidates[c].first;
+                int j = _candidates[c].second;
+                const GlobalSfM::View& v1 = _views[i];
+                const GlobalSfM::View& v2 = _views[j];
+
+                Features::match(v1.descriptors, v2.descriptors, matches);
+                if (matches.size() < min_matches)
+                    continue;
+
+                pts1.resize(matches.size());
+                pts2.resize(matches.size());
+                for (int k = 0; k < matches.size(); ++k)
+                {
+                    pts1[k] = v1.keypoints[matches[k].queryIdx].pt;
+                    pts2[k] = v2.keypoints[matches[k].trainIdx].pt;
+                }
+
+                if (!MultiView::triangulate(pts1, K, pts2, K, workspace, result))
+                    continue;
+
+                GlobalSfM::ViewPair& pair = _pairs[c];
+                pair.i = i;
+                pair.j = j;
+                pair.rotation = result.rotation;
+                pair.translation = result.translation;
+                Util::mask(matches, result.inliers, pair.matches);
+
+                _valid[c] = pair.matches.size() >= min_pair_inliers;
+            }
+        }
+    };
+
+    class RotationBody : public cv::ParallelLoopBody
+    {
+    private:
+        const std::vector<GlobalSfM::ViewPair>& _pairs;
+        const std::vector<std::vector<int> >& _incident;
+        const std::vector<cv::Matx33d>& _rotations;
+        const std::vector<unsigned char>& _registered;
+        int _root;
+        std::vector<cv::Matx33d>& _updated;
+
+    public:
+        RotationBody(
+            const std::vector<GlobalSfM::ViewPair>& pairs,
+            const std::vector<std::vector<int> >& incident,
+            const std::vector<cv::Matx33d>& rotations,
+            const std::vector<unsigned char>& registered,
+            int root,
+            std::vector<cv::Matx33d>& updated)
+        : _pairs(pairs)
+        , _incident(incident)
+        , _rotations(rotations)
+        , _registered(registered)
+        , _root(root)
+        , _updated(updated)
+        {}
+
+        virtual void operator()(const cv::Range& range) const
+        {
+            for (int v = range.start; v < range.end; ++v)
+            {
+                _updated[v] = _rotations[v];
+                if (v == _root || !_registered[v])
+                    continue;
+
+                // Weighted chordal mean of the estimates each neighbour
+                // implies for this view, with Cauchy weights on their
+                // current disagreement.
+                cv::Matx33d sum;
+                for (int k = 0; k < _incident[v].size(); ++k)
+                {
+                    const GlobalSfM::ViewPair& pair = _pairs[_incident[v][k]];
+                    cv::Matx33d estimate = pair.i == v
+                        ? pair.rotation.t() * _rotations[pair.j]
+                        : pair.rotation * _rotations[pair.i];
+
+                    double r = rotation_angle(estimate * _rotations[v].t()) / rotation_sigma;
+                    sum += estimate * (1.0 / (1.0 + r * r));
+                }
+
+                _updated[v] = project_to_rotation(sum);
+            }
+        }
+    };
+
+    // Rejects triangulated tracks whose inlier rays are nearly parallel
+    class ParallaxBody : public cv::ParallelLoopBody
+    {
+    private:
+        const MultiView::TrackBatch& _batch;
+        const std::vector<cv::Matx33d>& _rotations;
+        const std::vector<unsigned char>& _inliers;
+        std::vector<unsigned char>& _valid;
+
+    public:
+        ParallaxBody(
+            const MultiView::TrackBatch& batch,
+            const std::vector<cv::Matx33d>& rotations,
+            const std::vector<unsigned char>& inliers,
+            std::vector<unsigned char>& valid)
+        : _batch(batch)
+        , _rotations(rotations)
+        , _inliers(inliers)
+        , _valid(valid)
+        {}
+
+        virtual void operator()(const cv::Range& range) const
+        {
+            const double max_cos = std::cos(min_track_angle);
+            std::vector<cv::Vec3d> rays;
+
+            for (int t = range.start; t < range.end; ++t)
+            {
+                if (!_valid[t])
+                    continue;
+
+                rays.clear();
+                for (int k = _batch.offsets[t]; k < _batch.offsets[t + 1]; ++k)
+                {
+                    if (!_inliers[k])
+                        continue;
+
+                    const cv::Point2d& x = _batch.observations[k];
+                    cv::Vec3d ray = _rotations[_batch.views[k]].t() * cv::Vec3d(x.x, x.y, 1.0);
+                    rays.push_back(ray / std::sqrt(ray.dot(ray)));
+                }
+
+                bool wide = false;
+                for (int a = 0; a < rays.size() && !wide; ++a)
+                {
+                    for (int b = a + 1; b < rays.size() && !wide; ++b)
+                    {
+                        wide = rays[a].dot(rays[b]) < max_cos;
+                    }
+                }
+
+                _valid[t] = wide;
+            }
+        }
+    };
+}
+
+namespace GlobalSfM
+{
+    void relative_poses(
+        const std::vector<View>& views,
+        const cv::Mat& K,
+        std::vector<ViewPair>& pairs)
+    {
+        std::vector<std::pair<int, int> > candidates;
+        candidate_pairs(views, candidates);
+
+        std::vector<ViewPair> all_pairs(candidates.size());
+        std::vector<unsigned char> valid(candidates.size(), 0);
+        cv::parallel_for_(cv::Range(0, candidates.size()),
+            RelativePoseBody(views, candidates, K, all_pairs, valid));
+
+        pairs.clear();
+        Util::mask(all_pairs, valid, pairs);
+    }
+
+    bool average_rotations(
+        int n_views,
+        std::vector<ViewPair>& pairs,
+        std::vector<cv::Matx33d>& rotations,
+        std::vector<unsigned char>& registered)
+    {
+        rotations.assign(n_views, cv::Matx33d::eye());
+        registered.assign(n_views, 0);
+
+        if (pairs.empty())
+            return false;
+
+        std::vector<std::vector<int> > incident(n_views);
+        std::vector<int> strength(n_views, 0);
+        for (int e = 0; e < pairs.size(); ++e)
+        {
+            incident[pairs[e].i].push_back(e);
+            incident[pairs[e].j].push_back(e);
+            strength[pairs[e].i] += pairs[e].matches.size();
+            strength[pairs[e].j] += pairs[e].matches.size();
+        }
+
+        int root = std::max_element(strength.begin(), strength.end()) - strength.begin();
+
+        // Initialize by chaining relative rotations along the maximum
+        // spanning tree (by inlier count) rooted at the strongest view.
+        std::priority_queue<std::pair<int, int> > frontier;
+        registered[root] = 1;
+        for (int k = 0; k < incident[root].size(); ++k)
+        {
+            int e = incident[root][k];
+            frontier.push(std::make_pair(pairs[e].matches.size(), e));
+        }
+
+        while (!frontier.empty())
+        {
+            const ViewPair& pair = pairs[frontier.top().second];
+            frontier.pop();
+
+            if (registered[pair.i] && registered[pair.j])
+                continue;
+
+            int v = registered[pair.i] ? pair.j : pair.i;
+            rotations[v] = registered[pair.i]
+                ? pair.rotation * rotations[pair.i]
+                : pair.rotation.t() * rotations[pair.j];
+            registered[v] = 1;
+
+            for (int k = 0; k < incident[v].size(); ++k)
+            {
+                int e = incident[v][k];
+                frontier.push(std::make_pair(pairs[e].matches.size(), e));
+            }
+        }
+
+        // Iteratively reweighted averaging over every edge (not just the
+        // tree) so that a single bad pair can't bend the whole graph.
+        std::vector<cv::Matx33d> updated(n_views);
+        for (int it = 0; it < rotation_iterations; ++it)
+        {
+            cv::parallel_for_(cv::Range(0, n_views),
+                RotationBody(pairs, incident, rotations, registered, root, updated));
+            rotations.swap(updated);
+        }
+
+        std::vector<unsigned char> consistent(pairs.size(), 0);
+        for (int e = 0; e < pairs.size(); ++e)
+        {
+            const ViewPair& pair = pairs[e];
+            cv::Matx33d residual = pair.rotation * rotations[pair.i] * rotations[pair.j].t();
+            consistent[e] = registered[pair.i] && registered[pair.j] &&
+                            rotation_angle(residual) <= max_rotation_error;
+        }
+
+        std::vector<ViewPair> kept;
+        Util::mask(pairs, consistent, kept);
+        pairs.swap(kept);
+
+        connected_to(root, n_views, pairs, registered);
+
+        int count = 0;
+        for (int v = 0; v < n_views; ++v)
+        {
+            if (!registered[v])
+                rotations[v] = cv::Matx33d::eye();
+            count += registered[v];
+        }
+
+        printf("Registered rotations for %d / %d views\n", count, n_views);
+        return count >= 2;
+    }
+
+    void average_translations(
+        const std::vector<ViewPair>& pairs,
+        const std::vector<cv::Matx33d>& rotations,
+        std::vector<unsigned char>& registered,
+        std::vector<cv::Vec3d>& translations)
+    {
+        const int n_views = rotations.size();
+        translations.assign(n_views, cv::Vec3d(0, 0, 0));
+
+        std::vector<int> edges;
+        std::vector<cv::Vec3d> directions;
+        for (int e = 0; e < pairs.size(); ++e)
+        {
+            if (registered[pairs[e].i] && registered[pairs[e].j])
+            {
+                edges.push_back(e);
+                directions.push_back(pair_direction(pairs[e], rotations));
+            }
+        }
+
+        if (edges.empty())
+            return;
+
+        // Fix the gauge: the strongest pair pins both its centers, which
+        // fixes the origin and the global scale.
+        int anchor = 0;
+        for (int k = 1; k < edges.size(); ++k)
+        {
+            if (pairs[edges[k]].matches.size() > pairs[edges[anchor]].matches.size())
+                anchor = k;
+        }
+
+        std::vector<cv::Vec3d> centers(n_views, cv::Vec3d(0, 0, 0));
+        std::vector<unsigned char> fixed(n_views, 0);
+        const ViewPair& anchor_pair = pairs[edges[anchor]];
+        centers[anchor_pair.i] = directions[anchor];
+        fixed[anchor_pair.i] = 1;
+        fixed[anchor_pair.j] = 1;
+
+        std::vector<double> weights(edges.size(), 1.0);
+        int dropped = drop_unconstrained(pairs, edges, weights, fixed, registered);
+
+        // Only edges between the views left take part in the solve
+        int kept = 0;
+        for (int k = 0; k < edges.size(); ++k)
+        {
+            if (registered[pairs[edges[k]].i] && registered[pairs[edges[k]].j])
+            {
+                edges[kept] = edges[k];
+                directions[kept] = directions[k];
+                ++kept;
+            }
+        }
+        edges.resize(kept);
+        directions.resize(kept);
+        weights.assign(kept, 1.0);
+
+        for (int v = 0; v < n_views; ++v)
+        {
+            if (!registered[v])
+                fixed[v] = 1;
+        }
+
+        // Each edge asks for (c_i - c_j) to be parallel to its direction
+        // d, i.e. for (I - d d^T) (c_i - c_j) = 0. The normal equations
+        // are a sparse Laplacian which we solve matrix-free with
+        // conjugate gradients, so memory stays linear in the graph size.
+        std::vector<cv::Vec3d> x(n_views), r(n_views), p(n_views), Ap(n_views);
+
+        for (int outer = 0; outer < translation_iterations; ++outer)
+        {
+            // r = -L * c_fixed on the free views
+            apply_laplacian(pairs, edges, directions, weights, centers, r);
+            double rr = 0.0;
+            for (int v = 0; v < n_views; ++v)
+            {
+                r[v] = fixed[v] ? cv::Vec3d(0, 0, 0) : cv::Vec3d(-r[v]);
+                x[v] = fixed[v] ? centers[v] : cv::Vec3d(0, 0, 0);
+                p[v] = r[v];
+                rr += r[v].dot(r[v]);
+            }
+
+            std::vector<cv::Vec3d> dx(n_views, cv::Vec3d(0, 0, 0));
+            for (int it = 0; it < 3 * n_views && rr > 1e-20; ++it)
+            {
+                apply_laplacian(pairs, edges, directions, weights, p, Ap);
+
+                double pAp = 0.0;
+                for (int v = 0; v < n_views; ++v)
+                {
+                    if (fixed[v])
+                        Ap[v] = cv::Vec3d(0, 0, 0);
+                    pAp += p[v].dot(Ap[v]);
+                }
+
+                if (pAp <= 0.0)
+                    break;
+
+                double alpha = rr / pAp;
+                double rr_next = 0.0;
+                for (int v = 0; v < n_views; ++v)
+                {
+                    dx[v] += p[v] * alpha;
+                    r[v] -= Ap[v] * alpha;
+                    rr_next += r[v].dot(r[v]);
+                }
+
+                double beta = rr_next / rr;
+                for (int v = 0; v < n_views; ++v)
+                {
+                    p[v] = r[v] + p[v] * beta;
+                }
+                rr = rr_next;
+            }
+
+            for (int v = 0; v < n_views; ++v)
+            {
+                x[v] += dx[v];
+            }
+
+            // Reweight by how far each baseline is from its measured
+            // direction. The constraint itself is blind to the sign of d,
+            // so a baseline pointing backwards is left out of the next
+            // solve altogether rather than only down-weighted.
+            for (int k = 0; k < edges.size(); ++k)
+            {
+                const ViewPair& pair = pairs[edges[k]];
+                cv::Vec3d delta = x[pair.i] - x[pair.j];
+                double along = directions[k].dot(delta);
+                if (along <= 0.0)
+                {
+                    weights[k] = 0.0;
+                    continue;
+                }
+
+                cv::Vec3d perp = delta - directions[k] * along;
+                double s = std::sqrt(perp.dot(perp) / delta.dot(delta)) / translation_sigma;
+                weights[k] = 1.0 / (1.0 + s * s);
+            }
+        }
+
+        // Views whose edges the sign check took away are no better placed
+        // than those with a single edge
+        dropped += drop_unconstrained(pairs, edges, weights, fixed, registered);
+
+        int count = 0;
+        for (int v = 0; v < n_views; ++v)
+        {
+            if (registered[v])
+                translations[v] = -(rotations[v] * x[v]);
+            count += registered[v];
+        }
+
+        printf("Registered translations for %d / %d views, %d underconstrained\n",
+            count, n_views, dropped);
+    }
+
+    void build_tracks(
+        const std::vector<View>& views,
+        const std::vector<ViewPair>& pairs,
+        const std::vector<unsigned char>& registered,
+        std::vector<Track>& tracks)
+    {
+        std::vector<int> offsets(views.size() + 1, 0);
+        for (int v = 0; v < views.size(); ++v)
+        {
+            offsets[v + 1] = offsets[v] + views[v].keypoints.size();
+        }
+
+        std::vector<int> parent(offsets.back());
+        std::vector<unsigned char> matched(offsets.back(), 0);
+        for (int k = 0; k < parent.size(); ++k)
+            parent[k] = k;
+
+        for (int e = 0; e < pairs.size(); ++e)
+        {
+            const ViewPair& pair = pairs[e];
+            if (!registered[pair.i] || !registered[pair.j])
+                continue;
+
+            for (int m = 0; m < pair.matches.size(); ++m)
+            {
+                int a = offsets[pair.i] + pair.matches[m].queryIdx;
+                int b = offsets[pair.j] + pair.matches[m].trainIdx;
+                matched[a] = matched[b] = 1;
+
+                a = find_root(parent, a);
+                b = find_root(parent, b);
+                if (a != b)
+                    parent[b] = a;
+            }
+        }
+
+        std::map<int, int> track_index;
+        tracks.clear();
+        for (int v = 0; v < views.size(); ++v)
+        {
+            for (int k = 0; k < views[v].keypoints.size(); ++k)
+            {
+                int node = offsets[v] + k;
+                if (!matched[node])
+                    continue;
+
+                int root = find_root(parent, node);
+                std::map<int, int>::iterator it = track_index.find(root);
+                if (it == track_index.end())
+                {
+                    it = track_index.insert(std::make_pair(root, (int) tracks.size())).first;
+                    tracks.push_back(Track());
+                }
+
+                tracks[it->second].views.push_back(v);
+                tracks[it->second].keypoints.push_back(k);
+            }
+        }
+
+        // Keep tracks seen at least twice and never twice in the same view
+        std::vector<Track> kept;
+        for (int t = 0; t < tracks.size(); ++t)
+        {
+            const Track& track = tracks[t];
+            if (track.views.size() < 2)
+                continue;
+
+            bool consistent = true;
+            for (int k = 1; k < track.views.size() && consistent; ++k)
+            {
+                consistent = track.views[k] != track.views[k - 1];
+            }
+
+            if (consistent)
+                kept.push_back(track);
+        }
+
+        tracks.swap(kept);
+    }
+
+    void triangulate_tracks(
+        const std::vector<View>& views,
+        const cv::Mat& K,
+        Reconstruction& recon)
+    {
+        const int n = recon.tracks.size();
+        cv::Matx33d K_inv = cv::Matx33d(K).inv();
+
+        // Flatten the tracks into normalized observations
+        MultiView::TrackBatch batch;
+        batch.offsets.reserve(n + 1);
+        batch.offsets.push_back(0);
+        for (int t = 0; t < n; ++t)
+        {
+            const Track& track = recon.tracks[t];
+            for (int k = 0; k < track.views.size(); ++k)
+            {
+                const cv::KeyPoint& kp = views[track.views[k]].keypoints[track.keypoints[k]];
+                cv::Vec3d x = K_inv * cv::Vec3d(kp.pt.x, kp.pt.y, 1.0);
+                batch.views.push_back(track.views[k]);
+                batch.observations.push_back(cv::Point2d(x(0) / x(2), x(1) / x(2)));
+            }
+            batch.offsets.push_back(batch.views.size());
+        }
+
+        std::vector<cv::Matx34d> projections(recon.rotations.size());
+        for (int v = 0; v < projections.size(); ++v)
+        {
+            const cv::Matx33d& R = recon.rotations[v];
+            const cv::Vec3d& tr = recon.translations[v];
+            projections[v] = cv::Matx34d(R(0, 0), R(0, 1), R(0, 2), tr(0),
+                                         R(1, 0), R(1, 1), R(1, 2), tr(1),
+                                         R(2, 0), R(2, 1), R(2, 2), tr(2));
+        }
+
+        std::vector<cv::Point3d> points;
+        std::vector<unsigned char> valid, inliers;
+        MultiView::triangulate(batch, projections, max_track_error * K_inv(0, 0),
+                               points, valid, inliers);
+        cv::parallel_for_(cv::Range(0, n), ParallaxBody(batch, recon.rotations, inliers, valid));
+
+        // Keep the surviving tracks without their outlier observations
+        recon.points.clear();
+        std::vector<Track> tracks;
+        for (int t = 0; t < n; ++t)
+        {
+            if (!valid[t])
+                continue;
+
+            const Track& track = recon.tracks[t];
+            Track kept;
+            for (int k = 0; k < track.views.size(); ++k)
+            {
+                if (inliers[batch.offsets[t] + k])
+                {
+                    kept.views.push_back(track.views[k]);
+                    kept.keypoints.push_back(track.keypoints[k]);
+                }
+            }
+
+            recon.points.push_back(points[t]);
+            tracks.push_back(kept);
+        }
+        recon.tracks.swap(tracks);
+    }
+
+    void bundle_adjust(
+        const std::vector<View>& views,
+        const cv::Mat& K,
+        Reconstruction& recon)
+    {
+        std::vector<BundleAdjust::Observation> observations;
+        for (int p = 0; p < recon.tracks.size(); ++p)
+        {
+            const Track& track = recon.tracks[p];
+            for (int k = 0; k < track.views.size(); ++k)
+            {
+                BundleAdjust::Observation o;
+                o.view = track.views[k];
+                o.point = p;
+                o.pixel = views[o.view].keypoints[track.keypoints[k]].pt;
+                observations.push_back(o);
+            }
+        }
+
+        // The first registered view holds the gauge
+        std::vector<unsigned char> fixed(recon.registered.size(), 0);
+        for (int v = 0; v < fixed.size(); ++v)
+        {
+            if (recon.registered[v])
+            {
+                fixed[v] = 1;
+                break;
+            }
+        }
+
+        double error = BundleAdjust::adjust(
+            observations,
+            cv::Matx33d(K),
+            recon.rotations,
+            recon.translations,
+            recon.points,
+            fixed);
+
+        printf("Bundle adjustment: %ld points, %0.4f px mean error\n",
+            recon.points.size(), error);
+    }
+
+    bool reconstruct(
+        const std::vector<View>& views,
+        const cv::Mat& K,
+        Reconstruction& recon)
+    {
+        assert(K.size() == cv::Size(3, 3) && K.type() == CV_64F);
+
+        double t = cv::getTickCount();
+        std::vector<ViewPair> pairs;
+        relative_poses(views, K, pairs);
+        printf("[relative_poses]: %ld pairs, %0.4f seconds\n",
+            pairs.size(), (cv::getTickCount() - t) / cv::getTickFrequency());
+
+        t = cv::getTickCount();
+        if (!average_rotations(views.size(), pairs, recon.rotations, recon.registered))
+            return false;
+        average_translations(pairs, recon.rotations, recon.registered, recon.translations);
+        printf("[motion_averaging]: %0.4f seconds\n",
+            (cv::getTickCount() - t) / cv::getTickFrequency());
+
+        t = cv::getTickCount();
+        build_tracks(views, pairs, recon.registered, recon.tracks);
+        triangulate_tracks(views, K, recon);
+        printf("[triangulate_tracks]: %ld points, %0.4f seconds\n",
+            recon.points.size(), (cv::getTickCount() - t) / cv::getTickFrequency());
+
+        if (recon.points.empty())
+            return false;
+
+        t = cv::getTickCount();
+        bundle_adjust(views, K, recon);
+        printf("[bundle_adjust]: %0.4f seconds\n",
+            (cv::getTickCount() - t) / cv::getTickFrequency());
+
+        return true;
+    }
+}
@@ -0,0 +1,102 @@
+#ifndef __GLOBAL_SFM_HPP__
+#define __GLOBAL_SFM_HPP__
+
+#include <vector>
+#include <core.hpp>
+
+// Global (non-incremental) structure from motion:
+//
+// 1. Relative poses for the pairs of views that image retrieval proposes
+// 2. Robust rotation averaging over the view graph
+// 3. Translation averaging given the global rotations
+// 4. Triangulation of every track in one parallel pass
+// 5. A single bundle adjustment
+//
+// Poses follow the MultiView convention: x_camera = R * x_world + t.
+namespace GlobalSfM
+{
+    struct View
+    {
+        std::vector<cv::KeyPoint> keypoints;
+        cv::Mat                   descriptors;
+    };
+
+    // Pose of view j relative to view i (x_j = rotation * x_i + translation).
+    // The translation is only known up to scale.
+    struct ViewPair
+    {
+        int i, j;
+        cv::Matx33d rotation;
+        cv::Vec3d   translation;
+
+        // Inlier matches, queryIdx indexes view i and trainIdx view j
+        std::vector<cv::DMatch> matches;
+    };
+
+    // A feature followed across views, at most one keypoint per view
+    struct Track
+    {
+        std::vector<int> views;
+        std::vector<int> keypoints;
+    };
+
+    struct Reconstruction
+    {
+        std::vector<cv::Matx33d>   rotations;
+        std::vector<cv::Vec3d>     translations;
+        std::vector<unsigned char> registered;
+
+        // tracks[i] is the track that produced points[i]
+        std::vector<cv::Point3d>   points;
+        std::vector<Track>         tracks;
+    };
+
+    // Only pairs among each view's most similar views by bag of words are
+    // matched and verified, rather than all N^2 / 2 of them.
+    void relative_poses(
+        const std::vector<View>& views,
+        const cv::Mat& K,
+        std::vector<ViewPair>& pairs);
+
+    // Removes pairs that disagree with the averaged rotations. Views that
+    // are not connected to the largest component are left unregistered.
+    bool average_rotations(
+        int n_views,
+        std::vector<ViewPair>& pairs,
+        std::vector<cv::Matx33d>& rotations,
+        std::vector<unsigned char>& registered);
+
+    // Views held by fewer than two direction constraints, counting only
+    // the ones the solution doesn't point backwards, can't be placed and
+    // are unregistered.
+    void average_translations(
+        const std::vector<ViewPair>& pairs,
+        const std::vector<cv::Matx33d>& rotations,
+        std::vector<unsigned char>& registered,
+        std::vector<cv::Vec3d>& translations);
+
+    void build_tracks(
+        const std::vector<View>& views,
+        const std::vector<ViewPair>& pairs,
+        const std::vector<unsigned char>& registered,
+        std::vector<Track>& tracks);
+
+    // Triangulates recon.tracks and drops the ones that are behind a
+    // camera or reproject poorly, keeping points and tracks aligned.
+    void triangulate_tracks(
+        const std::vector<View>& views,
+        const cv::Mat& K,
+        Reconstruction& recon);
+
+    void bundle_adjust(
+        const std::vector<View>& views,
+        const cv::Mat& K,
+        Reconstruction& recon);
+
+    bool reconstruct(
+        const std::vector<View>& views,
+        const cv::Mat& K,
+        Reconstruction& recon);
+}
+
+#endif
@@ -0,0 +1,86 @@
+#include "InvertedIndex.hpp"
+
+#include <cassert>
+#include <algorithm>
+
+namespace
+{
+    struct BetterScore
+    {
+        bool operator()(const InvertedIndex::Candidate& a, const InvertedIndex::Candidate& b) const
+        {
+            return a.score > b.score || (a.score == b.score && a.keyframe < b.keyframe);
+        }
+    };
+}
+
+InvertedIndex::InvertedIndex(int words)
+{
+    clear(words);
+}
+
+void InvertedIndex::clear(int words)
+{
+    _lists.assign(words, std::vector<Entry>());
+    _size = 0;
+    _scores.clear();
+    _touched.clear();
+}
+
+void InvertedIndex::add(int keyframe, const Vocabulary::BowVector& bow)
+{
+    assert(keyframe >= 0);
+
+    for (int i = 0; i < bow.size(); ++i)
+    {
+        assert(bow[i].first < _lists.size());
+        _lists[bow[i].first].push_back(Entry(keyframe, bow[i].second));
+    }
+
+    if (keyframe >= _scores.size())
+        _scores.resize(keyframe + 1, 0.0);
+    ++_size;
+}
+
+int InvertedIndex::size() const
+{
+    return _size;
+}
+
+void InvertedIndex::query(
+    const Vocabulary::BowVector& bow,
+    int max_results,
+    double min_score,
+    std::vector<Candidate>& candidates)
+{
+    candidates.clear();
+    _touched.clear();
+
+    // Sum of the smaller weight over shared words, as Vocabulary::score
+    for (int i = 0; i < bow.size(); ++i)
+    {
+        const std::vector<Entry>& list = _lists[bow[i].first];
+        for (int j = 0; j < list.size(); ++j)
+        {
+            double& score = _scores[list[j].first];
+            if (score == 0.0)
+                _touched.push_back(list[j].first);
+            score += std::min(bow[i].second, list[j].second);
+        }
+    }
+
+    for (int i = 0; i < _touched.size(); ++i)
+    {
+        const int keyframe = _touched[i];
+        if (_scores[keyframe] >= min_score)
+        {
+            Candidate candidate = { keyframe, _scores[keyframe] };
+            candidates.push_back(candidate);
+        }
+        _scores[keyframe] = 0.0;
+    }
+
+    const int kept = std::min<int>(max_results, candidates.size());
+    std::partial_sort(candidates.begin(), candidates.begin() + kept, candidates.end(), BetterScore());
+    candidates.resize(kept);
+}
@@ -0,0 +1,50 @@
+#ifndef __INVERTED_INDEX_HPP__
+#define __INVERTED_INDEX_HPP__
+
+#include <vector>
+
+#include "Vocabulary.hpp"
+
+// Inverted file over the bag-of-words vectors of keyframes: every word
+// lists the keyframes containing it with their weight. A query only visits
+// the lists of its own words, so it touches the keyframes sharing a word
+// with it instead of scoring every keyframe.
+class InvertedIndex
+{
+public:
+    struct Candidate
+    {
+        int keyframe;
+        double score;   // Vocabulary::score with the query
+    };
+
+    explicit InvertedIndex(int words = 0);
+
+    void clear(int words);
+
+    // Keyframe ids are whatever the caller uses, but have to be small
+    // non-negative integers
+    void add(int keyframe, const Vocabulary::BowVector& bow);
+
+    int size() const;
+
+    // The keyframes scoring at least min_score against bow, best first, at
+    // most max_results of them. Reuses internal buffers, so one index
+    // can't be queried from two threads at once.
+    void query(
+        const Vocabulary::BowVector& bow,
+        int max_results,
+        double min_score,
+        std::vector<Candidate>& candidates);
+
+private:
+    typedef std::pair<int, float> Entry;   // keyframe and its weight
+
+    std::vector<std::vector<Entry> > _lists;
+    int _size;
+
+    std::vector<double> _scores;   // per keyframe, zero outside a query
+    std::vector<int> _touched;
+};
+
+#endif
@@ -0,0 +1,451 @@
+#include "KeyframeMap.hpp"
+
+#include <cassert>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+
+namespace
+{
+    const int initial_buckets = 1024;
+
+    // Binary layout, all fields in host byte order:
+    //   char[4] magic, int32 version, float64 voxel size, int32 keyframes,
+    //   int32 points, then float64 x, y, z per point, then per keyframe
+    //   int32 frame, float64 rotation[9], translation[3], int32 points,
+    //   int32 described, int32 descriptor bytes, the point indices, the
+    //   described point indices, float64 x, y per observation and the
+    //   descriptor rows.
+    const char binary_magic[4] = { 'K', 'F', 'M', 'P' };
+    const int  binary_version  = 1;
+
+    template <typename T>
+    bool write(FILE* file, const T* values, int count)
+    {
+        return count == 0 || fwrite(values, sizeof(T), count, file) == count;
+    }
+
+    template <typename T>
+    bool read(FILE* file, T* values, int count)
+    {
+        return count == 0 || fread(values, sizeof(T), count, file) == count;
+    }
+
+    // Orders covisible keyframes by shared points, most first
+    struct MoreShared
+    {
+        bool operator()(const std::pair<int, int>& a, const std::pair<int, int>& b) const
+        {
+            return a.second > b.second || (a.second == b.second && a.first < b.first);
+        }
+    };
+}
+
+KeyframeMap::KeyframeMap(double voxel_size)
+{
+    clear(voxel_size);
+}
+
+void KeyframeMap::clear(double voxel_size)
+{
+    assert(voxel_size > 0.0);
+    _voxel_size = voxel_size;
+
+    _keyframes.clear();
+    _points.clear();
+    _next.clear();
+    _voxels.clear();
+    _buckets.assign(initial_buckets, -1);
+}
+
+int KeyframeMap::add_keyframe(int frame, const cv::Matx33d& rotation, const cv::Vec3d& translation)
+{
+    Keyframe keyframe;
+    keyframe.frame = frame;
+    keyframe.rotation = rotation;
+    keyframe.translation = translation;
+    _keyframes.push_back(keyframe);
+
+    return _keyframes.size() - 1;
+}
+
+int KeyframeMap::add_point(const cv::Point3d& position)
+{
+    const int index = _points.size();
+
+    MapPoint point;
+    point.position = position;
+    _points.push_back(point);
+    _next.push_back(-1);
+    _voxels.push_back(voxel(position));
+
+    if (_points.size() > _buckets.size())
+        rehash(2 * _buckets.size());
+    else
+        insert(index);
+
+    return index;
+}
+
+void KeyframeMap::move_point(int point, const cv::Point3d& position)
+{
+    assert(point >= 0 && point < _points.size());
+    _points[point].position = position;
+
+    const cv::Vec3i v = voxel(position);
+    if (v != _voxels[point])
+    {
+        remove(point);
+        _voxels[point] = v;
+        insert(point);
+    }
+}
+
+void KeyframeMap::observe(int keyframe, int point)
+{
+    assert(keyframe >= 0 && keyframe < _keyframes.size());
+    assert(point >= 0 && point < _points.size());
+
+    std::vector<int>& seen_by = _points[point].keyframes;
+    if (std::find(seen_by.begin(), seen_by.end(), keyframe) != seen_by.end())
+        return;
+
+    for (int i = 0; i < seen_by.size(); ++i)
+    {
+        ++_keyframes[keyframe].covisible[seen_by[i]];
+        ++_keyframes[seen_by[i]].covisible[keyframe];
+    }
+
+    seen_by.push_back(keyframe);
+    _keyframes[keyframe].points.push_back(point);
+}
+
+void KeyframeMap::describe(
+    int keyframe,
+    const cv::Mat& descriptors,
+    const std::vector<int>& points,
+    const std::vector<cv::Point2d>& observations)
+{
+    assert(keyframe >= 0 && keyframe < _keyframes.size());
+    assert(descriptors.rows == points.size() && points.size() == observations.size());
+
+    Keyframe& k = _keyframes[keyframe];
+    descriptors.copyTo(k.descriptors);
+    k.described = points;
+    k.observations = observations;
+}
+
+int KeyframeMap::keyframes() const
+{
+    return _keyframes.size();
+}
+
+int KeyframeMap::points() const
+{
+    return _points.size();
+}
+
+double KeyframeMap::voxel_size() const
+{
+    return _voxel_size;
+}
+
+const KeyframeMap::Keyframe& KeyframeMap::keyframe(int i) const
+{
+    assert(i >= 0 && i < _keyframes.size());
+    return _keyframes[i];
+}
+
+const KeyframeMap::MapPoint& KeyframeMap::point(int i) const
+{
+    assert(i >= 0 && i < _points.size());
+    return _points[i];
+}
+
+void KeyframeMap::covisible(int keyframe, int min_shared, std::vector<int>& neighbours) const
+{
+    const std::map<int, int>& links = KeyframeMap::keyframe(keyframe).covisible;
+
+    std::vector<std::pair<int, int> > sorted;
+    for (std::map<int, int>::const_iterator it = links.begin(); it != links.end(); ++it)
+    {
+        if (it->second >= min_shared)
+            sorted.push_back(*it);
+    }
+    std::sort(sorted.begin(), sorted.end(), MoreShared());
+
+    neighbours.resize(sorted.size());
+    for (int i = 0; i < sorted.size(); ++i)
+    {
+        neighbours[i] = sorted[i].first;
+    }
+}
+
+void KeyframeMap::visible(
+    const cv::Matx33d& rotation,
+    const cv::Vec3d& translation,
+    const cv::Matx33d& K,
+    const cv::Size& size,
+    double max_depth,
+    std::vector<int>& points,
+    std::vector<cv::Point2d>& normalized) const
+{
+    points.clear();
+    normalized.clear();
+
+    // Image bounds in normalized coordinates
+    const double x0 = -K(0, 2) / K(0, 0), x1 = (size.width - K(0, 2)) / K(0, 0);
+    const double y0 = -K(1, 2) / K(1, 1), y1 = (size.height - K(1, 2)) / K(1, 1);
+
+    // Frustum side planes n . x <= 0 in camera coordinates
+    const cv::Vec3d planes[4] =
+    {
+        cv::Vec3d( 1,  0, -x1),
+        cv::Vec3d(-1,  0,  x0),
+        cv::Vec3d( 0,  1, -y1),
+        cv::Vec3d( 0, -1,  y0),
+    };
+    double plane_norms[4];
+    for (int k = 0; k < 4; ++k)
+    {
+        plane_norms[k] = cv::norm(planes[k]);
+    }
+
+    // World bounding box of the camera center and the far corners
+    const cv::Matx33d Rt = rotation.t();
+    const cv::Vec3d center = -(Rt * translation);
+    cv::Vec3d low = center, high = center;
+    const double corners[4][2] = { {x0, y0}, {x1, y0}, {x0, y1}, {x1, y1} };
+    for (int k = 0; k < 4; ++k)
+    {
+        const cv::Vec3d corner = center + Rt * cv::Vec3d(corners[k][0], corners[k][1], 1.0) * max_depth;
+        for (int a = 0; a < 3; ++a)
+        {
+            low(a) = std::min(low(a), corner(a));
+            high(a) = std::max(high(a), corner(a));
+        }
+    }
+
+    const cv::Vec3i first = voxel(cv::Point3d(low(0), low(1), low(2)));
+    const cv::Vec3i last = voxel(cv::Point3d(high(0), high(1), high(2)));
+
+    // A voxel is skipped when the sphere around it misses the frustum
+    const double radius = 0.5 * std::sqrt(3.0) * _voxel_size;
+
+    for (int i = first(0); i <= last(0); ++i)
+    {
+        for (int j = first(1); j <= last(1); ++j)
+        {
+            for (int k = first(2); k <= last(2); ++k)
+            {
+                const cv::Vec3i v(i, j, k);
+                const cv::Vec3d middle((i + 0.5) * _voxel_size, (j + 0.5) * _voxel_size, (k + 0.5) * _voxel_size);
+                const cv::Vec3d c = rotation * middle + translation;
+
+                if (c(2) < -radius || c(2) > max_depth + radius)
+                    continue;
+
+                bool outside = false;
+                for (int p = 0; p < 4 && !outside; ++p)
+                {
+                    outside = planes[p].dot(c) > radius * plane_norms[p];
+                }
+                if (outside)
+                    continue;
+
+                for (int q = _buckets[bucket(v)]; q >= 0; q = _next[q])
+                {
+                    // Other voxels can share the bucket
+                    if (_voxels[q] != v)
+                        continue;
+
+                    const cv::Point3d& X = _points[q].position;
+                    const cv::Vec3d x = rotation * cv::Vec3d(X.x, X.y, X.z) + translation;
+                    if (x(2) <= 0.0 || x(2) > max_depth)
+                        continue;
+
+                    const cv::Point2d n(x(0) / x(2), x(1) / x(2));
+                    if (n.x >= x0 && n.x < x1 && n.y >= y0 && n.y < y1)
+                    {
+                        points.push_back(q);
+                        normalized.push_back(n);
+                    }
+                }
+            }
+        }
+    }
+}
+
+bool KeyframeMap::save(const std::string& path) const
+{
+    FILE* file = fopen(path.c_str(), "wb");
+    if (!file)
+    {
+        printf("Could not open %s for writing\n", path.c_str());
+        return false;
+    }
+
+    const int counts[2] = { (int) _keyframes.size(), (int) _points.size() };
+    bool ok = write(file, binary_magic, 4)
+           && write(file, &binary_version, 1)
+           && write(file, &_voxel_size, 1)
+           && write(file, counts, 2);
+
+    for (int i = 0; ok && i < _points.size(); ++i)
+    {
+        ok = write(file, &_points[i].position.x, 1)
+          && write(file, &_points[i].position.y, 1)
+          && write(file, &_points[i].position.z, 1);
+    }
+
+    for (int i = 0; ok && i < _keyframes.size(); ++i)
+    {
+        const Keyframe& k = _keyframes[i];
+        assert(k.descriptors.empty() || (k.descriptors.type() == CV_8U && k.descriptors.isContinuous()));
+
+        const int sizes[4] = { k.frame, (int) k.points.size(), (int) k.described.size(), k.descriptors.cols };
+        ok = write(file, sizes, 1)
+          && write(file, k.rotation.val, 9)
+          && write(file, k.translation.val, 3)
+          && write(file, sizes + 1, 3)
+          && write(file, k.points.empty() ? NULL : &k.points[0], k.points.size())
+          && write(file, k.described.empty() ? NULL : &k.described[0], k.described.size());
+
+        for (int j = 0; ok && j < k.observations.size(); ++j)
+        {
+            ok = write(file, &k.observations[j].x, 1) && write(file, &k.observations[j].y, 1);
+        }
+
+        ok = ok && write(file, k.descriptors.ptr<uchar>(), k.descriptors.rows * k.descriptors.cols);
+    }
+
+    fclose(file);
+    return ok;
+}
+
+bool KeyframeMap::load(const std::string& path)
+{
+    FILE* file = fopen(path.c_str(), "rb");
+    if (!file)
+        return false;
+
+    char magic[4];
+    int version = 0, counts[2] = { 0, 0 };
+    double voxel_size = 0.0;
+    bool ok = read(file, magic, 4) && memcmp(magic, binary_magic, 4) == 0
+           && read(file, &version, 1) && version == binary_version
+           && read(file, &voxel_size, 1) && voxel_size > 0.0
+           && read(file, counts, 2) && counts[0] >= 0 && counts[1] >= 0;
+
+    clear(ok ? voxel_size : 1.0);
+
+    for (int i = 0; ok && i < counts[1]; ++i)
+    {
+        cv::Point3d X;
+        ok = read(file, &X.x, 1) && read(file, &X.y, 1) && read(file, &X.z, 1);
+        if (ok)
+            add_point(X);
+    }
+
+    std::vector<int> points, described;
+    std::vector<cv::Point2d> observations;
+    cv::Mat descriptors;
+    for (int i = 0; ok && i < counts[0]; ++i)
+    {
+        int sizes[4];
+        cv::Matx33d rotation;
+        cv::Vec3d translation;
+        ok = read(file, sizes, 1)
+          && read(file, rotation.val, 9)
+          && read(file, translation.val, 3)
+          && read(file, sizes + 1, 3)
+          && sizes[1] >= 0 && sizes[2] >= 0 && sizes[3] >= 0;
+        if (!ok)
+            break;
+
+        points.resize(sizes[1]);
+        described.resize(sizes[2]);
+        observations.resize(sizes[2]);
+        ok = read(file, points.empty() ? NULL : &points[0], sizes[1])
+          && read(file, described.empty() ? NULL : &described[0], sizes[2]);
+
+        for (int j = 0; ok && j < sizes[2]; ++j)
+        {
+            ok = read(file, &observations[j].x, 1) && read(file, &observations[j].y, 1);
+        }
+
+        descriptors.create(sizes[2], sizes[3], CV_8U);
+        ok = ok && read(file, descriptors.ptr<uchar>(), sizes[2] * sizes[3]);
+
+        for (int j = 0; ok && j < sizes[1]; ++j)
+        {
+            ok = points[j] >= 0 && points[j] < _points.size();
+        }
+        for (int j = 0; ok && j < sizes[2]; ++j)
+        {
+            ok = described[j] >= 0 && described[j] < _points.size();
+        }
+        if (!ok)
+            break;
+
+        // Observing in keyframe order gives the same covisibility graph
+        // and per-point keyframe lists as when the map was built
+        const int keyframe = add_keyframe(sizes[0], rotation, translation);
+        for (int j = 0; j < points.size(); ++j)
+        {
+            observe(keyframe, points[j]);
+        }
+        if (!described.empty())
+            describe(keyframe, descriptors, described, observations);
+    }
+
+    fclose(file);
+    if (!ok)
+        clear(1.0);
+    return ok;
+}
+
+cv::Vec3i KeyframeMap::voxel(const cv::Point3d& position) const
+{
+    return cv::Vec3i((int) std::floor(position.x / _voxel_size),
+                     (int) std::floor(position.y / _voxel_size),
+                     (int) std::floor(position.z / _voxel_size));
+}
+
+// Spatial hash of Teschner et al., the table size being a power of two
+int KeyframeMap::bucket(const cv::Vec3i& voxel) const
+{
+    const unsigned int h = ((unsigned int) voxel(0) * 73856093u)
+                         ^ ((unsigned int) voxel(1) * 19349663u)
+                         ^ ((unsigned int) voxel(2) * 83492791u);
+    return h & (_buckets.size() - 1);
+}
+
+void KeyframeMap::insert(int point)
+{
+    const int b = bucket(_voxels[point]);
+    _next[point] = _buckets[b];
+    _buckets[b] = point;
+}
+
+void KeyframeMap::remove(int point)
+{
+    int* link = &_buckets[bucket(_voxels[point])];
+    while (*link != point)
+    {
+        assert(*link >= 0);
+        link = &_next[*link];
+    }
+    *link = _next[point];
+    _next[point] = -1;
+}
+
+void KeyframeMap::rehash(int buckets)
+{
+    _buckets.assign(buckets, -1);
+    for (int i = 0; i < _points.size(); ++i)
+    {
+        insert(i);
+    }
+}
@@ -0,0 +1,117 @@
+#ifndef __KEYFRAME_MAP_HPP__
+#define __KEYFRAME_MAP_HPP__
+
+#include <map>
+#include <string>
+#include <vector>
+#include <core.hpp>
+
+// Keyframes and the map points they observe, with the two indices a
+// tracking loop needs to find candidate points without going over the
+// whole map:
+//
+//  - a covisibility graph between keyframes, weighted by the number of
+//    map points they share
+//  - a voxel hash over point positions, so a frustum query visits only
+//    the voxels in front of the camera and its cost depends on the voxel
+//    size and depth range, not on the size of the map
+//
+// Poses follow the MultiView convention x_camera = R * x_world + t.
+class KeyframeMap
+{
+public:
+    struct Keyframe
+    {
+        int frame;
+        cv::Matx33d rotation;
+        cv::Vec3d translation;
+
+        std::vector<int> points;
+
+        // Other keyframe -> number of shared points
+        std::map<int, int> covisible;
+
+        // Binary descriptors of some of the points, one row per entry of
+        // described, with their normalized coordinates on this keyframe
+        cv::Mat descriptors;
+        std::vector<int> described;
+        std::vector<cv::Point2d> observations;
+    };
+
+    struct MapPoint
+    {
+        cv::Point3d position;
+        std::vector<int> keyframes;
+    };
+
+    explicit KeyframeMap(double voxel_size = 1.0);
+
+    // Empties the map, picking a new voxel size (map units) for the hash
+    void clear(double voxel_size);
+
+    int add_keyframe(int frame, const cv::Matx33d& rotation, const cv::Vec3d& translation);
+    int add_point(const cv::Point3d& position);
+    void move_point(int point, const cv::Point3d& position);
+
+    // Records that keyframe sees point, linking keyframe in the
+    // covisibility graph with every other keyframe that does
+    void observe(int keyframe, int point);
+
+    // Attaches descriptors of the given points to keyframe, for matching
+    // against it when relocalizing or closing loops
+    void describe(
+        int keyframe,
+        const cv::Mat& descriptors,
+        const std::vector<int>& points,
+        const std::vector<cv::Point2d>& observations);
+
+    int keyframes() const;
+    int points() const;
+    double voxel_size() const;
+
+    const Keyframe& keyframe(int i) const;
+    const MapPoint& point(int i) const;
+
+    // Keyframes sharing at least min_shared points with keyframe, most
+    // shared first
+    void covisible(int keyframe, int min_shared, std::vector<int>& neighbours) const;
+
+    // Points between the camera and max_depth whose projection lands in
+    // an image of the given size, with their normalized coordinates
+    // (pinhole, no distortion)
+    void visible(
+        const cv::Matx33d& rotation,
+        const cv::Vec3d& translation,
+        const cv::Matx33d& K,
+        const cv::Size& size,
+        double max_depth,
+        std::vector<int>& points,
+        std::vector<cv::Point2d>& normalized) const;
+
+    // Binary blob of keyframes, points and descriptors; the covisibility
+    // graph and the voxel hash are rebuilt on load, which returns false
+    // (leaving the map empty) if the file isn't one
+    bool save(const std::string& path) const;
+    bool load(const std::string& path);
+
+private:
+    double _voxel_size;
+
+    std::vector<Keyframe> _keyframes;
+    std::vector<MapPoint> _points;
+
+    // Chained hash: the first point of each bucket, then the next point
+    // of the same bucket per point. The table doubles once there are more
+    // points than buckets.
+    std::vector<int> _buckets;
+    std::vector<int> _next;
+    std::vector<cv::Vec3i> _voxels;
+
+    cv::Vec3i voxel(const cv::Point3d& position) const;
+    int bucket(const cv::Vec3i& voxel) const;
+    void insert(int point);
+    void remove(int point);
+    void rehash(int buckets);
+};
+
+#endif
@@ -0,0 +1,184 @@
+#include "LocalizationProtocol.hpp"
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cassert>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+namespace
+{
+    const char request_magic[4]  = { 'L', 'O', 'C', 'Q' };
+    const char response_magic[4] = { 'L', 'O', 'C', 'R' };
+
+    // Larger images are taken as a corrupt header
+    const int max_side = 1 << 14;
+
+    bool write_all(int socket, const void* data, size_t bytes)
+    {
+        const char* p = (const char*) data;
+        while (bytes > 0)
+        {
+            const ssize_t n = ::write(socket, p, bytes);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0)
+                return false;
+            p += n;
+            bytes -= n;
+        }
+        return true;
+    }
+
+    bool read_all(int socket, void* data, size_t bytes)
+    {
+        char* p = (char*) data;
+        while (bytes > 0)
+        {
+            const ssize_t n = ::read(socket, p, bytes);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0)
+                return false;
+            p += n;
+            bytes -= n;
+        }
+        return true;
+    }
+
+    bool address(const std::string& path, sockaddr_un& addr)
+    {
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        if (path.size() >= sizeof(addr.sun_path))
+        {
+            printf("Socket path %s is too long\n", path.c_str());
+            return false;
+        }
+        strcpy(addr.sun_path, path.c_str());
+        return true;
+    }
+}
+
+namespace LocalizationProtocol
+{
+    int listen(const std::string& path)
+    {
+        sockaddr_un addr;
+        if (!address(path, addr))
+            return -1;
+
+        const int server = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        if (server < 0)
+            return -1;
+
+        ::unlink(path.c_str());
+        if (::bind(server, (const sockaddr*) &addr, sizeof(addr)) < 0 || ::listen(server, 4) < 0)
+        {
+            printf("Could not listen on %s: %s\n", path.c_str(), strerror(errno));
+            ::close(server);
+            return -1;
+        }
+        return server;
+    }
+
+    int accept(int server)
+    {
+        int client;
+        do
+        {
+            client = ::accept(server, NULL, NULL);
+        }
+        while (client < 0 && errno == EINTR);
+        return client;
+    }
+
+    int connect(const std::string& path)
+    {
+        sockaddr_un addr;
+        if (!address(path, addr))
+            return -1;
+
+        const int client = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        if (client < 0)
+            return -1;
+
+        if (::connect(client, (const sockaddr*) &addr, sizeof(addr)) < 0)
+        {
+            printf("Could not connect to %s: %s\n", path.c_str(), strerror(errno));
+            ::close(client);
+            return -1;
+        }
+        return client;
+    }
+
+    void close(int socket)
+    {
+        if (socket >= 0)
+            ::close(socket);
+    }
+
+    bool send_image(int socket, const cv::Mat& gray)
+    {
+        assert(gray.type() == CV_8UC1);
+
+        const int size[2] = { gray.cols, gray.rows };
+        bool ok = write_all(socket, request_magic, 4) && write_all(socket, size, sizeof(size));
+
+        if (gray.isContinuous())
+            return ok && write_all(socket, gray.data, gray.total());
+
+        for (int r = 0; ok && r < gray.rows; ++r)
+        {
+            ok = write_all(socket, gray.ptr(r), gray.cols);
+        }
+        return ok;
+    }
+
+    bool receive_image(int socket, cv::Mat& gray)
+    {
+        char magic[4];
+        int size[2];
+        if (!read_all(socket, magic, 4) || memcmp(magic, request_magic, 4) != 0
+            || !read_all(socket, size, sizeof(size))
+            || size[0] <= 0 || size[1] <= 0 || size[0] > max_side || size[1] > max_side)
+        {
+            return false;
+        }
+
+        gray.create(size[1], size[0], CV_8UC1);
+        return read_all(socket, gray.data, gray.total());
+    }
+
+    bool send_response(int socket, const Response& response)
+    {
+        const int header[3] = { response.located, response.keyframe, response.inliers };
+        return write_all(socket, response_magic, 4)
+            && write_all(socket, header, sizeof(header))
+            && write_all(socket, response.rotation.val, 9 * sizeof(double))
+            && write_all(socket, response.translation.val, 3 * sizeof(double))
+            && write_all(socket, &response.seconds, sizeof(double));
+    }
+
+    bool receive_response(int socket, Response& response)
+    {
+        char magic[4];
+        int header[3];
+        if (!read_all(socket, magic, 4) || memcmp(magic, response_magic, 4) != 0
+            || !read_all(socket, header, sizeof(header))
+            || !read_all(socket, response.rotation.val, 9 * sizeof(double))
+            || !read_all(socket, response.translation.val, 3 * sizeof(double))
+            || !read_all(socket, &response.seconds, sizeof(double)))
+        {
+            return false;
+        }
+
+        response.located = header[0];
+        response.keyframe = header[1];
+        response.inliers = header[2];
+        return true;
+    }
+}
@@ -0,0 +1,45 @@
+#ifndef __LOCALIZATION_PROTOCOL_HPP__
+#define __LOCALIZATION_PROTOCOL_HPP__
+
+#include <string>
+#include <core.hpp>
+
+// Requests and replies between localization_server and its clients over a
+// Unix domain stream socket, all fields in host byte order:
+//
+//   request:  char[4] magic, int32 width, int32 height, then the 8-bit gray
+//             image, row by row
+//   response: char[4] magic, int32 located, int32 keyframe, int32 inliers,
+//             float64 rotation[9], translation[3], float64 seconds the
+//             server spent on the query
+//
+// Every call blocks until the whole message is through and returns false
+// if the peer went away or sent something else.
+namespace LocalizationProtocol
+{
+    struct Response
+    {
+        int located;
+        int keyframe;
+        int inliers;
+        cv::Matx33d rotation;     // x_camera = R * x_world + t
+        cv::Vec3d translation;
+        double seconds;
+    };
+
+    // Socket descriptors, or -1. listen replaces a stale socket file.
+    int listen(const std::string& path);
+    int accept(int server);
+    int connect(const std::string& path);
+    void close(int socket);
+
+    bool send_image(int socket, const cv::Mat& gray);
+
+    // gray keeps its buffer when the size doesn't change
+    bool receive_image(int socket, cv::Mat& gray);
+
+    bool send_response(int socket, const Response& response);
+    bool receive_response(int socket, Response& response);
+}
+
+#endif
@@ -0,0 +1,200 @@
+#include "Localizer.hpp"
+#include "Camera.hpp"
+#include "Features.hpp"
+#include "KeyframeMap.hpp"
+#include "Pose.hpp"
+
+#include <features2d.hpp>
+
+#include <cassert>
+#include <algorithm>
+
+namespace
+{
+    // Pixels, turned into normalized units with the focal length
+    const double reprojection_threshold = 2.0;
+
+    // Fewer inliers than this and the pose is not trusted
+    const int min_inliers = 30;
+
+    // Features detected on a query image, and keyframes tried for it
+    const int query_features   = 1000;
+    const int query_candidates = 5;
+
+    // Loop closure: candidates tried per keyframe, and how many keyframes
+    // back a candidate has to be
+    const int loop_candidates = 3;
+    const int min_loop_gap    = 10;
+}
+
+Localizer::Localizer(const Camera& camera, const Vocabulary* vocabulary, const KeyframeMap& map)
+: _camera(camera)
+, _vocabulary(vocabulary && !vocabulary->empty() ? vocabulary : NULL)
+, _map(map)
+, _threshold(reprojection_threshold / cv::Matx33d(camera.matrix())(0, 0))
+{
+    clear();
+}
+
+bool Localizer::enabled() const
+{
+    return _vocabulary != NULL;
+}
+
+void Localizer::clear()
+{
+    _index.clear(_vocabulary ? _vocabulary->words() : 0);
+    _bows.clear();
+}
+
+void Localizer::add(int keyframe)
+{
+    if (!_vocabulary)
+        return;
+
+    _bows.resize(std::max<int>(_bows.size(), keyframe + 1));
+
+    // Keyframes without descriptors stay out of the index
+    const KeyframeMap::Keyframe& k = _map.keyframe(keyframe);
+    if (k.descriptors.empty())
+        return;
+
+    if (_vocabulary->transform(k.descriptors, _bows[keyframe]))
+        _index.add(keyframe, _bows[keyframe]);
+}
+
+int Localizer::size() const
+{
+    return _index.size();
+}
+
+bool Localizer::localize(const cv::Mat& gray, Result& result)
+{
+    result.keyframe = -1;
+    result.inliers = 0;
+    if (!_vocabulary || _index.size() == 0)
+        return false;
+
+    Features::orbFeatures(gray, query_features, _keypoints, _descriptors);
+    if (_keypoints.size() < min_inliers)
+        return false;
+
+    _pixels.resize(_keypoints.size());
+    for (int i = 0; i < _keypoints.size(); ++i)
+    {
+        _pixels[i] = _keypoints[i].pt;
+    }
+    _camera.normalize(_pixels, _normalized);
+
+    if (!_vocabulary->transform(_descriptors, _bow))
+        return false;
+    _index.query(_bow, query_candidates, 0.0, _candidates);
+
+    for (int c = 0; c < _candidates.size(); ++c)
+    {
+        if (verify(_candidates[c].keyframe, _descriptors, _normalized, result) >= min_inliers)
+            return true;
+    }
+
+    result.keyframe = -1;
+    result.inliers = 0;
+    return false;
+}
+
+const std::vector<cv::KeyPoint>& Localizer::keypoints() const
+{
+    return _keypoints;
+}
+
+int Localizer::loop(int keyframe, Result& result)
+{
+    if (!_vocabulary || keyframe >= _bows.size() || _bows[keyframe].empty())
+        return -1;
+
+    const Vocabulary::BowVector& bow = _bows[keyframe];
+
+    _map.covisible(keyframe, 1, _neighbours);
+    double min_score = 1.0;
+    for (int i = 0; i < _neighbours.size(); ++i)
+    {
+        const int n = _neighbours[i];
+        if (n < _bows.size() && !_bows[n].empty())
+            min_score = std::min(min_score, Vocabulary::score(bow, _bows[n]));
+    }
+
+    // The keyframe itself and its neighbours may be in the index too
+    _index.query(bow, loop_candidates + _neighbours.size() + 1, min_score, _candidates);
+
+    const KeyframeMap::Keyframe& current = _map.keyframe(keyframe);
+    int tried = 0;
+    for (int c = 0; c < _candidates.size() && tried < loop_candidates; ++c)
+    {
+        const int candidate = _candidates[c].keyframe;
+        if (keyframe - candidate < min_loop_gap
+            || std::find(_neighbours.begin(), _neighbours.end(), candidate) != _neighbours.end())
+        {
+            continue;
+        }
+        ++tried;
+
+        if (verify(candidate, current.descriptors, current.observations, result) >= min_inliers)
+            return candidate;
+    }
+
+    return -1;
+}
+
+int Localizer::verify(
+    int keyframe,
+    const cv::Mat& descriptors,
+    const std::vector<cv::Point2d>& normalized,
+    Result& result)
+{
+    const KeyframeMap::Keyframe& k = _map.keyframe(keyframe);
+
+    result.keyframe = keyframe;
+    result.inliers = 0;
+    result.points.clear();
+    result.features.clear();
+
+    _matches.clear();
+    Features::match(descriptors, k.descriptors, _matches);
+    if (_matches.size() < min_inliers)
+        return 0;
+
+    _object.resize(_matches.size());
+    _image.resize(_matches.size());
+    result.points.resize(_matches.size());
+    result.features.resize(_matches.size());
+    for (int m = 0; m < _matches.size(); ++m)
+    {
+        const int point = k.described[_matches[m].trainIdx];
+        _object[m] = _map.point(point).position;
+        _image[m] = normalized[_matches[m].queryIdx];
+        result.points[m] = point;
+        result.features[m] = _matches[m].queryIdx;
+    }
+
+    if (!Pose::ransac(_object, _image, _threshold, result.rotation, result.translation, _mask))
+        return 0;
+
+    int n = 0;
+    for (int m = 0; m < _mask.size(); ++m)
+    {
+        if (_mask[m])
+        {
+            _object[n] = _object[m];
+            _image[n] = _image[m];
+            result.points[n] = result.points[m];
+            result.features[n] = result.features[m];
+            ++n;
+        }
+    }
+    result.points.resize(n);
+    result.features.resize(n);
+
+    if (n >= min_inliers)
+        Pose::refine(&_object[0], &_image[0], n, result.rotation, result.translation);
+    result.inliers = n;
+    return n;
+}
@@ -0,0 +1,93 @@
+#ifndef __LOCALIZER_HPP__
+#define __LOCALIZER_HPP__
+
+#include <vector>
+#include <core.hpp>
+
+#include "InvertedIndex.hpp"
+#include "Vocabulary.hpp"
+
+class Camera;
+class KeyframeMap;
+
+namespace cv
+{
+    class KeyPoint;
+    struct DMatch;
+}
+
+// Place recognition against a KeyframeMap. Keyframes with descriptors
+// (KeyframeMap::describe) go into an inverted index by their bag-of-words
+// vectors; an image is located by looking its ORB features up in the
+// index and verifying the best keyframes with PnP on their map points.
+class Localizer
+{
+public:
+    struct Result
+    {
+        int keyframe;             // the keyframe the pose was verified on
+        int inliers;
+        cv::Matx33d rotation;     // x_camera = R * x_world + t
+        cv::Vec3d translation;
+
+        // Per inlier, the map point and the query feature it matched
+        std::vector<int> points;
+        std::vector<int> features;
+    };
+
+    // Without a (non-empty) vocabulary nothing is indexed or found
+    Localizer(const Camera& camera, const Vocabulary* vocabulary, const KeyframeMap& map);
+
+    bool enabled() const;
+
+    void clear();
+
+    // Indexes a keyframe of the map by its descriptors
+    void add(int keyframe);
+
+    // Indexed keyframes
+    int size() const;
+
+    // Locates a gray image from its own ORB features, which keypoints()
+    // holds afterwards. Not thread-safe: queries share buffers.
+    bool localize(const cv::Mat& gray, Result& result);
+
+    const std::vector<cv::KeyPoint>& keypoints() const;
+
+    // An indexed keyframe well before keyframe that shares no points with
+    // it, scores above its worst covisible neighbour and gives keyframe a
+    // PnP pose from its own points: a loop. Returns -1 if there is none.
+    int loop(int keyframe, Result& result);
+
+    // PnP of descriptors, at the given normalized coordinates, against the
+    // keyframe's map points. Returns the number of inliers.
+    int verify(
+        int keyframe,
+        const cv::Mat& descriptors,
+        const std::vector<cv::Point2d>& normalized,
+        Result& result);
+
+private:
+    const Camera& _camera;
+    const Vocabulary* _vocabulary;
+    const KeyframeMap& _map;
+    double _threshold;   // reprojection threshold in normalized units
+
+    InvertedIndex _index;
+    std::vector<Vocabulary::BowVector> _bows;   // per keyframe
+
+    // Query scratch, kept to avoid reallocation
+    std::vector<cv::KeyPoint> _keypoints;
+    cv::Mat _descriptors;
+    std::vector<cv::Point2f> _pixels;
+    std::vector<cv::Point2d> _normalized;
+    Vocabulary::BowVector _bow;
+    std::vector<InvertedIndex::Candidate> _candidates;
+    std::vector<int> _neighbours;
+    std::vector<cv::DMatch> _matches;
+    std::vector<cv::Point3d> _object;
+    std::vector<cv::Point2d> _image;
+    std::vector<unsigned char> _mask;
+};
+
+#endif
@@ -4,10 +4,77 @@
 #include <cmath>
 #include <cstdio>
 #include <iostream>
+#include <limits>
 
 #include "Camera.hpp"
+#include "Geometry.hpp"
+#include "Reprojection.hpp"
 #include "Util.hpp"
 
+namespace
+{
+    // Squared reprojection error in normalized coordinates, or a
+    // negative value when the point is behind the camera.
+    double squared_error(
+        const cv::Point3d& X,
+        const cv::Matx34d& P,
+        const cv::Point2d& x)
+    {
+        double w = P(2, 0) * X.x + P(2, 1) * X.y + P(2, 2) * X.z + P(2, 3);
+        if (w <= 0.0)
+            return -1.0;
+
+        double u = (P(0, 0) * X.x + P(0, 1) * X.y + P(0, 2) * X.z + P(0, 3)) / w;
+        double v = (P(1, 0) * X.x + P(1, 1) * X.y + P(1, 2) * X.z + P(1, 3)) / w;
+        return (u - x.x) * (u - x.x) + (v - x.y) * (v - x.y);
+    }
+
+    class TriangulateBody : public cv::ParallelLoopBody
+    {
+    private:
+        const MultiView::TrackBatch& _tracks;
+        const std::vector<cv::Matx34d>& _projections;
+        double _max_error;
+        std::vector<cv::Point3d>& _points;
+        std::vector<unsigned char>& _valid;
+        std::vector<unsigned char>& _inliers;
+
+    public:
+        TriangulateBody(
+            const MultiView::TrackBatch& tracks,
+            const std::vector<cv::Matx34d>& projections,
+            double max_error,
+            std::vector<cv::Point3d>& points,
+            std::vector<unsigned char>& valid,
+            std::vector<unsigned char>& inliers)
+        : _tracks(tracks)
+        , _projections(projections)
+        , _max_error(max_error)
+        , _points(points)
+        , _valid(valid)
+        , _inliers(inliers)
+        {}
+
+        virtual void operator()(const cv::Range& range) const
+        {
+            for (int i = range.start; i < range.end; ++i)
+            {
+                const int begin = _tracks.offsets[i];
+                const int n = _tracks.offsets[i + 1] - begin;
+
+                _valid[i] = n >= 2 && MultiView::triangulate(
+                    &_tracks.observations[begin],
+                    &_tracks.views[begin],
+                    n,
+                    _projections,
+                    _max_error,
+                    _points[i],
+                    &_inliers[begin]);
+            }
+        }
+    };
+}
+
 namespace MultiView
 {
     void fundamental(
@@ -182,48 +249,37 @@ namespace MultiView
     {
         static const int max_iterations = 10;
 
+        // The rows of each view are weighted by 1 / its depth of the last
+        // estimate, the same as scaling its projection. Fixed-size
+        // systems, as this runs for every point of every pose candidate.
         double wi1 = 1.0, wi2 = 1.0;
-        cv::Mat_<double> X_(4, 1);
 
-        triangulate(x1, cv::Mat(P1), x2, cv::Mat(P2), point);
-        cv::Mat_<double> X = (cv::Mat_<double>(4, 1) << point.x,
-                                                        point.y,
-                                                        point.z,
-                                                        1.0);
+        Geometry::NormalEquations<double> equations;
+        equations.add(x1, P1);
+        equations.add(x2, P2);
+        if (!equations.solve(point))
+        {
+            point = cv::Point3d(0.0, 0.0, 0.0);
+            return;
+        }
 
         for (int i = 0; i < max_iterations; ++i)
         {
-            double p2x1 = cv::Mat_<double>(cv::Mat_<double>(P1).row(2) * X)(0);
-            double p2x2 = cv::Mat_<double>(cv::Mat_<double>(P2).row(2) * X)(0);
-            
+            double p2x1 = P1(2, 0) * point.x + P1(2, 1) * point.y + P1(2, 2) * point.z + P1(2, 3);
+            double p2x2 = P2(2, 0) * point.x + P2(2, 1) * point.y + P2(2, 2) * point.z + P2(2, 3);
+
             if (Util::eq(wi1, p2x1) && Util::eq(wi2, p2x2)) break;
-            
+
             wi1 = p2x1;
             wi2 = p2x2;
             assert(wi1 != 0.0 and wi2 != 0.0);
 
-            cv::Matx43d A;
-            for (int j = 0; j <= 2; ++j)
-            {
-                A(0, j) = (x1.x * P1(2, j) - P1(0, j)) / wi1;
-                A(1, j) = (x1.y * P1(2, j) - P1(1, j)) / wi1;
-                A(2, j) = (x2.x * P2(2, j) - P2(0, j)) / wi2;
-                A(3, j) = (x2.y * P2(2, j) - P2(1, j)) / wi2;
-            }
-
-            cv::Mat_<double> B = (cv::Mat_<double>(4,1) << -(x1.x * P1(2,3) - P1(0,3)) / wi1,
-                                                           -(x1.y * P1(2,3) - P1(1,3)) / wi1,
-                                                           -(x2.x * P2(2,3) - P2(0,3)) / wi2,
-                                                           -(x2.y * P2(2,3) - P2(1,3)) / wi2);
-            
-            solve(A, B, X_, cv::DECOMP_SVD);
-            X(0) = X_(0);
-            X(1) = X_(1);
-            X(2) = X_(2);
-            X(3) = 1.0;
+            Geometry::NormalEquations<double> weighted;
+            weighted.add(x1, P1 * (1.0 / wi1));
+            weighted.add(x2, P2 * (1.0 / wi2));
+            if (!weighted.solve(point))
+                break;
         }
-
-        point = cv::Point3d(X(0), X(1), X(2));
     }
 
     void triangulate(
@@ -304,130 +360,262 @@ namespace MultiView
         const cv::Mat& K2,
         std::vector<unsigned char>& inliers,
         std::vector<cv::Point3d>& points)
+    {
+        cv::Mat rotation, translation;
+        triangulate(pts1, K1, pts2, K2, inliers, points, rotation, translation);
+    }
+
+    bool triangulate(
+        const std::vector<cv::Point2d>& pts1,
+        const cv::Mat& K1,
+        const std::vector<cv::Point2d>& pts2,
+        const cv::Mat& K2,
+        std::vector<unsigned char>& inliers,
+        std::vector<cv::Point3d>& points,
+        cv::Mat& rotation,
+        cv::Mat& translation)
+    {
+        TwoViewWorkspace workspace;
+        TwoViewResult result;
+        if (!triangulate(pts1, cv::Matx33d(K1), pts2, cv::Matx33d(K2), workspace, result))
+        {
+            inliers.swap(result.epipolar_inliers);
+            points.clear();
+            return false;
+        }
+
+        inliers.swap(result.inliers);
+        points.swap(result.points);
+        rotation = cv::Mat(result.rotation);
+        translation = cv::Mat(result.translation);
+        return true;
+    }
+
+    bool triangulate(
+        const std::vector<cv::Point2d>& pts1,
+        const cv::Matx33d& K1,
+        const std::vector<cv::Point2d>& pts2,
+        const cv::Matx33d& K2,
+        TwoViewWorkspace& workspace,
+        TwoViewResult& result)
     {
         static const double min_percent_in_front = 0.75;
 
         assert(pts1.size() == pts2.size());
 
-        cv::Mat F, E;
-        fundamental(pts1, pts2, F, inliers);
-        essential(F, K1, K2, E);
+        result.epipolar_inliers.assign(pts1.size(), 0);
+        result.inliers.assign(pts1.size(), 0);
+        result.points.clear();
 
-        assert(inliers.size() == pts1.size());
-        assert(inliers.size() == pts2.size());
+        // findFundamentalMat needs 8 points for RANSAC and hands back an
+        // empty matrix when it finds no model
+        if (pts1.size() < 8)
+            return false;
 
-        std::vector<cv::Point2d> best_pts1, best_pts2;
-        Util::mask(pts1, inliers, best_pts1);
-        Util::mask(pts2, inliers, best_pts2);
+        cv::Mat& F = workspace.fundamental;
+        fundamental(pts1, pts2, F, result.epipolar_inliers);
+        if (F.size() != cv::Size(3, 3))
+        {
+            result.epipolar_inliers.assign(pts1.size(), 0);
+            return false;
+        }
+        assert(result.epipolar_inliers.size() == pts1.size());
 
-        std::vector<int> indices;
-        for (int i = 0; i < inliers.size(); ++i)
+        // Essential matrix projected onto the space of valid ones
+        cv::Matx33d E = K2.t() * cv::Matx33d(F) * K1;
+        cv::Matx31d w;
+        cv::Matx33d u, vt;
+        cv::SVD::compute(E, w, u, vt);
+        if (cv::determinant(u) < 0.0)
+            u = -u;
+        if (cv::determinant(vt) < 0.0)
+            vt = -vt;
+
+        const cv::Matx33d W(0, -1,  0,
+                            1,  0,  0,
+                            0,  0,  1);
+        const cv::Matx33d r1 = u * W * vt;
+        const cv::Matx33d r2 = u * W.t() * vt;
+        const cv::Vec3d t1(u(0, 2), u(1, 2), u(2, 2));
+
+        const cv::Matx33d rotations[4] = { r1, r1, r2, r2 };
+        const cv::Vec3d translations[4] = { t1, -t1, t1, -t1 };
+
+        // Normalized and pixel coordinates of the epipolar inliers
+        const cv::Matx33d K1_inv = K1.inv();
+        const cv::Matx33d K2_inv = K2.inv();
+
+        workspace.indices.clear();
+        for (int i = 0; i < result.epipolar_inliers.size(); ++i)
         {
-            indices.push_back(i);
+            if (result.epipolar_inliers[i])
+                workspace.indices.push_back(i);
         }
 
-        std::vector<int> best_indices;
-        Util::mask(indices, inliers, best_indices);
+        const int m = workspace.indices.size();
+        if (m == 0)
+            return false;
 
-        std::vector<cv::Mat> rotations, translations;
-        get_rotation_and_translation(E, rotations, translations);
+        workspace.normalized1.resize(m);
+        workspace.normalized2.resize(m);
+        workspace.observed1.resize(m);
+        workspace.observed2.resize(m);
+        for (int j = 0; j < m; ++j)
+        {
+            const cv::Point2d& p1 = pts1[workspace.indices[j]];
+            const cv::Point2d& p2 = pts2[workspace.indices[j]];
+            cv::Vec3d x1 = K1_inv * cv::Vec3d(p1.x, p1.y, 1.0);
+            cv::Vec3d x2 = K2_inv * cv::Vec3d(p2.x, p2.y, 1.0);
+
+            workspace.normalized1[j] = cv::Point2d(x1(0) / x1(2), x1(1) / x1(2));
+            workspace.normalized2[j] = cv::Point2d(x2(0) / x2(2), x2(1) / x2(2));
+            workspace.observed1.x[j] = p1.x;
+            workspace.observed1.y[j] = p1.y;
+            workspace.observed2.x[j] = p2.x;
+            workspace.observed2.y[j] = p2.y;
+        }
 
-        int n = rotations.size();
-        std::vector<std::vector<cv::Point3d> > clouds(n);
-        std::vector<std::vector<uchar> > in_front_inliers(n);
-        std::vector<double> in_front_percent1(n), in_front_percent2(n);
-        std::vector<double> projection_error1(n), projection_error2(n);
+        const cv::Matx34d P1(1, 0, 0, 0,
+                             0, 1, 0, 0,
+                             0, 0, 1, 0);
+        const cv::Matx34d KP1 = K1 * P1;
+        const double unbounded = std::numeric_limits<double>::max();
 
-        for (int i = 0; i < n; ++i)
+        // Take the first pose that puts the points in front of both views
+        for (int c = 0; c < 4; ++c)
         {
-            cv::Mat rotation = rotations[i];
-            cv::Mat translation = translations[i];
-
-            cv::Mat no_rotation = cv::Mat::eye(3, 3, CV_64F);
-            cv::Mat no_translation = cv::Mat::zeros(3, 1, CV_64F);
-            
-            triangulate(
-                best_pts1,
-                K1,
-                best_pts2,
-                K2,
-                rotation,
-                translation,
-                clouds[i]);
-
-            std::vector<cv::Point2d> projected_pts1, projected_pts2;
-            project(clouds[i], no_rotation, no_translation, K1, projected_pts1);
-            project(clouds[i], rotation, translation, K2, projected_pts2);
-
-            double in_front1 = 0.0, in_front2 = 0.0;
-            double proj_err1 = 0.0, proj_err2 = 0.0;
-
-            int num_points = best_pts1.size();
-            for (int j = 0; j < num_points; ++j)
+            const cv::Matx33d& R = rotations[c];
+            const cv::Vec3d& t = translations[c];
+            const cv::Matx34d P2(R(0, 0), R(0, 1), R(0, 2), t(0),
+                                 R(1, 0), R(1, 1), R(1, 2), t(1),
+                                 R(2, 0), R(2, 1), R(2, 2), t(2));
+
+            workspace.cloud.resize(m);
+            for (int j = 0; j < m; ++j)
             {
-                cv::Point3d pt3d1, pt3d2;
-                pt3d1 = clouds[i][j];
-                transform(pt3d1, rotation, translation, pt3d2);
-
-                in_front1 += pt3d1.z > 0.0;
-                in_front2 += pt3d2.z > 0.0;
-                bool in_front = pt3d1.z > 0.0 and pt3d2.z > 0.0;
-                in_front_inliers[i].push_back(in_front);
-
-                proj_err1 += cv::norm(cv::Mat(best_pts1[j]), cv::Mat(projected_pts1[j]));
-                proj_err2 += cv::norm(cv::Mat(best_pts2[j]), cv::Mat(projected_pts2[j]));
+                cv::Point3d X;
+                iterative_triangulate(workspace.normalized1[j], P1, workspace.normalized2[j], P2, X);
+                workspace.cloud.x[j] = X.x;
+                workspace.cloud.y[j] = X.y;
+                workspace.cloud.z[j] = X.z;
             }
 
-            assert(num_points != 0);
-            in_front1 /= num_points;
-            in_front2 /= num_points;
-            proj_err1 /= num_points;
-            proj_err2 /= num_points;
+            // With an unbounded threshold the inlier masks only hold the
+            // cheirality of each point (K has [0 0 1] as its last row).
+            Reprojection::Errors errors1 = Reprojection::errors(
+                workspace.cloud, KP1, workspace.observed1, unbounded, NULL, &workspace.in_front1);
+            Reprojection::Errors errors2 = Reprojection::errors(
+                workspace.cloud, K2 * P2, workspace.observed2, unbounded, NULL, &workspace.in_front2);
 
-            in_front_percent1[i] = in_front1;
-            in_front_percent2[i] = in_front2;
-            projection_error1[i] = proj_err1;
-            projection_error2[i] = proj_err2;
-        }
+            result.in_front1 = (double) errors1.inliers / m;
+            result.in_front2 = (double) errors2.inliers / m;
+            result.error1 = errors1.mean;
+            result.error2 = errors2.mean;
 
+            if (result.in_front1 <= min_percent_in_front || result.in_front2 <= min_percent_in_front)
+                continue;
 
-        int best_index = -1;
-        for (int i = 0; i < 4; ++i)
-        {
-            if (in_front_percent1[i] > min_percent_in_front &&
-                in_front_percent2[i] > min_percent_in_front)
+            result.rotation = R;
+            result.translation = t;
+            for (int j = 0; j < m; ++j)
             {
-                best_index = i;
-                break;
+                if (workspace.in_front1[j] && workspace.in_front2[j])
+                {
+                    result.inliers[workspace.indices[j]] = 1;
+                    result.points.push_back(cv::Point3d(
+                        workspace.cloud.x[j], workspace.cloud.y[j], workspace.cloud.z[j]));
+                }
             }
+            return true;
         }
 
-        std::cout << best_index << std::endl;
-        for (int i = 0; i < 4; ++i)
-        {
-            printf("%ld: (%f, %f) and (%f, %f)\n",
-                clouds[i].size(),
-                in_front_percent1[i],
-                in_front_percent2[i],
-                projection_error1[i],
-                projection_error2[i]);
-        }
+        return false;
+    }
 
+    bool triangulate(
+        const std::vector<cv::Point2d>& observations,
+        const std::vector<cv::Matx34d>& projections,
+        cv::Point3d& point)
+    {
+        assert(observations.size() == projections.size());
+
+        return observations.size() >= 2 && Geometry::triangulate(
+            &observations[0], &projections[0], observations.size(), point);
+    }
 
-        if (best_index == -1)
+    bool triangulate(
+        const cv::Point2d* observations,
+        const int* views,
+        int n,
+        const std::vector<cv::Matx34d>& projections,
+        double max_error,
+        cv::Point3d& point,
+        unsigned char* inliers)
+    {
+        Geometry::NormalEquations<double> equations;
+        for (int k = 0; k < n; ++k)
         {
-            printf("Couldn't find a proper cloud.\n");
-            return;
+            equations.add(observations[k], projections[views[k]]);
+            inliers[k] = 1;
         }
 
-        Util::mask(clouds[best_index], in_front_inliers[best_index], points);
+        const double max_squared_error = max_error * max_error;
+        int remaining = n;
 
-        for (int i = 0; i < in_front_inliers[best_index].size(); ++i)
+        while (remaining >= 2)
         {
-            inliers[best_indices[i]] &= in_front_inliers[best_index][i];
+            if (!equations.solve(point))
+                return false;
+
+            int worst = -1;
+            double worst_error = max_squared_error;
+            for (int k = 0; k < n; ++k)
+            {
+                if (!inliers[k])
+                    continue;
+
+                double e = squared_error(point, projections[views[k]], observations[k]);
+                if (e < 0.0)
+                    e = std::numeric_limits<double>::max();
+
+                if (e > worst_error)
+                {
+                    worst = k;
+                    worst_error = e;
+                }
+            }
+
+            if (worst < 0)
+                return true;
+
+            // Downdate the normal equations instead of rebuilding them
+            equations.add(observations[worst], projections[views[worst]], -1.0);
+            inliers[worst] = 0;
+            --remaining;
         }
 
-        assert(cv::countNonZero(inliers) == points.size());
+        return false;
+    }
+
+    void triangulate(
+        const TrackBatch& tracks,
+        const std::vector<cv::Matx34d>& projections,
+        double max_error,
+        std::vector<cv::Point3d>& points,
+        std::vector<unsigned char>& valid,
+        std::vector<unsigned char>& inliers)
+    {
+        assert(!tracks.offsets.empty());
+        assert(tracks.views.size() == tracks.observations.size());
+        assert(tracks.offsets.back() == tracks.views.size());
+
+        const int n = tracks.offsets.size() - 1;
+        points.resize(n);
+        valid.resize(n);
+        inliers.resize(tracks.views.size());
+
+        cv::parallel_for_(cv::Range(0, n),
+            TriangulateBody(tracks, projections, max_error, points, valid, inliers));
     }
 
     void project(
@@ -489,11 +677,12 @@ namespace MultiView
         const cv::Mat& projection,
         std::vector<cv::Point2d>& coordinates)
     {
-        int n = points.size();
-        coordinates = std::vector<cv::Point2d>(n);
-        for (int i = 0; i < n; ++i)
-        {
-            project(points[i], projection, coordinates[i]);
-        }
+        assert(projection.size() == cv::Size(4, 3));
+
+        Reprojection::Points3 soa_points;
+        Reprojection::Points2 soa_coordinates;
+        soa_points.assign(points);
+        Reprojection::project(soa_points, cv::Matx34d(projection), soa_coordinates);
+        soa_coordinates.copy_to(coordinates);
     }
 }
@@ -1,10 +1,11 @@
-
 #ifndef __MULTI_VIEW_HPP__
 #define __MULTI_VIEW_HPP__
 
 #include <vector>
 #include <core.hpp>
 
+#include "Reprojection.hpp"
+
 class Camera;
 
 namespace MultiView
@@ -45,9 +46,9 @@ namespace MultiView
         cv::Point3d& point);
     
     void iterative_triangulate(
-        const cv::Point3d& u,
+        const cv::Point2d& x1,
         const cv::Matx34d& P1,
-        const cv::Point3d& v,
+        const cv::Point2d& x2,
         const cv::Matx34d& P2,
         cv::Point3d& point);
 
@@ -77,6 +78,110 @@ namespace MultiView
         std::vector<unsigned char>& inliers,
         std::vector<cv::Point3d>& points);
 
+    // Same as above, but also returns the pose of the second view
+    // relative to the first (x2 = rotation * x1 + translation).
+    // Returns false if no pose puts enough points in front of both views.
+    bool triangulate(
+        const std::vector<cv::Point2d>& pts1,
+        const cv::Mat& K1,
+        const std::vector<cv::Point2d>& pts2,
+        const cv::Mat& K2,
+        std::vector<unsigned char>& inliers,
+        std::vector<cv::Point3d>& points,
+        cv::Mat& rotation,
+        cv::Mat& translation);
+
+    // Outcome of a two-view reconstruction
+    struct TwoViewResult
+    {
+        // Pose of the second view relative to the first
+        // (x2 = rotation * x1 + translation), unit length translation
+        cv::Matx33d rotation;
+        cv::Vec3d   translation;
+
+        // One point per match in inliers, in match order
+        std::vector<cv::Point3d> points;
+
+        // Per match: passes the epipolar test, and additionally lands in
+        // front of both views
+        std::vector<unsigned char> epipolar_inliers;
+        std::vector<unsigned char> inliers;
+
+        // Fraction of the epipolar inliers in front of each view and the
+        // mean reprojection error (pixels) in each view for the chosen pose
+        double in_front1, in_front2;
+        double error1, error2;
+    };
+
+    // Buffers that the two-view reconstruction reuses between calls. Once
+    // they (and the result) have grown to the working size, per-frame calls
+    // do no heap allocation of their own; what findFundamentalMat
+    // allocates inside OpenCV is beyond reach.
+    struct TwoViewWorkspace
+    {
+        cv::Mat                    fundamental;
+        std::vector<int>           indices;
+        std::vector<cv::Point2d>   normalized1, normalized2;
+        Reprojection::Points2      observed1, observed2;
+        Reprojection::Points3      cloud;
+        std::vector<unsigned char> in_front1, in_front2;
+    };
+
+    // Estimates the relative pose from the matches pts1[i] <-> pts2[i] and
+    // triangulates the inliers. Returns false with fewer than 8 matches,
+    // when RANSAC finds no fundamental matrix, or if none of the four poses
+    // from the essential matrix puts enough points in front of both views.
+    bool triangulate(
+        const std::vector<cv::Point2d>& pts1,
+        const cv::Matx33d& K1,
+        const std::vector<cv::Point2d>& pts2,
+        const cv::Matx33d& K2,
+        TwoViewWorkspace& workspace,
+        TwoViewResult& result);
+
+    // Tracks in a flattened (CSR) layout: the observations of track i are
+    // the entries [offsets[i], offsets[i + 1]) of views and observations.
+    struct TrackBatch
+    {
+        std::vector<int>         offsets;
+        std::vector<int>         views;
+        std::vector<cv::Point2d> observations;
+    };
+
+    // Linear (DLT) triangulation from any number of views. Observations
+    // are normalized image coordinates and projections the matching
+    // [R | t]. Returns false if the system is degenerate.
+    bool triangulate(
+        const std::vector<cv::Point2d>& observations,
+        const std::vector<cv::Matx34d>& projections,
+        cv::Point3d& point);
+
+    // N-view triangulation of the n observations seen by
+    // projections[views[k]]. While the worst reprojection error (in
+    // normalized units) is above max_error, that view is dropped and the
+    // point re-solved from the rest; a view the point lands behind counts
+    // as the worst and is dropped the same way. inliers marks the kept
+    // observations. Returns false if the system is degenerate or fewer
+    // than two views agree.
+    bool triangulate(
+        const cv::Point2d* observations,
+        const int* views,
+        int n,
+        const std::vector<cv::Matx34d>& projections,
+        double max_error,
+        cv::Point3d& point,
+        unsigned char* inliers);
+
+    // Triangulates every track of the batch in parallel. valid has one
+    // entry per track and inliers one per observation.
+    void triangulate(
+        const TrackBatch& tracks,
+        const std::vector<cv::Matx34d>& projections,
+        double max_error,
+        std::vector<cv::Point3d>& points,
+        std::vector<unsigned char>& valid,
+        std::vector<unsigned char>& inliers);
+
     void project(
         const cv::Point3d& point,
         const cv::Mat& rotation,
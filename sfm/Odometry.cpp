@@ -0,0 +1,604 @@
+#include "Odometry.hpp"
+#include "Camera.hpp"
+#include "Features.hpp"
+#include "Pose.hpp"
+#include "Pyramid.hpp"
+
+#include <features2d.hpp>
+
+#include <cassert>
+#include <cmath>
+#include <algorithm>
+#include <limits>
+
+namespace
+{
+    // Tracks from the reference frame needed to keep initializing, and
+    // their median motion (pixels) before the two views are triangulated
+    const int    min_init_tracks   = 80;
+    const double min_init_parallax = 20.0;
+
+    // Pixels, turned into normalized units with the focal length
+    const double reprojection_threshold = 2.0;
+
+    // Fewer map points than this and the pose is not trusted
+    const int min_pose_points = 30;
+
+    // A keyframe is taken when less than this fraction of the last one's
+    // map points is still tracked, or when the unmapped tracks have moved
+    // this many pixels (median) since it
+    const double keyframe_kept_ratio = 0.6;
+    const double keyframe_parallax   = 15.0;
+    const int    min_parallax_tracks = 20;
+
+    // Smallest angle between the two rays of a new map point
+    const double min_ray_angle = 1.0 * CV_PI / 180.0;
+
+    // Voxel size and frustum depth of the map, relative to the median
+    // depth of the initial points
+    const double voxel_depth_ratio = 0.25;
+    const double max_depth_ratio   = 3.0;
+
+    // Pixels between a new track and a projected map point for it to take
+    // the point over; no other point may be within twice that
+    const double associate_radius = 1.5;
+
+    // Cells per side, at most, of the grid the projections are binned into
+    const int max_grid_cells = 256;
+
+    // Lost frames after which the map is dropped
+    const int max_lost_frames = 60;
+
+    double seconds(int64 start)
+    {
+        return (cv::getTickCount() - start) / cv::getTickFrequency();
+    }
+
+    cv::Matx34d projection(const cv::Matx33d& R, const cv::Vec3d& t)
+    {
+        return cv::Matx34d(R(0, 0), R(0, 1), R(0, 2), t(0),
+                           R(1, 0), R(1, 1), R(1, 2), t(1),
+                           R(2, 0), R(2, 1), R(2, 2), t(2));
+    }
+
+    // Camera center -R^T * t of a projection [R | t]
+    cv::Vec3d center(const cv::Matx34d& P)
+    {
+        const cv::Matx33d R = P.get_minor<3, 3>(0, 0);
+        const cv::Vec3d t(P(0, 3), P(1, 3), P(2, 3));
+        return -(R.t() * t);
+    }
+
+    double median(std::vector<double>& values)
+    {
+        assert(!values.empty());
+        std::nth_element(values.begin(), values.begin() + values.size() / 2, values.end());
+        return values[values.size() / 2];
+    }
+}
+
+Odometry::Odometry(const Camera& camera, const Vocabulary* vocabulary)
+: _camera(camera)
+, _K(camera.matrix())
+, _threshold(reprojection_threshold / _K(0, 0))
+, _state(LOST)
+, _rotation(cv::Matx33d::eye())
+, _inliers(0)
+, _max_depth(0.0)
+, _first_id(0)
+, _stamp(0)
+, _localizer(camera, vocabulary, _map)
+, _lost_frames(0)
+, _loop(-1)
+{
+    _timings.track = _timings.pose = _timings.map = 0.0;
+}
+
+bool Odometry::update(const Pyramid& frame)
+{
+    _timings.track = _timings.pose = _timings.map = 0.0;
+
+    _loop = -1;
+
+    int64 t = cv::getTickCount();
+    if (_state == LOST)
+    {
+        // Keep trying to find the map again for a while before starting a
+        // new one, unless there is no vocabulary to find it with
+        const bool found = relocalize(frame);
+        if (!found && (!_localizer.enabled() || _map.keyframes() == 0 || ++_lost_frames > max_lost_frames))
+            restart(frame);
+        _timings.pose = seconds(t);
+        return found;
+    }
+
+    _tracker.update(frame);
+
+    // Every live track in normalized coordinates, in track order
+    const std::vector<Tracker::Track>& tracks = _tracker.tracks();
+    _pixels.resize(tracks.size());
+    for (int i = 0; i < tracks.size(); ++i)
+    {
+        _pixels[i] = tracks[i].point;
+    }
+    _camera.normalize(_pixels, _normalized);
+    _timings.track = seconds(t);
+
+    t = cv::getTickCount();
+    if (_state == INITIALIZING)
+    {
+        const bool initialized = initialize(frame);
+        _timings.pose = seconds(t);
+        return initialized;
+    }
+
+    const bool tracked = estimate_pose();
+    _timings.pose = seconds(t);
+    if (!tracked)
+    {
+        _state = LOST;
+        _lost_frames = 0;
+        return false;
+    }
+
+    t = cv::getTickCount();
+    associate();
+    if (need_keyframe())
+        add_keyframe(frame);
+    _timings.map = seconds(t);
+
+    return true;
+}
+
+Odometry::State Odometry::state() const
+{
+    return _state;
+}
+
+const cv::Matx33d& Odometry::rotation() const
+{
+    return _rotation;
+}
+
+const cv::Vec3d& Odometry::translation() const
+{
+    return _translation;
+}
+
+int Odometry::inliers() const
+{
+    return _inliers;
+}
+
+const KeyframeMap& Odometry::map() const
+{
+    return _map;
+}
+
+int Odometry::point(const Tracker::Track& track) const
+{
+    const int i = track.id - _first_id;
+    return i >= 0 && i < _states.size() ? _states[i].point : -1;
+}
+
+int Odometry::loop() const
+{
+    return _loop;
+}
+
+const Tracker& Odometry::tracker() const
+{
+    return _tracker;
+}
+
+const Odometry::Timings& Odometry::timings() const
+{
+    return _timings;
+}
+
+// Drops the map and takes frame as the new reference
+void Odometry::restart(const Pyramid& frame)
+{
+    _first_id = _tracker.created();
+    _tracker.reset(frame);
+
+    _map.clear(1.0);
+    _projections.clear();
+    _states.clear();
+    _carried.clear();
+    _localizer.clear();
+    _lost_frames = 0;
+
+    _rotation = cv::Matx33d::eye();
+    _translation = cv::Vec3d();
+    _inliers = 0;
+    _state = INITIALIZING;
+}
+
+// Two-view reconstruction between the reference frame and this one, once
+// the tracks from the reference have moved far enough
+bool Odometry::initialize(const Pyramid& frame)
+{
+    const std::vector<Tracker::Track>& tracks = _tracker.tracks();
+
+    _which.clear();
+    _distances.clear();
+    _pixels.clear();
+    for (int i = 0; i < tracks.size(); ++i)
+    {
+        if (tracks[i].born == 0)
+        {
+            const cv::Point2f d = tracks[i].point - tracks[i].first;
+            _which.push_back(i);
+            _distances.push_back(std::sqrt(d.x * d.x + d.y * d.y));
+            _pixels.push_back(tracks[i].first);
+        }
+    }
+
+    if (_which.size() < min_init_tracks)
+    {
+        _state = LOST;
+        return false;
+    }
+
+    if (median(_distances) < min_init_parallax)
+        return false;
+
+    // The two-view reconstruction works on pixels, so both ends go through
+    // undistortion and back through the camera matrix
+    _camera.normalize(_pixels, _first);
+    _current.resize(_which.size());
+    for (int k = 0; k < _which.size(); ++k)
+    {
+        const cv::Point2d& x1 = _first[k];
+        const cv::Point2d& x2 = _normalized[_which[k]];
+        _first[k]   = cv::Point2d(_K(0, 0) * x1.x + _K(0, 2), _K(1, 1) * x1.y + _K(1, 2));
+        _current[k] = cv::Point2d(_K(0, 0) * x2.x + _K(0, 2), _K(1, 1) * x2.y + _K(1, 2));
+    }
+
+    if (!MultiView::triangulate(_first, _K, _current, _K, _workspace, _two_view)
+        || _two_view.points.size() < min_pose_points)
+    {
+        return false;
+    }
+
+    _rotation = _two_view.rotation;
+    _translation = _two_view.translation;
+    _inliers = _two_view.points.size();
+
+    // The scene depth sets the scale of the voxel hash
+    _distances.resize(_two_view.points.size());
+    for (int k = 0; k < _two_view.points.size(); ++k)
+    {
+        _distances[k] = _two_view.points[k].z;
+    }
+    const double depth = median(_distances);
+    _map.clear(voxel_depth_ratio * depth);
+    _max_depth = max_depth_ratio * depth;
+
+    // The reference frame is gone by now, so it has no descriptors
+    const int reference = _map.add_keyframe(0, cv::Matx33d::eye(), cv::Vec3d());
+    _projections.push_back(projection(cv::Matx33d::eye(), cv::Vec3d()));
+
+    // Result points come in match order
+    int next = 0;
+    for (int k = 0; k < _which.size(); ++k)
+    {
+        if (_two_view.inliers[k])
+        {
+            const int point = _map.add_point(_two_view.points[next++]);
+            state(tracks[_which[k]].id).point = point;
+            _map.observe(reference, point);
+        }
+    }
+
+    add_keyframe(frame);
+
+    _state = TRACKING;
+    return true;
+}
+
+bool Odometry::estimate_pose()
+{
+    const std::vector<Tracker::Track>& tracks = _tracker.tracks();
+
+    _object.clear();
+    _image.clear();
+    _which.clear();
+    for (int i = 0; i < tracks.size(); ++i)
+    {
+        const int p = state(tracks[i].id).point;
+        if (p >= 0)
+        {
+            _object.push_back(_map.point(p).position);
+            _image.push_back(_normalized[i]);
+            _which.push_back(i);
+        }
+    }
+
+    if (_object.size() < min_pose_points)
+        return false;
+
+    cv::Matx33d R;
+    cv::Vec3d t;
+    if (!Pose::ransac(_object, _image, _threshold, R, t, _mask))
+        return false;
+
+    // Outliers lose their map point, which keeps a drifting track from
+    // pulling on the next poses
+    int n = 0;
+    for (int k = 0; k < _object.size(); ++k)
+    {
+        if (_mask[k])
+        {
+            _object[n] = _object[k];
+            _image[n] = _image[k];
+            ++n;
+        }
+        else
+        {
+            state(tracks[_which[k]].id).point = -1;
+        }
+    }
+
+    if (n < min_pose_points)
+        return false;
+
+    Pose::refine(&_object[0], &_image[0], n, R, t);
+
+    _rotation = R;
+    _translation = t;
+    _inliers = n;
+    return true;
+}
+
+// Gives unmapped tracks the map point in view whose projection they land on
+void Odometry::associate()
+{
+    const std::vector<Tracker::Track>& tracks = _tracker.tracks();
+
+    _map.visible(_rotation, _translation, _K, _camera.resolution(), _max_depth, _candidates, _projected);
+    if (_candidates.empty())
+        return;
+
+    // Points some track already carries are out
+    ++_stamp;
+    _carried.resize(_map.points(), 0);
+    for (int i = 0; i < tracks.size(); ++i)
+    {
+        const int p = state(tracks[i].id).point;
+        if (p >= 0)
+            _carried[p] = _stamp;
+    }
+
+    // The projections go into a grid of cells at least twice the radius
+    // wide, so the 3x3 cells around a track hold every projection within
+    // twice the radius of it, which is all the test below looks at
+    const double radius = associate_radius / _K(0, 0);
+    const int n = _candidates.size();
+
+    cv::Point2d low = _projected[0], high = low;
+    for (int k = 1; k < n; ++k)
+    {
+        low.x = std::min(low.x, _projected[k].x);
+        low.y = std::min(low.y, _projected[k].y);
+        high.x = std::max(high.x, _projected[k].x);
+        high.y = std::max(high.y, _projected[k].y);
+    }
+    const double cell = std::max(2.0 * radius,
+                                 std::max(high.x - low.x, high.y - low.y) / max_grid_cells);
+    const int cols = (int) ((high.x - low.x) / cell) + 1;
+    const int rows = (int) ((high.y - low.y) / cell) + 1;
+
+    // Counting sort by cell: the projections of cell c are
+    // _cell_points[_cell_starts[c], _cell_starts[c + 1])
+    _cell_starts.assign(cols * rows + 1, 0);
+    _cell_points.resize(n);
+    for (int k = 0; k < n; ++k)
+    {
+        const int c = (int) ((_projected[k].y - low.y) / cell) * cols + (int) ((_projected[k].x - low.x) / cell);
+        ++_cell_starts[c];
+    }
+    for (int c = 1; c < cols * rows; ++c)
+    {
+        _cell_starts[c] += _cell_starts[c - 1];
+    }
+    _cell_starts[cols * rows] = n;
+    for (int k = 0; k < n; ++k)
+    {
+        const int c = (int) ((_projected[k].y - low.y) / cell) * cols + (int) ((_projected[k].x - low.x) / cell);
+        _cell_points[--_cell_starts[c]] = k;
+    }
+
+    for (int i = 0; i < tracks.size(); ++i)
+    {
+        TrackState& s = state(tracks[i].id);
+        if (s.point >= 0)
+            continue;
+
+        const double gx = std::floor((_normalized[i].x - low.x) / cell);
+        const double gy = std::floor((_normalized[i].y - low.y) / cell);
+        if (gx < -1 || gy < -1 || gx > cols || gy > rows)
+            continue;
+
+        // Nearest and second nearest projection
+        int best = -1;
+        double d1 = std::numeric_limits<double>::max(), d2 = d1;
+        for (int y = std::max((int) gy - 1, 0); y <= std::min((int) gy + 1, rows - 1); ++y)
+        {
+            for (int x = std::max((int) gx - 1, 0); x <= std::min((int) gx + 1, cols - 1); ++x)
+            {
+                const int c = y * cols + x;
+                for (int e = _cell_starts[c]; e < _cell_starts[c + 1]; ++e)
+                {
+                    const int k = _cell_points[e];
+                    if (_carried[_candidates[k]] == _stamp)
+                        continue;
+
+                    const cv::Point2d d = _projected[k] - _normalized[i];
+                    const double distance = d.x * d.x + d.y * d.y;
+                    if (distance < d1)
+                    {
+                        d2 = d1;
+                        d1 = distance;
+                        best = _candidates[k];
+                    }
+                    else if (distance < d2)
+                    {
+                        d2 = distance;
+                    }
+                }
+            }
+        }
+
+        if (best >= 0 && d1 <= radius * radius && d2 > 4.0 * radius * radius)
+        {
+            s.point = best;
+            _carried[best] = _stamp;
+        }
+    }
+}
+
+bool Odometry::need_keyframe()
+{
+    const int last = _map.keyframes() - 1;
+    if (_inliers < keyframe_kept_ratio * _map.keyframe(last).points.size())
+        return true;
+
+    const std::vector<Tracker::Track>& tracks = _tracker.tracks();
+
+    _distances.clear();
+    for (int i = 0; i < tracks.size(); ++i)
+    {
+        const TrackState& s = state(tracks[i].id);
+        if (s.point < 0 && s.keyframe == last)
+        {
+            const cv::Point2d d = _normalized[i] - s.observed;
+            _distances.push_back(_K(0, 0) * std::sqrt(d.x * d.x + d.y * d.y));
+        }
+    }
+
+    return _distances.size() >= min_parallax_tracks && median(_distances) > keyframe_parallax;
+}
+
+// Makes the current frame a keyframe: triangulates the unmapped tracks seen
+// on an earlier keyframe and records where every track is now
+void Odometry::add_keyframe(const Pyramid& frame)
+{
+    const std::vector<Tracker::Track>& tracks = _tracker.tracks();
+    const int index = _map.add_keyframe(_tracker.frame(), _rotation, _translation);
+    _projections.push_back(projection(_rotation, _translation));
+
+    const double min_cos = std::cos(min_ray_angle);
+
+    for (int i = 0; i < tracks.size(); ++i)
+    {
+        TrackState& s = state(tracks[i].id);
+        if (s.point < 0 && s.keyframe >= 0)
+        {
+            const cv::Point2d observations[2] = { s.observed, _normalized[i] };
+            const int views[2] = { s.keyframe, index };
+            unsigned char inliers[2];
+
+            cv::Point3d X;
+            if (MultiView::triangulate(observations, views, 2, _projections, _threshold, X, inliers))
+            {
+                const cv::Vec3d x(X.x, X.y, X.z);
+                const cv::Vec3d r1 = x - center(_projections[s.keyframe]);
+                const cv::Vec3d r2 = x - center(_projections[index]);
+                if (r1.dot(r2) < min_cos * cv::norm(r1) * cv::norm(r2))
+                {
+                    s.point = _map.add_point(X);
+                }
+            }
+        }
+
+        if (s.point >= 0)
+            _map.observe(index, s.point);
+
+        s.keyframe = index;
+        s.observed = _normalized[i];
+    }
+
+    if (_localizer.enabled())
+    {
+        describe_keyframe(index, frame);
+        _localizer.add(index);
+        _loop = _localizer.loop(index, _located);
+    }
+}
+
+// Looks the frame up in the keyframe index; tracking resumes from the
+// features that matched map points
+bool Odometry::relocalize(const Pyramid& frame)
+{
+    if (!_localizer.localize(frame.gray(), _located))
+        return false;
+
+    const std::vector<cv::KeyPoint>& keypoints = _localizer.keypoints();
+    _seeds.resize(_located.inliers);
+    for (int k = 0; k < _located.inliers; ++k)
+    {
+        _seeds[k] = keypoints[_located.features[k]].pt;
+    }
+
+    _first_id = _tracker.created();
+    _tracker.reset(frame, _seeds);
+    _states.clear();
+    for (int k = 0; k < _located.inliers; ++k)
+    {
+        state(_first_id + k).point = _located.points[k];
+    }
+
+    _rotation = _located.rotation;
+    _translation = _located.translation;
+    _inliers = _located.inliers;
+    _lost_frames = 0;
+    _state = TRACKING;
+    return true;
+}
+
+// Upright ORB descriptors at the keyframe's tracked map points
+void Odometry::describe_keyframe(int keyframe, const Pyramid& frame)
+{
+    const std::vector<Tracker::Track>& tracks = _tracker.tracks();
+
+    _keypoints.clear();
+    for (int i = 0; i < tracks.size(); ++i)
+    {
+        if (state(tracks[i].id).point >= 0)
+        {
+            cv::KeyPoint keypoint(tracks[i].point, 31.0f);
+            keypoint.class_id = i;
+            _keypoints.push_back(keypoint);
+        }
+    }
+
+    Features::orbDescriptors(frame.gray(), _keypoints, _descriptors);
+
+    _matched.resize(_keypoints.size());
+    _observations.resize(_keypoints.size());
+    for (int r = 0; r < _keypoints.size(); ++r)
+    {
+        const int i = _keypoints[r].class_id;
+        _matched[r] = state(tracks[i].id).point;
+        _observations[r] = _normalized[i];
+    }
+    _map.describe(keyframe, _descriptors, _matched, _observations);
+}
+
+Odometry::TrackState& Odometry::state(int id)
+{
+    const int i = id - _first_id;
+    assert(i >= 0);
+
+    if (i >= _states.size())
+    {
+        TrackState unknown;
+        unknown.point = -1;
+        unknown.keyframe = -1;
+        _states.resize(i + 1, unknown);
+    }
+
+    return _states[i];
+}
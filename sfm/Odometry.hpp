@@ -0,0 +1,154 @@
+#ifndef __ODOMETRY_HPP__
+#define __ODOMETRY_HPP__
+
+#include <vector>
+#include <core.hpp>
+
+#include "KeyframeMap.hpp"
+#include "Localizer.hpp"
+#include "MultiView.hpp"
+#include "Tracker.hpp"
+
+class Camera;
+class Pyramid;
+
+// Monocular visual odometry on a live video. KLT tracks are followed from
+// a reference frame until they have moved far enough to triangulate the
+// two views (MultiView::triangulate), which fixes the map's frame and
+// scale. Every later frame gets its pose from P3P RANSAC (Pose::ransac)
+// against the map points its tracks carry, and new points come from
+// triangulating tracks between keyframes. A keyframe is taken when too
+// many of the map points of the last one have been lost, or when the
+// unmapped tracks have moved far enough since it. New tracks that land on
+// the projection of a map point in view take that point over, which only
+// looks at the points the map's voxel hash puts in the frustum.
+//
+// With a vocabulary, every keyframe also stores ORB descriptors of its map
+// points, indexed by a Localizer. A lost frame is then looked up there
+// before giving up on the map, and each new keyframe is checked the same
+// way against keyframes it doesn't share points with, which flags loop
+// closures.
+//
+// Poses follow the MultiView convention x_camera = R * x_world + t, with
+// the world being the reference frame's camera.
+class Odometry
+{
+public:
+    enum State
+    {
+        LOST,          // nothing to track against, the next frame starts over
+        INITIALIZING,  // waiting for enough parallax from the reference frame
+        TRACKING
+    };
+
+    // Seconds spent in each stage on the latest frame
+    struct Timings
+    {
+        double track;
+        double pose;
+        double map;
+    };
+
+    // vocabulary may be null, which turns relocalization and loop
+    // detection off
+    explicit Odometry(const Camera& camera, const Vocabulary* vocabulary = NULL);
+
+    // Runs the next frame through tracking, pose estimation and mapping.
+    // Returns true if the frame got a pose.
+    bool update(const Pyramid& frame);
+
+    State state() const;
+
+    // Pose of the latest frame that got one
+    const cv::Matx33d& rotation() const;
+    const cv::Vec3d& translation() const;
+
+    // Map points that agreed with the latest pose
+    int inliers() const;
+
+    const KeyframeMap& map() const;
+
+    // Older keyframe the latest frame's keyframe was verified to close a
+    // loop with, or -1
+    int loop() const;
+
+    // Map point index of a live track, or -1
+    int point(const Tracker::Track& track) const;
+
+    const Tracker& tracker() const;
+    const Timings& timings() const;
+
+private:
+    // What the map knows about a track, by track id
+    struct TrackState
+    {
+        int point;              // map point, or -1
+        int keyframe;           // last keyframe the track was seen on, or -1
+        cv::Point2d observed;   // normalized position there
+    };
+
+    const Camera& _camera;
+    cv::Matx33d _K;
+    double _threshold;   // reprojection threshold in normalized units
+
+    Tracker _tracker;
+    State _state;
+
+    cv::Matx33d _rotation;
+    cv::Vec3d _translation;
+    int _inliers;
+
+    KeyframeMap _map;
+    std::vector<cv::Matx34d> _projections;   // one per keyframe
+
+    // Depth range of the frustum queries, from the initial scene depth
+    double _max_depth;
+
+    // By track id, from the first track of the current map on
+    std::vector<TrackState> _states;
+    int _first_id;
+
+    // Place recognition
+    Localizer _localizer;
+    Localizer::Result _located;
+    int _lost_frames;
+    int _loop;
+
+    Timings _timings;
+
+    // Per-frame scratch, kept to avoid reallocation
+    std::vector<cv::Point2f> _pixels;
+    std::vector<cv::Point2d> _normalized;
+    std::vector<cv::Point2d> _first, _current;
+    std::vector<cv::Point3d> _object;
+    std::vector<cv::Point2d> _image;
+    std::vector<int> _which;
+    std::vector<unsigned char> _mask;
+    std::vector<double> _distances;
+    std::vector<int> _candidates;
+    std::vector<cv::Point2d> _projected;
+    std::vector<int> _cell_starts, _cell_points;   // _projected binned by grid cell
+    std::vector<int> _carried;   // per map point, the last stamp it was carried on
+    int _stamp;
+    std::vector<int> _matched;
+    std::vector<cv::KeyPoint> _keypoints;
+    cv::Mat _descriptors;
+    std::vector<cv::Point2d> _observations;
+    std::vector<cv::Point2f> _seeds;
+    MultiView::TwoViewWorkspace _workspace;
+    MultiView::TwoViewResult _two_view;
+
+    void restart(const Pyramid& frame);
+    bool initialize(const Pyramid& frame);
+    bool estimate_pose();
+    void associate();
+    bool need_keyframe();
+    void add_keyframe(const Pyramid& frame);
+
+    bool relocalize(const Pyramid& frame);
+    void describe_keyframe(int keyframe, const Pyramid& frame);
+
+    TrackState& state(int id);
+};
+
+#endif
@@ -0,0 +1,670 @@
+#include "Partition.hpp"
+
+#include <imgcodecs.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <map>
+#include <queue>
+
+#include "Features.hpp"
+#include "GlobalSfM.hpp"
+
+namespace
+{
+    const int    min_edge_matches     = 50;
+    const int    min_shared_points    = 3;
+    const int    similarity_ransac    = 256;
+    const double similarity_threshold = 0.05;
+
+    typedef std::pair<int, int> ViewKeypoint;
+
+    void load_features(const std::string& workdir, int view, GlobalSfM::View& features)
+    {
+        cv::FileStorage fs(Partition::features_path(workdir, view), cv::FileStorage::READ);
+        fs["keypoints"]   >> features.keypoints;
+        fs["descriptors"] >> features.descriptors;
+        fs.release();
+    }
+
+    cv::Mat load_descriptors(const std::string& workdir, int view)
+    {
+        cv::Mat descriptors;
+        cv::FileStorage fs(Partition::features_path(workdir, view), cv::FileStorage::READ);
+        fs["descriptors"] >> descriptors;
+        fs.release();
+        return descriptors;
+    }
+
+    cv::Vec3d center(const cv::Matx33d& R, const cv::Vec3d& t)
+    {
+        return -(R.t() * t);
+    }
+
+    // Umeyama's closed form for dst = scale * R * src + t
+    bool similarity(
+        const std::vector<cv::Vec3d>& src,
+        const std::vector<cv::Vec3d>& dst,
+        double& scale,
+        cv::Matx33d& R,
+        cv::Vec3d& t)
+    {
+        const int n = src.size();
+        if (n < 3)
+            return false;
+
+        cv::Vec3d mu_src(0, 0, 0), mu_dst(0, 0, 0);
+        for (int i = 0; i < n; ++i)
+        {
+            mu_src += src[i];
+            mu_dst += dst[i];
+        }
+        mu_src /= n;
+        mu_dst /= n;
+
+        cv::Matx33d cov;
+        double var_src = 0.0;
+        for (int i = 0; i < n; ++i)
+        {
+            cv::Vec3d a = src[i] - mu_src;
+            cv::Vec3d b = dst[i] - mu_dst;
+            cov += b * a.t();
+            var_src += a.dot(a);
+        }
+        cov *= 1.0 / n;
+        var_src /= n;
+
+        if (var_src <= 0.0)
+            return false;
+
+        cv::Matx31d w;
+        cv::Matx33d u, vt;
+        cv::SVD::compute(cov, w, u, vt);
+
+        cv::Matx33d S = cv::Matx33d::eye();
+        if (cv::determinant(u) * cv::determinant(vt) < 0.0)
+            S(2, 2) = -1.0;
+
+        R = u * S * vt;
+        scale = (w(0) * S(0, 0) + w(1) * S(1, 1) + w(2) * S(2, 2)) / var_src;
+        t = mu_dst - scale * (R * mu_src);
+
+        return scale > 0.0;
+    }
+
+    // RANSAC over three point samples followed by a fit to every inlier
+    bool robust_similarity(
+        const std::vector<cv::Vec3d>& src,
+        const std::vector<cv::Vec3d>& dst,
+        double& scale,
+        cv::Matx33d& R,
+        cv::Vec3d& t)
+    {
+        const int n = src.size();
+        if (n < min_shared_points)
+            return false;
+
+        // Scale the threshold with the spread of the merged points
+        std::vector<double> spread(n);
+        cv::Vec3d mu(0, 0, 0);
+        for (int i = 0; i < n; ++i)
+            mu += dst[i];
+        mu /= n;
+        for (int i = 0; i < n; ++i)
+            spread[i] = cv::norm(dst[i] - mu);
+        std::nth_element(spread.begin(), spread.begin() + n / 2, spread.end());
+        const double threshold = similarity_threshold * spread[n / 2];
+
+        cv::RNG rng(n);
+        std::vector<unsigned char> best_inliers;
+        int best_count = 0;
+
+        for (int it = 0; it < similarity_ransac; ++it)
+        {
+            std::vector<cv::Vec3d> sample_src(3), sample_dst(3);
+            for (int k = 0; k < 3; ++k)
+            {
+                int index = rng.uniform(0, n);
+                sample_src[k] = src[index];
+                sample_dst[k] = dst[index];
+            }
+
+            double s;
+            cv::Matx33d sample_R;
+            cv::Vec3d sample_t;
+            if (!similarity(sample_src, sample_dst, s, sample_R, sample_t))
+                continue;
+
+            std::vector<unsigned char> inliers(n, 0);
+            int count = 0;
+            for (int i = 0; i < n; ++i)
+            {
+                inliers[i] = cv::norm(s * (sample_R * src[i]) + sample_t - dst[i]) <= threshold;
+                count += inliers[i];
+            }
+
+            if (count > best_count)
+            {
+                best_count = count;
+                best_inliers.swap(inliers);
+            }
+        }
+
+        if (best_count < min_shared_points)
+            return false;
+
+        std::vector<cv::Vec3d> inlier_src, inlier_dst;
+        for (int i = 0; i < n; ++i)
+        {
+            if (best_inliers[i])
+            {
+                inlier_src.push_back(src[i]);
+                inlier_dst.push_back(dst[i]);
+            }
+        }
+
+        return similarity(inlier_src, inlier_dst, scale, R, t);
+    }
+
+    // False, leaving merged as it was, if the cluster can't be aligned
+    bool merge_model(
+        const Partition::Model& cluster,
+        Partition::Model& merged,
+        std::map<int, int>& view_index,
+        std::map<ViewKeypoint, int>& point_index)
+    {
+        // Group the cluster's observations by point
+        std::vector<std::vector<int> > point_observations(cluster.points.size());
+        for (int k = 0; k < cluster.observations.size(); ++k)
+        {
+            point_observations[cluster.observations[k].point].push_back(k);
+        }
+
+        // Correspondences: shared tracks and shared camera centers
+        std::vector<cv::Vec3d> src, dst;
+        std::vector<int> matched_point(cluster.points.size(), -1);
+        for (int p = 0; p < cluster.points.size(); ++p)
+        {
+            for (int k = 0; k < point_observations[p].size(); ++k)
+            {
+                int o = point_observations[p][k];
+                int view = cluster.views[cluster.observations[o].view];
+                std::map<ViewKeypoint, int>::const_iterator it =
+                    point_index.find(ViewKeypoint(view, cluster.keypoints[o]));
+
+                if (it != point_index.end())
+                {
+                    const cv::Point3d& a = cluster.points[p];
+                    const cv::Point3d& b = merged.points[it->second];
+                    src.push_back(cv::Vec3d(a.x, a.y, a.z));
+                    dst.push_back(cv::Vec3d(b.x, b.y, b.z));
+                    matched_point[p] = it->second;
+                    break;
+                }
+            }
+        }
+
+        for (int v = 0; v < cluster.views.size(); ++v)
+        {
+            std::map<int, int>::const_iterator it = view_index.find(cluster.views[v]);
+            if (it != view_index.end())
+            {
+                src.push_back(center(cluster.rotations[v], cluster.translations[v]));
+                dst.push_back(center(merged.rotations[it->second], merged.translations[it->second]));
+            }
+        }
+
+        double s;
+        cv::Matx33d R;
+        cv::Vec3d t;
+        if (!robust_similarity(src, dst, s, R, t))
+            return false;
+
+        // x_c = Rc * X + tc with X = R^T (X' - t) / s, up to the scale s
+        std::vector<int> cluster_to_merged(cluster.views.size());
+        for (int v = 0; v < cluster.views.size(); ++v)
+        {
+            std::map<int, int>::const_iterator it = view_index.find(cluster.views[v]);
+            if (it != view_index.end())
+            {
+                cluster_to_merged[v] = it->second;
+                continue;
+            }
+
+            cv::Matx33d Rc = cluster.rotations[v] * R.t();
+            cv::Vec3d tc = s * cluster.translations[v] - Rc * t;
+
+            cluster_to_merged[v] = merged.views.size();
+            view_index[cluster.views[v]] = merged.views.size();
+            merged.views.push_back(cluster.views[v]);
+            merged.rotations.push_back(Rc);
+            merged.translations.push_back(tc);
+        }
+
+        for (int p = 0; p < cluster.points.size(); ++p)
+        {
+            int index = matched_point[p];
+            if (index < 0)
+            {
+                const cv::Point3d& a = cluster.points[p];
+                cv::Vec3d X = s * (R * cv::Vec3d(a.x, a.y, a.z)) + t;
+
+                index = merged.points.size();
+                merged.points.push_back(cv::Point3d(X(0), X(1), X(2)));
+            }
+
+            for (int k = 0; k < point_observations[p].size(); ++k)
+            {
+                int o = point_observations[p][k];
+                int view = cluster.views[cluster.observations[o].view];
+                ViewKeypoint key(view, cluster.keypoints[o]);
+                if (point_index.count(key))
+                    continue;
+
+                BundleAdjust::Observation observation = cluster.observations[o];
+                observation.view = cluster_to_merged[observation.view];
+                observation.point = index;
+
+                point_index[key] = index;
+                merged.observations.push_back(observation);
+                merged.keypoints.push_back(key.second);
+            }
+        }
+
+        return true;
+    }
+}
+
+namespace Partition
+{
+    std::string features_path(const std::string& workdir, int view)
+    {
+        return workdir + "/features_" + std::to_string(view) + ".yml.gz";
+    }
+
+    std::string cluster_path(const std::string& workdir, int cluster)
+    {
+        return workdir + "/cluster_" + std::to_string(cluster) + ".yml.gz";
+    }
+
+    void extract_features(
+        const std::vector<std::string>& image_paths,
+        const std::string& workdir)
+    {
+        for (int i = 0; i < image_paths.size(); ++i)
+        {
+            cv::Mat image = cv::imread(image_paths[i]);
+            assert(!image.empty());
+
+            GlobalSfM::View features;
+            Features::detect(image, features.keypoints, features.descriptors);
+
+            cv::FileStorage fs(features_path(workdir, i), cv::FileStorage::WRITE);
+            fs << "keypoints" << features.keypoints;
+            fs << "descriptors" << features.descriptors;
+            fs.release();
+        }
+    }
+
+    void build_view_graph(
+        int n_views,
+        const std::string& workdir,
+        std::vector<Edge>& edges)
+    {
+        // Each file is read and decompressed once rather than once per pair
+        std::vector<cv::Mat> descriptors(n_views);
+        for (int i = 0; i < n_views; ++i)
+        {
+            descriptors[i] = load_descriptors(workdir, i);
+        }
+
+        edges.clear();
+        for (int i = 0; i < n_views; ++i)
+        {
+            for (int j = i + 1; j < n_views; ++j)
+            {
+                std::vector<cv::DMatch> matches;
+                Features::match(descriptors[i], descriptors[j], matches);
+
+                if (matches.size() >= min_edge_matches)
+                {
+                    Edge edge;
+                    edge.i = i;
+                    edge.j = j;
+                    edge.matches = matches.size();
+                    edges.push_back(edge);
+                }
+            }
+        }
+    }
+
+    void cluster_views(
+        int n_views,
+        const std::vector<Edge>& edges,
+        int max_size,
+        int overlap,
+        std::vector<std::vector<int> >& clusters)
+    {
+        assert(max_size > overlap);
+
+        std::vector<std::vector<std::pair<int, int> > > adjacency(n_views);
+        std::vector<int> degree(n_views, 0);
+        for (int e = 0; e < edges.size(); ++e)
+        {
+            adjacency[edges[e].i].push_back(std::make_pair(edges[e].j, edges[e].matches));
+            adjacency[edges[e].j].push_back(std::make_pair(edges[e].i, edges[e].matches));
+            degree[edges[e].i] += edges[e].matches;
+            degree[edges[e].j] += edges[e].matches;
+        }
+
+        const int core_size = max_size - overlap;
+        std::vector<int> assigned(n_views, -1);
+        clusters.clear();
+
+        while (true)
+        {
+            int seed = -1;
+            for (int v = 0; v < n_views; ++v)
+            {
+                if (assigned[v] < 0 && !adjacency[v].empty() &&
+                    (seed < 0 || degree[v] > degree[seed]))
+                    seed = v;
+            }
+
+            if (seed < 0)
+                break;
+
+            // Grow by the unassigned view most connected to the cluster
+            std::vector<int> cluster(1, seed);
+            std::map<int, int> gain;
+            assigned[seed] = clusters.size();
+
+            int added = seed;
+            while (cluster.size() < core_size)
+            {
+                for (int k = 0; k < adjacency[added].size(); ++k)
+                {
+                    int u = adjacency[added][k].first;
+                    if (assigned[u] < 0)
+                        gain[u] += adjacency[added][k].second;
+                }
+
+                if (gain.empty())
+                    break;
+
+                std::map<int, int>::iterator best = gain.begin();
+                for (std::map<int, int>::iterator it = gain.begin(); it != gain.end(); ++it)
+                {
+                    if (it->second > best->second)
+                        best = it;
+                }
+
+                added = best->first;
+                gain.erase(best);
+                assigned[added] = clusters.size();
+                cluster.push_back(added);
+            }
+
+            clusters.push_back(cluster);
+        }
+
+        // Share the strongest boundary views with each neighbour
+        for (int c = 0; c < clusters.size(); ++c)
+        {
+            std::map<int, int> boundary;
+            for (int k = 0; k < clusters[c].size(); ++k)
+            {
+                int v = clusters[c][k];
+                for (int a = 0; a < adjacency[v].size(); ++a)
+                {
+                    int u = adjacency[v][a].first;
+                    if (assigned[u] != c)
+                        boundary[u] += adjacency[v][a].second;
+                }
+            }
+
+            std::vector<std::pair<int, int> > ranked;
+            for (std::map<int, int>::iterator it = boundary.begin(); it != boundary.end(); ++it)
+            {
+                ranked.push_back(std::make_pair(it->second, it->first));
+            }
+            std::sort(ranked.rbegin(), ranked.rend());
+
+            for (int k = 0; k < ranked.size() && k < overlap; ++k)
+            {
+                clusters[c].push_back(ranked[k].second);
+            }
+        }
+    }
+
+    bool reconstruct_cluster(
+        const std::vector<int>& views,
+        const cv::Mat& K,
+        const std::string& workdir,
+        int index)
+    {
+        std::vector<GlobalSfM::View> features(views.size());
+        for (int v = 0; v < views.size(); ++v)
+        {
+            load_features(workdir, views[v], features[v]);
+        }
+
+        GlobalSfM::Reconstruction recon;
+        if (!GlobalSfM::reconstruct(features, K, recon))
+            return false;
+
+        Model model;
+        std::vector<int> local_index(views.size(), -1);
+        for (int v = 0; v < views.size(); ++v)
+        {
+            if (!recon.registered[v])
+                continue;
+
+            local_index[v] = model.views.size();
+            model.views.push_back(views[v]);
+            model.rotations.push_back(recon.rotations[v]);
+            model.translations.push_back(recon.translations[v]);
+        }
+
+        model.points = recon.points;
+        for (int p = 0; p < recon.tracks.size(); ++p)
+        {
+            const GlobalSfM::Track& track = recon.tracks[p];
+            for (int k = 0; k < track.views.size(); ++k)
+            {
+                BundleAdjust::Observation o;
+                o.view = local_index[track.views[k]];
+                o.point = p;
+                o.pixel = features[track.views[k]].keypoints[track.keypoints[k]].pt;
+
+                model.observations.push_back(o);
+                model.keypoints.push_back(track.keypoints[k]);
+            }
+        }
+
+        save_model(cluster_path(workdir, index), model);
+        return true;
+    }
+
+    void save_model(const std::string& path, const Model& model)
+    {
+        cv::Mat_<double> poses(model.views.size(), 12);
+        for (int v = 0; v < model.views.size(); ++v)
+        {
+            for (int k = 0; k < 9; ++k)
+                poses(v, k) = model.rotations[v].val[k];
+            for (int k = 0; k < 3; ++k)
+                poses(v, 9 + k) = model.translations[v](k);
+        }
+
+        cv::Mat_<double> points(model.points.size(), 3);
+        for (int p = 0; p < model.points.size(); ++p)
+        {
+            points(p, 0) = model.points[p].x;
+            points(p, 1) = model.points[p].y;
+            points(p, 2) = model.points[p].z;
+        }
+
+        // point, view, keypoint, pixel x, pixel y
+        cv::Mat_<double> observations(model.observations.size(), 5);
+        for (int k = 0; k < model.observations.size(); ++k)
+        {
+            const BundleAdjust::Observation& o = model.observations[k];
+            observations(k, 0) = o.point;
+            observations(k, 1) = o.view;
+            observations(k, 2) = model.keypoints[k];
+            observations(k, 3) = o.pixel.x;
+            observations(k, 4) = o.pixel.y;
+        }
+
+        cv::FileStorage fs(path, cv::FileStorage::WRITE);
+        fs << "views" << model.views;
+        fs << "poses" << poses;
+        fs << "points" << points;
+        fs << "observations" << observations;
+        fs.release();
+    }
+
+    bool load_model(const std::string& path, Model& model)
+    {
+        cv::FileStorage fs(path, cv::FileStorage::READ);
+        if (!fs.isOpened())
+            return false;
+
+        cv::Mat_<double> poses, points, observations;
+        fs["views"]        >> model.views;
+        fs["poses"]        >> poses;
+        fs["points"]       >> points;
+        fs["observations"] >> observations;
+        fs.release();
+
+        model.rotations.resize(model.views.size());
+        model.translations.resize(model.views.size());
+        for (int v = 0; v < model.views.size(); ++v)
+        {
+            model.rotations[v] = cv::Matx33d(poses[v]);
+            model.translations[v] = cv::Vec3d(poses(v, 9), poses(v, 10), poses(v, 11));
+        }
+
+        model.points.resize(points.rows);
+        for (int p = 0; p < points.rows; ++p)
+        {
+            model.points[p] = cv::Point3d(points(p, 0), points(p, 1), points(p, 2));
+        }
+
+        model.observations.resize(observations.rows);
+        model.keypoints.resize(observations.rows);
+        for (int k = 0; k < observations.rows; ++k)
+        {
+            BundleAdjust::Observation& o = model.observations[k];
+            o.point = (int) observations(k, 0);
+            o.view = (int) observations(k, 1);
+            o.pixel = cv::Point2d(observations(k, 3), observations(k, 4));
+            model.keypoints[k] = (int) observations(k, 2);
+        }
+
+        return true;
+    }
+
+    bool merge_clusters(
+        const std::string& workdir,
+        int n_clusters,
+        Model& merged,
+        std::vector<int>& dropped)
+    {
+        dropped.clear();
+
+        // Only the view lists are needed to order the merge
+        std::vector<std::vector<int> > cluster_views(n_clusters);
+        int largest = -1;
+        for (int c = 0; c < n_clusters; ++c)
+        {
+            cv::FileStorage fs(cluster_path(workdir, c), cv::FileStorage::READ);
+            if (!fs.isOpened())
+                continue;
+
+            fs["views"] >> cluster_views[c];
+            fs.release();
+
+            std::sort(cluster_views[c].begin(), cluster_views[c].end());
+            if (largest < 0 || cluster_views[c].size() > cluster_views[largest].size())
+                largest = c;
+        }
+
+        if (largest < 0)
+            return false;
+
+        std::map<int, int> view_index;
+        std::map<ViewKeypoint, int> point_index;
+        std::vector<unsigned char> done(n_clusters, 0);
+
+        merged = Model();
+        if (!load_model(cluster_path(workdir, largest), merged))
+            return false;
+        done[largest] = 1;
+        for (int v = 0; v < merged.views.size(); ++v)
+            view_index[merged.views[v]] = v;
+        for (int k = 0; k < merged.observations.size(); ++k)
+        {
+            ViewKeypoint key(merged.views[merged.observations[k].view], merged.keypoints[k]);
+            point_index[key] = merged.observations[k].point;
+        }
+
+        // Repeatedly merge the pending cluster sharing the most views
+        while (true)
+        {
+            int best = -1;
+            int best_shared = 0;
+            for (int c = 0; c < n_clusters; ++c)
+            {
+                if (done[c])
+                    continue;
+
+                int shared = 0;
+                for (int k = 0; k < cluster_views[c].size(); ++k)
+                    shared += view_index.count(cluster_views[c][k]);
+
+                if (shared > best_shared)
+                {
+                    best = c;
+                    best_shared = shared;
+                }
+            }
+
+            if (best < 0)
+                break;
+
+            Model cluster;
+            if (!load_model(cluster_path(workdir, best), cluster) ||
+                !merge_model(cluster, merged, view_index, point_index))
+                dropped.push_back(best);
+            done[best] = 1;
+        }
+
+        // Missing, or sharing no view with the merged model
+        for (int c = 0; c < n_clusters; ++c)
+        {
+            if (!done[c])
+                dropped.push_back(c);
+        }
+        std::sort(dropped.begin(), dropped.end());
+
+        printf("Merged %ld views and %ld points\n", merged.views.size(), merged.points.size());
+        return true;
+    }
+
+    double refine(const cv::Mat& K, Model& model)
+    {
+        std::vector<unsigned char> fixed(model.views.size(), 0);
+        if (!fixed.empty())
+            fixed[0] = 1;
+
+        return BundleAdjust::adjust(
+            model.observations,
+            cv::Matx33d(K),
+            model.rotations,
+            model.translations,
+            model.points,
+            fixed);
+    }
+}
@@ -0,0 +1,96 @@
+#ifndef __PARTITION_HPP__
+#define __PARTITION_HPP__
+
+#include <string>
+#include <vector>
+#include <core.hpp>
+
+#include "BundleAdjust.hpp"
+
+// Out-of-core reconstruction of large image sets.
+//
+// Everything that scales with the number of images lives on disk in a
+// working directory: per-view features, the view graph and one model per
+// cluster. The view graph is split into overlapping clusters which are
+// reconstructed independently (GlobalSfM), possibly in separate processes,
+// and then merged through their shared tracks with similarity transforms.
+// Peak memory is bounded by the cluster size, except for matching, which
+// holds every view's descriptors, and the final merge/refinement which
+// only holds poses, points and observations.
+namespace Partition
+{
+    struct Edge
+    {
+        int i, j;
+        int matches;
+    };
+
+    // Poses and structure in global view and keypoint indices
+    struct Model
+    {
+        // Global ids of the views with a pose, rotations/translations
+        // are aligned with it.
+        std::vector<int>         views;
+        std::vector<cv::Matx33d> rotations;
+        std::vector<cv::Vec3d>   translations;
+
+        std::vector<cv::Point3d> points;
+
+        // observations[k].view indexes the views above and keypoints[k]
+        // is the keypoint of that observation within its view.
+        std::vector<BundleAdjust::Observation> observations;
+        std::vector<int>                       keypoints;
+    };
+
+    std::string features_path(const std::string& workdir, int view);
+    std::string cluster_path(const std::string& workdir, int cluster);
+
+    // Detects and stores features for every image, one image in memory
+    // at a time.
+    void extract_features(
+        const std::vector<std::string>& image_paths,
+        const std::string& workdir);
+
+    // Matches every pair of views. Every view's descriptors are read once
+    // and held for the whole pass; keypoints and images stay on disk.
+    void build_view_graph(
+        int n_views,
+        const std::string& workdir,
+        std::vector<Edge>& edges);
+
+    // Greedily grows clusters of at most max_size views around strongly
+    // connected seeds, then extends each one with its overlap strongest
+    // outside neighbours so that neighbouring clusters share views.
+    void cluster_views(
+        int n_views,
+        const std::vector<Edge>& edges,
+        int max_size,
+        int overlap,
+        std::vector<std::vector<int> >& clusters);
+
+    // Reconstructs the given views from their stored features and writes
+    // the result to cluster_path(workdir, index).
+    bool reconstruct_cluster(
+        const std::vector<int>& views,
+        const cv::Mat& K,
+        const std::string& workdir,
+        int index);
+
+    void save_model(const std::string& path, const Model& model);
+    bool load_model(const std::string& path, Model& model);
+
+    // Loads the cluster models one at a time and aligns each to the
+    // growing merged model with a robust similarity transform. dropped
+    // gets the clusters left out: missing, failing to align, or sharing
+    // no view with the rest. Returns false if no cluster could be loaded.
+    bool merge_clusters(
+        const std::string& workdir,
+        int n_clusters,
+        Model& merged,
+        std::vector<int>& dropped);
+
+    // Final global refinement of the merged model
+    double refine(const cv::Mat& K, Model& model);
+}
+
+#endif
@@ -0,0 +1,224 @@
+#include "Pipeline.hpp"
+
+#include <highgui.hpp>
+#include <videoio.hpp>
+
+#include <algorithm>
+#include <chrono>
+
+namespace
+{
+    // Backoff: busy spins, then yields, then sleeps of this many
+    // microseconds, which bounds how late a waiting stage wakes up
+    const int spin_waits  = 64;
+    const int yield_waits = 64;
+    const int sleep_us    = 200;
+}
+
+namespace Pipeline
+{
+    Backoff::Backoff()
+    : _count(0)
+    {}
+
+    void Backoff::wait()
+    {
+        if (_count < spin_waits)
+        {
+            ++_count;
+        }
+        else if (_count < spin_waits + yield_waits)
+        {
+            ++_count;
+            std::this_thread::yield();
+        }
+        else
+        {
+            std::this_thread::sleep_for(std::chrono::microseconds(sleep_us));
+        }
+    }
+
+    Stage::Stage()
+    : _stopped(false)
+    {}
+
+    void Stage::attach(Edge& edge)
+    {
+        _edges.push_back(&edge);
+    }
+
+    void Stage::run()
+    {
+        while (!_stopped.load(std::memory_order_acquire) && step())
+        {}
+
+        for (int i = 0; i < _edges.size(); ++i)
+        {
+            _edges[i]->close();
+        }
+    }
+
+    void Stage::stop()
+    {
+        _stopped.store(true, std::memory_order_release);
+    }
+
+    Runner::~Runner()
+    {
+        join();
+    }
+
+    void Runner::start(Stage& stage)
+    {
+        _stages.push_back(&stage);
+        _threads.push_back(std::thread(&Stage::run, &stage));
+    }
+
+    void Runner::run(Stage& stage)
+    {
+        stage.run();
+
+        // Stages waiting on a device rather than a ring only notice this
+        for (int i = 0; i < _stages.size(); ++i)
+        {
+            _stages[i]->stop();
+        }
+        join();
+    }
+
+    void Runner::join()
+    {
+        for (int i = 0; i < _threads.size(); ++i)
+        {
+            if (_threads[i].joinable())
+                _threads[i].join();
+        }
+        _threads.clear();
+        _stages.clear();
+    }
+
+    void release(Frame& frame)
+    {
+        if (frame.buffer.empty())
+            return;
+        frame.buffer.release();
+        frame.image.release();
+    }
+
+    bool pass(Ring<Frame>& ring, Frame& frame)
+    {
+        const bool pushed = ring.push(frame);
+        release(frame);
+        return pushed;
+    }
+
+    Capture::Capture(cv::VideoCapture& capture, FramePool& pool, Ring<Frame>& output)
+    : _capture(capture)
+    , _pool(pool)
+    , _output(output)
+    , _index(0)
+    , _starved(0)
+    {
+        attach(output);
+
+        // Frames queued in the driver are stale by the time they are read;
+        // backends without the property ignore it
+        _capture.set(cv::CAP_PROP_BUFFERSIZE, 1);
+    }
+
+    bool Capture::step()
+    {
+        if (!_capture.grab())
+            return false;
+        _frame.captured = cv::getTickCount();
+
+        ++_index;
+        _frame.buffer = _pool.acquire();
+        if (_frame.buffer.empty())
+        {
+            ++_starved;
+            return true;
+        }
+
+        // Decoded in place, as the header is already of the frame's size
+        // and type
+        _frame.image = _frame.buffer.image();
+        if (!_capture.retrieve(_frame.image) || _frame.image.empty())
+            return false;
+        if (!_frame.buffer.holds(_frame.image))
+        {
+            printf("Capture: %dx%d frames don't fit the %dx%d frame pool\n",
+                   _frame.image.cols, _frame.image.rows, _pool.size().width, _pool.size().height);
+            return false;
+        }
+
+        _frame.index = _index;
+        _frame.started = _frame.processed = _frame.captured;
+        return pass(_output, _frame);
+    }
+
+    long Capture::starved() const
+    {
+        return _starved;
+    }
+
+    Display::Display(const std::string& window, Ring<Frame>& input, Ring<int>* keys, int quit_key, int wait_ms)
+    : _window(window)
+    , _input(input)
+    , _keys(keys)
+    , _quit_key(quit_key)
+    , _wait_ms(wait_ms)
+    , _report(false)
+    , _shown(0)
+    , _total_ms(0.0)
+    , _worst_ms(0.0)
+    {
+        attach(input);
+        if (keys)
+            attach(*keys);
+    }
+
+    bool Display::step()
+    {
+        if (!_input.pop(_frame))
+            return false;
+
+        cv::imshow(_window, _frame.image);
+        const int key = cv::waitKey(_wait_ms);
+        release(_frame);
+
+        const double ms = 1000.0 / cv::getTickFrequency();
+        const double latency = (cv::getTickCount() - _frame.captured) * ms;
+        ++_shown;
+        _total_ms += latency;
+        _worst_ms = std::max(_worst_ms, latency);
+
+        if (_report)
+        {
+            printf("[frame %d] glass to overlay %0.2f ms: queued %0.2f processing %0.2f display %0.2f\n",
+                   _frame.index, latency,
+                   (_frame.started - _frame.captured) * ms,
+                   (_frame.processed - _frame.started) * ms,
+                   latency - (_frame.processed - _frame.captured) * ms);
+        }
+
+        if (key == _quit_key)
+            return false;
+
+        int pressed = key;
+        if (key >= 0 && _keys && !_keys->push(pressed))
+            return false;
+        return true;
+    }
+
+    void Display::report_latency(bool on)
+    {
+        _report = on;
+    }
+
+    void Display::summary() const
+    {
+        printf("[display]: %d frames shown, glass to overlay mean %0.2f worst %0.2f ms\n",
+               _shown, _shown > 0 ? _total_ms / _shown : 0.0, _worst_ms);
+    }
+}
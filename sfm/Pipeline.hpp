@@ -0,0 +1,394 @@
+#ifndef __PIPELINE_HPP__
+#define __PIPELINE_HPP__
+
+#include <atomic>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+#include <core.hpp>
+
+#include "FramePool.hpp"
+
+namespace cv
+{
+    class VideoCapture;
+}
+
+// Stages of a live tool (capture, processing, display) each on a thread of
+// their own, passing items through bounded single-producer single-consumer
+// rings. Every edge picks what happens when its consumer falls behind:
+// BLOCK holds the producer back until there is room, which suits inputs
+// that must all be seen (an image list); DROP_OLDEST throws out the oldest
+// waiting item instead, so a camera or a slow display never holds up the
+// stage before it.
+//
+// A stage stops when its step returns false, for instance when its input
+// ring is closed and empty or its output ring is closed. It then closes
+// every ring it is attached to, so the stop spreads both ways through the
+// pipeline.
+namespace Pipeline
+{
+    // Waits in a loop: spins, then yields, then sleeps, so a stage that
+    // has nothing to do for a whole frame doesn't hold a core
+    class Backoff
+    {
+    public:
+        Backoff();
+        void wait();
+
+    private:
+        int _count;
+    };
+
+    class Edge
+    {
+    public:
+        virtual ~Edge() {}
+        virtual void close() = 0;
+    };
+
+    enum Policy { BLOCK, DROP_OLDEST };
+
+    // Items are swapped in and out rather than copied, so the buffers of a
+    // cv::Mat go round between producer and consumer instead of being
+    // allocated per item. A stage must not keep a header to an item it
+    // pushed: the consumer may write into it.
+    //
+    // The slots follow Vyukov's bounded queue, each with a sequence number
+    // that tells whose turn it is. When DROP_OLDEST drops, the producer
+    // claims the oldest item the way the consumer would, so the only
+    // other wait left to it is the swap of a slot the consumer is still
+    // taking out.
+    template <typename T>
+    class Ring : public Edge
+    {
+    public:
+        Ring(int capacity, Policy policy);
+
+        // Swaps item into the ring, leaving item with a recycled one.
+        // Returns false once the ring is closed.
+        bool push(T& item);
+
+        // Swaps the oldest item out into item, waiting while the ring is
+        // empty. Returns false once the ring is closed and empty.
+        bool pop(T& item);
+
+        // As pop, without waiting
+        bool try_pop(T& item);
+
+        void close();
+        bool closed() const;
+
+        int capacity() const;
+        long pushed() const;
+        long dropped() const;
+
+    private:
+        const size_t _capacity;
+        const size_t _slots;
+        const Policy _policy;
+
+        std::vector<std::atomic<size_t> > _sequences;
+        std::vector<T> _items;
+
+        // Apart, so each end writes its own cache line
+        char _pad0[64];
+        std::atomic<size_t> _head;
+        char _pad1[64];
+        std::atomic<size_t> _tail;
+        char _pad2[64];
+
+        std::atomic<bool> _closed;
+        std::atomic<long> _pushed;
+        std::atomic<long> _dropped;
+
+        bool take(T& item, bool wait);
+    };
+
+    class Stage
+    {
+    public:
+        Stage();
+        virtual ~Stage() {}
+
+        // One unit of work. Returns false once the stage is done.
+        virtual bool step() = 0;
+
+        // Rings closed when the stage is done
+        void attach(Edge& edge);
+
+        // Steps until done, then closes the attached rings
+        void run();
+
+        // Asks the stage to stop after the current step
+        void stop();
+
+    private:
+        std::vector<Edge*> _edges;
+        std::atomic<bool> _stopped;
+    };
+
+    // Runs stages on threads of their own
+    class Runner
+    {
+    public:
+        ~Runner();
+
+        // Starts stage on a new thread
+        void start(Stage& stage);
+
+        // Runs stage on the calling thread, as HighGUI wants its windows
+        // driven from the main thread, then stops and joins the others
+        void run(Stage& stage);
+
+        void join();
+
+    private:
+        std::vector<Stage*> _stages;
+        std::vector<std::thread> _threads;
+    };
+
+    // What the live tools pass between stages. A captured image is a
+    // header on a pool buffer, held by buffer for as long as the frame is
+    // on its way; images a stage makes itself leave buffer empty.
+    struct Frame
+    {
+        cv::Mat image;
+        FramePool::Handle buffer;
+        int index;   // in capture order, from 1
+
+        // Tick counts (cv::getTickCount) along the way
+        int64 captured;    // the device handed the frame over
+        int64 started;     // processing took it
+        int64 processed;   // processing passed it on
+    };
+
+    // Lets go of frame's pool buffer, and of the image header on it, so no
+    // header is left behind to write into a buffer someone else now holds.
+    // Images of a stage's own stay for reuse.
+    void release(Frame& frame);
+
+    // Pushes frame into ring and releases the frame that comes back, so
+    // its buffer goes back to the pool now rather than when the recycled
+    // frame is next written
+    bool pass(Ring<Frame>& ring, Frame& frame);
+
+    // Drains a video device into a ring on a thread of its own, until the
+    // device runs dry. Into a DROP_OLDEST ring of capacity 1 this is the
+    // "latest frame wins" mode: the device's queue never fills up, and the
+    // stage after always gets the newest frame there is, whatever number
+    // of frames it was too slow for.
+    //
+    // Frames are decoded straight into buffers of pool, which must be of
+    // the device's frame size and hold enough buffers for every frame that
+    // can be in flight at once: one per stage and per ring slot. When the
+    // pool runs out all the same the frame is grabbed and thrown away, and
+    // the stage after, as the only holder, may draw on the ones it gets.
+    class Capture : public Stage
+    {
+    public:
+        Capture(cv::VideoCapture& capture, FramePool& pool, Ring<Frame>& output);
+        bool step();
+
+        // Frames thrown away for want of a free buffer
+        long starved() const;
+
+    private:
+        cv::VideoCapture& _capture;
+        FramePool& _pool;
+        Ring<Frame>& _output;
+        Frame _frame;
+        int _index;
+        long _starved;
+    };
+
+    // Shows frames in a window and passes the keys pressed on, until the
+    // quit key. keys may be null.
+    //
+    // With latency reporting on, prints for every frame shown how long it
+    // took from capture to being on screen, split into the wait before
+    // processing, processing, and the wait and draw after. Capture time is
+    // when the device handed the frame over, so exposure and transfer
+    // before that are not counted, and on screen is when waitKey has run
+    // the window's redraw.
+    class Display : public Stage
+    {
+    public:
+        Display(const std::string& window, Ring<Frame>& input, Ring<int>* keys,
+                int quit_key = 27, int wait_ms = 1);
+        bool step();
+
+        void report_latency(bool on);
+
+        // Frames shown, and the mean and worst capture to screen latency
+        void summary() const;
+
+    private:
+        std::string _window;
+        Ring<Frame>& _input;
+        Ring<int>* _keys;
+        int _quit_key;
+        int _wait_ms;
+        Frame _frame;
+
+        bool _report;
+        int _shown;
+        double _total_ms;
+        double _worst_ms;
+    };
+
+    template <typename T>
+    void report(const char* name, const Ring<T>& ring);
+}
+
+template <typename T>
+Pipeline::Ring<T>::Ring(int capacity, Policy policy)
+: _capacity(capacity)
+, _slots(capacity + 1)
+, _policy(policy)
+, _sequences(capacity + 1)
+, _items(capacity + 1)
+, _head(0)
+, _tail(0)
+, _closed(false)
+, _pushed(0)
+, _dropped(0)
+{
+    CV_Assert(capacity > 0);
+    for (size_t i = 0; i < _slots; ++i)
+    {
+        _sequences[i].store(i, std::memory_order_relaxed);
+    }
+}
+
+template <typename T>
+bool Pipeline::Ring<T>::push(T& item)
+{
+    // Only the producer moves the tail
+    const size_t tail = _tail.load(std::memory_order_relaxed);
+    const size_t slot = tail % _slots;
+
+    Backoff backoff;
+    while (true)
+    {
+        if (_closed.load(std::memory_order_acquire))
+            return false;
+
+        size_t head = _head.load(std::memory_order_acquire);
+        if (tail - head >= _capacity)
+        {
+            if (_policy == BLOCK)
+            {
+                backoff.wait();
+                continue;
+            }
+
+            // The oldest item is claimed as a pop would, but stays in its
+            // slot for reuse
+            if (_head.compare_exchange_strong(head, head + 1, std::memory_order_acq_rel))
+            {
+                _sequences[head % _slots].store(head + _slots, std::memory_order_release);
+                _dropped.fetch_add(1, std::memory_order_relaxed);
+            }
+            continue;
+        }
+
+        // The consumer can still be swapping out of this slot
+        if (_sequences[slot].load(std::memory_order_acquire) != tail)
+        {
+            backoff.wait();
+            continue;
+        }
+
+        std::swap(item, _items[slot]);
+        _sequences[slot].store(tail + 1, std::memory_order_release);
+        _tail.store(tail + 1, std::memory_order_release);
+        _pushed.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+}
+
+template <typename T>
+bool Pipeline::Ring<T>::pop(T& item)
+{
+    return take(item, true);
+}
+
+template <typename T>
+bool Pipeline::Ring<T>::try_pop(T& item)
+{
+    return take(item, false);
+}
+
+template <typename T>
+bool Pipeline::Ring<T>::take(T& item, bool wait)
+{
+    Backoff backoff;
+    while (true)
+    {
+        size_t head = _head.load(std::memory_order_acquire);
+        const size_t slot = head % _slots;
+        if (_sequences[slot].load(std::memory_order_acquire) == head + 1)
+        {
+            // Loses to a producer dropping this item
+            if (_head.compare_exchange_strong(head, head + 1, std::memory_order_acq_rel))
+            {
+                std::swap(item, _items[slot]);
+                _sequences[slot].store(head + _slots, std::memory_order_release);
+                return true;
+            }
+            continue;
+        }
+
+        // Items pushed before the close are still handed out
+        if (_closed.load(std::memory_order_acquire))
+        {
+            if (_sequences[slot].load(std::memory_order_acquire) == head + 1)
+                continue;
+            return false;
+        }
+
+        if (!wait)
+            return false;
+        backoff.wait();
+    }
+}
+
+template <typename T>
+void Pipeline::Ring<T>::close()
+{
+    _closed.store(true, std::memory_order_release);
+}
+
+template <typename T>
+bool Pipeline::Ring<T>::closed() const
+{
+    return _closed.load(std::memory_order_acquire);
+}
+
+template <typename T>
+int Pipeline::Ring<T>::capacity() const
+{
+    return _capacity;
+}
+
+template <typename T>
+long Pipeline::Ring<T>::pushed() const
+{
+    return _pushed.load(std::memory_order_relaxed);
+}
+
+template <typename T>
+long Pipeline::Ring<T>::dropped() const
+{
+    return _dropped.load(std::memory_order_relaxed);
+}
+
+template <typename T>
+void Pipeline::report(const char* name, const Ring<T>& ring)
+{
+    printf("[%s]: %ld pushed, %ld dropped\n", name, ring.pushed(), ring.dropped());
+}
+
+#endif
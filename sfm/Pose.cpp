@@ -0,0 +1,1000 @@
+#include "Pose.hpp"
+
+#include <cmath>
+#include <cassert>
+#include <algorithm>
+#include <limits>
+
+namespace
+{
+    const int min_inliers = 6;
+
+    // Largest real root of x^3 + a x^2 + b x + c
+    double largest_cubic_root(double a, double b, double c)
+    {
+        double Q = (a * a - 3.0 * b) / 9.0;
+        double R = (2.0 * a * a * a - 9.0 * a * b + 27.0 * c) / 54.0;
+
+        if (R * R < Q * Q * Q)
+        {
+            double theta = std::acos(R / std::sqrt(Q * Q * Q));
+            double s = -2.0 * std::sqrt(Q);
+            double r0 = s * std::cos(theta / 3.0) - a / 3.0;
+            double r1 = s * std::cos((theta + 2.0 * CV_PI) / 3.0) - a / 3.0;
+            double r2 = s * std::cos((theta - 2.0 * CV_PI) / 3.0) - a / 3.0;
+            return std::max(r0, std::max(r1, r2));
+        }
+
+        double A = -std::cbrt(std::abs(R) + std::sqrt(R * R - Q * Q * Q));
+        if (R < 0.0)
+            A = -A;
+        double B = A == 0.0 ? 0.0 : Q / A;
+        return A + B - a / 3.0;
+    }
+
+    // Real roots of c[4] x^4 + c[3] x^3 + c[2] x^2 + c[1] x + c[0] (Ferrari),
+    // polished with Newton steps on the original polynomial.
+    int solve_quartic(const double c[5], double roots[4])
+    {
+        if (std::abs(c[4]) < 1e-14)
+            return 0;
+
+        const double a = c[3] / c[4], b = c[2] / c[4], d = c[1] / c[4], e = c[0] / c[4];
+
+        // Depressed quartic y^4 + p y^2 + q y + r with x = y - a / 4
+        const double p = b - 3.0 * a * a / 8.0;
+        const double q = d - a * b / 2.0 + a * a * a / 8.0;
+        const double r = e - a * d / 4.0 + a * a * b / 16.0 - 3.0 * a * a * a * a / 256.0;
+
+        double y[4];
+        int n = 0;
+
+        if (std::abs(q) < 1e-12)
+        {
+            // Biquadratic
+            double disc = p * p - 4.0 * r;
+            if (disc >= 0.0)
+            {
+                double z[2] = { (-p + std::sqrt(disc)) / 2.0, (-p - std::sqrt(disc)) / 2.0 };
+                for (int k = 0; k < 2; ++k)
+                {
+                    if (z[k] >= 0.0)
+                    {
+                        y[n++] = std::sqrt(z[k]);
+                        y[n++] = -std::sqrt(z[k]);
+                    }
+                }
+            }
+        }
+        else
+        {
+            // (y^2 + p / 2 + m)^2 = 2 m (y - q / (4 m))^2 for the positive
+            // root m of the resolvent cubic
+            double m = largest_cubic_root(p, p * p / 4.0 - r, -q * q / 8.0);
+            if (m <= 0.0)
+                return 0;
+
+            double s = std::sqrt(2.0 * m);
+            double k = s * q / (4.0 * m);
+            for (int sign = -1; sign <= 1; sign += 2)
+            {
+                // y^2 + sign * s * y + (p / 2 + m - sign * k) = 0
+                double B = sign * s;
+                double C = p / 2.0 + m - sign * k;
+                double disc = B * B - 4.0 * C;
+                if (disc < 0.0)
+                    continue;
+
+                y[n++] = (-B + std::sqrt(disc)) / 2.0;
+                y[n++] = (-B - std::sqrt(disc)) / 2.0;
+            }
+        }
+
+        for (int i = 0; i < n; ++i)
+        {
+            double x = y[i] - a / 4.0;
+            for (int it = 0; it < 2; ++it)
+            {
+                double f  = (((c[4] * x + c[3]) * x + c[2]) * x + c[1]) * x + c[0];
+                double df = ((4.0 * c[4] * x + 3.0 * c[3]) * x + 2.0 * c[2]) * x + c[1];
+                if (df == 0.0)
+                    break;
+                x -= f / df;
+            }
+            roots[i] = x;
+        }
+
+        return n;
+    }
+
+    // Orthonormal frame (as rows) spanned by a triangle
+    bool triangle_frame(const cv::Vec3d& a, const cv::Vec3d& b, const cv::Vec3d& c, cv::Matx33d& frame)
+    {
+        cv::Vec3d e1 = b - a;
+        cv::Vec3d e3 = e1.cross(c - a);
+
+        double n1 = cv::norm(e1), n3 = cv::norm(e3);
+        if (n1 < 1e-12 || n3 < 1e-12 * n1)
+            return false;
+
+        e1 = e1 / n1;
+        e3 = e3 / n3;
+        cv::Vec3d e2 = e3.cross(e1);
+
+        frame = cv::Matx33d(e1(0), e1(1), e1(2),
+                            e2(0), e2(1), e2(2),
+                            e3(0), e3(1), e3(2));
+        return true;
+    }
+
+    // Cyclic Jacobi eigen decomposition of a symmetric matrix, eigenvalues
+    // in ascending order and eigenvectors as the columns of vectors.
+    template<int n>
+    void symmetric_eigen(
+        cv::Matx<double, n, n> A,
+        cv::Vec<double, n>& values,
+        cv::Matx<double, n, n>& vectors)
+    {
+        cv::Matx<double, n, n> V = cv::Matx<double, n, n>::eye();
+
+        for (int sweep = 0; sweep < 30; ++sweep)
+        {
+            double off = 0.0, diagonal = 0.0;
+            for (int p = 0; p < n; ++p)
+            {
+                diagonal += A(p, p) * A(p, p);
+                for (int q = p + 1; q < n; ++q)
+                    off += A(p, q) * A(p, q);
+            }
+
+            if (off <= 1e-30 * diagonal)
+                break;
+
+            for (int p = 0; p < n; ++p)
+            {
+                for (int q = p + 1; q < n; ++q)
+                {
+                    if (A(p, q) == 0.0)
+                        continue;
+
+                    double theta = (A(q, q) - A(p, p)) / (2.0 * A(p, q));
+                    double t = (theta >= 0.0 ? 1.0 : -1.0) / (std::abs(theta) + std::sqrt(theta * theta + 1.0));
+                    double c = 1.0 / std::sqrt(t * t + 1.0);
+                    double s = t * c;
+
+                    for (int k = 0; k < n; ++k)
+                    {
+                        double akp = A(k, p), akq = A(k, q);
+                        A(k, p) = c * akp - s * akq;
+                        A(k, q) = s * akp + c * akq;
+                    }
+                    for (int k = 0; k < n; ++k)
+                    {
+                        double apk = A(p, k), aqk = A(q, k);
+                        A(p, k) = c * apk - s * aqk;
+                        A(q, k) = s * apk + c * aqk;
+                    }
+                    for (int k = 0; k < n; ++k)
+                    {
+                        double vkp = V(k, p), vkq = V(k, q);
+                        V(k, p) = c * vkp - s * vkq;
+                        V(k, q) = s * vkp + c * vkq;
+                    }
+                }
+            }
+        }
+
+        int order[n];
+        for (int i = 0; i < n; ++i)
+            order[i] = i;
+        for (int i = 1; i < n; ++i)
+        {
+            for (int j = i; j > 0 && A(order[j], order[j]) < A(order[j - 1], order[j - 1]); --j)
+                std::swap(order[j], order[j - 1]);
+        }
+
+        for (int i = 0; i < n; ++i)
+        {
+            values(i) = A(order[i], order[i]);
+            for (int k = 0; k < n; ++k)
+                vectors(k, i) = V(k, order[i]);
+        }
+    }
+
+    // Horn's closed-form absolute orientation from the cross-covariance
+    // S = sum (world_i - world_c) (camera_i - camera_c)^T
+    cv::Matx33d horn_rotation(const cv::Matx33d& S)
+    {
+        const double Sxx = S(0, 0), Sxy = S(0, 1), Sxz = S(0, 2);
+        const double Syx = S(1, 0), Syy = S(1, 1), Syz = S(1, 2);
+        const double Szx = S(2, 0), Szy = S(2, 1), Szz = S(2, 2);
+
+        const double N[16] =
+        {
+            Sxx + Syy + Szz, Syz - Szy,        Szx - Sxz,        Sxy - Syx,
+            Syz - Szy,       Sxx - Syy - Szz,  Sxy + Syx,        Szx + Sxz,
+            Szx - Sxz,       Sxy + Syx,       -Sxx + Syy - Szz,  Syz + Szy,
+            Sxy - Syx,       Szx + Sxz,        Syz + Szy,       -Sxx - Syy + Szz,
+        };
+
+        cv::Vec4d values;
+        cv::Matx44d vectors;
+        symmetric_eigen<4>(cv::Matx44d(N), values, vectors);
+
+        const double w = vectors(0, 3), x = vectors(1, 3), y = vectors(2, 3), z = vectors(3, 3);
+        return cv::Matx33d(
+            w * w + x * x - y * y - z * z, 2.0 * (x * y - w * z),         2.0 * (x * z + w * y),
+            2.0 * (x * y + w * z),         w * w - x * x + y * y - z * z, 2.0 * (y * z - w * x),
+            2.0 * (x * z - w * y),         2.0 * (y * z + w * x),         w * w - x * x - y * y + z * z);
+    }
+
+    // EPnP state shared by the beta approximations
+    struct EPnP
+    {
+        cv::Vec3d control[4];
+        cv::Matx33d to_barycentric;
+        cv::Matx<double, 12, 4> null_space;
+        cv::Matx<double, 6, 10> L;
+        cv::Vec<double, 6> rho;
+
+        void alphas(const cv::Point3d& X, double a[4]) const
+        {
+            cv::Vec3d b = to_barycentric * (cv::Vec3d(X.x, X.y, X.z) - control[0]);
+            a[0] = 1.0 - b(0) - b(1) - b(2);
+            a[1] = b(0);
+            a[2] = b(1);
+            a[3] = b(2);
+        }
+    };
+
+    const int control_pairs[6][2] = { {0, 1}, {0, 2}, {0, 3}, {1, 2}, {1, 3}, {2, 3} };
+
+    void gauss_newton(const EPnP& e, double betas[4])
+    {
+        for (int it = 0; it < 5; ++it)
+        {
+            cv::Matx44d JtJ;
+            cv::Vec4d Jtr;
+            const double b0 = betas[0], b1 = betas[1], b2 = betas[2], b3 = betas[3];
+            const double b10[10] = { b0 * b0, b0 * b1, b1 * b1, b0 * b2, b1 * b2,
+                                     b2 * b2, b0 * b3, b1 * b3, b2 * b3, b3 * b3 };
+
+            for (int i = 0; i < 6; ++i)
+            {
+                const double* l = &e.L.val[i * 10];
+                double J[4] =
+                {
+                    2.0 * l[0] * b0 + l[1] * b1 + l[3] * b2 + l[6] * b3,
+                    l[1] * b0 + 2.0 * l[2] * b1 + l[4] * b2 + l[7] * b3,
+                    l[3] * b0 + l[4] * b1 + 2.0 * l[5] * b2 + l[8] * b3,
+                    l[6] * b0 + l[7] * b1 + l[8] * b2 + 2.0 * l[9] * b3,
+                };
+
+                double r = e.rho(i);
+                for (int k = 0; k < 10; ++k)
+                    r -= l[k] * b10[k];
+
+                for (int a = 0; a < 4; ++a)
+                {
+                    Jtr(a) += J[a] * r;
+                    for (int b = 0; b < 4; ++b)
+                        JtJ(a, b) += J[a] * J[b];
+                }
+            }
+
+            cv::Vec4d delta = JtJ.solve(Jtr, cv::DECOMP_LU);
+            for (int k = 0; k < 4; ++k)
+                betas[k] += delta(k);
+        }
+    }
+
+    // Least squares fit of rho by the chosen columns of L
+    template<int k>
+    cv::Vec<double, k> fit_columns(const EPnP& e, const int columns[k])
+    {
+        cv::Matx<double, k, k> AtA;
+        cv::Vec<double, k> Atb;
+        for (int i = 0; i < 6; ++i)
+        {
+            for (int a = 0; a < k; ++a)
+            {
+                Atb(a) += e.L(i, columns[a]) * e.rho(i);
+                for (int b = 0; b < k; ++b)
+                    AtA(a, b) += e.L(i, columns[a]) * e.L(i, columns[b]);
+            }
+        }
+        return AtA.solve(Atb, cv::DECOMP_LU);
+    }
+
+    double mean_error(
+        const cv::Point3d* points,
+        const cv::Point2d* normalized,
+        int n,
+        const cv::Matx33d& R,
+        const cv::Vec3d& t)
+    {
+        double error = 0.0;
+        for (int i = 0; i < n; ++i)
+        {
+            cv::Vec3d Xc = R * cv::Vec3d(points[i].x, points[i].y, points[i].z) + t;
+            double dx = Xc(0) / Xc(2) - normalized[i].x;
+            double dy = Xc(1) / Xc(2) - normalized[i].y;
+            error += std::sqrt(dx * dx + dy * dy);
+        }
+        return error / n;
+    }
+
+    double pose_from_betas(
+        const EPnP& e,
+        const double betas[4],
+        const cv::Point3d* points,
+        const cv::Point2d* normalized,
+        int n,
+        cv::Matx33d& rotation,
+        cv::Vec3d& translation)
+    {
+        cv::Vec3d control[4];
+        for (int c = 0; c < 4; ++c)
+        {
+            for (int d = 0; d < 3; ++d)
+            {
+                double v = 0.0;
+                for (int k = 0; k < 4; ++k)
+                    v += betas[k] * e.null_space(3 * c + d, k);
+                control[c](d) = v;
+            }
+        }
+
+        // Camera frame points, flipped if they ended up behind the camera
+        cv::Vec3d world_centroid, camera_centroid;
+        double depth = 0.0;
+        for (int i = 0; i < n; ++i)
+        {
+            double a[4];
+            e.alphas(points[i], a);
+            cv::Vec3d pc = a[0] * control[0] + a[1] * control[1] + a[2] * control[2] + a[3] * control[3];
+            camera_centroid += pc;
+            world_centroid += cv::Vec3d(points[i].x, points[i].y, points[i].z);
+            depth += pc(2);
+        }
+
+        const double sign = depth < 0.0 ? -1.0 : 1.0;
+        camera_centroid = camera_centroid * (sign / n);
+        world_centroid = world_centroid / n;
+
+        cv::Matx33d S;
+        for (int i = 0; i < n; ++i)
+        {
+            double a[4];
+            e.alphas(points[i], a);
+            cv::Vec3d pc = (a[0] * control[0] + a[1] * control[1] + a[2] * control[2] + a[3] * control[3]) * sign;
+            cv::Vec3d pw = cv::Vec3d(points[i].x, points[i].y, points[i].z);
+            S += (pw - world_centroid) * (pc - camera_centroid).t();
+        }
+
+        rotation = horn_rotation(S);
+        translation = camera_centroid - rotation * world_centroid;
+        return mean_error(points, normalized, n, rotation, translation);
+    }
+
+    // exp([w]x) by Rodrigues' formula
+    cv::Matx33d exp_rotation(const cv::Vec3d& w)
+    {
+        double angle = cv::norm(w);
+        cv::Matx33d W(0.0, -w(2), w(1),
+                      w(2), 0.0, -w(0),
+                      -w(1), w(0), 0.0);
+        if (angle < 1e-12)
+            return cv::Matx33d::eye() + W;
+
+        return cv::Matx33d::eye()
+            + W * (std::sin(angle) / angle)
+            + W * W * ((1.0 - std::cos(angle)) / (angle * angle));
+    }
+
+    // Homography from the object plane (relative to center) to normalized
+    // coordinates with H(2, 2) = 1, exact for four points.
+    bool plane_homography(
+        const cv::Point2d* object,
+        const cv::Point2d& center,
+        const cv::Point2d* normalized,
+        int n,
+        cv::Matx33d& H)
+    {
+        cv::Matx<double, 8, 8> AtA;
+        cv::Vec<double, 8> Atb;
+        for (int i = 0; i < n; ++i)
+        {
+            const double x = object[i].x - center.x, y = object[i].y - center.y;
+            const double u = normalized[i].x, v = normalized[i].y;
+            const double rows[2][8] =
+            {
+                { x, y, 1.0, 0.0, 0.0, 0.0, -u * x, -u * y },
+                { 0.0, 0.0, 0.0, x, y, 1.0, -v * x, -v * y },
+            };
+            const double b[2] = { u, v };
+
+            for (int r = 0; r < 2; ++r)
+            {
+                for (int j = 0; j < 8; ++j)
+                {
+                    Atb(j) += rows[r][j] * b[r];
+                    for (int k = 0; k < 8; ++k)
+                        AtA(j, k) += rows[r][j] * rows[r][k];
+                }
+            }
+        }
+
+        cv::Vec<double, 8> h = AtA.solve(Atb, cv::DECOMP_LU);
+        H = cv::Matx33d(h(0), h(1), h(2),
+                        h(3), h(4), h(5),
+                        h(6), h(7), 1.0);
+        return std::abs(cv::determinant(H)) > 1e-12;
+    }
+
+    // Least squares translation for a known rotation of a planar target
+    cv::Vec3d plane_translation(
+        const cv::Point2d* object,
+        const cv::Point2d& center,
+        const cv::Point2d* normalized,
+        int n,
+        const cv::Matx33d& R)
+    {
+        cv::Matx33d AtA;
+        cv::Vec3d Atb;
+        for (int i = 0; i < n; ++i)
+        {
+            const double x = object[i].x - center.x, y = object[i].y - center.y;
+            const double u = normalized[i].x, v = normalized[i].y;
+            const double rx = R(0, 0) * x + R(0, 1) * y;
+            const double ry = R(1, 0) * x + R(1, 1) * y;
+            const double rz = R(2, 0) * x + R(2, 1) * y;
+
+            // u * (rz + tz) = rx + tx and v * (rz + tz) = ry + ty
+            const cv::Vec3d a1(1.0, 0.0, -u), a2(0.0, 1.0, -v);
+            AtA += a1 * a1.t() + a2 * a2.t();
+            Atb += a1 * (u * rz - rx) + a2 * (v * rz - ry);
+        }
+        return AtA.solve(Atb, cv::DECOMP_LU);
+    }
+
+    double plane_error(
+        const cv::Point2d* object,
+        const cv::Point2d* normalized,
+        int n,
+        const cv::Matx33d& R,
+        const cv::Vec3d& t)
+    {
+        double error = 0.0;
+        for (int i = 0; i < n; ++i)
+        {
+            const double x = object[i].x, y = object[i].y;
+            const double z = R(2, 0) * x + R(2, 1) * y + t(2);
+            const double dx = (R(0, 0) * x + R(0, 1) * y + t(0)) / z - normalized[i].x;
+            const double dy = (R(1, 0) * x + R(1, 1) * y + t(1)) / z - normalized[i].y;
+            error += std::sqrt(dx * dx + dy * dy);
+        }
+        return error / n;
+    }
+}
+
+namespace Pose
+{
+    int p3p(
+        const cv::Vec3d points[3],
+        const cv::Vec3d bearings[3],
+        cv::Matx33d rotations[4],
+        cv::Vec3d translations[4])
+    {
+        // Side lengths opposite each point and the cosines of the angles
+        // between the matching rays
+        const double a2 = (points[1] - points[2]).dot(points[1] - points[2]);
+        const double b2 = (points[0] - points[2]).dot(points[0] - points[2]);
+        const double c2 = (points[0] - points[1]).dot(points[0] - points[1]);
+        if (b2 < 1e-12)
+            return 0;
+
+        const double ca = bearings[1].dot(bearings[2]);
+        const double cb = bearings[0].dot(bearings[2]);
+        const double cg = bearings[0].dot(bearings[1]);
+
+        cv::Matx33d world_frame;
+        if (!triangle_frame(points[0], points[1], points[2], world_frame))
+            return 0;
+
+        // Depths s2 = u * s1 and s3 = v * s1 with v a root of Grunert's
+        // quartic
+        const double amc = (a2 - c2) / b2;
+        const double apc = (a2 + c2) / b2;
+        const double bmc = (b2 - c2) / b2;
+        const double bma = (b2 - a2) / b2;
+
+        double coeffs[5];
+        coeffs[4] = (amc - 1.0) * (amc - 1.0) - 4.0 * c2 / b2 * ca * ca;
+        coeffs[3] = 4.0 * (amc * (1.0 - amc) * cb - (1.0 - apc) * ca * cg + 2.0 * c2 / b2 * ca * ca * cb);
+        coeffs[2] = 2.0 * (amc * amc - 1.0 + 2.0 * amc * amc * cb * cb + 2.0 * bmc * ca * ca
+                           - 4.0 * apc * ca * cb * cg + 2.0 * bma * cg * cg);
+        coeffs[1] = 4.0 * (-amc * (1.0 + amc) * cb + 2.0 * a2 / b2 * cg * cg * cb - (1.0 - apc) * ca * cg);
+        coeffs[0] = (1.0 + amc) * (1.0 + amc) - 4.0 * a2 / b2 * cg * cg;
+
+        double roots[4];
+        const int n_roots = solve_quartic(coeffs, roots);
+
+        int n = 0;
+        for (int i = 0; i < n_roots; ++i)
+        {
+            const double v = roots[i];
+            const double denominator = 2.0 * (cg - v * ca);
+            const double s1_squared = b2 / (1.0 + v * v - 2.0 * v * cb);
+            if (v <= 0.0 || std::abs(denominator) < 1e-12 || !(s1_squared > 0.0))
+                continue;
+
+            const double u = ((amc - 1.0) * v * v - 2.0 * amc * cb * v + 1.0 + amc) / denominator;
+            if (u <= 0.0)
+                continue;
+
+            const double s1 = std::sqrt(s1_squared);
+            cv::Vec3d camera[3] = { bearings[0] * s1, bearings[1] * (u * s1), bearings[2] * (v * s1) };
+
+            cv::Matx33d camera_frame;
+            if (!triangle_frame(camera[0], camera[1], camera[2], camera_frame))
+                continue;
+
+            rotations[n] = camera_frame.t() * world_frame;
+            translations[n] = camera[0] - rotations[n] * points[0];
+            ++n;
+        }
+
+        return n;
+    }
+
+    bool epnp(
+        const cv::Point3d* points,
+        const cv::Point2d* normalized,
+        int n,
+        cv::Matx33d& rotation,
+        cv::Vec3d& translation)
+    {
+        if (n < 4)
+            return false;
+
+        // Control points: the centroid plus the principal directions
+        EPnP e;
+        for (int i = 0; i < n; ++i)
+            e.control[0] += cv::Vec3d(points[i].x, points[i].y, points[i].z);
+        e.control[0] = e.control[0] / n;
+
+        cv::Matx33d covariance;
+        for (int i = 0; i < n; ++i)
+        {
+            cv::Vec3d d = cv::Vec3d(points[i].x, points[i].y, points[i].z) - e.control[0];
+            covariance += d * d.t();
+        }
+
+        cv::Vec3d spread;
+        cv::Matx33d axes;
+        symmetric_eigen<3>(covariance, spread, axes);
+
+        cv::Matx33d basis;
+        for (int c = 1; c < 4; ++c)
+        {
+            double k = std::sqrt(std::max(spread(3 - c), 0.0) / n);
+            if (k < 1e-9)
+                k = 1e-9;
+
+            for (int d = 0; d < 3; ++d)
+            {
+                e.control[c](d) = e.control[0](d) + k * axes(d, 3 - c);
+                basis(d, c - 1) = k * axes(d, 3 - c);
+            }
+        }
+        e.to_barycentric = basis.inv();
+
+        // M^T M accumulated directly, two rows per correspondence
+        cv::Matx<double, 12, 12> MtM;
+        for (int i = 0; i < n; ++i)
+        {
+            double a[4];
+            e.alphas(points[i], a);
+
+            double rows[2][12];
+            for (int c = 0; c < 4; ++c)
+            {
+                rows[0][3 * c + 0] = a[c];
+                rows[0][3 * c + 1] = 0.0;
+                rows[0][3 * c + 2] = -a[c] * normalized[i].x;
+                rows[1][3 * c + 0] = 0.0;
+                rows[1][3 * c + 1] = a[c];
+                rows[1][3 * c + 2] = -a[c] * normalized[i].y;
+            }
+
+            for (int r = 0; r < 2; ++r)
+            {
+                for (int j = 0; j < 12; ++j)
+                {
+                    if (rows[r][j] == 0.0)
+                        continue;
+                    for (int k = j; k < 12; ++k)
+                        MtM(j, k) += rows[r][j] * rows[r][k];
+                }
+            }
+        }
+        for (int j = 0; j < 12; ++j)
+        {
+            for (int k = 0; k < j; ++k)
+                MtM(j, k) = MtM(k, j);
+        }
+
+        cv::Vec<double, 12> values;
+        cv::Matx<double, 12, 12> vectors;
+        symmetric_eigen<12>(MtM, values, vectors);
+        for (int j = 0; j < 12; ++j)
+        {
+            for (int k = 0; k < 4; ++k)
+                e.null_space(j, k) = vectors(j, k);
+        }
+
+        // Distance constraints between the control points
+        for (int i = 0; i < 6; ++i)
+        {
+            const int p = control_pairs[i][0], q = control_pairs[i][1];
+            cv::Vec3d dv[4];
+            for (int k = 0; k < 4; ++k)
+            {
+                for (int d = 0; d < 3; ++d)
+                    dv[k](d) = e.null_space(3 * p + d, k) - e.null_space(3 * q + d, k);
+            }
+
+            e.L(i, 0) = dv[0].dot(dv[0]);
+            e.L(i, 1) = 2.0 * dv[0].dot(dv[1]);
+            e.L(i, 2) = dv[1].dot(dv[1]);
+            e.L(i, 3) = 2.0 * dv[0].dot(dv[2]);
+            e.L(i, 4) = 2.0 * dv[1].dot(dv[2]);
+            e.L(i, 5) = dv[2].dot(dv[2]);
+            e.L(i, 6) = 2.0 * dv[0].dot(dv[3]);
+            e.L(i, 7) = 2.0 * dv[1].dot(dv[3]);
+            e.L(i, 8) = 2.0 * dv[2].dot(dv[3]);
+            e.L(i, 9) = dv[3].dot(dv[3]);
+
+            cv::Vec3d d = e.control[p] - e.control[q];
+            e.rho(i) = d.dot(d);
+        }
+
+        double betas[3][4] = { { 0.0 } };
+
+        // N = 4 approximation: betas from b00, b01, b02, b03
+        {
+            const int columns[4] = { 0, 1, 3, 6 };
+            cv::Vec4d B = fit_columns<4>(e, columns);
+            double b0 = std::sqrt(std::abs(B(0)));
+            double s = B(0) < 0.0 ? -1.0 : 1.0;
+            if (b0 > 0.0)
+            {
+                betas[0][0] = b0;
+                betas[0][1] = s * B(1) / b0;
+                betas[0][2] = s * B(2) / b0;
+                betas[0][3] = s * B(3) / b0;
+            }
+        }
+
+        // N = 2 approximation: b00, b01, b11
+        {
+            const int columns[3] = { 0, 1, 2 };
+            cv::Vec3d B = fit_columns<3>(e, columns);
+            double b0 = std::sqrt(std::abs(B(0)));
+            double b1 = (B(0) < 0.0) == (B(2) < 0.0) ? std::sqrt(std::abs(B(2))) : 0.0;
+            if (B(1) < 0.0)
+                b0 = -b0;
+            betas[1][0] = b0;
+            betas[1][1] = b1;
+        }
+
+        // N = 3 approximation: b00, b01, b11, b02, b12
+        {
+            const int columns[5] = { 0, 1, 2, 3, 4 };
+            cv::Vec<double, 5> B = fit_columns<5>(e, columns);
+            double b0 = std::sqrt(std::abs(B(0)));
+            double b1 = (B(0) < 0.0) == (B(2) < 0.0) ? std::sqrt(std::abs(B(2))) : 0.0;
+            if (B(1) < 0.0)
+                b0 = -b0;
+            betas[2][0] = b0;
+            betas[2][1] = b1;
+            betas[2][2] = b0 != 0.0 ? B(3) / b0 : 0.0;
+        }
+
+        double best_error = std::numeric_limits<double>::max();
+        for (int k = 0; k < 3; ++k)
+        {
+            gauss_newton(e, betas[k]);
+
+            cv::Matx33d R;
+            cv::Vec3d t;
+            double error = pose_from_betas(e, betas[k], points, normalized, n, R, t);
+            if (error < best_error)
+            {
+                best_error = error;
+                rotation = R;
+                translation = t;
+            }
+        }
+
+        return best_error < std::numeric_limits<double>::max();
+    }
+
+    int planar(
+        const cv::Point2d* object,
+        const cv::Point2d* normalized,
+        int n,
+        cv::Matx33d rotations[2],
+        cv::Vec3d translations[2],
+        double errors[2])
+    {
+        if (n < 4)
+            return 0;
+
+        // IPPE works around the object origin, so center the target
+        cv::Point2d center(0.0, 0.0);
+        for (int i = 0; i < n; ++i)
+            center = center + object[i];
+        center = center * (1.0 / n);
+
+        cv::Matx33d H;
+        if (!plane_homography(object, center, normalized, n, H))
+            return 0;
+
+        // Jacobian of the homography at the origin and the image of the
+        // origin (p, q)
+        const double p = H(0, 2), q = H(1, 2);
+        const double j00 = H(0, 0) - H(2, 0) * p, j01 = H(0, 1) - H(2, 1) * p;
+        const double j10 = H(1, 0) - H(2, 0) * q, j11 = H(1, 1) - H(2, 1) * q;
+
+        // Rv turns the optical axis onto the ray through (p, q)
+        cv::Vec3d a(p, q, 1.0);
+        a = a / cv::norm(a);
+        cv::Matx33d W(0.0, 0.0, a(0),
+                      0.0, 0.0, a(1),
+                      -a(0), -a(1), 0.0);
+        cv::Matx33d Rv = cv::Matx33d::eye() + W + W * W * (1.0 / (1.0 + a(2)));
+
+        const double b00 = Rv(0, 0) - p * Rv(2, 0), b01 = Rv(0, 1) - p * Rv(2, 1);
+        const double b10 = Rv(1, 0) - q * Rv(2, 0), b11 = Rv(1, 1) - q * Rv(2, 1);
+        const double det = b00 * b11 - b01 * b10;
+        if (std::abs(det) < 1e-12)
+            return 0;
+
+        // A = B^-1 J is gamma times the upper-left 2x2 block of the
+        // rotation in the Rv frame
+        const double a00 = ( b11 * j00 - b01 * j10) / det;
+        const double a01 = ( b11 * j01 - b01 * j11) / det;
+        const double a10 = (-b10 * j00 + b00 * j10) / det;
+        const double a11 = (-b10 * j01 + b00 * j11) / det;
+
+        const double ata00 = a00 * a00 + a10 * a10;
+        const double ata01 = a00 * a01 + a10 * a11;
+        const double ata11 = a01 * a01 + a11 * a11;
+        const double gamma = std::sqrt(0.5 * (ata00 + ata11 +
+            std::sqrt((ata00 - ata11) * (ata00 - ata11) + 4.0 * ata01 * ata01)));
+        if (gamma < 1e-12)
+            return 0;
+
+        const double r00 = a00 / gamma, r01 = a01 / gamma;
+        const double r10 = a10 / gamma, r11 = a11 / gamma;
+
+        // Complete the two columns; the sign of the third row is the
+        // ambiguity
+        double c0 = std::sqrt(std::max(0.0, 1.0 - r00 * r00 - r10 * r10));
+        double c1 = std::sqrt(std::max(0.0, 1.0 - r01 * r01 - r11 * r11));
+        if (-(r00 * r01 + r10 * r11) < 0.0)
+            c1 = -c1;
+
+        for (int s = 0; s < 2; ++s)
+        {
+            const double sign = s == 0 ? 1.0 : -1.0;
+            cv::Vec3d e1(r00, r10, sign * c0);
+            cv::Vec3d e2(r01, r11, sign * c1);
+            cv::Vec3d e3 = e1.cross(e2);
+
+            cv::Matx33d R(e1(0), e2(0), e3(0),
+                          e1(1), e2(1), e3(1),
+                          e1(2), e2(2), e3(2));
+            rotations[s] = Rv * R;
+
+            // Back to the original object origin
+            translations[s] = plane_translation(object, center, normalized, n, rotations[s])
+                            - rotations[s] * cv::Vec3d(center.x, center.y, 0.0);
+            errors[s] = plane_error(object, normalized, n, rotations[s], translations[s]);
+        }
+
+        if (errors[1] < errors[0])
+        {
+            std::swap(rotations[0], rotations[1]);
+            std::swap(translations[0], translations[1]);
+            std::swap(errors[0], errors[1]);
+        }
+
+        return 2;
+    }
+
+    double refine(
+        const cv::Point3d* points,
+        const cv::Point2d* normalized,
+        int n,
+        cv::Matx33d& rotation,
+        cv::Vec3d& translation,
+        int iterations)
+    {
+        for (int it = 0; it < iterations; ++it)
+        {
+            cv::Matx66d JtJ;
+            cv::Vec6d Jtr;
+
+            for (int i = 0; i < n; ++i)
+            {
+                cv::Vec3d RX = rotation * cv::Vec3d(points[i].x, points[i].y, points[i].z);
+                cv::Vec3d Xc = RX + translation;
+                if (Xc(2) <= 0.0)
+                    continue;
+
+                const double iz = 1.0 / Xc(2);
+                const double u = Xc(0) * iz, v = Xc(1) * iz;
+                const double r[2] = { normalized[i].x - u, normalized[i].y - v };
+
+                // d(u, v)/dXc times dXc/d(omega, t) = [-[RX]x | I]
+                const double du[3] = { iz, 0.0, -u * iz };
+                const double dv[3] = { 0.0, iz, -v * iz };
+                const double* d[2] = { du, dv };
+
+                for (int k = 0; k < 2; ++k)
+                {
+                    const double* g = d[k];
+                    const double J[6] =
+                    {
+                        RX(1) * g[2] - RX(2) * g[1],
+                        RX(2) * g[0] - RX(0) * g[2],
+                        RX(0) * g[1] - RX(1) * g[0],
+                        g[0], g[1], g[2],
+                    };
+
+                    for (int a = 0; a < 6; ++a)
+                    {
+                        Jtr(a) += J[a] * r[k];
+                        for (int b = 0; b < 6; ++b)
+                            JtJ(a, b) += J[a] * J[b];
+                    }
+                }
+            }
+
+            cv::Vec6d delta = JtJ.solve(Jtr, cv::DECOMP_CHOLESKY);
+            rotation = exp_rotation(cv::Vec3d(delta(0), delta(1), delta(2))) * rotation;
+            translation += cv::Vec3d(delta(3), delta(4), delta(5));
+        }
+
+        return mean_error(points, normalized, n, rotation, translation);
+    }
+
+    int count_inliers(
+        const cv::Point3d* points,
+        const cv::Point2d* normalized,
+        int n,
+        const cv::Matx33d& rotation,
+        const cv::Vec3d& translation,
+        double threshold,
+        unsigned char* inliers)
+    {
+        const double threshold_squared = threshold * threshold;
+        const cv::Matx33d& R = rotation;
+        const cv::Vec3d& t = translation;
+
+        int count = 0;
+        for (int i = 0; i < n; ++i)
+        {
+            const cv::Point3d& X = points[i];
+            double z = R(2, 0) * X.x + R(2, 1) * X.y + R(2, 2) * X.z + t(2);
+            bool good = false;
+            if (z > 0.0)
+            {
+                double dx = (R(0, 0) * X.x + R(0, 1) * X.y + R(0, 2) * X.z + t(0)) / z - normalized[i].x;
+                double dy = (R(1, 0) * X.x + R(1, 1) * X.y + R(1, 2) * X.z + t(1)) / z - normalized[i].y;
+                good = dx * dx + dy * dy < threshold_squared;
+            }
+
+            count += good;
+            if (inliers)
+                inliers[i] = good;
+        }
+        return count;
+    }
+
+    bool ransac(
+        const std::vector<cv::Point3d>& points,
+        const std::vector<cv::Point2d>& normalized,
+        double threshold,
+        cv::Matx33d& rotation,
+        cv::Vec3d& translation,
+        std::vector<unsigned char>& inliers,
+        int max_iterations,
+        double confidence)
+    {
+        assert(points.size() == normalized.size());
+
+        const int n = points.size();
+        inliers.assign(n, 0);
+        if (n < min_inliers)
+            return false;
+
+        cv::RNG rng(n);
+        int best_count = 0;
+        int iterations = max_iterations;
+
+        for (int it = 0; it < iterations; ++it)
+        {
+            int sample[3];
+            sample[0] = rng.uniform(0, n);
+            do { sample[1] = rng.uniform(0, n); } while (sample[1] == sample[0]);
+            do { sample[2] = rng.uniform(0, n); } while (sample[2] == sample[0] || sample[2] == sample[1]);
+
+            cv::Vec3d X[3], f[3];
+            for (int k = 0; k < 3; ++k)
+            {
+                const cv::Point3d& p = points[sample[k]];
+                const cv::Point2d& x = normalized[sample[k]];
+                X[k] = cv::Vec3d(p.x, p.y, p.z);
+                f[k] = cv::Vec3d(x.x, x.y, 1.0);
+                f[k] = f[k] / cv::norm(f[k]);
+            }
+
+            cv::Matx33d R[4];
+            cv::Vec3d t[4];
+            const int solutions = p3p(X, f, R, t);
+
+            for (int s = 0; s < solutions; ++s)
+            {
+                int count = count_inliers(&points[0], &normalized[0], n, R[s], t[s], threshold, NULL);
+                if (count > best_count)
+                {
+                    best_count = count;
+                    rotation = R[s];
+                    translation = t[s];
+
+                    // Adaptive number of iterations for the given confidence
+                    double w = (double) count / n;
+                    double p_fail = 1.0 - w * w * w;
+                    if (p_fail <= 0.0)
+                        iterations = 0;
+                    else
+                        iterations = std::min(max_iterations,
+                            (int) std::ceil(std::log(1.0 - confidence) / std::log(p_fail)));
+                }
+            }
+        }
+
+        if (best_count < min_inliers)
+            return false;
+
+        // EPnP on the consensus set, kept only if it doesn't lose support
+        count_inliers(&points[0], &normalized[0], n, rotation, translation, threshold, &inliers[0]);
+
+        std::vector<cv::Point3d> inlier_points;
+        std::vector<cv::Point2d> inlier_normalized;
+        for (int i = 0; i < n; ++i)
+        {
+            if (inliers[i])
+            {
+                inlier_points.push_back(points[i]);
+                inlier_normalized.push_back(normalized[i]);
+            }
+        }
+
+        cv::Matx33d R;
+        cv::Vec3d t;
+        if (epnp(&inlier_points[0], &inlier_normalized[0], inlier_points.size(), R, t) &&
+            count_inliers(&points[0], &normalized[0], n, R, t, threshold, NULL) >= best_count)
+        {
+            rotation = R;
+            translation = t;
+            count_inliers(&points[0], &normalized[0], n, rotation, translation, threshold, &inliers[0]);
+        }
+
+        return true;
+    }
+}
@@ -0,0 +1,80 @@
+#ifndef __POSE_HPP__
+#define __POSE_HPP__
+
+#include <vector>
+#include <core.hpp>
+
+// Absolute pose (camera resectioning) from 3D-2D correspondences.
+//
+// Image points are normalized coordinates (K^-1 * pixel) and poses follow
+// the MultiView convention: x_camera = R * x_world + t. Everything works on
+// fixed-size types so a hypothesis never touches the heap.
+namespace Pose
+{
+    // Minimal solver (Grunert's quartic). points are world points and
+    // bearings the matching unit-length viewing rays. Writes up to four
+    // solutions and returns how many were found.
+    int p3p(
+        const cv::Vec3d points[3],
+        const cv::Vec3d bearings[3],
+        cv::Matx33d rotations[4],
+        cv::Vec3d translations[4]);
+
+    // EPnP (Lepetit et al.) on n >= 4 correspondences, the betas refined
+    // with Gauss-Newton. Returns false for degenerate configurations.
+    bool epnp(
+        const cv::Point3d* points,
+        const cv::Point2d* normalized,
+        int n,
+        cv::Matx33d& rotation,
+        cv::Vec3d& translation);
+
+    // P3P hypotheses inside an adaptive RANSAC loop, then EPnP on the
+    // consensus set. threshold is in normalized units. Returns false if
+    // too few correspondences agree on any pose.
+    bool ransac(
+        const std::vector<cv::Point3d>& points,
+        const std::vector<cv::Point2d>& normalized,
+        double threshold,
+        cv::Matx33d& rotation,
+        cv::Vec3d& translation,
+        std::vector<unsigned char>& inliers,
+        int max_iterations = 1000,
+        double confidence = 0.999);
+
+    // Pose of a planar target (z = 0 in object coordinates) from n >= 4
+    // points with IPPE (Collins and Bartoli). A plane seen under weak
+    // perspective has two poses that explain the image almost equally
+    // well; both are returned, the one with the lower mean reprojection
+    // error (written to errors) first. Returns the number of solutions.
+    int planar(
+        const cv::Point2d* object,
+        const cv::Point2d* normalized,
+        int n,
+        cv::Matx33d rotations[2],
+        cv::Vec3d translations[2],
+        double errors[2]);
+
+    // Gauss-Newton refinement from a nearby pose, e.g. the one found in
+    // the previous frame. Returns the mean reprojection error.
+    double refine(
+        const cv::Point3d* points,
+        const cv::Point2d* normalized,
+        int n,
+        cv::Matx33d& rotation,
+        cv::Vec3d& translation,
+        int iterations = 3);
+
+    // Number of correspondences that reproject within threshold, marked
+    // in inliers if it is not null.
+    int count_inliers(
+        const cv::Point3d* points,
+        const cv::Point2d* normalized,
+        int n,
+        const cv::Matx33d& rotation,
+        const cv::Vec3d& translation,
+        double threshold,
+        unsigned char* inliers);
+}
+
+#endif
@@ -0,0 +1,153 @@
+#include "Pyramid.hpp"
+
+#include <imgproc.hpp>
+#include <core/hal/intrin.hpp>
+
+#include <cassert>
+
+namespace
+{
+    // Gaussian [1 4 6 4 1] x [1 4 6 4 1] / 256 at every other pixel, with
+    // reflected borders
+    class DownsampleBody : public cv::ParallelLoopBody
+    {
+    private:
+        const cv::Mat& _src;
+        cv::Mat& _dst;
+
+    public:
+        DownsampleBody(const cv::Mat& src, cv::Mat& dst)
+        : _src(src)
+        , _dst(dst)
+        {}
+
+        virtual void operator()(const cv::Range& range) const
+        {
+            const int width = _src.cols, height = _src.rows;
+
+            // Vertical sums of one output row, with two reflected entries
+            // on either side for the horizontal pass
+            std::vector<ushort> buffer(width + 4);
+            ushort* v = &buffer[2];
+
+            for (int y = range.start; y < range.end; ++y)
+            {
+                const uchar* r[5];
+                for (int k = 0; k < 5; ++k)
+                {
+                    r[k] = _src.ptr<uchar>(cv::borderInterpolate(2 * y + k - 2, height, cv::BORDER_REFLECT_101));
+                }
+
+                // The sums stay below 16 * 255, so 16 bits hold them
+                int x = 0;
+#if CV_SIMD128
+                for (; x <= width - 8; x += 8)
+                {
+                    const cv::v_uint16x8 outer  = cv::v_load_expand(r[0] + x) + cv::v_load_expand(r[4] + x);
+                    const cv::v_uint16x8 inner  = cv::v_load_expand(r[1] + x) + cv::v_load_expand(r[3] + x);
+                    const cv::v_uint16x8 center = cv::v_load_expand(r[2] + x);
+                    cv::v_store(v + x, outer + (inner << 2) + (center << 2) + (center << 1));
+                }
+#endif
+                for (; x < width; ++x)
+                {
+                    v[x] = r[0][x] + r[4][x] + 4 * (r[1][x] + r[3][x]) + 6 * r[2][x];
+                }
+
+                for (int k = 1; k <= 2; ++k)
+                {
+                    v[-k] = v[cv::borderInterpolate(-k, width, cv::BORDER_REFLECT_101)];
+                    v[width - 1 + k] = v[cv::borderInterpolate(width - 1 + k, width, cv::BORDER_REFLECT_101)];
+                }
+
+                uchar* out = _dst.ptr<uchar>(y);
+                for (int j = 0; j < _dst.cols; ++j)
+                {
+                    const ushort* c = v + 2 * j;
+                    out[j] = (uchar) ((c[-2] + c[2] + 4 * (c[-1] + c[1]) + 6 * c[0] + 128) >> 8);
+                }
+            }
+        }
+    };
+
+    // A level of the given size inside a buffer padded on every side. The
+    // current one is kept if it fits and nothing else references it.
+    void padded(const cv::Size& size, cv::Mat& level)
+    {
+        if (level.size() == size && level.u && level.u->refcount == 1)
+            return;
+
+        const int b = Pyramid::border;
+        cv::Mat buffer(size.height + 2 * b, size.width + 2 * b, CV_8UC1);
+        level = buffer(cv::Rect(b, b, size.width, size.height));
+    }
+
+    // Reflects the level into its padding, the way buildOpticalFlowPyramid
+    // fills its own
+    void fill_border(const cv::Mat& level)
+    {
+        const int b = Pyramid::border;
+        cv::Mat buffer = level;
+        buffer.adjustROI(b, b, b, b);
+        cv::copyMakeBorder(level, buffer, b, b, b, b, cv::BORDER_REFLECT_101 | cv::BORDER_ISOLATED);
+    }
+}
+
+Pyramid::Pyramid()
+{}
+
+Pyramid::Pyramid(const cv::Mat& frame, int depth)
+{
+    build(frame, depth);
+}
+
+void Pyramid::build(const cv::Mat& frame, int depth)
+{
+    assert(depth >= 0);
+    std::vector<cv::Mat>& levels = _levels;
+    levels.resize(depth + 1);
+
+    // Converted (or copied) into the level's own buffer, so the pyramid
+    // never aliases a capture buffer
+    padded(frame.size(), levels[0]);
+    if (frame.channels() == 1)
+        frame.copyTo(levels[0]);
+    else
+        cv::cvtColor(frame, levels[0], CV_BGR2GRAY);
+    fill_border(levels[0]);
+
+    for (int i = 1; i <= depth; ++i)
+    {
+        const cv::Mat& src = levels[i - 1];
+        padded(cv::Size((src.cols + 1) / 2, (src.rows + 1) / 2), levels[i]);
+
+        cv::parallel_for_(cv::Range(0, levels[i].rows), DownsampleBody(src, levels[i]));
+        fill_border(levels[i]);
+    }
+}
+
+bool Pyramid::empty() const
+{
+    return _levels.empty();
+}
+
+int Pyramid::depth() const
+{
+    return (int) _levels.size() - 1;
+}
+
+const cv::Mat& Pyramid::gray() const
+{
+    return level(0);
+}
+
+const cv::Mat& Pyramid::level(int i) const
+{
+    assert(i >= 0 && i < _levels.size());
+    return _levels[i];
+}
+
+const std::vector<cv::Mat>& Pyramid::levels() const
+{
+    return _levels;
+}
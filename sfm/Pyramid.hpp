@@ -0,0 +1,44 @@
+#ifndef __PYRAMID_HPP__
+#define __PYRAMID_HPP__
+
+#include <vector>
+#include <core.hpp>
+
+// Gray image pyramid of one frame, built once and shared by everything that
+// works on several scales. Copies share the levels, so keeping a frame's
+// pyramid around as the previous frame's costs nothing.
+//
+// Every level sits inside a buffer with border pixels of reflected
+// padding, which is the layout calcOpticalFlowPyrLK takes in place of
+// images (for windows up to border pixels).
+class Pyramid
+{
+public:
+    enum { border = 32 };
+
+    Pyramid();
+
+    // The gray frame plus depth levels of halving resolution. Each level
+    // is a 5x5 Gaussian downsample (as cv::pyrDown) run over row bands in
+    // parallel with a vectorized vertical pass.
+    explicit Pyramid(const cv::Mat& frame, int depth = 3);
+
+    // Same, in place. Level buffers of the right size that no copy of the
+    // pyramid still holds are written again instead of reallocated.
+    void build(const cv::Mat& frame, int depth = 3);
+
+    bool empty() const;
+
+    // Levels below the full resolution one
+    int depth() const;
+
+    const cv::Mat& gray() const;
+    const cv::Mat& level(int i) const;
+    const std::vector<cv::Mat>& levels() const;
+
+private:
+    // Copying the headers shares the buffers, reference counted by cv::Mat
+    std::vector<cv::Mat> _levels;
+};
+
+#endif
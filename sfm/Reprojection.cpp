@@ -0,0 +1,516 @@
+#include "Reprojection.hpp"
+
+#include <cmath>
+#include <cassert>
+#include <limits>
+#include <algorithm>
+#include <core/hal/intrin.hpp>
+
+namespace
+{
+    const int min_block_size = 1024;
+    const int max_blocks     = 64;
+
+    int block_count(int n)
+    {
+        return std::max(1, std::min(max_blocks, (n + min_block_size - 1) / min_block_size));
+    }
+
+    int block_start(int n, int blocks, int b)
+    {
+        return (int) ((long long) n * b / blocks);
+    }
+
+    // Vector type for each scalar type; NoSimd where the target has none
+    // and the kernels run their scalar loop only.
+    struct NoSimd {};
+
+    template<typename T>
+    struct Simd
+    {
+        typedef NoSimd vector;
+    };
+
+#if CV_SIMD128_64F
+    template<>
+    struct Simd<double>
+    {
+        typedef cv::v_float64x2 vector;
+        static vector all(double value) { return cv::v_setall_f64(value); }
+    };
+#endif
+
+#if CV_SIMD128
+    template<>
+    struct Simd<float>
+    {
+        typedef cv::v_float32x4 vector;
+        static vector all(float value) { return cv::v_setall_f32(value); }
+    };
+#endif
+
+    // The vector parts of the kernels process [i, end) in whole registers
+    // and return where the scalar tail starts.
+    template<typename T>
+    int project_simd(NoSimd, const T*, const T*, const T*, const T*, T*, T*, int i, int)
+    {
+        return i;
+    }
+
+#if CV_SIMD128
+    template<typename V, typename T>
+    int project_simd(V, const T* X, const T* Y, const T* Z, const T* P, T* u, T* v, int i, int end)
+    {
+        const int lanes = V::nlanes;
+
+        V p[12];
+        for (int k = 0; k < 12; ++k)
+            p[k] = Simd<T>::all(P[k]);
+        const V one = Simd<T>::all(1);
+
+        for (; i + lanes <= end; i += lanes)
+        {
+            V x = cv::v_load(X + i);
+            V y = cv::v_load(Y + i);
+            V z = cv::v_load(Z + i);
+
+            V iw = one / (p[8] * x + p[9] * y + p[10] * z + p[11]);
+            cv::v_store(u + i, (p[0] * x + p[1] * y + p[2]  * z + p[3]) * iw);
+            cv::v_store(v + i, (p[4] * x + p[5] * y + p[6]  * z + p[7]) * iw);
+        }
+        return i;
+    }
+#endif
+
+    // Running sums of one block
+    struct Sums
+    {
+        double sum, sum_squared;
+        int count;
+    };
+
+    template<typename T>
+    int errors_simd(
+        NoSimd, const T*, const T*, const T*, const T*, const T*, const T*,
+        const T*, const T*, T, T*, unsigned char*, int i, int, Sums&)
+    {
+        return i;
+    }
+
+#if CV_SIMD128
+    template<typename V, typename T>
+    int errors_simd(
+        V,
+        const T* X, const T* Y, const T* Z,
+        const T* pu, const T* pv,
+        const T* P,
+        const T* ou, const T* ov,
+        T threshold_squared,
+        T* residuals,
+        unsigned char* inliers,
+        int i,
+        int end,
+        Sums& sums)
+    {
+        const int lanes = V::nlanes;
+
+        V p[12];
+        for (int k = 0; k < 12; ++k)
+            p[k] = Simd<T>::all(P[k]);
+        const V one  = Simd<T>::all(1);
+        const V zero = Simd<T>::all(0);
+        const V v_threshold_squared = Simd<T>::all(threshold_squared);
+
+        // Partial sums stay in T for min_block_size points at a time and
+        // are widened to double after each run, however large the block.
+        while (i + lanes <= end)
+        {
+            const int run_end = std::min(end, i + min_block_size);
+            V v_sum = zero, v_sum_squared = zero, v_count = zero;
+            for (; i + lanes <= run_end; i += lanes)
+            {
+                V u, v, w;
+                if (X)
+                {
+                    V x = cv::v_load(X + i);
+                    V y = cv::v_load(Y + i);
+                    V z = cv::v_load(Z + i);
+
+                    w = p[8] * x + p[9] * y + p[10] * z + p[11];
+                    V iw = one / w;
+                    u = (p[0] * x + p[1] * y + p[2] * z + p[3]) * iw;
+                    v = (p[4] * x + p[5] * y + p[6] * z + p[7]) * iw;
+                }
+                else
+                {
+                    u = cv::v_load(pu + i);
+                    v = cv::v_load(pv + i);
+                    w = one;
+                }
+
+                V dx = u - cv::v_load(ou + i);
+                V dy = v - cv::v_load(ov + i);
+                V d2 = dx * dx + dy * dy;
+                V d  = cv::v_sqrt(d2);
+                V in = (d2 < v_threshold_squared) & (w > zero) & one;
+
+                v_sum += d;
+                v_sum_squared += d2;
+                v_count += in;
+
+                if (residuals)
+                    cv::v_store(residuals + i, d);
+                if (inliers)
+                {
+                    T flags[V::nlanes];
+                    cv::v_store(flags, in);
+                    for (int k = 0; k < lanes; ++k)
+                        inliers[i + k] = flags[k] != 0;
+                }
+            }
+
+            T totals[3][V::nlanes];
+            cv::v_store(totals[0], v_sum);
+            cv::v_store(totals[1], v_sum_squared);
+            cv::v_store(totals[2], v_count);
+            for (int k = 0; k < lanes; ++k)
+            {
+                sums.sum += totals[0][k];
+                sums.sum_squared += totals[1][k];
+                sums.count += (int) totals[2][k];
+            }
+        }
+        return i;
+    }
+#endif
+
+    template<typename T>
+    class ProjectBody : public cv::ParallelLoopBody
+    {
+    private:
+        const Reprojection::Points3_<T>& _points;
+        const cv::Matx<T, 3, 4>& _projection;
+        Reprojection::Points2_<T>& _coordinates;
+        int _blocks;
+
+    public:
+        ProjectBody(
+            const Reprojection::Points3_<T>& points,
+            const cv::Matx<T, 3, 4>& projection,
+            Reprojection::Points2_<T>& coordinates,
+            int blocks)
+        : _points(points)
+        , _projection(projection)
+        , _coordinates(coordinates)
+        , _blocks(blocks)
+        {}
+
+        virtual void operator()(const cv::Range& range) const
+        {
+            const int n = _points.size();
+            const T* X = &_points.x[0];
+            const T* Y = &_points.y[0];
+            const T* Z = &_points.z[0];
+            T* u = &_coordinates.x[0];
+            T* v = &_coordinates.y[0];
+            const T* P = _projection.val;
+
+            for (int b = range.start; b < range.end; ++b)
+            {
+                int i = block_start(n, _blocks, b);
+                const int end = block_start(n, _blocks, b + 1);
+
+                i = project_simd(typename Simd<T>::vector(), X, Y, Z, P, u, v, i, end);
+                for (; i < end; ++i)
+                {
+                    T iw = 1 / (P[8] * X[i] + P[9] * Y[i] + P[10] * Z[i] + P[11]);
+                    u[i] = (P[0] * X[i] + P[1] * Y[i] + P[2] * Z[i] + P[3]) * iw;
+                    v[i] = (P[4] * X[i] + P[5] * Y[i] + P[6] * Z[i] + P[7]) * iw;
+                }
+            }
+        }
+    };
+
+    // Distances between projected (or already projected) points and the
+    // observations, with per-block partial sums.
+    template<typename T>
+    class ErrorBody : public cv::ParallelLoopBody
+    {
+    private:
+        const Reprojection::Points3_<T>* _points;
+        const Reprojection::Points2_<T>* _projected;
+        const cv::Matx<T, 3, 4>& _projection;
+        const Reprojection::Points2_<T>& _observed;
+        T _threshold_squared;
+        T* _residuals;
+        unsigned char* _inliers;
+        Sums* _sums;
+        int _blocks;
+
+    public:
+        ErrorBody(
+            const Reprojection::Points3_<T>* points,
+            const Reprojection::Points2_<T>* projected,
+            const cv::Matx<T, 3, 4>& projection,
+            const Reprojection::Points2_<T>& observed,
+            T threshold_squared,
+            T* residuals,
+            unsigned char* inliers,
+            Sums* sums,
+            int blocks)
+        : _points(points)
+        , _projected(projected)
+        , _projection(projection)
+        , _observed(observed)
+        , _threshold_squared(threshold_squared)
+        , _residuals(residuals)
+        , _inliers(inliers)
+        , _sums(sums)
+        , _blocks(blocks)
+        {}
+
+        virtual void operator()(const cv::Range& range) const
+        {
+            const int n = _observed.size();
+            const T* X = _points ? &_points->x[0] : NULL;
+            const T* Y = _points ? &_points->y[0] : NULL;
+            const T* Z = _points ? &_points->z[0] : NULL;
+            const T* pu = _projected ? &_projected->x[0] : NULL;
+            const T* pv = _projected ? &_projected->y[0] : NULL;
+            const T* ou = &_observed.x[0];
+            const T* ov = &_observed.y[0];
+            const T* P = _projection.val;
+
+            for (int b = range.start; b < range.end; ++b)
+            {
+                int i = block_start(n, _blocks, b);
+                const int end = block_start(n, _blocks, b + 1);
+
+                Sums sums = { 0.0, 0.0, 0 };
+                i = errors_simd(
+                    typename Simd<T>::vector(),
+                    X, Y, Z, pu, pv, P, ou, ov,
+                    _threshold_squared, _residuals, _inliers, i, end, sums);
+
+                for (; i < end; ++i)
+                {
+                    T u, v, w = 1;
+                    if (X)
+                    {
+                        w = P[8] * X[i] + P[9] * Y[i] + P[10] * Z[i] + P[11];
+                        u = (P[0] * X[i] + P[1] * Y[i] + P[2] * Z[i] + P[3]) / w;
+                        v = (P[4] * X[i] + P[5] * Y[i] + P[6] * Z[i] + P[7]) / w;
+                    }
+                    else
+                    {
+                        u = pu[i];
+                        v = pv[i];
+                    }
+
+                    T dx = u - ou[i], dy = v - ov[i];
+                    T d2 = dx * dx + dy * dy;
+                    T d  = std::sqrt(d2);
+                    bool in = d2 < _threshold_squared && w > 0;
+
+                    sums.sum += d;
+                    sums.sum_squared += d2;
+                    sums.count += in;
+
+                    if (_residuals)
+                        _residuals[i] = d;
+                    if (_inliers)
+                        _inliers[i] = in;
+                }
+
+                _sums[b] = sums;
+            }
+        }
+    };
+
+    template<typename T>
+    Reprojection::Errors run_errors(
+        const Reprojection::Points3_<T>* points,
+        const Reprojection::Points2_<T>* projected,
+        const cv::Matx<T, 3, 4>& projection,
+        const Reprojection::Points2_<T>& observed,
+        double threshold,
+        std::vector<T>* residuals,
+        std::vector<unsigned char>* inliers)
+    {
+        Reprojection::Errors errors = { 0.0, 0.0, 0 };
+
+        const int n = observed.size();
+        if (residuals)
+            residuals->resize(n);
+        if (inliers)
+            inliers->resize(n);
+        if (n == 0)
+            return errors;
+
+        // Keep a huge threshold (DBL_MAX means no threshold) finite in float
+        const double threshold_squared = std::min(
+            threshold * threshold, (double) std::numeric_limits<T>::max());
+
+        const int blocks = block_count(n);
+        Sums sums[max_blocks];
+
+        cv::parallel_for_(cv::Range(0, blocks), ErrorBody<T>(
+            points,
+            projected,
+            projection,
+            observed,
+            (T) threshold_squared,
+            residuals ? &(*residuals)[0] : NULL,
+            inliers ? &(*inliers)[0] : NULL,
+            sums,
+            blocks));
+
+        double sum = 0.0, sum_squared = 0.0;
+        for (int b = 0; b < blocks; ++b)
+        {
+            sum += sums[b].sum;
+            sum_squared += sums[b].sum_squared;
+            errors.inliers += sums[b].count;
+        }
+
+        errors.mean = sum / n;
+        errors.rms = std::sqrt(sum_squared / n);
+        return errors;
+    }
+}
+
+namespace Reprojection
+{
+    template<typename T>
+    void Points2_<T>::resize(int n)
+    {
+        x.resize(n);
+        y.resize(n);
+    }
+
+    template<typename T>
+    void Points2_<T>::assign(const std::vector<cv::Point2d>& points)
+    {
+        resize(points.size());
+        for (int i = 0; i < points.size(); ++i)
+        {
+            x[i] = points[i].x;
+            y[i] = points[i].y;
+        }
+    }
+
+    template<typename T>
+    void Points2_<T>::assign(const std::vector<cv::Point2f>& points)
+    {
+        resize(points.size());
+        for (int i = 0; i < points.size(); ++i)
+        {
+            x[i] = points[i].x;
+            y[i] = points[i].y;
+        }
+    }
+
+    template<typename T>
+    void Points2_<T>::copy_to(std::vector<cv::Point_<T> >& points) const
+    {
+        points.resize(size());
+        for (int i = 0; i < points.size(); ++i)
+        {
+            points[i] = cv::Point_<T>(x[i], y[i]);
+        }
+    }
+
+    template<typename T>
+    void Points3_<T>::resize(int n)
+    {
+        x.resize(n);
+        y.resize(n);
+        z.resize(n);
+    }
+
+    template<typename T>
+    void Points3_<T>::assign(const std::vector<cv::Point3d>& points)
+    {
+        resize(points.size());
+        for (int i = 0; i < points.size(); ++i)
+        {
+            x[i] = points[i].x;
+            y[i] = points[i].y;
+            z[i] = points[i].z;
+        }
+    }
+
+    template<typename T>
+    void Points3_<T>::assign(const std::vector<cv::Point3f>& points)
+    {
+        resize(points.size());
+        for (int i = 0; i < points.size(); ++i)
+        {
+            x[i] = points[i].x;
+            y[i] = points[i].y;
+            z[i] = points[i].z;
+        }
+    }
+
+    template<typename T>
+    void project(
+        const Points3_<T>& points,
+        const cv::Matx<T, 3, 4>& projection,
+        Points2_<T>& coordinates)
+    {
+        const int n = points.size();
+        coordinates.resize(n);
+        if (n == 0)
+            return;
+
+        const int blocks = block_count(n);
+        cv::parallel_for_(cv::Range(0, blocks), ProjectBody<T>(points, projection, coordinates, blocks));
+    }
+
+    template<typename T>
+    Errors errors(
+        const Points3_<T>& points,
+        const cv::Matx<T, 3, 4>& projection,
+        const Points2_<T>& observed,
+        double threshold,
+        std::vector<typename Points2_<T>::value_type>* residuals,
+        std::vector<unsigned char>* inliers)
+    {
+        assert(points.size() == observed.size());
+        return run_errors(&points, (const Points2_<T>*) NULL, projection, observed, threshold, residuals, inliers);
+    }
+
+    template<typename T>
+    Errors errors(
+        const Points2_<T>& projected,
+        const Points2_<T>& observed,
+        double threshold,
+        std::vector<typename Points2_<T>::value_type>* residuals,
+        std::vector<unsigned char>* inliers)
+    {
+        assert(projected.size() == observed.size());
+        return run_errors((const Points3_<T>*) NULL, &projected, cv::Matx<T, 3, 4>(), observed, threshold, residuals, inliers);
+    }
+
+    template struct Points2_<float>;
+    template struct Points2_<double>;
+    template struct Points3_<float>;
+    template struct Points3_<double>;
+
+    template void project(const Points3_<float>&, const cv::Matx<float, 3, 4>&, Points2_<float>&);
+    template void project(const Points3_<double>&, const cv::Matx<double, 3, 4>&, Points2_<double>&);
+
+    template Errors errors(
+        const Points3_<float>&, const cv::Matx<float, 3, 4>&, const Points2_<float>&,
+        double, std::vector<float>*, std::vector<unsigned char>*);
+    template Errors errors(
+        const Points3_<double>&, const cv::Matx<double, 3, 4>&, const Points2_<double>&,
+        double, std::vector<double>*, std::vector<unsigned char>*);
+
+    template Errors errors(
+        const Points2_<float>&, const Points2_<float>&,
+        double, std::vector<float>*, std::vector<unsigned char>*);
+    template Errors errors(
+        const Points2_<double>&, const Points2_<double>&,
+        double, std::vector<double>*, std::vector<unsigned char>*);
+}
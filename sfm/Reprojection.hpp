@@ -0,0 +1,84 @@
+#ifndef __REPROJECTION_HPP__
+#define __REPROJECTION_HPP__
+
+#include <vector>
+#include <core.hpp>
+
+// Batch projection and reprojection error kernels.
+//
+// Points are kept as structure of arrays so that consecutive coordinates
+// load straight into SIMD registers. Batches are split into blocks that
+// run in parallel, and the error statistics, residuals and inlier mask
+// come out of the same pass over the data.
+//
+// Everything is templated on the scalar type and instantiated for float
+// and double; float packs twice as many points per register.
+namespace Reprojection
+{
+    template<typename T>
+    struct Points2_
+    {
+        typedef T value_type;
+
+        std::vector<T> x, y;
+
+        int size() const { return x.size(); }
+        void resize(int n);
+        void assign(const std::vector<cv::Point2d>& points);
+        void assign(const std::vector<cv::Point2f>& points);
+        void copy_to(std::vector<cv::Point_<T> >& points) const;
+    };
+
+    template<typename T>
+    struct Points3_
+    {
+        std::vector<T> x, y, z;
+
+        int size() const { return x.size(); }
+        void resize(int n);
+        void assign(const std::vector<cv::Point3d>& points);
+        void assign(const std::vector<cv::Point3f>& points);
+    };
+
+    typedef Points2_<double> Points2;
+    typedef Points3_<double> Points3;
+    typedef Points2_<float>  Points2f;
+    typedef Points3_<float>  Points3f;
+
+    struct Errors
+    {
+        double mean;    // mean distance
+        double rms;     // root mean squared distance
+        int    inliers; // within the threshold (and in front of the camera)
+    };
+
+    // coordinates[i] = projection * [points[i] 1], dehomogenized
+    template<typename T>
+    void project(
+        const Points3_<T>& points,
+        const cv::Matx<T, 3, 4>& projection,
+        Points2_<T>& coordinates);
+
+    // Projects the points and compares them with observed in one pass.
+    // residuals (distances) and inliers are filled if they aren't null;
+    // their type doesn't take part in deduction so NULL can be passed.
+    template<typename T>
+    Errors errors(
+        const Points3_<T>& points,
+        const cv::Matx<T, 3, 4>& projection,
+        const Points2_<T>& observed,
+        double threshold,
+        std::vector<typename Points2_<T>::value_type>* residuals = NULL,
+        std::vector<unsigned char>* inliers = NULL);
+
+    // Same for points that are already projected
+    template<typename T>
+    Errors errors(
+        const Points2_<T>& projected,
+        const Points2_<T>& observed,
+        double threshold,
+        std::vector<typename Points2_<T>::value_type>* residuals = NULL,
+        std::vector<unsigned char>* inliers = NULL);
+}
+
+#endif
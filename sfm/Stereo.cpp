@@ -0,0 +1,499 @@
+#include "Stereo.hpp"
+#include "Camera.hpp"
+
+#include <calib3d.hpp>
+#include <imgproc.hpp>
+#include <core/hal/intrin.hpp>
+
+#include <cassert>
+#include <climits>
+#include <cstdlib>
+#include <algorithm>
+
+namespace
+{
+    // Census window of 5x5 pixels: one bit per neighbour darker than the
+    // center, so costs run from 0 to 24
+    const int census_radius = 2;
+    const int census_bits   = 24;
+
+    // Cost of disparities that fall off the second view
+    const ushort invalid_cost = census_bits;
+
+    // Path costs are stored with a pad entry on either side, so the d - 1
+    // and d + 1 neighbours at the ends of the range never win
+    const ushort pad_cost = SHRT_MAX;
+
+    inline int popcount(unsigned int v)
+    {
+        v = v - ((v >> 1) & 0x55555555);
+        v = (v & 0x33333333) + ((v >> 2) & 0x33333333);
+        return (((v + (v >> 4)) & 0x0f0f0f0f) * 0x01010101) >> 24;
+    }
+
+    class CensusBody : public cv::ParallelLoopBody
+    {
+    private:
+        const cv::Mat& _gray;
+        cv::Mat& _codes;
+
+    public:
+        CensusBody(const cv::Mat& gray, cv::Mat& codes)
+        : _gray(gray)
+        , _codes(codes)
+        {}
+
+        virtual void operator()(const cv::Range& range) const
+        {
+            const int r = census_radius;
+            const int cols = _gray.cols, rows = _gray.rows;
+
+            for (int i = range.start; i < range.end; ++i)
+            {
+                int* out = _codes.ptr<int>(i);
+                if (i < r || i >= rows - r)
+                {
+                    std::fill(out, out + cols, 0);
+                    continue;
+                }
+
+                std::fill(out, out + r, 0);
+                std::fill(out + cols - r, out + cols, 0);
+
+                for (int j = r; j < cols - r; ++j)
+                {
+                    const uchar center = _gray.ptr<uchar>(i)[j];
+
+                    unsigned int code = 0;
+                    for (int dy = -r; dy <= r; ++dy)
+                    {
+                        const uchar* row = _gray.ptr<uchar>(i + dy) + j;
+                        for (int dx = -r; dx <= r; ++dx)
+                        {
+                            if (dy != 0 || dx != 0)
+                                code = (code << 1) | (row[dx] < center);
+                        }
+                    }
+                    out[j] = code;
+                }
+            }
+        }
+    };
+
+    void census(const cv::Mat& gray, cv::Mat& codes)
+    {
+        codes.create(gray.size(), CV_32S);
+        cv::parallel_for_(cv::Range(0, gray.rows), CensusBody(gray, codes));
+    }
+
+    // Matching costs of one row: the Hamming distance between the census
+    // codes of x in the first view and x - d in the second
+    void row_costs(const int* codes1, const int* codes2, int width, int disparities, ushort* cost)
+    {
+        for (int x = 0; x < width; ++x, cost += disparities)
+        {
+            const int reach = std::min(x + 1, disparities);
+            for (int d = 0; d < reach; ++d)
+            {
+                cost[d] = (ushort) popcount(codes1[x] ^ codes2[x - d]);
+            }
+            std::fill(cost + reach, cost + disparities, invalid_cost);
+        }
+    }
+
+    // One step along an aggregation path,
+    //   L(d) = C(d) + min(L'(d), L'(d - 1) + P1, L'(d + 1) + P1, min L' + P2) - min L'
+    // where L' are the path costs at the previous pixel, or NULL where the
+    // path starts. Adds L to sum and returns its minimum.
+    ushort aggregate(
+        const ushort* cost,
+        const ushort* previous,
+        ushort previous_min,
+        ushort* current,
+        ushort* sum,
+        int disparities,
+        ushort P1,
+        ushort P2)
+    {
+        ushort minimum = USHRT_MAX;
+
+        if (!previous)
+        {
+            for (int d = 0; d < disparities; ++d)
+            {
+                current[d] = cost[d];
+                sum[d] += cost[d];
+                minimum = std::min(minimum, cost[d]);
+            }
+            return minimum;
+        }
+
+        const ushort jump = previous_min + P2;
+
+        int d = 0;
+#if CV_SIMD128
+        // Saturating arithmetic; the minimum of L' is at most any of the
+        // candidates, so the subtraction can't wrap either
+        const cv::v_uint16x8 v_P1           = cv::v_setall_u16(P1);
+        const cv::v_uint16x8 v_jump         = cv::v_setall_u16(jump);
+        const cv::v_uint16x8 v_previous_min = cv::v_setall_u16(previous_min);
+        cv::v_uint16x8 v_minimum            = cv::v_setall_u16(USHRT_MAX);
+
+        for (; d <= disparities - 8; d += 8)
+        {
+            cv::v_uint16x8 step = cv::v_min(cv::v_load(previous + d - 1), cv::v_load(previous + d + 1)) + v_P1;
+            cv::v_uint16x8 l = cv::v_min(cv::v_min(cv::v_load(previous + d), step), v_jump);
+            l = cv::v_load(cost + d) + (l - v_previous_min);
+
+            cv::v_store(current + d, l);
+            cv::v_store(sum + d, cv::v_load(sum + d) + l);
+            v_minimum = cv::v_min(v_minimum, l);
+        }
+        minimum = cv::v_reduce_min(v_minimum);
+#endif
+        for (; d < disparities; ++d)
+        {
+            const int step = std::min(previous[d - 1], previous[d + 1]) + P1;
+            const int l = cost[d] + std::min(std::min((int) previous[d], step), (int) jump) - previous_min;
+
+            current[d] = (ushort) l;
+            sum[d] += (ushort) l;
+            minimum = std::min(minimum, (ushort) l);
+        }
+        return minimum;
+    }
+
+    // Winner-take-all over the aggregated costs of one row. A match is
+    // dropped if another disparity (not next to it) comes within the
+    // uniqueness margin, or if the second view's winner at x - d
+    // disagrees by more than max_difference. Survivors get a parabolic
+    // sub-pixel offset.
+    void select(
+        const ushort* sum,
+        int width,
+        const Stereo::Parameters& parameters,
+        ushort* right_cost,
+        int* right_best,
+        int* left_best,
+        float* disparity)
+    {
+        const int disparities = parameters.disparities;
+
+        std::fill(right_cost, right_cost + width, USHRT_MAX);
+        std::fill(right_best, right_best + width, -1);
+
+        for (int x = 0; x < width; ++x)
+        {
+            const ushort* s = sum + x * disparities;
+
+            int best = 0;
+            for (int d = 1; d < disparities; ++d)
+            {
+                if (s[d] < s[best])
+                    best = d;
+            }
+
+            for (int d = 0; d <= std::min(x, disparities - 1); ++d)
+            {
+                if (s[d] < right_cost[x - d])
+                {
+                    right_cost[x - d] = s[d];
+                    right_best[x - d] = d;
+                }
+            }
+
+            const int margin = s[best] * (100 + parameters.uniqueness);
+            bool unique = best <= x;
+            for (int d = 0; d < disparities && unique; ++d)
+            {
+                unique = std::abs(d - best) <= 1 || s[d] * 100 >= margin;
+            }
+
+            left_best[x] = unique ? best : -1;
+        }
+
+        for (int x = 0; x < width; ++x)
+        {
+            const int best = left_best[x];
+            if (best <= 0 || std::abs(right_best[x - best] - best) > parameters.max_difference)
+            {
+                disparity[x] = 0;
+                continue;
+            }
+
+            float value = best;
+            if (best < disparities - 1)
+            {
+                const ushort* s = sum + x * disparities;
+                const int denominator = s[best - 1] + s[best + 1] - 2 * s[best];
+                if (denominator > 0)
+                    value += (s[best - 1] - s[best + 1]) / (2.0f * denominator);
+            }
+            disparity[x] = value;
+        }
+    }
+
+    class StripBody : public cv::ParallelLoopBody
+    {
+    private:
+        const cv::Mat& _codes1;
+        const cv::Mat& _codes2;
+        const Stereo::Parameters& _parameters;
+        cv::Mat& _disparity;
+
+    public:
+        StripBody(
+            const cv::Mat& codes1,
+            const cv::Mat& codes2,
+            const Stereo::Parameters& parameters,
+            cv::Mat& disparity)
+        : _codes1(codes1)
+        , _codes2(codes2)
+        , _parameters(parameters)
+        , _disparity(disparity)
+        {}
+
+        virtual void operator()(const cv::Range& range) const
+        {
+            const int width = _codes1.cols, rows = _codes1.rows;
+            const int disparities = _parameters.disparities;
+            const int slot = disparities + 2;
+            const ushort P1 = _parameters.P1, P2 = _parameters.P2;
+
+            // Everything a band needs is a few rows of costs: the current
+            // cost and aggregated rows, the previous and current rows of
+            // the up, upper left and upper right paths, and two pixels'
+            // worth of the left and right paths
+            std::vector<ushort> cost(width * disparities), sum(width * disparities);
+            std::vector<ushort> vertical(6 * width * slot, pad_cost), vertical_min(6 * width);
+            std::vector<ushort> horizontal(4 * slot, pad_cost);
+            std::vector<ushort> right_cost(width);
+            std::vector<int>    right_best(width), left_best(width);
+
+            ushort* left  = &horizontal[1];
+            ushort* right = &horizontal[2 * slot + 1];
+
+            for (int band = range.start; band < range.end; ++band)
+            {
+                const int y0 = band * _parameters.strip_rows;
+                const int y1 = std::min(rows, y0 + _parameters.strip_rows);
+                const int start = std::max(0, y0 - _parameters.overlap);
+
+                ushort *previous[3], *current[3], *previous_min[3], *current_min[3];
+                for (int k = 0; k < 3; ++k)
+                {
+                    previous[k]     = &vertical[2 * k * width * slot] + 1;
+                    current[k]      = &vertical[(2 * k + 1) * width * slot] + 1;
+                    previous_min[k] = &vertical_min[2 * k * width];
+                    current_min[k]  = &vertical_min[(2 * k + 1) * width];
+                }
+
+                for (int y = start; y < y1; ++y)
+                {
+                    const bool first = y == start;
+
+                    row_costs(_codes1.ptr<int>(y), _codes2.ptr<int>(y), width, disparities, &cost[0]);
+                    std::fill(sum.begin(), sum.end(), 0);
+
+                    // Up, upper left, upper right and left paths
+                    ushort left_min = 0;
+                    for (int x = 0; x < width; ++x)
+                    {
+                        const ushort* c = &cost[x * disparities];
+                        ushort* s = &sum[x * disparities];
+                        const int at = x * slot;
+                        const bool up_left = !first && x > 0, up_right = !first && x < width - 1;
+
+                        current_min[0][x] = aggregate(c,
+                            first ? NULL : previous[0] + at, first ? 0 : previous_min[0][x],
+                            current[0] + at, s, disparities, P1, P2);
+                        current_min[1][x] = aggregate(c,
+                            up_left ? previous[1] + at - slot : NULL, up_left ? previous_min[1][x - 1] : 0,
+                            current[1] + at, s, disparities, P1, P2);
+                        current_min[2][x] = aggregate(c,
+                            up_right ? previous[2] + at + slot : NULL, up_right ? previous_min[2][x + 1] : 0,
+                            current[2] + at, s, disparities, P1, P2);
+
+                        left_min = aggregate(c,
+                            x > 0 ? left + ((x + 1) & 1) * slot : NULL, left_min,
+                            left + (x & 1) * slot, s, disparities, P1, P2);
+                    }
+
+                    // Right path
+                    ushort right_min = 0;
+                    for (int x = width - 1; x >= 0; --x)
+                    {
+                        right_min = aggregate(&cost[x * disparities],
+                            x < width - 1 ? right + ((x + 1) & 1) * slot : NULL, right_min,
+                            right + (x & 1) * slot, &sum[x * disparities], disparities, P1, P2);
+                    }
+
+                    for (int k = 0; k < 3; ++k)
+                    {
+                        std::swap(previous[k], current[k]);
+                        std::swap(previous_min[k], current_min[k]);
+                    }
+
+                    // Rows above the band only warm the vertical paths up
+                    if (y >= y0)
+                    {
+                        select(&sum[0], width, _parameters,
+                            &right_cost[0], &right_best[0], &left_best[0], _disparity.ptr<float>(y));
+                    }
+                }
+            }
+        }
+    };
+
+    void gray(const cv::Mat& image, cv::Mat& out)
+    {
+        if (image.channels() == 3)
+            cv::cvtColor(image, out, CV_BGR2GRAY);
+        else
+            out = image;
+    }
+}
+
+namespace Stereo
+{
+    Parameters::Parameters()
+    : disparities(128)
+    , P1(3)
+    , P2(30)
+    , strip_rows(64)
+    , overlap(16)
+    , uniqueness(10)
+    , max_difference(1)
+    {}
+
+    bool rectify(
+        const Camera& camera,
+        const cv::Matx33d& rotation,
+        const cv::Vec3d& translation,
+        Rectification& rectification)
+    {
+        const cv::Mat K = camera.matrix();
+        const cv::Mat D = camera.distortion();
+        const cv::Size size = camera.resolution();
+
+        cv::Mat R1, R2, P1, P2, Q;
+        if (camera.model() == Camera::FISHEYE)
+        {
+            cv::fisheye::stereoRectify(K, D, K, D, size, cv::Mat(rotation), cv::Mat(translation),
+                R1, R2, P1, P2, Q, cv::CALIB_ZERO_DISPARITY);
+        }
+        else
+        {
+            cv::stereoRectify(K, D, K, D, size, cv::Mat(rotation), cv::Mat(translation),
+                R1, R2, P1, P2, Q, cv::CALIB_ZERO_DISPARITY, 0);
+        }
+
+        // A vertical baseline shows up as a y offset in the second projection
+        if (std::abs(P2.at<double>(1, 3)) > std::abs(P2.at<double>(0, 3)))
+            return false;
+
+        if (camera.model() == Camera::FISHEYE)
+        {
+            cv::fisheye::initUndistortRectifyMap(K, D, R1, P1, size, CV_16SC2, rectification.map1x, rectification.map1y);
+            cv::fisheye::initUndistortRectifyMap(K, D, R2, P2, size, CV_16SC2, rectification.map2x, rectification.map2y);
+        }
+        else
+        {
+            cv::initUndistortRectifyMap(K, D, R1, P1, size, CV_16SC2, rectification.map1x, rectification.map1y);
+            cv::initUndistortRectifyMap(K, D, R2, P2, size, CV_16SC2, rectification.map2x, rectification.map2y);
+        }
+
+        rectification.R1 = R1;
+        rectification.Q  = Q;
+
+        // The second view sits to the right of the first when its
+        // projection has a negative x offset
+        rectification.flipped = P2.at<double>(0, 3) > 0;
+        return true;
+    }
+
+    void remap(
+        const Rectification& rectification,
+        const cv::Mat& image1,
+        const cv::Mat& image2,
+        cv::Mat& rectified1,
+        cv::Mat& rectified2)
+    {
+        cv::remap(image1, rectified1, rectification.map1x, rectification.map1y, cv::INTER_LINEAR);
+        cv::remap(image2, rectified2, rectification.map2x, rectification.map2y, cv::INTER_LINEAR);
+    }
+
+    void match(
+        const Rectification& rectification,
+        const cv::Mat& rectified1,
+        const cv::Mat& rectified2,
+        const Parameters& parameters,
+        cv::Mat& disparity)
+    {
+        assert(rectified1.size() == rectified2.size());
+        assert(parameters.disparities > 0 && parameters.disparities % 8 == 0);
+        assert(parameters.strip_rows > 0 && parameters.overlap >= 0);
+
+        cv::Mat gray1, gray2;
+        gray(rectified1, gray1);
+        gray(rectified2, gray2);
+
+        // Mirrored, the first view is the left one and the search runs
+        // over positive disparities either way
+        if (rectification.flipped)
+        {
+            cv::Mat mirrored1, mirrored2;
+            cv::flip(gray1, mirrored1, 1);
+            cv::flip(gray2, mirrored2, 1);
+            gray1 = mirrored1;
+            gray2 = mirrored2;
+        }
+
+        cv::Mat codes1, codes2;
+        census(gray1, codes1);
+        census(gray2, codes2);
+
+        cv::Mat result(gray1.size(), CV_32F);
+        const int bands = (result.rows + parameters.strip_rows - 1) / parameters.strip_rows;
+        cv::parallel_for_(cv::Range(0, bands), StripBody(codes1, codes2, parameters, result));
+
+        if (rectification.flipped)
+        {
+            cv::flip(result, disparity, 1);
+            disparity *= -1;
+        }
+        else
+        {
+            disparity = result;
+        }
+    }
+
+    void triangulate(
+        const Rectification& rectification,
+        const cv::Mat& disparity,
+        std::vector<cv::Point3d>& points,
+        std::vector<cv::Point2d>& pixels)
+    {
+        const cv::Matx33d to_camera = rectification.R1.t();
+
+        points.clear();
+        pixels.clear();
+        for (int y = 0; y < disparity.rows; ++y)
+        {
+            const float* row = disparity.ptr<float>(y);
+            for (int x = 0; x < disparity.cols; ++x)
+            {
+                if (row[x] == 0)
+                    continue;
+
+                const cv::Vec4d X = rectification.Q * cv::Vec4d(x, y, row[x], 1.0);
+                if (X[3] <= 0)
+                    continue;
+
+                const cv::Vec3d p = to_camera * cv::Vec3d(X[0] / X[3], X[1] / X[3], X[2] / X[3]);
+                points.push_back(cv::Point3d(p));
+                pixels.push_back(cv::Point2d(x, y));
+            }
+        }
+    }
+}
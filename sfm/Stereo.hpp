@@ -0,0 +1,81 @@
+#ifndef __STEREO_HPP__
+#define __STEREO_HPP__
+
+#include <vector>
+#include <core.hpp>
+
+class Camera;
+
+// Dense two-view stereo: rectification of a calibrated pair and
+// semi-global matching on census costs.
+namespace Stereo
+{
+    struct Rectification
+    {
+        // Fixed-point remap tables of each view
+        cv::Mat map1x, map1y;
+        cv::Mat map2x, map2y;
+
+        // Rotation from the first camera into its rectified frame
+        cv::Matx33d R1;
+
+        // (x, y, disparity, 1) in the first rectified view to a
+        // homogeneous point in its rectified frame
+        cv::Matx44d Q;
+
+        // The second view is on the left after rectification; the pair is
+        // mirrored for matching
+        bool flipped;
+    };
+
+    struct Parameters
+    {
+        int    disparities;    // search range, a multiple of 8
+        int    P1, P2;         // penalties for disparity steps of one and more
+        int    strip_rows;     // rows per band
+        int    overlap;        // warm-up rows above each band
+        int    uniqueness;     // margin (percent) of the best over any other cost
+        int    max_difference; // left-right consistency, in pixels
+
+        Parameters();
+    };
+
+    // Rectifies the pair taken by camera with the second view at
+    // x2 = rotation * x1 + translation. Returns false if the baseline is
+    // mostly vertical, which the matcher doesn't handle.
+    bool rectify(
+        const Camera& camera,
+        const cv::Matx33d& rotation,
+        const cv::Vec3d& translation,
+        Rectification& rectification);
+
+    void remap(
+        const Rectification& rectification,
+        const cv::Mat& image1,
+        const cv::Mat& image2,
+        cv::Mat& rectified1,
+        cv::Mat& rectified2);
+
+    // Semi-global matching of the rectified pair. The cost volume is never
+    // stored whole: bands of strip_rows rows run in parallel, each
+    // streaming one cost row at a time through five aggregation paths
+    // (left, right, up and the two upper diagonals) that restart overlap
+    // rows above the band. disparity (CV_32F) is x1 - x2 in the first
+    // view, with 0 where no match survived the checks.
+    void match(
+        const Rectification& rectification,
+        const cv::Mat& rectified1,
+        const cv::Mat& rectified2,
+        const Parameters& parameters,
+        cv::Mat& disparity);
+
+    // One point per valid disparity, in the first camera's frame, and the
+    // rectified pixel it came from
+    void triangulate(
+        const Rectification& rectification,
+        const cv::Mat& disparity,
+        std::vector<cv::Point3d>& points,
+        std::vector<cv::Point2d>& pixels);
+}
+
+#endif
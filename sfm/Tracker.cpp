@@ -0,0 +1,170 @@
+#include "Tracker.hpp"
+
+#include <features2d.hpp>
+#include <video.hpp>
+
+#include <cassert>
+#include <cmath>
+#include <algorithm>
+
+namespace
+{
+    // Lucas-Kanade window and pyramid levels; the window has to fit in
+    // the pyramid's padding
+    const int window_size = 21;
+    const int levels      = 3;
+
+    // Largest distance (pixels) between a point and where the backward
+    // flow puts it again
+    const float max_round_trip = 0.5f;
+
+    const int fast_threshold = 20;
+}
+
+Tracker::Tracker(int max_tracks, int min_tracks, int cell_size)
+: _max_tracks(max_tracks)
+, _min_tracks(min_tracks)
+, _cell_size(cell_size)
+, _frame(0)
+, _next_id(0)
+{
+    assert(cell_size > 0 && min_tracks <= max_tracks);
+    assert(window_size <= Pyramid::border);
+}
+
+void Tracker::reset(const Pyramid& frame, const std::vector<cv::Point2f>& points)
+{
+    _frame = 0;
+    _tracks.clear();
+    _previous = frame;
+
+    for (int i = 0; i < points.size(); ++i)
+    {
+        add(points[i]);
+    }
+
+    if (points.empty() && _min_tracks > 0)
+        detect(frame.gray());
+}
+
+int Tracker::update(const Pyramid& frame)
+{
+    if (_previous.empty())
+    {
+        reset(frame);
+        return _tracks.size();
+    }
+
+    const cv::Mat& gray = frame.gray();
+    ++_frame;
+
+    if (!_tracks.empty())
+    {
+        std::vector<cv::Point2f> points(_tracks.size()), forward, backward;
+        for (int i = 0; i < _tracks.size(); ++i)
+        {
+            points[i] = _tracks[i].point;
+        }
+
+        // Both passes run on the frames' own pyramids
+        const cv::Size window(window_size, window_size);
+        const int depth = std::min(levels, std::min(_previous.depth(), frame.depth()));
+        std::vector<unsigned char> status, back_status;
+        std::vector<float> error;
+        cv::calcOpticalFlowPyrLK(_previous.levels(), frame.levels(), points, forward, status, error, window, depth);
+        cv::calcOpticalFlowPyrLK(frame.levels(), _previous.levels(), forward, backward, back_status, error, window, depth);
+
+        // Survivors keep their order, so ids stay sorted
+        const cv::Rect image(0, 0, gray.cols, gray.rows);
+        int kept = 0;
+        for (int i = 0; i < _tracks.size(); ++i)
+        {
+            const cv::Point2f d = backward[i] - points[i];
+            if (status[i] && back_status[i]
+                && image.contains(forward[i])
+                && std::sqrt(d.x * d.x + d.y * d.y) <= max_round_trip)
+            {
+                _tracks[kept] = _tracks[i];
+                _tracks[kept].point = forward[i];
+                ++kept;
+            }
+        }
+        _tracks.resize(kept);
+    }
+
+    if (_tracks.size() < _min_tracks)
+        detect(gray);
+
+    _previous = frame;
+    return _tracks.size();
+}
+
+const std::vector<Tracker::Track>& Tracker::tracks() const
+{
+    return _tracks;
+}
+
+int Tracker::frame() const
+{
+    return _frame;
+}
+
+int Tracker::created() const
+{
+    return _next_id;
+}
+
+void Tracker::add(const cv::Point2f& point)
+{
+    Track track;
+    track.id    = _next_id++;
+    track.born  = _frame;
+    track.first = point;
+    track.point = point;
+    _tracks.push_back(track);
+}
+
+// The strongest FAST corner of every cell without a track, until there are
+// max_tracks tracks
+void Tracker::detect(const cv::Mat& gray)
+{
+    const int cols = (gray.cols + _cell_size - 1) / _cell_size;
+    const int rows = (gray.rows + _cell_size - 1) / _cell_size;
+
+    const cv::Rect image(0, 0, gray.cols, gray.rows);
+
+    std::vector<unsigned char> occupied(cols * rows, 0);
+    for (int i = 0; i < _tracks.size(); ++i)
+    {
+        const cv::Point2f& p = _tracks[i].point;
+        if (image.contains(p))
+            occupied[((int) p.y / _cell_size) * cols + (int) p.x / _cell_size] = 1;
+    }
+
+    std::vector<cv::KeyPoint> keypoints;
+    for (int i = 0; i < rows && _tracks.size() < _max_tracks; ++i)
+    {
+        for (int j = 0; j < cols && _tracks.size() < _max_tracks; ++j)
+        {
+            if (occupied[i * cols + j])
+                continue;
+
+            const cv::Rect cell = cv::Rect(j * _cell_size, i * _cell_size, _cell_size, _cell_size)
+                                & image;
+
+            keypoints.clear();
+            cv::FAST(gray(cell), keypoints, fast_threshold, true);
+            if (keypoints.empty())
+                continue;
+
+            int best = 0;
+            for (int k = 1; k < keypoints.size(); ++k)
+            {
+                if (keypoints[k].response > keypoints[best].response)
+                    best = k;
+            }
+
+            add(keypoints[best].pt + cv::Point2f(cell.x, cell.y));
+        }
+    }
+}
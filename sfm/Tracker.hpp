@@ -0,0 +1,60 @@
+#ifndef __TRACKER_HPP__
+#define __TRACKER_HPP__
+
+#include <vector>
+#include <core.hpp>
+
+#include "Pyramid.hpp"
+
+// Keypoint tracks across consecutive video frames. Points are carried from
+// frame to frame by pyramidal Lucas-Kanade flow and dropped when the flow
+// back from the new frame doesn't return to where they came from. The
+// detector only runs once fewer than min_tracks survive, and then only in
+// the grid cells that no track covers, so a steady frame costs two sparse
+// flow passes. Frames come in as pyramids, and the last one is kept as the
+// previous frame's.
+class Tracker
+{
+public:
+    struct Track
+    {
+        int id;            // unique over the tracker's lifetime, in order of birth
+        int born;          // frame the track started on
+        cv::Point2f first; // position on that frame
+        cv::Point2f point; // position on the latest frame
+    };
+
+    // min_tracks = 0 never detects: only points passed to reset are tracked
+    Tracker(int max_tracks = 500, int min_tracks = 200, int cell_size = 32);
+
+    // Drops every track and starts over on frame, from points if given
+    // (ids then follow their order) or else from a detection
+    void reset(const Pyramid& frame, const std::vector<cv::Point2f>& points = std::vector<cv::Point2f>());
+
+    // Moves the tracks onto the next frame and tops them up if needed.
+    // Returns the number of live tracks.
+    int update(const Pyramid& frame);
+
+    const std::vector<Track>& tracks() const;
+
+    // Frames seen so far, counting the one passed to reset as frame 0
+    int frame() const;
+
+    // Number of tracks created so far, which is also the next id
+    int created() const;
+
+private:
+    int _max_tracks;
+    int _min_tracks;
+    int _cell_size;
+
+    int _frame;
+    int _next_id;
+    Pyramid _previous;
+    std::vector<Track> _tracks;
+
+    void add(const cv::Point2f& point);
+    void detect(const cv::Mat& gray);
+};
+
+#endif
@@ -0,0 +1,392 @@
+#include "Vocabulary.hpp"
+
+#include <core/hal/hal.hpp>
+
+#include <cassert>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <climits>
+#include <limits>
+#include <algorithm>
+
+namespace
+{
+    const int max_kmedians_iterations = 10;
+
+    // Binary layout, all fields in host byte order:
+    //   char[4] magic, int32 version, int32 descriptor bytes, int32 nodes,
+    //   int32 words, then per node int32 first child, children, word,
+    //   then bytes per node of centers and a float weight per word.
+    const char binary_magic[4] = { 'V', 'O', 'C', 'B' };
+    const int  binary_version  = 1;
+
+    int distance(const uchar* a, const uchar* b, int bytes)
+    {
+        return cv::hal::normHamming(a, b, bytes);
+    }
+
+    struct ByWord
+    {
+        bool operator()(const std::pair<int, float>& a, const std::pair<int, float>& b) const
+        {
+            return a.first < b.first;
+        }
+    };
+}
+
+Vocabulary::Vocabulary()
+: _bytes(0)
+{}
+
+void Vocabulary::train(const std::vector<cv::Mat>& descriptors, int branching, int depth)
+{
+    assert(branching > 1 && depth > 0);
+
+    _bytes = 0;
+    _nodes.clear();
+    _centers.clear();
+    _weights.clear();
+
+    std::vector<const uchar*> all;
+    for (int i = 0; i < descriptors.size(); ++i)
+    {
+        assert(descriptors[i].empty() || descriptors[i].type() == CV_8U);
+        _bytes = std::max(_bytes, descriptors[i].cols);
+        for (int r = 0; r < descriptors[i].rows; ++r)
+        {
+            all.push_back(descriptors[i].ptr<uchar>(r));
+        }
+    }
+
+    Node root = { 0, 0, -1 };
+    _nodes.push_back(root);
+    _centers.resize(_bytes);
+    if (all.empty())
+        return;
+
+    build(0, all, branching, 0, depth);
+
+    // Inverse document frequency: log(images / images containing the word)
+    std::vector<int> containing(_weights.size(), 0), last_image(_weights.size(), -1);
+    for (int i = 0; i < descriptors.size(); ++i)
+    {
+        for (int r = 0; r < descriptors[i].rows; ++r)
+        {
+            const int w = word(descriptors[i].ptr<uchar>(r));
+            if (last_image[w] != i)
+            {
+                last_image[w] = i;
+                ++containing[w];
+            }
+        }
+    }
+
+    const double images = descriptors.size();
+    for (int w = 0; w < _weights.size(); ++w)
+    {
+        _weights[w] = std::log(images / std::max(containing[w], 1));
+    }
+}
+
+// Splits descriptors into branching clusters under node with k-medians
+// (k-means++ seeding, bitwise majority centers) and recurses into each
+void Vocabulary::build(int node, const std::vector<const uchar*>& descriptors, int branching, int level, int depth)
+{
+    const int n = descriptors.size();
+    const int k = std::min(n, branching);
+
+    std::vector<uchar> centers(k * _bytes);
+    std::vector<int> assignment(n);
+
+    if (n <= branching)
+    {
+        for (int i = 0; i < n; ++i)
+        {
+            std::memcpy(&centers[i * _bytes], descriptors[i], _bytes);
+            assignment[i] = i;
+        }
+    }
+    else
+    {
+        cv::RNG rng(n + level);
+
+        // Seeds drawn with probability proportional to the squared
+        // distance to the closest seed so far
+        std::vector<double> nearest(n, std::numeric_limits<double>::max());
+        int seed = rng.uniform(0, n);
+        for (int c = 0; c < k; ++c)
+        {
+            std::memcpy(&centers[c * _bytes], descriptors[seed], _bytes);
+
+            double total = 0.0;
+            for (int i = 0; i < n; ++i)
+            {
+                const double d = distance(descriptors[i], &centers[c * _bytes], _bytes);
+                nearest[i] = std::min(nearest[i], d * d);
+                total += nearest[i];
+            }
+
+            double target = rng.uniform(0.0, total);
+            seed = 0;
+            while (seed < n - 1 && target >= nearest[seed])
+            {
+                target -= nearest[seed];
+                ++seed;
+            }
+        }
+
+        std::vector<int> counts(k * _bytes * 8), sizes(k);
+        for (int it = 0; it < max_kmedians_iterations; ++it)
+        {
+            bool changed = it == 0;
+            for (int i = 0; i < n; ++i)
+            {
+                int best = 0, best_distance = INT_MAX;
+                for (int c = 0; c < k; ++c)
+                {
+                    const int d = distance(descriptors[i], &centers[c * _bytes], _bytes);
+                    if (d < best_distance)
+                    {
+                        best = c;
+                        best_distance = d;
+                    }
+                }
+                changed = changed || assignment[i] != best;
+                assignment[i] = best;
+            }
+
+            if (!changed)
+                break;
+
+            // Each center bit is the majority of its members' bits; a
+            // cluster left empty keeps its center
+            std::fill(counts.begin(), counts.end(), 0);
+            std::fill(sizes.begin(), sizes.end(), 0);
+            for (int i = 0; i < n; ++i)
+            {
+                int* count = &counts[assignment[i] * _bytes * 8];
+                for (int b = 0; b < _bytes * 8; ++b)
+                {
+                    count[b] += (descriptors[i][b >> 3] >> (7 - (b & 7))) & 1;
+                }
+                ++sizes[assignment[i]];
+            }
+
+            for (int c = 0; c < k; ++c)
+            {
+                if (sizes[c] == 0)
+                    continue;
+
+                uchar* center = &centers[c * _bytes];
+                const int* count = &counts[c * _bytes * 8];
+                std::memset(center, 0, _bytes);
+                for (int b = 0; b < _bytes * 8; ++b)
+                {
+                    if (2 * count[b] > sizes[c])
+                        center[b >> 3] |= 1 << (7 - (b & 7));
+                }
+            }
+        }
+    }
+
+    // Children go in one block, so the node only keeps where it starts
+    const int first = _nodes.size();
+    _nodes[node].first_child = first;
+    _nodes[node].children = k;
+    for (int c = 0; c < k; ++c)
+    {
+        Node child = { 0, 0, -1 };
+        _nodes.push_back(child);
+    }
+    _centers.insert(_centers.end(), centers.begin(), centers.end());
+
+    std::vector<const uchar*> members;
+    for (int c = 0; c < k; ++c)
+    {
+        members.clear();
+        for (int i = 0; i < n; ++i)
+        {
+            if (assignment[i] == c)
+                members.push_back(descriptors[i]);
+        }
+
+        if (level + 1 < depth && members.size() > 1)
+        {
+            build(first + c, members, branching, level + 1, depth);
+        }
+        else
+        {
+            _nodes[first + c].word = _weights.size();
+            _weights.push_back(0.0f);
+        }
+    }
+}
+
+bool Vocabulary::save(const std::string& path) const
+{
+    FILE* file = fopen(path.c_str(), "wb");
+    if (!file)
+    {
+        printf("Could not open %s for writing\n", path.c_str());
+        return false;
+    }
+
+    const int header[4] = { binary_version, _bytes, (int) _nodes.size(), (int) _weights.size() };
+    bool ok = fwrite(binary_magic, 1, 4, file) == 4
+           && fwrite(header, sizeof(int), 4, file) == 4;
+
+    for (int i = 0; ok && i < _nodes.size(); ++i)
+    {
+        const int node[3] = { _nodes[i].first_child, _nodes[i].children, _nodes[i].word };
+        ok = fwrite(node, sizeof(int), 3, file) == 3;
+    }
+
+    ok = ok && (_centers.empty() || fwrite(&_centers[0], 1, _centers.size(), file) == _centers.size())
+            && (_weights.empty() || fwrite(&_weights[0], sizeof(float), _weights.size(), file) == _weights.size());
+
+    fclose(file);
+    return ok;
+}
+
+bool Vocabulary::load(const std::string& path)
+{
+    FILE* file = fopen(path.c_str(), "rb");
+    if (!file)
+        return false;
+
+    char magic[4];
+    int header[4];
+    bool ok = fread(magic, 1, 4, file) == 4 && memcmp(magic, binary_magic, 4) == 0
+           && fread(header, sizeof(int), 4, file) == 4
+           && header[0] == binary_version && header[1] > 0 && header[2] > 0 && header[3] >= 0;
+
+    if (ok)
+    {
+        _bytes = header[1];
+        _nodes.resize(header[2]);
+        _centers.resize(header[2] * _bytes);
+        _weights.resize(header[3]);
+    }
+
+    // Children follow their parent, as build lays them out, so a walk down
+    // the tree always ends; without a checksum this is all that keeps a
+    // damaged file from sending word() outside the arrays
+    const int nodes = _nodes.size(), words = _weights.size();
+    for (int i = 0; ok && i < nodes; ++i)
+    {
+        int node[3];
+        ok = fread(node, sizeof(int), 3, file) == 3
+          && node[1] >= 0
+          && (node[1] == 0 || (node[0] > i && node[0] <= nodes - node[1]))
+          && node[2] >= -1 && node[2] < words;
+        _nodes[i].first_child = node[0];
+        _nodes[i].children = node[1];
+        _nodes[i].word = node[2];
+    }
+
+    ok = ok && (_centers.empty() || fread(&_centers[0], 1, _centers.size(), file) == _centers.size())
+            && (_weights.empty() || fread(&_weights[0], sizeof(float), _weights.size(), file) == _weights.size());
+
+    fclose(file);
+    if (!ok)
+    {
+        _bytes = 0;
+        _nodes.clear();
+        _centers.clear();
+        _weights.clear();
+    }
+    return ok;
+}
+
+bool Vocabulary::empty() const
+{
+    return _weights.empty();
+}
+
+int Vocabulary::words() const
+{
+    return _weights.size();
+}
+
+int Vocabulary::word(const uchar* descriptor) const
+{
+    if (_nodes.empty())
+        return -1;
+
+    int node = 0;
+    while (_nodes[node].children > 0)
+    {
+        const int first = _nodes[node].first_child;
+        int best = first, best_distance = INT_MAX;
+        for (int c = first; c < first + _nodes[node].children; ++c)
+        {
+            const int d = distance(descriptor, &_centers[c * _bytes], _bytes);
+            if (d < best_distance)
+            {
+                best = c;
+                best_distance = d;
+            }
+        }
+        node = best;
+    }
+
+    return _nodes[node].word;
+}
+
+bool Vocabulary::transform(const cv::Mat& descriptors, BowVector& bow, std::vector<int>* words) const
+{
+    bow.clear();
+    if (words)
+        words->assign(descriptors.rows, -1);
+
+    if (!descriptors.empty() && (descriptors.type() != CV_8U || descriptors.cols != _bytes))
+        return false;
+
+    for (int r = 0; r < descriptors.rows; ++r)
+    {
+        const int w = word(descriptors.ptr<uchar>(r));
+        if (words)
+            (*words)[r] = w;
+        if (w >= 0 && _weights[w] > 0.0f)
+            bow.push_back(std::make_pair(w, _weights[w]));
+    }
+
+    // Repeated words add up (term frequency)
+    std::sort(bow.begin(), bow.end(), ByWord());
+    int n = 0;
+    float total = 0.0f;
+    for (int i = 0; i < bow.size(); ++i)
+    {
+        if (n > 0 && bow[n - 1].first == bow[i].first)
+            bow[n - 1].second += bow[i].second;
+        else
+            bow[n++] = bow[i];
+        total += bow[i].second;
+    }
+    bow.resize(n);
+
+    for (int i = 0; i < n; ++i)
+    {
+        bow[i].second /= total;
+    }
+    return true;
+}
+
+// With both vectors L1-normalized, 1 - |a - b| / 2 reduces to the sum of
+// the smaller weight over the shared words
+double Vocabulary::score(const BowVector& a, const BowVector& b)
+{
+    double s = 0.0;
+    int i = 0, j = 0;
+    while (i < a.size() && j < b.size())
+    {
+        if (a[i].first < b[j].first)
+            ++i;
+        else if (b[j].first < a[i].first)
+            ++j;
+        else
+            s += std::min(a[i++].second, b[j++].second);
+    }
+    return s;
+}
@@ -0,0 +1,59 @@
+#ifndef __VOCABULARY_HPP__
+#define __VOCABULARY_HPP__
+
+#include <string>
+#include <vector>
+#include <core.hpp>
+
+// Vocabulary of binary visual words (Galvez-Lopez and Tardos): a tree
+// built by hierarchical k-medians over ORB descriptors, whose leaves are
+// the words, each weighted by its inverse document frequency over the
+// training images. A descriptor finds its word in branching * depth
+// Hamming distances, and an image becomes a sparse, L1-normalized tf-idf
+// vector.
+class Vocabulary
+{
+public:
+    // (word, weight) pairs, sorted by word
+    typedef std::vector<std::pair<int, float> > BowVector;
+
+    Vocabulary();
+
+    // descriptors holds one CV_8U matrix per training image, one binary
+    // descriptor per row
+    void train(const std::vector<cv::Mat>& descriptors, int branching = 10, int depth = 4);
+
+    // Binary blob; load returns false if the file isn't one
+    bool save(const std::string& path) const;
+    bool load(const std::string& path);
+
+    bool empty() const;
+    int words() const;
+
+    int word(const uchar* descriptor) const;
+
+    // The bag-of-words vector of an image's descriptors. words, if given,
+    // gets the word of every row. Returns false, with an empty vector, for
+    // descriptors of another type or length than the vocabulary's.
+    bool transform(const cv::Mat& descriptors, BowVector& bow, std::vector<int>* words = NULL) const;
+
+    // L1 similarity of two normalized vectors, in [0, 1]
+    static double score(const BowVector& a, const BowVector& b);
+
+private:
+    struct Node
+    {
+        int first_child;  // children are contiguous
+        int children;
+        int word;         // -1 for inner nodes
+    };
+
+    int _bytes;           // descriptor length
+    std::vector<Node> _nodes;
+    std::vector<uchar> _centers;   // _bytes per node, the root's unused
+    std::vector<float> _weights;   // per word
+
+    void build(int node, const std::vector<const uchar*>& descriptors, int branching, int level, int depth);
+};
+
+#endif
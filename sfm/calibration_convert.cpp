@@ -0,0 +1,48 @@
+#include <core.hpp>
+
+#include "Camera.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+using namespace std;
+using namespace cv;
+
+// Converts the calibration tool's XML output into the binary blob that
+// Camera loads without going through FileStorage, and reports how long
+// each format takes to load.
+int main(int argc, char** argv)
+{
+    if (argc < 3)
+    {
+        printf("<calibration_xml> <calibration_bin> [<with_maps>]\n");
+        return -1;
+    }
+
+    string xml_filepath = argv[1];
+    string bin_filepath = argv[2];
+    bool with_maps      = argc > 3 && atoi(argv[3]) != 0;
+
+    double t = getTickCount();
+    Camera camera(xml_filepath);
+    printf("[load xml]: %0.4f seconds\n", (getTickCount() - t) / getTickFrequency());
+
+    if (!camera.save(bin_filepath, with_maps))
+    {
+        printf("Couldn't write %s\n", bin_filepath.c_str());
+        return -1;
+    }
+
+    t = getTickCount();
+    Camera loaded(bin_filepath);
+    printf("[load binary]: %0.4f seconds\n", (getTickCount() - t) / getTickFrequency());
+
+    if (norm(loaded.matrix(), camera.matrix()) != 0.0 || loaded.resolution() != camera.resolution())
+    {
+        printf("Round trip mismatch\n");
+        return -1;
+    }
+
+    return 0;
+}
@@ -2,29 +2,64 @@
 
 #include "Util.hpp"
 #include "Features.hpp"
+#include "Pyramid.hpp"
+#include "FrameContext.hpp"
+#include "FramePool.hpp"
+#include "Tracker.hpp"
 
 #include <iostream>
+#include <cstdio>
+#include <cstdlib>
 
 using namespace std;
 using namespace cv;
 
 int main(int argc, char** argv)
 {
+    // 0: AKAZE matches, 1: dense flow, 2: KLT tracks followed from the
+    // first snapshot to the second
+    int mode = argc > 1 ? atoi(argv[1]) : 0;
+    Tracker tracker;
+
     VideoCapture vc(0);
 
+    // Frames are decoded into pool buffers and moved into the context, and
+    // a snapshot keeps hold of its frame's buffer rather than cloning it:
+    // the frame being read plus the first snapshot
+    FramePool pool(3, Size(vc.get(CV_CAP_PROP_FRAME_WIDTH), vc.get(CV_CAP_PROP_FRAME_HEIGHT)), CV_8UC3);
+    FramePool::Handle buffer, snapshots[2];
+
     int count = 0;
-    Mat image;
+    FrameContext frame;
     Mat im[2];
     namedWindow("source");
     while (vc.isOpened() && count < 2)
     {
-        vc >> image;
+        buffer = pool.acquire();
+        Mat read = buffer.image();
+        if (!vc.read(read))
+            break;
+        if (!buffer.holds(read))
+        {
+            printf("%dx%d frames don't fit the %dx%d frame pool\n",
+                   read.cols, read.rows, pool.size().width, pool.size().height);
+            return -1;
+        }
+        frame.swap(read);
+
+        Mat& image = frame.frame();
         imshow("source", image);
 
+        if (mode == 2 && count == 1)
+            tracker.update(frame.pyramid());
+
         char c = waitKey(20);
         if (c == ' ')
         {
-            im[count] = image.clone();
+            snapshots[count] = buffer;
+            im[count] = image;
+            if (mode == 2 && count == 0)
+                tracker.reset(frame.pyramid());
             ++count;
         }
         else if (c == 27)
@@ -37,7 +72,28 @@ int main(int argc, char** argv)
     vector<KeyPoint> kp1, kp2;
     Mat desc1, desc2;
     vector<DMatch> matches;
-    Features::findMatches(im[0], im[1], kp1, kp2, desc1, desc2, matches);
+    double t = getTickCount();
+    if (mode == 1)
+    {
+        Features::flowMatches(Pyramid(im[0]), Pyramid(im[1]), kp1, kp2, matches);
+    }
+    else if (mode == 2)
+    {
+        // Tracks that made it all the way from the first snapshot
+        const vector<Tracker::Track>& tracks = tracker.tracks();
+        for (int i = 0; i < tracks.size(); ++i)
+        {
+            if (tracks[i].born != 0)
+                continue;
+
+            matches.push_back(DMatch(kp1.size(), kp2.size(), 0.0f));
+            kp1.push_back(KeyPoint(tracks[i].first, 7.0f));
+            kp2.push_back(KeyPoint(tracks[i].point, 7.0f));
+        }
+    }
+    else
+        Features::findMatches(im[0], im[1], kp1, kp2, desc1, desc2, matches);
+    printf("[matches]: %0.4f seconds, %ld matches\n", (getTickCount() - t) / getTickFrequency(), matches.size());
 
     cout << kp1.size() << " " << kp2.size() << endl;
     Mat drawing;
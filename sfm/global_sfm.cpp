@@ -0,0 +1,93 @@
+#include <opencv.hpp>
+
+#include "Camera.hpp"
+#include "Features.hpp"
+#include "GlobalSfM.hpp"
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <cstdio>
+
+using namespace std;
+using namespace cv;
+
+void save_ply(
+    const vector<Mat>& images,
+    const vector<GlobalSfM::View>& views,
+    const GlobalSfM::Reconstruction& recon,
+    const string& filename)
+{
+    string header = "ply\
+        \nformat ascii 1.0\
+        \nelement vertex " + to_string(recon.points.size()) + "\
+        \nproperty float x\
+        \nproperty float y\
+        \nproperty float z\
+        \nproperty uchar red\
+        \nproperty uchar green\
+        \nproperty uchar blue\
+        \nend_header\n";
+
+    ofstream myfile;
+    myfile.open(filename);
+    myfile << header;
+    for (int i = 0; i < recon.points.size(); ++i)
+    {
+        // Color each point from its first observation
+        const GlobalSfM::Track& track = recon.tracks[i];
+        int view = track.views[0];
+        Point2f imagePoint = views[view].keypoints[track.keypoints[0]].pt;
+
+        Point3d cloudPoint = recon.points[i];
+        Vec3b color = images[view].at<Vec3b>(imagePoint);
+        myfile << cloudPoint.x << " " << cloudPoint.y << " " << cloudPoint.z << " ";
+        myfile << (int)color[2] << " " << (int)color[1] << " " << (int)color[0] << '\n';
+    }
+    myfile.close();
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 3 + 1)
+    {
+        cout << " <calibration_filepath>";
+        cout << " <image_1_filepath>";
+        cout << " <image_2_filepath>";
+        cout << " [<image_3_filepath> ...]";
+        cout << endl;
+        return -1;
+    }
+
+    string calibration_filepath = argv[1];
+
+    vector<Mat> images;
+    for (int i = 2; i < argc; ++i)
+    {
+        images.push_back(imread(argv[i]));
+        assert(!images.back().empty());
+
+        // All views share one camera
+        assert(images.back().size() == images[0].size());
+    }
+
+    Camera calibration(calibration_filepath);
+    const Camera& camera = calibration.at_resolution(images[0].size());
+
+    double t = getTickCount();
+    vector<GlobalSfM::View> views(images.size());
+    for (int i = 0; i < images.size(); ++i)
+    {
+        Features::detect(images[i], views[i].keypoints, views[i].descriptors);
+    }
+    printf("[detect]: %0.4f seconds\n", (getTickCount() - t) / getTickFrequency());
+
+    GlobalSfM::Reconstruction recon;
+    if (!GlobalSfM::reconstruct(views, camera.matrix(), recon))
+    {
+        printf("Couldn't reconstruct the scene.\n");
+        return -1;
+    }
+
+    save_ply(images, views, recon, "global_cloud.ply");
+}
\ No newline at end of file
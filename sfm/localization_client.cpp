@@ -0,0 +1,91 @@
+#include <core.hpp>
+#include <imgcodecs.hpp>
+
+#include "LocalizationProtocol.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+using namespace std;
+using namespace cv;
+
+// Stand-in client for localization_server: sends every image, in order, a
+// number of times over one connection and reports the round trip of each
+// query next to the time the server spent on it. The difference is what
+// the socket and the copies cost.
+int main(int argc, char** argv)
+{
+    if (argc < 4)
+    {
+        printf("<socket_path> <repeats> <image> [<image> ...]\n");
+        return -1;
+    }
+
+    const int repeats = max(atoi(argv[2]), 1);
+
+    // Read everything first so disk time stays out of the round trips
+    vector<Mat> images;
+    vector<string> names;
+    for (int i = 3; i < argc; ++i)
+    {
+        Mat gray = imread(argv[i], IMREAD_GRAYSCALE);
+        if (gray.empty())
+        {
+            printf("Couldn't read %s\n", argv[i]);
+            continue;
+        }
+
+        images.push_back(gray);
+        names.push_back(argv[i]);
+    }
+    if (images.empty())
+        return -1;
+
+    int64 t = getTickCount();
+    const int socket = LocalizationProtocol::connect(argv[1]);
+    if (socket < 0)
+        return -1;
+    printf("[connect]: %0.2f ms\n", 1000.0 * (getTickCount() - t) / getTickFrequency());
+
+    vector<double> round_trips, server_times;
+    int located = 0;
+    for (int r = 0; r < repeats; ++r)
+    {
+        for (int i = 0; i < images.size(); ++i)
+        {
+            LocalizationProtocol::Response response;
+            t = getTickCount();
+            if (!LocalizationProtocol::send_image(socket, images[i])
+                || !LocalizationProtocol::receive_response(socket, response))
+            {
+                printf("The server hung up\n");
+                LocalizationProtocol::close(socket);
+                return -1;
+            }
+            const double round_trip = 1000.0 * (getTickCount() - t) / getTickFrequency();
+
+            round_trips.push_back(round_trip);
+            server_times.push_back(1000.0 * response.seconds);
+            located += response.located;
+
+            const Vec3d position = -(response.rotation.t() * response.translation);
+            printf("[%s]: round trip %0.2f server %0.2f ms | %s keyframe %d, %d inliers, at (%0.3f %0.3f %0.3f)\n",
+                   names[i].c_str(), round_trip, 1000.0 * response.seconds,
+                   response.located ? "found at" : "not found,", response.keyframe, response.inliers,
+                   position(0), position(1), position(2));
+        }
+    }
+
+    LocalizationProtocol::close(socket);
+
+    const int n = round_trips.size();
+    sort(round_trips.begin(), round_trips.end());
+    sort(server_times.begin(), server_times.end());
+    printf("[queries]: %d, %d located | round trip median %0.2f max %0.2f ms | server median %0.2f max %0.2f ms\n",
+           n, located, round_trips[n / 2], round_trips[n - 1], server_times[n / 2], server_times[n - 1]);
+
+    return 0;
+}
@@ -0,0 +1,128 @@
+#include <core.hpp>
+
+#include "Camera.hpp"
+#include "KeyframeMap.hpp"
+#include "LocalizationProtocol.hpp"
+#include "Localizer.hpp"
+#include "Vocabulary.hpp"
+
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+using namespace std;
+using namespace cv;
+
+namespace
+{
+    double milliseconds(int64 start)
+    {
+        return 1000.0 * (getTickCount() - start) / getTickFrequency();
+    }
+}
+
+// Loads a map saved by main once, then answers localization queries over a
+// Unix socket, one client at a time, until killed. Startup is timed stage
+// by stage and apart from the queries, whose latency is printed one by one.
+int main(int argc, char** argv)
+{
+    if (argc != 7)
+    {
+        printf("<socket_path> <calibration_filepath> <video_width> <video_height> <vocabulary_filepath> <map_filepath>\n");
+        return -1;
+    }
+
+    const string socket_path = argv[1];
+    const Size resolution(atoi(argv[3]), atoi(argv[4]));
+
+    // A client hanging up mid-reply shouldn't take the server down
+    signal(SIGPIPE, SIG_IGN);
+
+    const int64 start = getTickCount();
+
+    int64 t = getTickCount();
+    Camera calibration(argv[2]);
+    const Camera& camera = calibration.at_resolution(resolution);
+    printf("[calibration]: %0.2f ms\n", milliseconds(t));
+
+    t = getTickCount();
+    Vocabulary vocabulary;
+    if (!vocabulary.load(argv[5]))
+    {
+        printf("Couldn't load the vocabulary %s\n", argv[5]);
+        return -1;
+    }
+    printf("[vocabulary]: %0.2f ms, %d words\n", milliseconds(t), vocabulary.words());
+
+    t = getTickCount();
+    KeyframeMap map;
+    if (!map.load(argv[6]))
+    {
+        printf("Couldn't load the map %s\n", argv[6]);
+        return -1;
+    }
+    printf("[map]: %0.2f ms, %d keyframes, %d points\n", milliseconds(t), map.keyframes(), map.points());
+
+    t = getTickCount();
+    Localizer localizer(camera, &vocabulary, map);
+    for (int i = 0; i < map.keyframes(); ++i)
+    {
+        localizer.add(i);
+    }
+    printf("[index]: %0.2f ms, %d keyframes indexed\n", milliseconds(t), localizer.size());
+
+    // The first query pays for allocating every scratch buffer, which
+    // belongs to startup rather than to whoever sends it
+    t = getTickCount();
+    Localizer::Result result;
+    Mat gray(resolution, CV_8UC1, Scalar(0));
+    randu(gray, Scalar(0), Scalar(256));
+    localizer.localize(gray, result);
+    printf("[warm up]: %0.2f ms\n", milliseconds(t));
+
+    const int server = LocalizationProtocol::listen(socket_path);
+    if (server < 0)
+        return -1;
+    printf("[startup]: %0.2f ms, listening on %s\n", milliseconds(start), socket_path.c_str());
+
+    int queries = 0;
+    while (true)
+    {
+        const int client = LocalizationProtocol::accept(server);
+        if (client < 0)
+            break;
+
+        while (true)
+        {
+            // Time waiting for the client isn't latency, so the clock starts
+            // once the image is in
+            if (!LocalizationProtocol::receive_image(client, gray))
+                break;
+
+            t = getTickCount();
+            LocalizationProtocol::Response response;
+            response.located = gray.size() == resolution && localizer.localize(gray, result);
+            response.keyframe = response.located ? result.keyframe : -1;
+            response.inliers = response.located ? result.inliers : 0;
+            response.rotation = response.located ? result.rotation : Matx33d::eye();
+            response.translation = response.located ? result.translation : Vec3d();
+            response.seconds = (getTickCount() - t) / getTickFrequency();
+
+            if (!LocalizationProtocol::send_response(client, response))
+                break;
+
+            if (gray.size() != resolution)
+                printf("[query %d]: %dx%d image, expected %dx%d\n",
+                       queries, gray.cols, gray.rows, resolution.width, resolution.height);
+            printf("[query %d]: %0.2f ms | keyframe %d, %d inliers\n",
+                   queries, 1000.0 * response.seconds, response.keyframe, response.inliers);
+            ++queries;
+        }
+
+        LocalizationProtocol::close(client);
+    }
+
+    LocalizationProtocol::close(server);
+    return 0;
+}
@@ -2,24 +2,49 @@
 
 #include "Util.hpp"
 #include "Camera.hpp"
-#include "Features.hpp"
-#include "MultiView.hpp"
+#include "FrameContext.hpp"
+#include "Odometry.hpp"
+#include "Vocabulary.hpp"
 
 #include <iostream>
 #include <string>
+#include <cstdio>
 
 using namespace std;
 using namespace cv;
 
+namespace
+{
+    const char* state_names[] = { "lost", "initializing", "tracking" };
+
+    double milliseconds(int64 start)
+    {
+        return 1000.0 * (getTickCount() - start) / getTickFrequency();
+    }
+
+    // Tracks carrying a map point in green, the others in red
+    void draw_tracks(Mat& image, const Odometry& odometry)
+    {
+        const vector<Tracker::Track>& tracks = odometry.tracker().tracks();
+        for (int i = 0; i < tracks.size(); ++i)
+        {
+            const Scalar color = odometry.point(tracks[i]) >= 0 ? Scalar(0, 255, 0) : Scalar(0, 0, 255);
+            circle(image, tracks[i].point, 2, color, -1);
+        }
+    }
+}
+
 int main(int argc, char** argv)
 {
-    if (argc != 5)
+    if (argc < 5 || argc > 7)
     {
         cout << "<video_camera_index>";
         cout << " <calibration_filepath>";
         cout << " <video_width>";
         cout << " <video_height>";
+        cout << " [<vocabulary_filepath> [<map_out_filepath>]]";
         cout << endl;
+        return 0;
     }
 
     int video_camera_index      = atoi(argv[1]);
@@ -27,8 +52,8 @@ int main(int argc, char** argv)
     int video_width             = atoi(argv[3]);
     int video_height            = atoi(argv[4]);
 
-    Camera camera(calibration_filepath);
-    camera.resize(Size(video_width, video_height));
+    Camera calibration(calibration_filepath);
+    const Camera& camera = calibration.at_resolution(Size(video_width, video_height));
 
     VideoCapture vc(video_camera_index);
     vc.set(CV_CAP_PROP_FRAME_WIDTH, video_width);
@@ -36,4 +61,63 @@ int main(int argc, char** argv)
 
     if (!vc.isOpened()) return 0;
 
+    // Without a vocabulary a lost track starts a new map right away
+    Vocabulary vocabulary;
+    if (argc > 5 && !vocabulary.load(argv[5]))
+        printf("Couldn't load the vocabulary %s, relocalization is off\n", argv[5]);
+
+    FrameContext frame;
+    Odometry odometry(camera, &vocabulary);
+
+    namedWindow("odometry");
+    while (true)
+    {
+        int64 t = getTickCount();
+        if (!frame.read(vc))
+            break;
+        const double capture = milliseconds(t);
+
+        t = getTickCount();
+        const Pyramid& pyramid = frame.pyramid();
+        const double build = milliseconds(t);
+
+        odometry.update(pyramid);
+        const Odometry::Timings& timings = odometry.timings();
+
+        t = getTickCount();
+        Mat& image = frame.frame();
+        draw_tracks(image, odometry);
+        imshow("odometry", image);
+        const double draw = milliseconds(t);
+
+        // Capture waits on the camera, so the processing total leaves it out
+        const double total = build + draw + 1000.0 * (timings.track + timings.pose + timings.map);
+        const Vec3d& t_cw = odometry.translation();
+        const Vec3d position = -(odometry.rotation().t() * t_cw);
+        printf("[frame %d] capture %0.2f pyramid %0.2f track %0.2f pose %0.2f map %0.2f draw %0.2f total %0.2f ms"
+               " | %s, %d inliers, %d keyframes, %d points, at (%0.3f %0.3f %0.3f)\n",
+               frame.index(), capture, build,
+               1000.0 * timings.track, 1000.0 * timings.pose, 1000.0 * timings.map, draw, total,
+               state_names[odometry.state()], odometry.inliers(), odometry.map().keyframes(),
+               odometry.map().points(), position(0), position(1), position(2));
+
+        if (odometry.loop() >= 0)
+            printf("[loop]: keyframe %d matches keyframe %d\n", odometry.map().keyframes() - 1, odometry.loop());
+
+        if (waitKey(1) == 27)
+            break;
+    }
+
+    // For localization_server, which needs the descriptors a vocabulary
+    // brings along
+    if (argc > 6)
+    {
+        if (odometry.map().save(argv[6]))
+            printf("Saved %d keyframes and %d points to %s\n",
+                   odometry.map().keyframes(), odometry.map().points(), argv[6]);
+        else
+            printf("Couldn't save the map to %s\n", argv[6]);
+    }
+
+    return 0;
 }
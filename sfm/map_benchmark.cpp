@@ -0,0 +1,116 @@
+#include <core.hpp>
+
+#include "KeyframeMap.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+using namespace std;
+using namespace cv;
+
+// Random camera inside the point cloud, looking anywhere
+void random_pose(RNG& rng, double extent, Matx33d& rotation, Vec3d& translation)
+{
+    Vec3d w(rng.uniform(-1.0, 1.0), rng.uniform(-1.0, 1.0), rng.uniform(-1.0, 1.0));
+    double angle = rng.uniform(0.0, CV_PI);
+    Vec3d k = w / norm(w);
+    Matx33d K(0.0, -k(2), k(1),
+              k(2), 0.0, -k(0),
+              -k(1), k(0), 0.0);
+    rotation = Matx33d::eye() + K * sin(angle) + K * K * (1.0 - cos(angle));
+
+    Vec3d center(rng.uniform(-extent, extent), rng.uniform(-extent, extent), rng.uniform(-extent, extent));
+    translation = -(rotation * center);
+}
+
+// Every point of the map, projected; the reference for visible
+void brute_force(
+    const KeyframeMap& map,
+    const Matx33d& rotation,
+    const Vec3d& translation,
+    const Matx33d& K,
+    const Size& size,
+    double max_depth,
+    vector<int>& points)
+{
+    const double x0 = -K(0, 2) / K(0, 0), x1 = (size.width - K(0, 2)) / K(0, 0);
+    const double y0 = -K(1, 2) / K(1, 1), y1 = (size.height - K(1, 2)) / K(1, 1);
+
+    points.clear();
+    for (int i = 0; i < map.points(); ++i)
+    {
+        const Point3d& X = map.point(i).position;
+        const Vec3d x = rotation * Vec3d(X.x, X.y, X.z) + translation;
+        if (x(2) <= 0.0 || x(2) > max_depth)
+            continue;
+
+        const Point2d n(x(0) / x(2), x(1) / x(2));
+        if (n.x >= x0 && n.x < x1 && n.y >= y0 && n.y < y1)
+            points.push_back(i);
+    }
+}
+
+// Checks the voxel hash frustum query against projecting every point, and
+// times both as the map grows
+int main(int argc, char** argv)
+{
+    const int n       = argc > 1 ? atoi(argv[1]) : 200000;
+    const int queries = argc > 2 ? atoi(argv[2]) : 100;
+
+    const double extent = 20.0;
+    const double max_depth = 6.0;
+    const Matx33d K(700.0, 0.0, 640.0,
+                    0.0, 700.0, 360.0,
+                    0.0, 0.0, 1.0);
+    const Size size(1280, 720);
+
+    RNG rng(12345);
+    KeyframeMap map(0.5);
+
+    vector<int> visible, expected;
+    vector<Point2d> normalized;
+    int mismatches = 0;
+
+    for (int m = max(n / 8, 1); ; m = min(2 * m, n))
+    {
+        while (map.points() < m)
+        {
+            map.add_point(Point3d(rng.uniform(-extent, extent),
+                                  rng.uniform(-extent, extent),
+                                  rng.uniform(-extent, extent)));
+        }
+
+        double hash_time = 0.0, brute_time = 0.0;
+        long found = 0;
+        for (int q = 0; q < queries; ++q)
+        {
+            Matx33d R;
+            Vec3d t;
+            random_pose(rng, extent, R, t);
+
+            double start = getTickCount();
+            map.visible(R, t, K, size, max_depth, visible, normalized);
+            hash_time += (getTickCount() - start) / getTickFrequency();
+
+            start = getTickCount();
+            brute_force(map, R, t, K, size, max_depth, expected);
+            brute_time += (getTickCount() - start) / getTickFrequency();
+
+            sort(visible.begin(), visible.end());
+            if (visible != expected)
+                ++mismatches;
+            found += visible.size();
+        }
+
+        printf("[visible]: %d points, %0.1f in view: hash %0.3f ms, brute force %0.3f ms\n",
+            m, (double) found / queries, 1e3 * hash_time / queries, 1e3 * brute_time / queries);
+
+        if (m >= n)
+            break;
+    }
+
+    printf("[visible]: %d of the queries disagree with brute force\n", mismatches);
+    return mismatches == 0 ? 0 : 1;
+}
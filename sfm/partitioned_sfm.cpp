@@ -0,0 +1,216 @@
+#include <opencv.hpp>
+
+#include "Camera.hpp"
+#include "Partition.hpp"
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <cstdio>
+#include <cstdlib>
+
+#include <unistd.h>
+#include <sys/wait.h>
+
+using namespace std;
+using namespace cv;
+
+void print_usage_format()
+{
+    cout << " <calibration_filepath>";
+    cout << " <image_list_filepath>";
+    cout << " <working_directory>";
+    cout << " [<max_cluster_size> <cluster_overlap> <processes>]";
+    cout << endl;
+    cout << " --cluster <calibration_filepath> <working_directory> <cluster_index>";
+    cout << endl;
+}
+
+void save_ply(const Partition::Model& model, const string& filename)
+{
+    string header = "ply\
+        \nformat ascii 1.0\
+        \nelement vertex " + to_string(model.points.size()) + "\
+        \nproperty float x\
+        \nproperty float y\
+        \nproperty float z\
+        \nend_header\n";
+
+    ofstream myfile;
+    myfile.open(filename);
+    myfile << header;
+    for (int i = 0; i < model.points.size(); ++i)
+    {
+        Point3d cloudPoint = model.points[i];
+        myfile << cloudPoint.x << " " << cloudPoint.y << " " << cloudPoint.z << '\n';
+    }
+    myfile.close();
+}
+
+// The camera is scaled to the image size recorded with the view list
+Mat camera_matrix(const string& calibration_filepath, const string& workdir)
+{
+    FileStorage fs(workdir + "/clusters.yml", FileStorage::READ);
+    int width, height;
+    fs["image_width"]  >> width;
+    fs["image_height"] >> height;
+    fs.release();
+
+    Camera calibration(calibration_filepath);
+    return calibration.at_resolution(Size(width, height)).matrix();
+}
+
+int run_cluster(const string& calibration_filepath, const string& workdir, int index)
+{
+    FileStorage fs(workdir + "/clusters.yml", FileStorage::READ);
+    vector<int> views;
+    fs["cluster_" + to_string(index)] >> views;
+    fs.release();
+
+    Mat K = camera_matrix(calibration_filepath, workdir);
+    return Partition::reconstruct_cluster(views, K, workdir, index) ? 0 : 1;
+}
+
+// Waits for any cluster worker and tells whether it exited cleanly
+bool worker_succeeded()
+{
+    int status;
+    if (wait(&status) < 0)
+        return false;
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+int main(int argc, char** argv)
+{
+    if (argc == 5 && string(argv[1]) == "--cluster")
+    {
+        return run_cluster(argv[2], argv[3], atoi(argv[4]));
+    }
+
+    if (argc != 4 && argc != 7)
+    {
+        print_usage_format();
+        return -1;
+    }
+
+    string calibration_filepath = argv[1];
+    string image_list_filepath  = argv[2];
+    string workdir              = argv[3];
+    int max_cluster_size        = argc == 7 ? atoi(argv[4]) : 40;
+    int cluster_overlap         = argc == 7 ? atoi(argv[5]) : 8;
+    int processes               = argc == 7 ? atoi(argv[6]) : 1;
+
+    vector<string> image_paths;
+    ifstream list(image_list_filepath);
+    for (string line; getline(list, line); )
+    {
+        if (!line.empty())
+            image_paths.push_back(line);
+    }
+
+    if (image_paths.size() < 2)
+    {
+        printf("Need at least two images.\n");
+        return -1;
+    }
+
+    Size image_size = imread(image_paths[0]).size();
+
+    double t = getTickCount();
+    Partition::extract_features(image_paths, workdir);
+    printf("[extract_features]: %0.4f seconds\n", (getTickCount() - t) / getTickFrequency());
+
+    t = getTickCount();
+    vector<Partition::Edge> edges;
+    Partition::build_view_graph(image_paths.size(), workdir, edges);
+    printf("[build_view_graph]: %ld edges, %0.4f seconds\n",
+        edges.size(), (getTickCount() - t) / getTickFrequency());
+
+    vector<vector<int> > clusters;
+    Partition::cluster_views(image_paths.size(), edges, max_cluster_size, cluster_overlap, clusters);
+
+    FileStorage fs(workdir + "/clusters.yml", FileStorage::WRITE);
+    fs << "image_width" << image_size.width;
+    fs << "image_height" << image_size.height;
+    fs << "clusters" << (int) clusters.size();
+    for (int c = 0; c < clusters.size(); ++c)
+    {
+        fs << "cluster_" + to_string(c) << clusters[c];
+    }
+    fs.release();
+
+    // A cluster that fails leaves no model behind, so one left over from
+    // an earlier run in the same directory must not be picked up instead
+    for (int c = 0; c < clusters.size(); ++c)
+    {
+        remove(Partition::cluster_path(workdir, c).c_str());
+    }
+
+    // Each cluster runs in its own process so that its memory is
+    // returned to the system as soon as it is written out. The worker is
+    // this same executable, found through /proc rather than argv[0],
+    // which needn't be a path when run from PATH.
+    t = getTickCount();
+    int running = 0, failed = 0;
+    for (int c = 0; c < clusters.size(); ++c)
+    {
+        if (running == max(processes, 1))
+        {
+            failed += !worker_succeeded();
+            --running;
+        }
+
+        pid_t pid = fork();
+        if (pid == 0)
+        {
+            string index = to_string(c);
+            execl("/proc/self/exe", argv[0], "--cluster",
+                  calibration_filepath.c_str(), workdir.c_str(), index.c_str(),
+                  (char*) NULL);
+            _exit(1);
+        }
+        else if (pid > 0)
+        {
+            ++running;
+        }
+        else
+        {
+            ++failed;
+        }
+    }
+
+    while (running-- > 0)
+        failed += !worker_succeeded();
+    printf("[reconstruct_clusters]: %ld clusters, %0.4f seconds\n",
+        clusters.size(), (getTickCount() - t) / getTickFrequency());
+
+    if (failed > 0)
+    {
+        printf("%d of %ld clusters failed to reconstruct.\n", failed, clusters.size());
+        return -1;
+    }
+
+    t = getTickCount();
+    Partition::Model model;
+    vector<int> dropped;
+    if (!Partition::merge_clusters(workdir, clusters.size(), model, dropped))
+    {
+        printf("Couldn't load any cluster.\n");
+        return -1;
+    }
+
+    if (!dropped.empty())
+    {
+        printf("Couldn't merge %ld of %ld clusters:", dropped.size(), clusters.size());
+        for (int k = 0; k < dropped.size(); ++k)
+            printf(" %d", dropped[k]);
+        printf("\n");
+        return -1;
+    }
+
+    double error = Partition::refine(camera_matrix(calibration_filepath, workdir), model);
+    printf("[merge_and_refine]: %0.4f px, %0.4f seconds\n",
+        error, (getTickCount() - t) / getTickFrequency());
+
+    save_ply(model, "partitioned_cloud.ply");
+}
@@ -0,0 +1,144 @@
+#include <core.hpp>
+
+#include "Pose.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+using namespace std;
+using namespace cv;
+
+// Synthetic scene: n points in front of a random camera, a fraction of the
+// observations replaced by outliers and the rest perturbed by noise.
+void make_scene(
+    RNG& rng,
+    int n,
+    double outlier_ratio,
+    double noise,
+    vector<Point3d>& points,
+    vector<Point2d>& normalized,
+    Matx33d& rotation,
+    Vec3d& translation)
+{
+    Vec3d w(rng.uniform(-1.0, 1.0), rng.uniform(-1.0, 1.0), rng.uniform(-1.0, 1.0));
+    double angle = norm(w);
+    Vec3d k = w / angle;
+    Matx33d K(0.0, -k(2), k(1),
+              k(2), 0.0, -k(0),
+              -k(1), k(0), 0.0);
+    rotation = Matx33d::eye() + K * sin(angle) + K * K * (1.0 - cos(angle));
+    translation = Vec3d(rng.uniform(-1.0, 1.0), rng.uniform(-1.0, 1.0), rng.uniform(-1.0, 1.0));
+
+    points.resize(n);
+    normalized.resize(n);
+    for (int i = 0; i < n; ++i)
+    {
+        Vec3d Xc(rng.uniform(-2.0, 2.0), rng.uniform(-2.0, 2.0), rng.uniform(4.0, 10.0));
+        Vec3d Xw = rotation.t() * (Xc - translation);
+        points[i] = Point3d(Xw(0), Xw(1), Xw(2));
+
+        if (rng.uniform(0.0, 1.0) < outlier_ratio)
+            normalized[i] = Point2d(rng.uniform(-0.5, 0.5), rng.uniform(-0.5, 0.5));
+        else
+            normalized[i] = Point2d(Xc(0) / Xc(2) + rng.gaussian(noise),
+                                    Xc(1) / Xc(2) + rng.gaussian(noise));
+    }
+}
+
+double pose_error(const Matx33d& R1, const Vec3d& t1, const Matx33d& R2, const Vec3d& t2)
+{
+    return norm(R1 - R2) + norm(t1 - t2);
+}
+
+int main(int argc, char** argv)
+{
+    const int scenes = argc > 1 ? atoi(argv[1]) : 200;
+    const int n      = argc > 2 ? atoi(argv[2]) : 200;
+    const double noise = 1.0 / 1000.0; // ~1 px at f = 1000
+
+    RNG rng(12345);
+    vector<Point3d> points;
+    vector<Point2d> normalized;
+    Matx33d R;
+    Vec3d t;
+
+    // Minimal solver alone, on noise-free samples
+    double p3p_time = 0.0, p3p_error = 0.0;
+    long hypotheses = 0;
+    for (int s = 0; s < scenes; ++s)
+    {
+        make_scene(rng, 3, 0.0, 0.0, points, normalized, R, t);
+
+        Vec3d X[3], f[3];
+        for (int k = 0; k < 3; ++k)
+        {
+            X[k] = Vec3d(points[k].x, points[k].y, points[k].z);
+            f[k] = Vec3d(normalized[k].x, normalized[k].y, 1.0);
+            f[k] = f[k] / norm(f[k]);
+        }
+
+        Matx33d Rs[4];
+        Vec3d ts[4];
+        int solutions = 0;
+        double start = getTickCount();
+        for (int it = 0; it < 1000; ++it)
+            solutions = Pose::p3p(X, f, Rs, ts);
+        p3p_time += (getTickCount() - start) / getTickFrequency();
+        hypotheses += 1000;
+
+        double best = 1e9;
+        for (int k = 0; k < solutions; ++k)
+            best = min(best, pose_error(Rs[k], ts[k], R, t));
+        p3p_error = max(p3p_error, best);
+    }
+    printf("[p3p]: %0.3f us per hypothesis, worst pose error %g\n",
+        1e6 * p3p_time / hypotheses, p3p_error);
+
+    // Hypothesis scoring against every correspondence
+    make_scene(rng, n, 0.0, noise, points, normalized, R, t);
+    double start = getTickCount();
+    int count = 0;
+    for (int it = 0; it < 1000; ++it)
+        count += Pose::count_inliers(&points[0], &normalized[0], n, R, t, 4.0 * noise, NULL);
+    printf("[count_inliers]: %0.3f us for %d points\n",
+        1e6 * (getTickCount() - start) / getTickFrequency() / 1000, n);
+
+    // EPnP on all (noisy) points
+    double epnp_time = 0.0, epnp_error = 0.0;
+    for (int s = 0; s < scenes; ++s)
+    {
+        make_scene(rng, n, 0.0, noise, points, normalized, R, t);
+
+        Matx33d Re;
+        Vec3d te;
+        start = getTickCount();
+        Pose::epnp(&points[0], &normalized[0], n, Re, te);
+        epnp_time += (getTickCount() - start) / getTickFrequency();
+        epnp_error += pose_error(Re, te, R, t);
+    }
+    printf("[epnp]: %0.3f us for %d points, mean pose error %g\n",
+        1e6 * epnp_time / scenes, n, epnp_error / scenes);
+
+    // Full RANSAC with 40% outliers
+    double ransac_time = 0.0, ransac_error = 0.0;
+    int failures = 0;
+    for (int s = 0; s < scenes; ++s)
+    {
+        make_scene(rng, n, 0.4, noise, points, normalized, R, t);
+
+        Matx33d Rr;
+        Vec3d tr;
+        vector<unsigned char> inliers;
+        start = getTickCount();
+        bool found = Pose::ransac(points, normalized, 4.0 * noise, Rr, tr, inliers);
+        ransac_time += (getTickCount() - start) / getTickFrequency();
+
+        if (found)
+            ransac_error += pose_error(Rr, tr, R, t);
+        else
+            ++failures;
+    }
+    printf("[ransac]: %0.3f ms for %d points, mean pose error %g, %d failures\n",
+        1e3 * ransac_time / scenes, n, ransac_error / max(scenes - failures, 1), failures);
+}
@@ -0,0 +1,208 @@
+#include <core.hpp>
+
+#include "Geometry.hpp"
+#include "Reprojection.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <vector>
+
+using namespace std;
+using namespace cv;
+
+// Synthetic scene: n points 4-10 units in front of two cameras a unit
+// baseline apart, seen at f = 1000 with about a pixel of noise.
+void make_scene(
+    RNG& rng,
+    int n,
+    vector<Point3d>& points,
+    Matx34d& P1,
+    Matx34d& P2,
+    vector<Point2d>& x1,
+    vector<Point2d>& x2)
+{
+    const double f = 1000.0, noise = 1.0;
+
+    P1 = Matx34d(f, 0, 640, 0,
+                 0, f, 360, 0,
+                 0, 0,   1, 0);
+    P2 = Matx34d(f, 0, 640, -f,
+                 0, f, 360,  0,
+                 0, 0,   1,  0);
+
+    points.resize(n);
+    x1.resize(n);
+    x2.resize(n);
+    for (int i = 0; i < n; ++i)
+    {
+        double z = rng.uniform(4.0, 10.0);
+        points[i] = Point3d(rng.uniform(-2.0, 2.0), rng.uniform(-2.0, 2.0), z);
+
+        Vec3d p1 = P1 * Vec4d(points[i].x, points[i].y, points[i].z, 1.0);
+        Vec3d p2 = P2 * Vec4d(points[i].x, points[i].y, points[i].z, 1.0);
+        x1[i] = Point2d(p1(0) / p1(2) + rng.gaussian(noise), p1(1) / p1(2) + rng.gaussian(noise));
+        x2[i] = Point2d(p2(0) / p2(2) + rng.gaussian(noise), p2(1) / p2(2) + rng.gaussian(noise));
+    }
+}
+
+double seconds_since(double start, int repeats)
+{
+    return (getTickCount() - start) / getTickFrequency() / repeats;
+}
+
+// Times projection and error evaluation in precision T, and reports how far
+// the projections land from the double results.
+template<typename T>
+void bench_reprojection(
+    const char* name,
+    const vector<Point3d>& points,
+    const Matx34d& P,
+    const vector<Point2d>& observed,
+    const Reprojection::Points2& reference,
+    int repeats)
+{
+    Reprojection::Points3_<T> soa_points;
+    Reprojection::Points2_<T> soa_observed, projected;
+    soa_points.assign(points);
+    soa_observed.assign(observed);
+    const Matx<T, 3, 4> projection = P;
+
+    double start = getTickCount();
+    for (int it = 0; it < repeats; ++it)
+        Reprojection::project(soa_points, projection, projected);
+    double project_time = seconds_since(start, repeats);
+
+    Reprojection::Errors errors;
+    start = getTickCount();
+    for (int it = 0; it < repeats; ++it)
+        errors = Reprojection::errors(soa_points, projection, soa_observed, 2.0);
+    double errors_time = seconds_since(start, repeats);
+
+    double max_deviation = 0.0;
+    for (int i = 0; i < points.size(); ++i)
+    {
+        double dx = projected.x[i] - reference.x[i];
+        double dy = projected.y[i] - reference.y[i];
+        max_deviation = max(max_deviation, sqrt(dx * dx + dy * dy));
+    }
+
+    printf("[project %s]: %0.2f Mpts/s, max deviation %g px\n",
+        name, points.size() / project_time / 1e6, max_deviation);
+    printf("[errors %s]: %0.2f Mpts/s, rms %0.6f px, %d inliers\n",
+        name, points.size() / errors_time / 1e6, errors.rms, errors.inliers);
+}
+
+// Same for two-view triangulation, against the double points
+template<typename T>
+void bench_triangulation(
+    const char* name,
+    const vector<Point2d>& x1,
+    const Matx34d& P1,
+    const vector<Point2d>& x2,
+    const Matx34d& P2,
+    const vector<Point3d>& reference,
+    int repeats)
+{
+    vector<Point_<T> > y1(x1.begin(), x1.end()), y2(x2.begin(), x2.end());
+    vector<Point3_<T> > points;
+    vector<unsigned char> valid;
+
+    double start = getTickCount();
+    for (int it = 0; it < repeats; ++it)
+        Geometry::triangulate(y1, Matx<T, 3, 4>(P1), y2, Matx<T, 3, 4>(P2), points, valid);
+    double time = seconds_since(start, repeats);
+
+    double max_deviation = 0.0;
+    int failures = 0;
+    for (int i = 0; i < points.size(); ++i)
+    {
+        if (!valid[i])
+        {
+            ++failures;
+            continue;
+        }
+
+        Point3d d(points[i].x - reference[i].x, points[i].y - reference[i].y, points[i].z - reference[i].z);
+        max_deviation = max(max_deviation, norm(d) / norm(reference[i]));
+    }
+
+    printf("[triangulate %s]: %0.2f Mpts/s, max relative deviation %g, %d failures\n",
+        name, points.size() / time / 1e6, max_deviation, failures);
+}
+
+// The panorama warp on a synthetic image, counting pixels that differ from
+// the double warp.
+template<typename T>
+void bench_warp(const char* name, const Mat& image, const Matx33d& H, const Mat& reference, int repeats)
+{
+    Mat warped = Mat::zeros(image.size(), CV_8UC3);
+
+    double start = getTickCount();
+    for (int it = 0; it < repeats; ++it)
+        Geometry::warp_homography(image, Matx<T, 3, 3>(H), Rect(0, 0, image.cols, image.rows), warped);
+    double time = seconds_since(start, repeats);
+
+    int different = 0;
+    for (int i = 0; i < warped.rows; ++i)
+        for (int j = 0; j < warped.cols; ++j)
+            different += warped.at<Vec3b>(i, j) != reference.at<Vec3b>(i, j);
+
+    printf("[warp %s]: %0.2f Mpx/s, %d of %d pixels differ from double\n",
+        name, image.total() / time / 1e6, different, (int) image.total());
+}
+
+int main(int argc, char** argv)
+{
+    const int n       = argc > 1 ? atoi(argv[1]) : 100000;
+    const int repeats = argc > 2 ? atoi(argv[2]) : 20;
+
+    RNG rng(12345);
+    vector<Point3d> points;
+    vector<Point2d> x1, x2;
+    Matx34d P1, P2;
+    make_scene(rng, n, points, P1, P2, x1, x2);
+
+    // Double results are the reference for both precisions
+    Reprojection::Points3 soa_points;
+    Reprojection::Points2 reference;
+    soa_points.assign(points);
+    Reprojection::project(soa_points, P1, reference);
+
+    bench_reprojection<double>("double", points, P1, x1, reference, repeats);
+    bench_reprojection<float>("float", points, P1, x1, reference, repeats);
+
+    // Triangulation works on normalized coordinates
+    const Matx33d K_inv = Matx33d(P1.get_minor<3, 3>(0, 0)).inv();
+    const Matx34d N1(1, 0, 0, 0,
+                     0, 1, 0, 0,
+                     0, 0, 1, 0);
+    const Matx34d N2 = K_inv * P2;
+    vector<Point2d> normalized1(n), normalized2(n);
+    for (int i = 0; i < n; ++i)
+    {
+        Vec3d u1 = K_inv * Vec3d(x1[i].x, x1[i].y, 1.0);
+        Vec3d u2 = K_inv * Vec3d(x2[i].x, x2[i].y, 1.0);
+        normalized1[i] = Point2d(u1(0), u1(1));
+        normalized2[i] = Point2d(u2(0), u2(1));
+    }
+
+    vector<Point3d> triangulated;
+    vector<unsigned char> valid;
+    Geometry::triangulate(normalized1, N1, normalized2, N2, triangulated, valid);
+
+    bench_triangulation<double>("double", normalized1, N1, normalized2, N2, triangulated, repeats);
+    bench_triangulation<float>("float", normalized1, N1, normalized2, N2, triangulated, repeats);
+
+    Mat image(1080, 1920, CV_8UC3);
+    rng.fill(image, RNG::UNIFORM, 0, 256);
+    const Matx33d H(0.9,   0.05,  40.0,
+                    -0.04, 0.95,  25.0,
+                    1e-5,  2e-5,   1.0);
+
+    Mat reference_warp = Mat::zeros(image.size(), CV_8UC3);
+    Geometry::warp_homography(image, H, Rect(0, 0, image.cols, image.rows), reference_warp);
+
+    bench_warp<double>("double", image, H, reference_warp, repeats);
+    bench_warp<float>("float", image, H, reference_warp, repeats);
+}
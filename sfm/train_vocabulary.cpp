@@ -0,0 +1,76 @@
+#include <core.hpp>
+#include <imgcodecs.hpp>
+
+#include "Features.hpp"
+#include "Vocabulary.hpp"
+#include "InvertedIndex.hpp"
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+using namespace std;
+using namespace cv;
+
+// Trains an ORB vocabulary for place recognition on a set of images, then
+// reports how long a bag-of-words lookup of each training image takes
+// against an index holding all of them.
+int main(int argc, char** argv)
+{
+    if (argc < 3)
+    {
+        printf("<vocabulary_out> <image> [<image> ...]\n");
+        return -1;
+    }
+
+    const int max_features = 1000;
+
+    vector<Mat> descriptors;
+    vector<KeyPoint> keypoints;
+    double t = getTickCount();
+    for (int i = 2; i < argc; ++i)
+    {
+        Mat gray = imread(argv[i], IMREAD_GRAYSCALE);
+        if (gray.empty())
+        {
+            printf("Couldn't read %s\n", argv[i]);
+            continue;
+        }
+
+        descriptors.push_back(Mat());
+        Features::orbFeatures(gray, max_features, keypoints, descriptors.back());
+    }
+    printf("[features]: %0.4f seconds\n", (getTickCount() - t) / getTickFrequency());
+
+    t = getTickCount();
+    Vocabulary vocabulary;
+    vocabulary.train(descriptors);
+    printf("[train]: %0.4f seconds, %d words\n", (getTickCount() - t) / getTickFrequency(), vocabulary.words());
+
+    if (!vocabulary.save(argv[1]))
+        return -1;
+
+    InvertedIndex index(vocabulary.words());
+    Vocabulary::BowVector bow;
+    for (int i = 0; i < descriptors.size(); ++i)
+    {
+        vocabulary.transform(descriptors[i], bow);
+        index.add(i, bow);
+    }
+
+    // Every image should find itself first
+    vector<InvertedIndex::Candidate> candidates;
+    int found = 0;
+    t = getTickCount();
+    for (int i = 0; i < descriptors.size(); ++i)
+    {
+        vocabulary.transform(descriptors[i], bow);
+        index.query(bow, 5, 0.0, candidates);
+        found += !candidates.empty() && candidates[0].keyframe == i;
+    }
+    printf("[query]: %0.4f seconds per image, %d of %d found themselves\n",
+           (getTickCount() - t) / getTickFrequency() / std::max<int>(descriptors.size(), 1),
+           found, (int) descriptors.size());
+
+    return 0;
+}
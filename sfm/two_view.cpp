@@ -4,11 +4,13 @@
 #include "Camera.hpp"
 #include "Features.hpp"
 #include "MultiView.hpp"
+#include "Stereo.hpp"
 
 #include <iostream>
 #include <fstream>
 #include <string>
 #include <cstdio>
+#include <cstdlib>
 
 using namespace std;
 using namespace cv;
@@ -127,11 +129,12 @@ void save_ply(
 
 int main(int argc, char** argv)
 {
-    if (argc != 3 + 1)
+    if (argc != 3 + 1 && argc != 4 + 1)
     {
         cout << " <calibration_filepath>";
         cout << " <image_1_filepath>";
         cout << " <image_2_filepath>";
+        cout << " [<dense>]";
         cout << endl;
         return -1;
     }
@@ -139,17 +142,18 @@ int main(int argc, char** argv)
     string calibration_filepath = argv[1];
     string image_1_filepath     = argv[2];
     string image_2_filepath     = argv[3];
+    bool dense                  = argc > 4 && atoi(argv[4]) != 0;
 
     // Find calibration file and load images
-    Camera camera(calibration_filepath);
+    Camera calibration(calibration_filepath);
     Mat im1 = imread(image_1_filepath);
     Mat im2 = imread(image_2_filepath);
 
     // Images must be of the same size for correspondences
     assert(im1.size() == im2.size());
 
-    // Resize the camera matrix to the image sizes taken
-    camera.resize(im1.size());   
+    // The calibration scaled to the image sizes taken
+    const Camera& camera = calibration.at_resolution(im1.size());
     
     // Find the point matches between the two frames
     vector<KeyPoint> feat1, feat2;
@@ -169,21 +173,68 @@ int main(int argc, char** argv)
         pts2.push_back(feat2[matches[i].trainIdx].pt);
     }
 
-    std::vector<uchar> inliers;
-    std::vector<cv::Point3d> cloud;
-    MultiView::triangulate(
-        pts1,
-        camera.matrix(),
-        pts2,
-        camera.matrix(),
-        inliers,
-        cloud);
+    // Remove the lens distortion from the matched keypoints only
+    std::vector<Point2d> undistorted1, undistorted2;
+    camera.undistort(pts1, undistorted1);
+    camera.undistort(pts2, undistorted2);
+
+    MultiView::TwoViewWorkspace workspace;
+    MultiView::TwoViewResult result;
+    if (!MultiView::triangulate(
+            undistorted1,
+            Matx33d(camera.matrix()),
+            undistorted2,
+            Matx33d(camera.matrix()),
+            workspace,
+            result))
+    {
+        printf("Couldn't find a proper cloud.\n");
+        return -1;
+    }
+
+    printf("%ld points, in front (%f, %f), reprojection error (%f, %f)\n",
+        result.points.size(),
+        result.in_front1,
+        result.in_front2,
+        result.error1,
+        result.error2);
 
     std::vector<cv::Point2d> best_pts1;
-    Util::mask(pts1, inliers, best_pts1);
+    Util::mask(pts1, result.inliers, best_pts1);
     
-    if (!cloud.empty())
+    if (!result.points.empty())
+    {
+      save_ply(im1, result.points, best_pts1, "multiview_cloud.ply");
+    }
+
+    if (!dense)
+        return 0;
+
+    // Dense mode: rectify the pair with the recovered pose and match every
+    // pixel of the first view
+    double t = getTickCount();
+    Stereo::Rectification rectification;
+    if (!Stereo::rectify(camera, result.rotation, result.translation, rectification))
+    {
+        printf("Dense matching needs a mostly horizontal baseline.\n");
+        return -1;
+    }
+
+    Mat rectified1, rectified2;
+    Stereo::remap(rectification, im1, im2, rectified1, rectified2);
+    printf("[rectify]: %0.4f seconds\n", (getTickCount() - t) / getTickFrequency());
+
+    t = getTickCount();
+    Mat disparity;
+    Stereo::match(rectification, rectified1, rectified2, Stereo::Parameters(), disparity);
+    printf("[match]: %0.4f seconds\n", (getTickCount() - t) / getTickFrequency());
+
+    vector<Point3d> dense_points;
+    vector<Point2d> dense_pixels;
+    Stereo::triangulate(rectification, disparity, dense_points, dense_pixels);
+
+    if (!dense_points.empty())
     {
-      save_ply(im1, cloud, best_pts1, "multiview_cloud.ply");
+        save_ply(rectified1, dense_points, dense_pixels, "dense_cloud.ply");
     }
 }
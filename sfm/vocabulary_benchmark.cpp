@@ -0,0 +1,108 @@
+#include <core.hpp>
+
+#include "InvertedIndex.hpp"
+#include "Vocabulary.hpp"
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+using namespace std;
+using namespace cv;
+
+// Random ORB-sized descriptors standing in for the landmarks of a scene
+void random_landmarks(RNG& rng, int n, Mat& landmarks)
+{
+    landmarks.create(n, 32, CV_8U);
+    rng.fill(landmarks, RNG::UNIFORM, 0, 256);
+}
+
+// An image sees features of its own landmarks, each with a few bits flipped
+void observe(RNG& rng, const Mat& landmarks, const vector<int>& seen, int flips, Mat& descriptors)
+{
+    descriptors.create(seen.size(), landmarks.cols, CV_8U);
+    for (int r = 0; r < seen.size(); ++r)
+    {
+        uchar* d = descriptors.ptr<uchar>(r);
+        memcpy(d, landmarks.ptr<uchar>(seen[r]), landmarks.cols);
+        for (int f = 0; f < flips; ++f)
+        {
+            const int bit = rng.uniform(0, 8 * landmarks.cols);
+            d[bit / 8] ^= 1 << (bit % 8);
+        }
+    }
+}
+
+// Trains a vocabulary on synthetic images, indexes them, and times
+// transform plus index lookup for a noisy half of every image. Each query
+// should find its own image first, and agree with scoring every image.
+int main(int argc, char** argv)
+{
+    const int images    = argc > 1 ? atoi(argv[1]) : 200;
+    const int features  = argc > 2 ? atoi(argv[2]) : 300;
+    const int branching = argc > 3 ? atoi(argv[3]) : 10;
+    const int depth     = argc > 4 ? atoi(argv[4]) : 4;
+
+    RNG rng(12345);
+    Mat landmarks;
+    random_landmarks(rng, 100 * images, landmarks);
+
+    vector<vector<int> > seen(images);
+    vector<Mat> descriptors(images);
+    for (int i = 0; i < images; ++i)
+    {
+        for (int f = 0; f < features; ++f)
+        {
+            seen[i].push_back(rng.uniform(0, landmarks.rows));
+        }
+        observe(rng, landmarks, seen[i], 0, descriptors[i]);
+    }
+
+    double t = getTickCount();
+    Vocabulary vocabulary;
+    vocabulary.train(descriptors, branching, depth);
+    printf("[train]: %0.4f seconds, %d words\n", (getTickCount() - t) / getTickFrequency(), vocabulary.words());
+
+    InvertedIndex index(vocabulary.words());
+    vector<Vocabulary::BowVector> bows(images);
+    for (int i = 0; i < images; ++i)
+    {
+        vocabulary.transform(descriptors[i], bows[i]);
+        index.add(i, bows[i]);
+    }
+
+    Vocabulary::BowVector bow;
+    vector<InvertedIndex::Candidate> candidates;
+    double query_time = 0.0;
+    int found = 0, mismatches = 0;
+    for (int i = 0; i < images; ++i)
+    {
+        Mat query;
+        vector<int> half(seen[i].begin(), seen[i].begin() + features / 2);
+        observe(rng, landmarks, half, 3, query);
+
+        double start = getTickCount();
+        vocabulary.transform(query, bow);
+        index.query(bow, 5, 0.0, candidates);
+        query_time += (getTickCount() - start) / getTickFrequency();
+
+        found += !candidates.empty() && candidates[0].keyframe == i;
+
+        // The index only skips images sharing no word with the query
+        double best = 0.0;
+        for (int j = 0; j < images; ++j)
+        {
+            best = max(best, Vocabulary::score(bow, bows[j]));
+        }
+        if (candidates.empty() ? best > 0.0 : abs(candidates[0].score - best) > 1e-6)
+            ++mismatches;
+    }
+
+    printf("[query]: %0.3f ms per image, %d of %d found themselves\n",
+        1e3 * query_time / max(images, 1), found, images);
+    printf("[query]: %d of the queries disagree with scoring every image\n", mismatches);
+
+    return found == images && mismatches == 0 ? 0 : 1;
+}